@@ -8,8 +8,8 @@ inline int MPackIntFromArray(mpack_node_t arr, int index) {
 
 inline bool MPackMatchString(mpack_node_t node, const char *str_to_match) {
 	assert(node.data->type == mpack_type_str);
-	const char *str = mpack_node_str(node);
-	return strncmp(str, str_to_match, mpack_node_strlen(node)) == 0;
+	size_t length = mpack_node_strlen(node);
+	return length == strlen(str_to_match) && strncmp(mpack_node_str(node), str_to_match, length) == 0;
 }
 
 enum class MPackMessageType {
@@ -38,33 +38,6 @@ struct MPackMessageResult {
 	};
 };
 
-inline void MPackStartRequest(int64_t msg_id, const char *request, mpack_writer_t *writer) {
-	mpack_start_array(writer, 4);
-	mpack_write_i64(writer, 0);
-	mpack_write_i64(writer, msg_id);
-	mpack_write_cstr(writer, request);
-}
-
-inline void MPackStartNotification(const char *notification, mpack_writer_t *writer) {
-	mpack_start_array(writer, 3);
-	mpack_write_i64(writer, static_cast<int64_t>(MPackMessageType::Notification));
-	mpack_write_cstr(writer, notification);
-}
-
-[[nodiscard]] inline size_t MPackFinishMessage(mpack_writer_t *writer) {
-	mpack_finish_array(writer);
-	size_t size = mpack_writer_buffer_used(writer);
-	mpack_error_t err = mpack_writer_destroy(writer);
-	assert(err == mpack_ok);
-	return size;
-}
-
-inline void MPackSendData(HANDLE handle, void *buffer, size_t size) {
-	DWORD bytes_written;
-	bool success = WriteFile(handle, buffer, static_cast<DWORD>(size), &bytes_written, nullptr);
-	assert(success);
-}
-
 inline MPackMessageResult MPackExtractMessageResult(mpack_tree_t *tree) {
 	mpack_node_t root = mpack_tree_root(tree);
 	assert(mpack_node_array_at(root, 0).data->type == mpack_type_uint);
@@ -85,7 +58,6 @@ inline MPackMessageResult MPackExtractMessageResult(mpack_tree_t *tree) {
 	}
 	else if (message_type == MPackMessageType::Response) {
 		assert(mpack_node_array_at(root, 1).data->type == mpack_type_uint);
-		assert(mpack_node_array_at(root, 2).data->type == mpack_type_nil);
 
 		return MPackMessageResult {
 			.type = message_type,
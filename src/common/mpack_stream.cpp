@@ -0,0 +1,414 @@
+#include "mpack_stream.h"
+#include <cstdlib>
+#include <cstring>
+
+void MPackStreamInitialize(MPackStream *stream, MPackStreamReadFn read_fn, void *read_context) {
+	*stream = MPackStream {
+		.read_fn = read_fn,
+		.read_context = read_context,
+		.buffer = static_cast<char *>(malloc(MPACK_STREAM_INITIAL_BUFFER_SIZE)),
+		.buffer_capacity = MPACK_STREAM_INITIAL_BUFFER_SIZE,
+		.node_pool = static_cast<mpack_node_data_t *>(malloc(MPACK_STREAM_INITIAL_NODE_COUNT * sizeof(mpack_node_data_t))),
+		.node_pool_capacity = MPACK_STREAM_INITIAL_NODE_COUNT
+	};
+}
+
+void MPackStreamDestroy(MPackStream *stream) {
+	if (stream->tree_active) {
+		mpack_tree_destroy(&stream->tree);
+		stream->tree_active = false;
+	}
+	free(stream->buffer);
+	free(stream->node_pool);
+	stream->buffer = nullptr;
+	stream->node_pool = nullptr;
+}
+
+MPackScanResult MPackScanObject(MPackScanState *scan, const char *data, size_t size) {
+	if (scan->offset == 0 && scan->pending_objects == 0) {
+		scan->pending_objects = 1;
+	}
+
+	// Kept in locals, the compiler can't tell stores to the scan state don't
+	// change the data, which is read through char pointers
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+	size_t offset = scan->offset;
+	size_t pending_objects = scan->pending_objects;
+	size_t node_count = scan->node_count;
+	const auto Stop = [&](MPackScanResult result) {
+		scan->offset = offset;
+		scan->pending_objects = pending_objects;
+		scan->node_count = node_count;
+		return result;
+	};
+	while (pending_objects > 0) {
+		if (offset >= size) {
+			return Stop(MPackScanResult::Incomplete);
+		}
+
+		// Size of the tag itself, the payload following it (for str, bin and ext)
+		// and the amount of child objects (for arrays and maps)
+		uint8_t type = bytes[offset];
+		size_t header_size = 1;
+		size_t payload_size = 0;
+		size_t child_count = 0;
+		const auto LoadLength = [&](size_t length_size, size_t extra_header) -> bool {
+			header_size = 1 + length_size + extra_header;
+			if (size - offset < 1 + length_size) {
+				return false;
+			}
+			const char *length_data = data + offset + 1;
+			switch (length_size) {
+			case 1: {
+				payload_size = mpack_load_u8(length_data);
+			} break;
+			case 2: {
+				payload_size = mpack_load_u16(length_data);
+			} break;
+			case 4: {
+				payload_size = mpack_load_u32(length_data);
+			} break;
+			}
+			return true;
+		};
+
+		if (type <= 0x7F || type >= 0xE0) {
+			// Positive and negative fixint
+		}
+		else if (type <= 0x8F) {
+			child_count = static_cast<size_t>(type & 0x0F) * 2;
+		}
+		else if (type <= 0x9F) {
+			child_count = type & 0x0F;
+		}
+		else if (type <= 0xBF) {
+			payload_size = type & 0x1F;
+		}
+		else {
+			bool have_length = true;
+			switch (type) {
+			case 0xC0: case 0xC2: case 0xC3: {
+			} break;
+			case 0xC4: case 0xD9: {
+				have_length = LoadLength(1, 0);
+			} break;
+			case 0xC5: case 0xDA: {
+				have_length = LoadLength(2, 0);
+			} break;
+			case 0xC6: case 0xDB: {
+				have_length = LoadLength(4, 0);
+			} break;
+			case 0xC7: {
+				have_length = LoadLength(1, 1);
+			} break;
+			case 0xC8: {
+				have_length = LoadLength(2, 1);
+			} break;
+			case 0xC9: {
+				have_length = LoadLength(4, 1);
+			} break;
+			case 0xCC: case 0xD0: {
+				header_size = 2;
+			} break;
+			case 0xCD: case 0xD1: {
+				header_size = 3;
+			} break;
+			case 0xCA: case 0xCE: case 0xD2: {
+				header_size = 5;
+			} break;
+			case 0xCB: case 0xCF: case 0xD3: {
+				header_size = 9;
+			} break;
+			case 0xD4: case 0xD5: case 0xD6: case 0xD7: case 0xD8: {
+				// fixext: one byte of type followed by 1, 2, 4, 8 or 16 bytes
+				header_size = 2;
+				payload_size = static_cast<size_t>(1) << (type - 0xD4);
+			} break;
+			case 0xDC: case 0xDE: {
+				have_length = LoadLength(2, 0);
+				child_count = payload_size;
+				payload_size = 0;
+			} break;
+			case 0xDD: case 0xDF: {
+				have_length = LoadLength(4, 0);
+				child_count = payload_size;
+				payload_size = 0;
+			} break;
+			default: {
+				// 0xC1 is never used
+			} return Stop(MPackScanResult::Invalid);
+			}
+
+			if (!have_length) {
+				return Stop(MPackScanResult::Incomplete);
+			}
+			if (type == 0xDE || type == 0xDF) {
+				child_count *= 2;
+			}
+		}
+
+		size_t object_size = header_size + payload_size;
+		if (size - offset < object_size) {
+			return Stop(MPackScanResult::Incomplete);
+		}
+
+		offset += object_size;
+		pending_objects += child_count;
+		pending_objects -= 1;
+		node_count += 1;
+
+		// Every object takes at least a byte, reject counts that can't be satisfied
+		if (pending_objects > MPACK_STREAM_MAX_MESSAGE_SIZE) {
+			return Stop(MPackScanResult::Invalid);
+		}
+	}
+
+	return Stop(MPackScanResult::Complete);
+}
+
+static bool FillBuffer(MPackStream *stream) {
+	// Wrap the unconsumed data back to the start of the buffer
+	// once there is no longer room for a full chunk at the end
+	if (stream->buffer_capacity - stream->write_offset < MPACK_STREAM_READ_CHUNK_SIZE) {
+		size_t unconsumed = stream->write_offset - stream->read_offset;
+		if (stream->read_offset > 0) {
+			memmove(stream->buffer, stream->buffer + stream->read_offset, unconsumed);
+			stream->read_offset = 0;
+			stream->write_offset = unconsumed;
+			stream->compactions += 1;
+		}
+
+		// The message being framed is larger than the buffer itself
+		if (stream->buffer_capacity - stream->write_offset < MPACK_STREAM_READ_CHUNK_SIZE) {
+			if (stream->buffer_capacity >= MPACK_STREAM_MAX_MESSAGE_SIZE) {
+				return false;
+			}
+			stream->buffer_capacity *= 2;
+			stream->buffer = static_cast<char *>(realloc(stream->buffer, stream->buffer_capacity));
+		}
+	}
+
+	size_t bytes_read = stream->read_fn(stream->read_context, stream->buffer + stream->write_offset,
+		stream->buffer_capacity - stream->write_offset);
+	if (bytes_read == 0) {
+		return false;
+	}
+
+	stream->write_offset += bytes_read;
+	stream->bytes_read += bytes_read;
+	stream->read_calls += 1;
+	return true;
+}
+
+static void ReleaseMessage(MPackStream *stream) {
+	if (stream->tree_active) {
+		mpack_tree_destroy(&stream->tree);
+		stream->tree_active = false;
+	}
+	stream->read_offset += stream->pending_consume;
+	stream->pending_consume = 0;
+	if (stream->read_offset == stream->write_offset) {
+		stream->read_offset = 0;
+		stream->write_offset = 0;
+	}
+}
+
+static bool EnsureAvailable(MPackStream *stream, size_t count) {
+	while (stream->write_offset - stream->read_offset < count) {
+		if (!FillBuffer(stream)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Reads the header of a str (or array) at the given offset past the read position.
+// Only requests as many bytes as the header itself needs, so peeking never
+// blocks on data that belongs to a message that doesn't match.
+static bool PeekLengthHeader(MPackStream *stream, size_t offset, bool array,
+	size_t *header_size, uint32_t *length) {
+	if (!EnsureAvailable(stream, offset + 1)) {
+		return false;
+	}
+
+	const char *data = stream->buffer + stream->read_offset + offset;
+	uint8_t type = mpack_load_u8(data);
+	uint8_t fix_base = array ? 0x90 : 0xA0;
+	uint8_t fix_mask = array ? 0x0F : 0x1F;
+	if ((type & ~fix_mask) == fix_base) {
+		*header_size = 1;
+		*length = type & fix_mask;
+		return true;
+	}
+
+	size_t length_size = 0;
+	if (!array && type == 0xD9) {
+		length_size = 1;
+	}
+	else if (type == (array ? 0xDC : 0xDA)) {
+		length_size = 2;
+	}
+	else if (type == (array ? 0xDD : 0xDB)) {
+		length_size = 4;
+	}
+	else {
+		return false;
+	}
+
+	if (!EnsureAvailable(stream, offset + 1 + length_size)) {
+		return false;
+	}
+	data = stream->buffer + stream->read_offset + offset;
+	*header_size = 1 + length_size;
+	*length = length_size == 1 ? mpack_load_u8(data + 1) :
+		length_size == 2 ? mpack_load_u16(data + 1) : mpack_load_u32(data + 1);
+	return true;
+}
+
+static bool Frame(MPackStream *stream) {
+	stream->scan = MPackScanState {};
+	while (true) {
+		MPackScanResult result = MPackScanObject(&stream->scan, stream->buffer + stream->read_offset,
+			stream->write_offset - stream->read_offset);
+		if (result == MPackScanResult::Complete) {
+			break;
+		}
+		if (result == MPackScanResult::Invalid || !FillBuffer(stream)) {
+			return false;
+		}
+	}
+
+	stream->pending_consume = stream->scan.offset;
+	return true;
+}
+
+bool MPackParseFrame(const MPackFrame *frame, mpack_tree_t *tree,
+	mpack_node_data_t **node_pool, size_t *node_pool_capacity) {
+	if (frame->node_count > *node_pool_capacity) {
+		size_t new_capacity = *node_pool_capacity ? *node_pool_capacity : MPACK_MIN_NODE_POOL_SIZE;
+		while (new_capacity < frame->node_count) {
+			new_capacity *= 2;
+		}
+		free(*node_pool);
+		*node_pool = static_cast<mpack_node_data_t *>(malloc(new_capacity * sizeof(mpack_node_data_t)));
+		*node_pool_capacity = new_capacity;
+	}
+
+	mpack_tree_init_pool(tree, frame->data, frame->size, *node_pool, *node_pool_capacity);
+	mpack_tree_parse(tree);
+	return mpack_tree_error(tree) == mpack_ok;
+}
+
+static bool FrameAndParse(MPackStream *stream) {
+	if (!Frame(stream)) {
+		return false;
+	}
+
+	MPackFrame frame {
+		.data = stream->buffer + stream->read_offset,
+		.size = stream->scan.offset,
+		.node_count = stream->scan.node_count
+	};
+	stream->tree_active = true;
+	return MPackParseFrame(&frame, &stream->tree, &stream->node_pool, &stream->node_pool_capacity);
+}
+
+bool MPackStreamNext(MPackStream *stream, MPackStreamMessage *message) {
+	ReleaseMessage(stream);
+	if (!FrameAndParse(stream)) {
+		return false;
+	}
+
+	stream->messages_parsed += 1;
+	*message = MPackStreamMessage {
+		.data = stream->buffer + stream->read_offset,
+		.size = stream->pending_consume,
+		.tree = &stream->tree
+	};
+	return true;
+}
+
+bool MPackStreamBeginNotification(MPackStream *stream, const char *name, uint32_t *param_count) {
+	ReleaseMessage(stream);
+
+	// [2, name, [params...]]
+	if (!EnsureAvailable(stream, 2)) {
+		return false;
+	}
+	const char *data = stream->buffer + stream->read_offset;
+	if (mpack_load_u8(data) != 0x93 || mpack_load_u8(data + 1) != 0x02) {
+		return false;
+	}
+
+	size_t name_header_size;
+	uint32_t name_length;
+	if (!PeekLengthHeader(stream, 2, false, &name_header_size, &name_length) ||
+		name_length != strlen(name) ||
+		!EnsureAvailable(stream, 2 + name_header_size + name_length)) {
+		return false;
+	}
+	data = stream->buffer + stream->read_offset;
+	if (memcmp(data + 2 + name_header_size, name, name_length) != 0) {
+		return false;
+	}
+
+	size_t params_offset = 2 + name_header_size + name_length;
+	size_t params_header_size;
+	if (!PeekLengthHeader(stream, params_offset, true, &params_header_size, param_count)) {
+		return false;
+	}
+
+	stream->read_offset += params_offset + params_header_size;
+	stream->messages_parsed += 1;
+	return true;
+}
+
+bool MPackStreamReadArrayHeader(MPackStream *stream, uint32_t *count) {
+	ReleaseMessage(stream);
+
+	size_t header_size;
+	if (!PeekLengthHeader(stream, 0, true, &header_size, count)) {
+		return false;
+	}
+	stream->read_offset += header_size;
+	return true;
+}
+
+bool MPackStreamReadString(MPackStream *stream, const char **str, uint32_t *length) {
+	ReleaseMessage(stream);
+
+	size_t header_size;
+	if (!PeekLengthHeader(stream, 0, false, &header_size, length) ||
+		!EnsureAvailable(stream, header_size + *length)) {
+		return false;
+	}
+	*str = stream->buffer + stream->read_offset + header_size;
+	stream->pending_consume = header_size + *length;
+	return true;
+}
+
+bool MPackStreamNextFrame(MPackStream *stream, MPackFrame *frame) {
+	ReleaseMessage(stream);
+	if (!Frame(stream)) {
+		return false;
+	}
+
+	*frame = MPackFrame {
+		.data = stream->buffer + stream->read_offset,
+		.size = stream->scan.offset,
+		.node_count = stream->scan.node_count
+	};
+	return true;
+}
+
+mpack_tree_t *MPackStreamParseFrame(MPackStream *stream, const MPackFrame *frame) {
+	if (stream->tree_active) {
+		mpack_tree_destroy(&stream->tree);
+	}
+
+	stream->tree_active = true;
+	if (!MPackParseFrame(frame, &stream->tree, &stream->node_pool, &stream->node_pool_capacity)) {
+		return nullptr;
+	}
+	return &stream->tree;
+}
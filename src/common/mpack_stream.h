@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "third_party/mpack/mpack.h"
+
+// Reads at most count bytes into buffer, returns the amount of bytes read.
+// Returning 0 signals end of stream (or an unrecoverable error).
+using MPackStreamReadFn = size_t (*)(void *context, char *buffer, size_t count);
+
+constexpr size_t MPACK_STREAM_READ_CHUNK_SIZE = 64 * 1024;
+constexpr size_t MPACK_STREAM_INITIAL_BUFFER_SIZE = 1024 * 1024;
+constexpr size_t MPACK_STREAM_INITIAL_NODE_COUNT = 16 * 1024;
+constexpr size_t MPACK_MIN_NODE_POOL_SIZE = 64;
+constexpr size_t MPACK_STREAM_MAX_MESSAGE_SIZE = 256 * 1024 * 1024;
+
+// Incremental state of the message framing scan, offsets are
+// relative to the start of the message being framed.
+struct MPackScanState {
+	size_t offset;
+	size_t pending_objects;
+	size_t node_count;
+};
+
+// Reads msgpack messages from a byte stream in large chunks. The data is kept
+// in a single buffer which wraps back to its start once the consumed prefix
+// is large enough, so messages are handed out as views into that buffer. The
+// node pool used to parse a message is reused for the next one, so once the
+// buffer and pool have grown to fit the largest message no more allocations
+// take place.
+struct MPackStream {
+	MPackStreamReadFn read_fn;
+	void *read_context;
+
+	char *buffer;
+	size_t buffer_capacity;
+	size_t read_offset;
+	size_t write_offset;
+
+	MPackScanState scan;
+
+	mpack_node_data_t *node_pool;
+	size_t node_pool_capacity;
+	mpack_tree_t tree;
+	bool tree_active;
+
+	// Size of the last message handed out, consumed on the next call
+	size_t pending_consume;
+
+	uint64_t bytes_read;
+	uint64_t read_calls;
+	uint64_t messages_parsed;
+	// Times unconsumed data was moved back to the start of the buffer
+	uint64_t compactions;
+};
+
+// Raw bytes of a single framed object
+struct MPackFrame {
+	const char *data;
+	size_t size;
+	size_t node_count;
+};
+
+// View of a single message, only valid until the next call into the stream
+struct MPackStreamMessage {
+	const char *data;
+	size_t size;
+	mpack_tree_t *tree;
+};
+
+void MPackStreamInitialize(MPackStream *stream, MPackStreamReadFn read_fn, void *read_context);
+void MPackStreamDestroy(MPackStream *stream);
+
+// Blocks until the next complete message is available and parses it.
+// Returns false once the stream has ended or the data is malformed.
+bool MPackStreamNext(MPackStream *stream, MPackStreamMessage *message);
+
+// Pull-style access for messages that should be consumed piece by piece
+// rather than framed as a whole. If the next message is a notification
+// with the given name, its header is consumed up to and including the
+// params array header and true is returned. Otherwise nothing is consumed.
+bool MPackStreamBeginNotification(MPackStream *stream, const char *name, uint32_t *param_count);
+bool MPackStreamReadArrayHeader(MPackStream *stream, uint32_t *count);
+// The returned string is only valid until the next call into the stream
+bool MPackStreamReadString(MPackStream *stream, const char **str, uint32_t *length);
+// Frames the next object without parsing it, the frame is valid until the next call
+bool MPackStreamNextFrame(MPackStream *stream, MPackFrame *frame);
+// Parses a frame returned by MPackStreamNextFrame into the stream's own node pool.
+// The tree is only valid until the next call into the stream.
+mpack_tree_t *MPackStreamParseFrame(MPackStream *stream, const MPackFrame *frame);
+
+// Parses a frame into the given node pool, growing the pool if it is too small.
+// The tree must be destroyed with mpack_tree_destroy() once it is no longer used.
+bool MPackParseFrame(const MPackFrame *frame, mpack_tree_t *tree,
+	mpack_node_data_t **node_pool, size_t *node_pool_capacity);
+
+enum class MPackScanResult {
+	Incomplete,
+	Complete,
+	Invalid
+};
+// Advances the scan over data[0, size) without building any nodes. Once a
+// complete msgpack object has been framed its size is scan->offset. The scan
+// state must be zero-initialized before framing a new object.
+MPackScanResult MPackScanObject(MPackScanState *scan, const char *data, size_t size);
@@ -0,0 +1,99 @@
+#include "outbound_buffer.h"
+#include <cstdlib>
+#include <cstring>
+
+void OutboundBufferInitialize(OutboundBuffer *buffer) {
+	*buffer = OutboundBuffer {
+		.data = static_cast<char *>(malloc(OUTBOUND_BUFFER_INITIAL_SIZE)),
+		.capacity = OUTBOUND_BUFFER_INITIAL_SIZE,
+		.messages = static_cast<OutboundMessage *>(malloc(OUTBOUND_BUFFER_INITIAL_MESSAGE_COUNT * sizeof(OutboundMessage))),
+		.message_capacity = OUTBOUND_BUFFER_INITIAL_MESSAGE_COUNT
+	};
+}
+
+void OutboundBufferDestroy(OutboundBuffer *buffer) {
+	free(buffer->data);
+	free(buffer->messages);
+	buffer->data = nullptr;
+	buffer->messages = nullptr;
+	buffer->size = 0;
+	buffer->capacity = 0;
+	buffer->message_count = 0;
+	buffer->message_capacity = 0;
+}
+
+char *OutboundBufferReserve(OutboundBuffer *buffer, size_t max_size) {
+	if (buffer->size + max_size > buffer->capacity) {
+		size_t new_capacity = buffer->capacity ? buffer->capacity : OUTBOUND_BUFFER_INITIAL_SIZE;
+		while (new_capacity < buffer->size + max_size) {
+			new_capacity *= 2;
+		}
+		buffer->data = static_cast<char *>(realloc(buffer->data, new_capacity));
+		buffer->capacity = new_capacity;
+	}
+	return buffer->data + buffer->size;
+}
+
+void OutboundBufferCommit(OutboundBuffer *buffer, size_t size, OutboundMessageKind kind) {
+	if (buffer->message_count == buffer->message_capacity) {
+		buffer->message_capacity = buffer->message_capacity ? buffer->message_capacity * 2 : OUTBOUND_BUFFER_INITIAL_MESSAGE_COUNT;
+		buffer->messages = static_cast<OutboundMessage *>(
+			realloc(buffer->messages, buffer->message_capacity * sizeof(OutboundMessage)));
+	}
+
+	buffer->messages[buffer->message_count++] = OutboundMessage {
+		.kind = kind,
+		.offset = static_cast<uint32_t>(buffer->size),
+		.size = static_cast<uint32_t>(size)
+	};
+	buffer->size += size;
+}
+
+void OutboundBufferAppend(OutboundBuffer *buffer, const char *data, size_t size, OutboundMessageKind kind) {
+	memcpy(OutboundBufferReserve(buffer, size), data, size);
+	OutboundBufferCommit(buffer, size, kind);
+}
+
+void OutboundBufferRemove(OutboundBuffer *buffer, size_t message_index) {
+	OutboundMessage removed = buffer->messages[message_index];
+	size_t tail_offset = removed.offset + removed.size;
+	memmove(buffer->data + removed.offset, buffer->data + tail_offset, buffer->size - tail_offset);
+	buffer->size -= removed.size;
+
+	for (size_t i = message_index + 1; i < buffer->message_count; ++i) {
+		buffer->messages[i - 1] = buffer->messages[i];
+		buffer->messages[i - 1].offset -= removed.size;
+	}
+	buffer->message_count -= 1;
+}
+
+void OutboundBufferClear(OutboundBuffer *buffer) {
+	buffer->size = 0;
+	buffer->message_count = 0;
+}
+
+bool OutboundBufferFlush(OutboundBuffer *buffer, OutboundWriteFn write_fn, void *write_context) {
+	if (buffer->size == 0) {
+		return true;
+	}
+
+	bool success = true;
+	size_t offset = 0;
+	while (offset < buffer->size) {
+		size_t written = write_fn(write_context, buffer->data + offset, buffer->size - offset);
+		buffer->write_calls += 1;
+		if (written == 0) {
+			success = false;
+			break;
+		}
+		offset += written;
+	}
+
+	buffer->flushes += 1;
+	buffer->bytes_written += offset;
+	buffer->messages_written += buffer->message_count;
+	buffer->last_flush_size = buffer->size;
+	buffer->last_flush_message_count = buffer->message_count;
+	OutboundBufferClear(buffer);
+	return success;
+}
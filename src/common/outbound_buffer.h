@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Writes count bytes from data, returns the amount of bytes written.
+// Returning 0 signals an unrecoverable error.
+using OutboundWriteFn = size_t (*)(void *context, const char *data, size_t count);
+
+constexpr size_t OUTBOUND_BUFFER_INITIAL_SIZE = 16 * 1024;
+constexpr size_t OUTBOUND_BUFFER_INITIAL_MESSAGE_COUNT = 64;
+
+// Messages that may be merged with or replaced by a newer one of the same
+// kind while they are still waiting to be written
+enum class OutboundMessageKind : uint8_t {
+	Default,
+	MouseDrag,
+	Resize
+};
+struct OutboundMessage {
+	OutboundMessageKind kind;
+	uint32_t offset;
+	uint32_t size;
+};
+
+// Encoded outbound messages are appended back to back and handed to the
+// write function in one go when the buffer is flushed, so a burst of input
+// costs a single write instead of one per message.
+struct OutboundBuffer {
+	char *data;
+	size_t size;
+	size_t capacity;
+	OutboundMessage *messages;
+	size_t message_count;
+	size_t message_capacity;
+
+	uint64_t flushes;
+	uint64_t write_calls;
+	uint64_t bytes_written;
+	uint64_t messages_written;
+	size_t last_flush_size;
+	size_t last_flush_message_count;
+};
+
+void OutboundBufferInitialize(OutboundBuffer *buffer);
+void OutboundBufferDestroy(OutboundBuffer *buffer);
+
+// Returns space for a message of up to max_size bytes at the end of the
+// buffer, the message becomes part of the buffer once it is committed
+char *OutboundBufferReserve(OutboundBuffer *buffer, size_t max_size);
+void OutboundBufferCommit(OutboundBuffer *buffer, size_t size, OutboundMessageKind kind = OutboundMessageKind::Default);
+void OutboundBufferAppend(OutboundBuffer *buffer, const char *data, size_t size, OutboundMessageKind kind);
+void OutboundBufferRemove(OutboundBuffer *buffer, size_t message_index);
+void OutboundBufferClear(OutboundBuffer *buffer);
+
+// Writes out everything queued so far. Returns false if the write failed,
+// in which case the queued messages are dropped.
+bool OutboundBufferFlush(OutboundBuffer *buffer, OutboundWriteFn write_fn, void *write_context);
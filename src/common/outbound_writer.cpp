@@ -0,0 +1,95 @@
+#include "outbound_writer.h"
+#include <utility>
+
+static void SwapStorage(OutboundBuffer *a, OutboundBuffer *b) {
+	std::swap(a->data, b->data);
+	std::swap(a->size, b->size);
+	std::swap(a->capacity, b->capacity);
+	std::swap(a->messages, b->messages);
+	std::swap(a->message_count, b->message_count);
+	std::swap(a->message_capacity, b->message_capacity);
+}
+
+static void WriterThread(OutboundWriter *writer) {
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(writer->mutex);
+			writer->wakeup.wait(lock, [writer] { return writer->stopping || writer->pending.size > 0; });
+			if (writer->pending.size == 0) {
+				break;
+			}
+			SwapStorage(&writer->pending, &writer->writing);
+		}
+
+		// Once a write has failed the pipe is gone, drop everything after it
+		if (writer->failed || !OutboundBufferFlush(&writer->writing, writer->write_fn, writer->write_context)) {
+			writer->failed = true;
+			OutboundBufferClear(&writer->writing);
+		}
+	}
+}
+
+void OutboundWriterStart(OutboundWriter *writer, OutboundWriteFn write_fn, void *write_context) {
+	writer->write_fn = write_fn;
+	writer->write_context = write_context;
+	OutboundBufferInitialize(&writer->pending);
+	OutboundBufferInitialize(&writer->writing);
+	writer->thread = std::thread(WriterThread, writer);
+}
+
+void OutboundWriterStop(OutboundWriter *writer) {
+	{
+		std::lock_guard<std::mutex> lock(writer->mutex);
+		writer->stopping = true;
+	}
+	writer->wakeup.notify_one();
+	writer->thread.join();
+
+	OutboundBufferDestroy(&writer->pending);
+	OutboundBufferDestroy(&writer->writing);
+}
+
+void OutboundWriterSubmit(OutboundWriter *writer, OutboundBuffer *staged) {
+	if (staged->message_count == 0) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(writer->mutex);
+		OutboundBuffer *pending = &writer->pending;
+		for (size_t i = 0; i < staged->message_count; ++i) {
+			OutboundMessage message = staged->messages[i];
+			switch (message.kind) {
+			case OutboundMessageKind::MouseDrag: {
+				if (pending->message_count > 0 &&
+					pending->messages[pending->message_count - 1].kind == OutboundMessageKind::MouseDrag) {
+					OutboundBufferRemove(pending, pending->message_count - 1);
+					writer->merged_messages += 1;
+				}
+				else if (pending->size >= OUTBOUND_WRITER_MAX_PENDING_SIZE) {
+					writer->dropped_messages += 1;
+					continue;
+				}
+			} break;
+			case OutboundMessageKind::Resize: {
+				for (size_t j = pending->message_count; j > 0; --j) {
+					if (pending->messages[j - 1].kind == OutboundMessageKind::Resize) {
+						OutboundBufferRemove(pending, j - 1);
+						writer->merged_messages += 1;
+					}
+				}
+			} break;
+			case OutboundMessageKind::Default: {
+				if (pending->size >= OUTBOUND_WRITER_MAX_PENDING_SIZE) {
+					writer->overflowed_messages += 1;
+				}
+			} break;
+			}
+
+			OutboundBufferAppend(pending, staged->data + message.offset, message.size, message.kind);
+		}
+	}
+	writer->wakeup.notify_one();
+
+	OutboundBufferClear(staged);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "common/outbound_buffer.h"
+
+// Past this many queued bytes, new mouse drags are dropped instead of queued
+constexpr size_t OUTBOUND_WRITER_MAX_PENDING_SIZE = 256 * 1024;
+
+// Writes outbound messages on a dedicated thread, so a full pipe only ever
+// stalls that thread. Submitted messages wait in the pending buffer while the
+// previous batch is being written, and the two buffers are swapped once the
+// write completes. While messages wait they are subject to backpressure:
+// consecutive mouse drags collapse into the newest one, only the newest
+// resize is kept and drags are dropped once the pending buffer is full.
+// Everything else is always queued.
+struct OutboundWriter {
+	OutboundWriteFn write_fn;
+	void *write_context;
+
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	OutboundBuffer pending;
+	bool stopping;
+	bool failed;
+
+	// Only touched by the writer thread, its counters add up every flush of
+	// the session and can be read once the writer has stopped
+	OutboundBuffer writing;
+	std::thread thread;
+
+	uint64_t merged_messages;
+	uint64_t dropped_messages;
+	uint64_t overflowed_messages;
+};
+
+void OutboundWriterStart(OutboundWriter *writer, OutboundWriteFn write_fn, void *write_context);
+// Writes out whatever is still pending, then joins the writer thread.
+// The write function must fail or return for this to complete.
+void OutboundWriterStop(OutboundWriter *writer);
+
+// Moves the messages of the staged buffer over to the writer, never blocks on the write itself
+void OutboundWriterSubmit(OutboundWriter *writer, OutboundBuffer *staged);
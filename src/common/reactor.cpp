@@ -0,0 +1,147 @@
+#include "reactor.h"
+#include <cassert>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static bool IsValidHandle(ReactorHandle handle) {
+	return handle != nullptr && handle != INVALID_HANDLE_VALUE;
+}
+#else
+static bool IsValidHandle(ReactorHandle handle) {
+	return handle >= 0;
+}
+
+static void Watch(Reactor *reactor, int source) {
+	epoll_event event {
+		.events = EPOLLIN,
+		.data = { .u32 = static_cast<uint32_t>(source) }
+	};
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->sources[source].handle, &event);
+}
+
+static void Unwatch(Reactor *reactor, int source) {
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, reactor->sources[source].handle, nullptr);
+}
+#endif
+
+void ReactorInitialize(Reactor *reactor) {
+	*reactor = Reactor {};
+#ifndef _WIN32
+	reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	assert(reactor->epoll_fd >= 0);
+#endif
+}
+
+void ReactorDestroy(Reactor *reactor) {
+#ifndef _WIN32
+	close(reactor->epoll_fd);
+	reactor->epoll_fd = -1;
+#endif
+	reactor->source_count = 0;
+}
+
+int ReactorAdd(Reactor *reactor, ReactorHandle handle, ReactorFn fn, void *context) {
+	assert(reactor->source_count < MAX_REACTOR_SOURCES);
+
+	int source = reactor->source_count++;
+	reactor->sources[source] = ReactorSource {
+		.handle = handle,
+		.fn = fn,
+		.context = context,
+		.active = false
+	};
+	ReactorUpdate(reactor, source, handle);
+	return source;
+}
+
+void ReactorUpdate(Reactor *reactor, int source, ReactorHandle handle) {
+	ReactorSource *reactor_source = &reactor->sources[source];
+	bool active = IsValidHandle(handle);
+	if (reactor_source->active == active && reactor_source->handle == handle) {
+		return;
+	}
+
+#ifndef _WIN32
+	if (reactor_source->active) {
+		Unwatch(reactor, source);
+	}
+#endif
+	reactor_source->handle = handle;
+	reactor_source->active = active;
+#ifndef _WIN32
+	if (reactor_source->active) {
+		Watch(reactor, source);
+	}
+#endif
+}
+
+static void Dispatch(Reactor *reactor, int source) {
+	ReactorSource *reactor_source = &reactor->sources[source];
+	reactor->dispatches += 1;
+	if (!reactor_source->fn(reactor_source->context)) {
+#ifdef _WIN32
+		ReactorUpdate(reactor, source, nullptr);
+#else
+		ReactorUpdate(reactor, source, -1);
+#endif
+	}
+}
+
+#ifdef _WIN32
+ReactorWaitResult ReactorWait(Reactor *reactor, uint32_t timeout_ms) {
+	HANDLE handles[MAX_REACTOR_SOURCES];
+	int sources[MAX_REACTOR_SOURCES];
+	DWORD handle_count = 0;
+	for (int i = 0; i < reactor->source_count; ++i) {
+		if (reactor->sources[i].active) {
+			handles[handle_count] = reactor->sources[i].handle;
+			sources[handle_count] = i;
+			handle_count += 1;
+		}
+	}
+
+	DWORD result = MsgWaitForMultipleObjectsEx(handle_count, handles,
+		timeout_ms == REACTOR_WAIT_INFINITE ? INFINITE : timeout_ms, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+	reactor->wakeups += 1;
+
+	if (result < WAIT_OBJECT_0 + handle_count) {
+		Dispatch(reactor, sources[result - WAIT_OBJECT_0]);
+		return ReactorWaitResult::SourceReady;
+	}
+	if (result == WAIT_OBJECT_0 + handle_count) {
+		return ReactorWaitResult::MessagesAvailable;
+	}
+	if (result == WAIT_TIMEOUT) {
+		return ReactorWaitResult::Timeout;
+	}
+	return ReactorWaitResult::Error;
+}
+#else
+ReactorWaitResult ReactorWait(Reactor *reactor, uint32_t timeout_ms) {
+	epoll_event events[MAX_REACTOR_SOURCES];
+	int event_count = epoll_wait(reactor->epoll_fd, events, MAX_REACTOR_SOURCES,
+		timeout_ms == REACTOR_WAIT_INFINITE ? -1 : static_cast<int>(timeout_ms));
+	reactor->wakeups += 1;
+
+	if (event_count < 0) {
+		return ReactorWaitResult::Error;
+	}
+	if (event_count == 0) {
+		return ReactorWaitResult::Timeout;
+	}
+	for (int i = 0; i < event_count; ++i) {
+		int source = static_cast<int>(events[i].data.u32);
+		// An earlier callback may have switched this source off
+		if (reactor->sources[source].active) {
+			Dispatch(reactor, source);
+		}
+	}
+	return ReactorWaitResult::SourceReady;
+}
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+
+#ifdef _WIN32
+// Any waitable HANDLE: processes, events, swapchain waitable objects...
+using ReactorHandle = void *;
+#else
+// Any file descriptor epoll can watch for readability
+using ReactorHandle = int;
+#endif
+
+constexpr int MAX_REACTOR_SOURCES = 8;
+constexpr uint32_t REACTOR_WAIT_INFINITE = 0xFFFFFFFF;
+
+// Returning false switches the source off, e.g. for handles that stay signaled
+using ReactorFn = bool (*)(void *context);
+struct ReactorSource {
+	ReactorHandle handle;
+	ReactorFn fn;
+	void *context;
+	bool active;
+};
+
+// Waits on a fixed set of handles (and on Windows, the thread's message queue)
+// at once and calls back into whichever source became ready, so nothing needs
+// to poll. Sources are identified by the index returned from ReactorAdd and
+// can be switched off or pointed at a new handle without being removed.
+struct Reactor {
+	ReactorSource sources[MAX_REACTOR_SOURCES];
+	int source_count;
+#ifndef _WIN32
+	int epoll_fd;
+#endif
+
+	uint64_t wakeups;
+	uint64_t dispatches;
+};
+
+enum class ReactorWaitResult {
+	SourceReady,
+	// Only on Windows, the caller should pump its window messages
+	MessagesAvailable,
+	Timeout,
+	Error
+};
+
+void ReactorInitialize(Reactor *reactor);
+void ReactorDestroy(Reactor *reactor);
+
+int ReactorAdd(Reactor *reactor, ReactorHandle handle, ReactorFn fn, void *context);
+// Passing a null handle (or -1 on POSIX) deactivates the source
+void ReactorUpdate(Reactor *reactor, int source, ReactorHandle handle);
+
+// Blocks until at least one source is ready or, on Windows, input has arrived
+// in the message queue. Ready sources are dispatched before returning.
+ReactorWaitResult ReactorWait(Reactor *reactor, uint32_t timeout_ms);
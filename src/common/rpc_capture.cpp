@@ -0,0 +1,165 @@
+#include "rpc_capture.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+uint64_t RpcCaptureNowMicroseconds() {
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+#ifdef _WIN32
+static wchar_t *WidenPath(const char *path) {
+	int length = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+	if (length <= 0) {
+		return nullptr;
+	}
+	wchar_t *wide_path = static_cast<wchar_t *>(malloc(length * sizeof(wchar_t)));
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, length);
+	return wide_path;
+}
+#endif
+
+bool RpcCaptureOpen(RpcCapture *capture, const char *path) {
+#ifdef _WIN32
+	wchar_t *wide_path = WidenPath(path);
+	if (!wide_path) {
+		return false;
+	}
+	capture->file = _wfopen(wide_path, L"wb");
+	free(wide_path);
+#else
+	capture->file = fopen(path, "wb");
+#endif
+	if (!capture->file) {
+		return false;
+	}
+
+	fwrite(RPC_CAPTURE_MAGIC, sizeof(RPC_CAPTURE_MAGIC), 1, capture->file);
+	capture->start_us = RpcCaptureNowMicroseconds();
+	capture->records = 0;
+	capture->bytes = 0;
+	return true;
+}
+
+void RpcCaptureClose(RpcCapture *capture) {
+	if (capture->file) {
+		fclose(capture->file);
+		capture->file = nullptr;
+	}
+}
+
+void RpcCaptureWrite(RpcCapture *capture, RpcCaptureDirection direction, const char *data, size_t size) {
+	RpcCaptureRecord record {
+		.size = static_cast<uint32_t>(size),
+		.direction = direction
+	};
+
+	// The timestamp is taken under the lock, so records are in timestamp order
+	std::lock_guard<std::mutex> lock(capture->mutex);
+	record.timestamp_us = RpcCaptureNowMicroseconds() - capture->start_us;
+	fwrite(&record, sizeof(record), 1, capture->file);
+	fwrite(data, 1, size, capture->file);
+	capture->records += 1;
+	capture->bytes += size;
+}
+
+bool RpcCaptureMap(RpcCaptureFile *capture_file, const char *path) {
+	*capture_file = RpcCaptureFile {};
+#ifdef _WIN32
+	wchar_t *wide_path = WidenPath(path);
+	if (!wide_path) {
+		return false;
+	}
+	HANDLE file = CreateFileW(wide_path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	free(wide_path);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	HANDLE mapping = nullptr;
+	const void *data = nullptr;
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart >= static_cast<LONGLONG>(sizeof(RPC_CAPTURE_MAGIC))) {
+		mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	}
+	if (mapping) {
+		data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (!data) {
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		return false;
+	}
+	capture_file->file = file;
+	capture_file->mapping = mapping;
+	capture_file->data = static_cast<const char *>(data);
+	capture_file->size = static_cast<size_t>(file_size.QuadPart);
+#else
+	int file = open(path, O_RDONLY | O_CLOEXEC);
+	if (file < 0) {
+		return false;
+	}
+	struct stat file_stat;
+	void *data = MAP_FAILED;
+	if (fstat(file, &file_stat) == 0 && file_stat.st_size >= static_cast<off_t>(sizeof(RPC_CAPTURE_MAGIC))) {
+		data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	}
+	// The mapping stays valid without the descriptor
+	close(file);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	// Replay reads the file front to back
+	madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+	capture_file->data = static_cast<const char *>(data);
+	capture_file->size = static_cast<size_t>(file_stat.st_size);
+#endif
+
+	if (memcmp(capture_file->data, RPC_CAPTURE_MAGIC, sizeof(RPC_CAPTURE_MAGIC)) != 0) {
+		RpcCaptureUnmap(capture_file);
+		return false;
+	}
+	return true;
+}
+
+void RpcCaptureUnmap(RpcCaptureFile *capture_file) {
+	if (!capture_file->data) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(capture_file->data);
+	CloseHandle(capture_file->mapping);
+	CloseHandle(capture_file->file);
+#else
+	munmap(const_cast<char *>(capture_file->data), capture_file->size);
+#endif
+	*capture_file = RpcCaptureFile {};
+}
+
+bool RpcCaptureNextRecord(const RpcCaptureFile *capture_file, size_t *offset,
+	RpcCaptureRecord *record, const char **data) {
+	if (capture_file->size - *offset < sizeof(RpcCaptureRecord)) {
+		return false;
+	}
+	memcpy(record, capture_file->data + *offset, sizeof(RpcCaptureRecord));
+	size_t data_offset = *offset + sizeof(RpcCaptureRecord);
+	if (capture_file->size - data_offset < record->size) {
+		return false;
+	}
+
+	*data = capture_file->data + data_offset;
+	*offset = data_offset + record->size;
+	return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+// A capture file starts with RPC_CAPTURE_MAGIC, followed by records back to
+// back. Each record is an RpcCaptureRecord header and size bytes of the raw
+// stream in its direction, exactly as they were read or written, so replaying
+// the inbound records reproduces what nvim sent down to the chunk boundaries.
+// All fields are little-endian.
+constexpr char RPC_CAPTURE_MAGIC[8] = { 'N', 'V', 'Y', 'C', 'A', 'P', '0', '1' };
+
+enum class RpcCaptureDirection : uint8_t {
+	// Sent by nvim
+	Inbound,
+	// Sent to nvim
+	Outbound
+};
+struct RpcCaptureRecord {
+	// Monotonic, relative to when the capture was opened
+	uint64_t timestamp_us;
+	uint32_t size;
+	RpcCaptureDirection direction;
+	uint8_t _padding[3];
+};
+static_assert(sizeof(RpcCaptureRecord) == 16);
+
+// Written to from the reader and the writer thread
+struct RpcCapture {
+	std::mutex mutex;
+	FILE *file;
+	uint64_t start_us;
+
+	uint64_t records;
+	uint64_t bytes;
+};
+
+// The path is UTF-8
+bool RpcCaptureOpen(RpcCapture *capture, const char *path);
+void RpcCaptureClose(RpcCapture *capture);
+void RpcCaptureWrite(RpcCapture *capture, RpcCaptureDirection direction, const char *data, size_t size);
+
+// A capture file mapped into memory for replay
+struct RpcCaptureFile {
+	const char *data;
+	size_t size;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#endif
+};
+
+bool RpcCaptureMap(RpcCaptureFile *capture_file, const char *path);
+void RpcCaptureUnmap(RpcCaptureFile *capture_file);
+
+// Start iterating at RPC_CAPTURE_FIRST_RECORD. Returns false at the end of the
+// file, a truncated record at the end (e.g. from a crash) also ends the file.
+constexpr size_t RPC_CAPTURE_FIRST_RECORD = sizeof(RPC_CAPTURE_MAGIC);
+bool RpcCaptureNextRecord(const RpcCaptureFile *capture_file, size_t *offset,
+	RpcCaptureRecord *record, const char **data);
+
+uint64_t RpcCaptureNowMicroseconds();
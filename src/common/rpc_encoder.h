@@ -0,0 +1,262 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+// Typed msgpack-rpc encoding. Every method is declared once as an RpcMethod
+// together with its argument types, so calls with the wrong number or types
+// of arguments don't compile. Messages are measured with an RpcSizeCounter
+// first and then encoded with an RpcBufferWriter straight into a buffer of
+// exactly that size, there is no intermediate copy and no size limit.
+template<typename... Args>
+struct RpcMethod {
+	uint8_t id;
+	std::string_view name;
+};
+
+// A map of boolean options, e.g. the options of nvim_ui_attach
+struct RpcOption {
+	std::string_view name;
+	bool value;
+};
+template<size_t N>
+using RpcOptions = std::array<RpcOption, N>;
+
+enum RpcMessageType : uint8_t {
+	RPC_REQUEST = 0,
+	RPC_NOTIFICATION = 2
+};
+
+struct RpcSizeCounter {
+	size_t size;
+};
+struct RpcBufferWriter {
+	char *data;
+	size_t size;
+};
+
+constexpr void RpcPut(RpcSizeCounter *counter, uint8_t) {
+	counter->size += 1;
+}
+constexpr void RpcPut(RpcSizeCounter *counter, const char *, size_t count) {
+	counter->size += count;
+}
+constexpr void RpcPut(RpcBufferWriter *writer, uint8_t byte) {
+	writer->data[writer->size++] = static_cast<char>(byte);
+}
+constexpr void RpcPut(RpcBufferWriter *writer, const char *bytes, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		writer->data[writer->size++] = bytes[i];
+	}
+}
+
+template<typename Out>
+constexpr void RpcPutBigEndian(Out *out, uint8_t marker, uint64_t value, int byte_count) {
+	RpcPut(out, marker);
+	for (int i = byte_count - 1; i >= 0; --i) {
+		RpcPut(out, static_cast<uint8_t>(value >> (i * 8)));
+	}
+}
+
+// Integers, strings and headers use their smallest encoding, same as mpack
+template<typename Out>
+constexpr void RpcEncodeInt(Out *out, int64_t value) {
+	if (value >= 0) {
+		uint64_t unsigned_value = static_cast<uint64_t>(value);
+		if (unsigned_value <= 0x7F) {
+			RpcPut(out, static_cast<uint8_t>(unsigned_value));
+		}
+		else if (unsigned_value <= 0xFF) {
+			RpcPutBigEndian(out, 0xCC, unsigned_value, 1);
+		}
+		else if (unsigned_value <= 0xFFFF) {
+			RpcPutBigEndian(out, 0xCD, unsigned_value, 2);
+		}
+		else if (unsigned_value <= 0xFFFFFFFF) {
+			RpcPutBigEndian(out, 0xCE, unsigned_value, 4);
+		}
+		else {
+			RpcPutBigEndian(out, 0xCF, unsigned_value, 8);
+		}
+	}
+	else if (value >= -32) {
+		RpcPut(out, static_cast<uint8_t>(value));
+	}
+	else if (value >= INT8_MIN) {
+		RpcPutBigEndian(out, 0xD0, static_cast<uint64_t>(value), 1);
+	}
+	else if (value >= INT16_MIN) {
+		RpcPutBigEndian(out, 0xD1, static_cast<uint64_t>(value), 2);
+	}
+	else if (value >= INT32_MIN) {
+		RpcPutBigEndian(out, 0xD2, static_cast<uint64_t>(value), 4);
+	}
+	else {
+		RpcPutBigEndian(out, 0xD3, static_cast<uint64_t>(value), 8);
+	}
+}
+
+template<typename Out>
+constexpr void RpcEncodeArrayHeader(Out *out, size_t count) {
+	if (count <= 15) {
+		RpcPut(out, static_cast<uint8_t>(0x90 | count));
+	}
+	else if (count <= 0xFFFF) {
+		RpcPutBigEndian(out, 0xDC, count, 2);
+	}
+	else {
+		RpcPutBigEndian(out, 0xDD, count, 4);
+	}
+}
+
+template<typename Out>
+constexpr void RpcEncodeMapHeader(Out *out, size_t count) {
+	if (count <= 15) {
+		RpcPut(out, static_cast<uint8_t>(0x80 | count));
+	}
+	else if (count <= 0xFFFF) {
+		RpcPutBigEndian(out, 0xDE, count, 2);
+	}
+	else {
+		RpcPutBigEndian(out, 0xDF, count, 4);
+	}
+}
+
+template<typename Out>
+constexpr void RpcEncodeValue(Out *out, int64_t value) {
+	RpcEncodeInt(out, value);
+}
+
+template<typename Out>
+constexpr void RpcEncodeValue(Out *out, bool value) {
+	RpcPut(out, static_cast<uint8_t>(value ? 0xC3 : 0xC2));
+}
+
+template<typename Out>
+constexpr void RpcEncodeValue(Out *out, std::string_view value) {
+	size_t length = value.size();
+	if (length <= 31) {
+		RpcPut(out, static_cast<uint8_t>(0xA0 | length));
+	}
+	else if (length <= 0xFF) {
+		RpcPutBigEndian(out, 0xD9, length, 1);
+	}
+	else if (length <= 0xFFFF) {
+		RpcPutBigEndian(out, 0xDA, length, 2);
+	}
+	else {
+		RpcPutBigEndian(out, 0xDB, length, 4);
+	}
+	RpcPut(out, value.data(), length);
+}
+
+template<typename Out, size_t N>
+constexpr void RpcEncodeValue(Out *out, const RpcOptions<N> &options) {
+	RpcEncodeMapHeader(out, N);
+	for (const RpcOption &option : options) {
+		RpcEncodeValue(out, option.name);
+		RpcEncodeValue(out, option.value);
+	}
+}
+
+template<typename Out, size_t N>
+constexpr void RpcEncodeValue(Out *out, const std::array<int64_t, N> &values) {
+	RpcEncodeArrayHeader(out, N);
+	for (int64_t value : values) {
+		RpcEncodeInt(out, value);
+	}
+}
+
+// An Ex command with a single argument for nvim_cmd. The argument reaches the
+// command as one word, as is, without file name expansion or a | ending it.
+struct RpcExCommand {
+	std::string_view command;
+	std::string_view argument;
+};
+
+template<typename Out>
+constexpr void RpcEncodeValue(Out *out, const RpcExCommand &command) {
+	RpcEncodeMapHeader(out, 3);
+	RpcEncodeValue(out, std::string_view("cmd"));
+	RpcEncodeValue(out, command.command);
+	RpcEncodeValue(out, std::string_view("args"));
+	RpcEncodeArrayHeader(out, 1);
+	RpcEncodeValue(out, command.argument);
+	RpcEncodeValue(out, std::string_view("magic"));
+	RpcEncodeValue(out, RpcOptions<2> { RpcOption { "file", false }, RpcOption { "bar", false } });
+}
+
+// Arguments are taken as std::type_identity_t, so they convert to the types
+// the method was declared with instead of taking part in deduction
+template<typename Out, typename... Args>
+constexpr void RpcEncodeNotification(Out *out, const RpcMethod<Args...> &method,
+	std::type_identity_t<const Args &>... args) {
+	RpcEncodeArrayHeader(out, 3);
+	RpcEncodeInt(out, RPC_NOTIFICATION);
+	RpcEncodeValue(out, method.name);
+	RpcEncodeArrayHeader(out, sizeof...(Args));
+	(RpcEncodeValue(out, args), ...);
+}
+
+template<typename Out, typename... Args>
+constexpr void RpcEncodeRequest(Out *out, uint32_t msg_id, const RpcMethod<Args...> &method,
+	std::type_identity_t<const Args &>... args) {
+	RpcEncodeArrayHeader(out, 4);
+	RpcEncodeInt(out, RPC_REQUEST);
+	RpcEncodeInt(out, msg_id);
+	RpcEncodeValue(out, method.name);
+	RpcEncodeArrayHeader(out, sizeof...(Args));
+	(RpcEncodeValue(out, args), ...);
+}
+
+// Methods taking a batch of calls, such as nvim_call_atomic, are declared
+// as RpcMethod<RpcBatch>. The batch is started with the number of calls and
+// each call is then encoded as [method, [args...]] with RpcEncodeCall.
+struct RpcBatch {};
+
+template<typename Out>
+constexpr void RpcBeginBatchNotification(Out *out, const RpcMethod<RpcBatch> &method, size_t call_count) {
+	RpcEncodeArrayHeader(out, 3);
+	RpcEncodeInt(out, RPC_NOTIFICATION);
+	RpcEncodeValue(out, method.name);
+	RpcEncodeArrayHeader(out, 1);
+	RpcEncodeArrayHeader(out, call_count);
+}
+
+template<typename Out>
+constexpr void RpcBeginBatchRequest(Out *out, uint32_t msg_id, const RpcMethod<RpcBatch> &method, size_t call_count) {
+	RpcEncodeArrayHeader(out, 4);
+	RpcEncodeInt(out, RPC_REQUEST);
+	RpcEncodeInt(out, msg_id);
+	RpcEncodeValue(out, method.name);
+	RpcEncodeArrayHeader(out, 1);
+	RpcEncodeArrayHeader(out, call_count);
+}
+
+template<typename Out, typename... Args>
+constexpr void RpcEncodeCall(Out *out, const RpcMethod<Args...> &method, std::type_identity_t<const Args &>... args) {
+	RpcEncodeArrayHeader(out, 2);
+	RpcEncodeValue(out, method.name);
+	RpcEncodeArrayHeader(out, sizeof...(Args));
+	(RpcEncodeValue(out, args), ...);
+}
+
+// A message serialized at compile time. Only meant for constexpr variables,
+// where a message that doesn't fit the capacity fails to compile.
+constexpr size_t RPC_CONSTANT_MESSAGE_CAPACITY = 128;
+struct RpcConstantMessage {
+	char data[RPC_CONSTANT_MESSAGE_CAPACITY];
+	size_t size;
+};
+
+template<typename... Args>
+constexpr RpcConstantMessage RpcConstantNotification(const RpcMethod<Args...> &method,
+	std::type_identity_t<const Args &>... args) {
+	RpcConstantMessage message {};
+	RpcBufferWriter writer { .data = message.data, .size = 0 };
+	RpcEncodeNotification(&writer, method, args...);
+	message.size = writer.size;
+	return message;
+}
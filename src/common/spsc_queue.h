@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Bounded lock-free single-producer/single-consumer ring. Slots are filled
+// and drained in place, so any storage a slot owns is reused across messages
+// instead of being allocated per message. Each side caches the other side's
+// index and only touches the shared cache line once its cached view runs out.
+template<typename T, size_t N>
+struct SpscQueue {
+	static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+	size_t consumer_cached_tail;
+
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+	size_t producer_cached_head;
+
+	alignas(CACHE_LINE_SIZE) T slots[N];
+};
+
+// Producer side. Returns the next free slot, or nullptr if the queue is full.
+// The slot becomes visible to the consumer once SpscQueueEndPush is called.
+template<typename T, size_t N>
+inline T *SpscQueueBeginPush(SpscQueue<T, N> *queue) {
+	size_t tail = queue->tail.load(std::memory_order_relaxed);
+	if (tail - queue->producer_cached_head == N) {
+		queue->producer_cached_head = queue->head.load(std::memory_order_acquire);
+		if (tail - queue->producer_cached_head == N) {
+			return nullptr;
+		}
+	}
+	return &queue->slots[tail & (N - 1)];
+}
+
+template<typename T, size_t N>
+inline void SpscQueueEndPush(SpscQueue<T, N> *queue) {
+	size_t tail = queue->tail.load(std::memory_order_relaxed);
+	queue->tail.store(tail + 1, std::memory_order_release);
+}
+
+// Consumer side. Returns the oldest published slot, or nullptr if the queue
+// is empty. The slot is handed back to the producer by SpscQueuePop.
+template<typename T, size_t N>
+inline T *SpscQueueFront(SpscQueue<T, N> *queue) {
+	size_t head = queue->head.load(std::memory_order_relaxed);
+	if (head == queue->consumer_cached_tail) {
+		queue->consumer_cached_tail = queue->tail.load(std::memory_order_acquire);
+		if (head == queue->consumer_cached_tail) {
+			return nullptr;
+		}
+	}
+	return &queue->slots[head & (N - 1)];
+}
+
+template<typename T, size_t N>
+inline void SpscQueuePop(SpscQueue<T, N> *queue) {
+	size_t head = queue->head.load(std::memory_order_relaxed);
+	queue->head.store(head + 1, std::memory_order_release);
+}
@@ -0,0 +1,588 @@
+#include "transport.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include "common/rpc_capture.h"
+
+#ifdef _WIN32
+// Included ahead of windows.h, which would otherwise pull in the old winsock.h
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+bool TransportSplitTcpAddress(const char *address, char *host, size_t host_capacity, const char **port) {
+	if (strchr(address, '/') || strchr(address, '\\')) {
+		return false;
+	}
+	const char *separator = strrchr(address, ':');
+	if (!separator || separator == address || separator[1] == '\0') {
+		return false;
+	}
+
+	const char *host_start = address;
+	const char *host_end = separator;
+	if (*host_start == '[' && host_end[-1] == ']') {
+		host_start += 1;
+		host_end -= 1;
+	}
+	size_t host_length = static_cast<size_t>(host_end - host_start);
+	if (host_length == 0 || host_length >= host_capacity) {
+		return false;
+	}
+	memcpy(host, host_start, host_length);
+	host[host_length] = '\0';
+	*port = separator + 1;
+	return true;
+}
+
+struct TransportReplayState {
+	RpcCaptureFile file;
+	size_t next_record;
+	const char *record_data;
+	size_t record_remaining;
+
+	bool original_pace;
+	uint64_t start_us;
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool stopped;
+};
+
+bool TransportReplay(Transport *transport, const char *path, bool original_pace) {
+	TransportReplayState *replay = new TransportReplayState {};
+	if (!RpcCaptureMap(&replay->file, path)) {
+		delete replay;
+		return false;
+	}
+	replay->next_record = RPC_CAPTURE_FIRST_RECORD;
+	replay->original_pace = original_pace;
+	replay->start_us = RpcCaptureNowMicroseconds();
+
+	*transport = Transport {
+		.kind = TransportKind::Replay,
+#ifndef _WIN32
+		.read_fd = -1,
+		.write_fd = -1,
+		.exit_fd = -1,
+#endif
+		.replay = replay
+	};
+	return true;
+}
+
+// Returns false once the replay has been stopped
+static bool WaitForRecord(TransportReplayState *replay, uint64_t timestamp_us) {
+	auto deadline = std::chrono::steady_clock::time_point(std::chrono::microseconds(replay->start_us + timestamp_us));
+	std::unique_lock<std::mutex> lock(replay->mutex);
+	return !replay->wakeup.wait_until(lock, deadline, [replay] { return replay->stopped; });
+}
+
+static size_t ReadReplay(TransportReplayState *replay, char *buffer, size_t count) {
+	while (replay->record_remaining == 0) {
+		RpcCaptureRecord record;
+		const char *data;
+		if (!RpcCaptureNextRecord(&replay->file, &replay->next_record, &record, &data)) {
+			return 0;
+		}
+		if (record.direction != RpcCaptureDirection::Inbound) {
+			continue;
+		}
+		if (replay->original_pace && !WaitForRecord(replay, record.timestamp_us)) {
+			return 0;
+		}
+		replay->record_data = data;
+		replay->record_remaining = record.size;
+	}
+
+	size_t size = std::min(count, replay->record_remaining);
+	memcpy(buffer, replay->record_data, size);
+	replay->record_data += size;
+	replay->record_remaining -= size;
+	return size;
+}
+
+static void StopReplay(TransportReplayState *replay) {
+	{
+		std::lock_guard<std::mutex> lock(replay->mutex);
+		replay->stopped = true;
+	}
+	replay->wakeup.notify_all();
+}
+
+static void CloseReplay(TransportReplayState *replay) {
+	RpcCaptureUnmap(&replay->file);
+	delete replay;
+}
+
+#ifdef _WIN32
+bool TransportSpawn(Transport *transport, TransportCommandLine command_line) {
+	*transport = Transport { .kind = TransportKind::Process };
+
+	// The job outlives every handle to it, so nvim is killed along with Nvy
+	HANDLE job_object = CreateJobObjectW(nullptr, nullptr);
+	JOBOBJECT_EXTENDED_LIMIT_INFORMATION job_info {
+		.BasicLimitInformation = JOBOBJECT_BASIC_LIMIT_INFORMATION {
+			.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE
+		}
+	};
+	SetInformationJobObject(job_object, JobObjectExtendedLimitInformation, &job_info, sizeof(job_info));
+
+	SECURITY_ATTRIBUTES sec_attribs {
+		.nLength = sizeof(SECURITY_ATTRIBUTES),
+		.bInheritHandle = true
+	};
+	HANDLE stdin_read, stdin_write, stdout_read, stdout_write;
+	CreatePipe(&stdin_read, &stdin_write, &sec_attribs, 0);
+	CreatePipe(&stdout_read, &stdout_write, &sec_attribs, 0);
+
+	STARTUPINFO startup_info {
+		.cb = sizeof(STARTUPINFO),
+		.dwFlags = STARTF_USESTDHANDLES,
+		.hStdInput = stdin_read,
+		.hStdOutput = stdout_write,
+		.hStdError = stdout_write
+	};
+	PROCESS_INFORMATION process_info {};
+	BOOL success = CreateProcessW(
+		nullptr,
+		command_line,
+		nullptr,
+		nullptr,
+		true,
+		CREATE_NO_WINDOW,
+		nullptr,
+		nullptr,
+		&startup_info,
+		&process_info
+	);
+
+	// Only nvim should hold the child ends of the pipes, otherwise reads
+	// never see the end of the stream once nvim exits
+	CloseHandle(stdin_read);
+	CloseHandle(stdout_write);
+	if (!success) {
+		CloseHandle(stdin_write);
+		CloseHandle(stdout_read);
+		CloseHandle(job_object);
+		return false;
+	}
+
+	AssignProcessToJobObject(job_object, process_info.hProcess);
+	CloseHandle(process_info.hThread);
+	transport->read_handle = stdout_read;
+	transport->write_handle = stdin_write;
+	transport->process = process_info.hProcess;
+	return true;
+}
+
+static bool OpenNamedPipe(Transport *transport, const char *address) {
+	int path_length = MultiByteToWideChar(CP_UTF8, 0, address, -1, nullptr, 0);
+	if (path_length <= 0) {
+		return false;
+	}
+	wchar_t *path = static_cast<wchar_t *>(malloc(path_length * sizeof(wchar_t)));
+	MultiByteToWideChar(CP_UTF8, 0, address, -1, path, path_length);
+	HANDLE pipe = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+		OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+	free(path);
+	if (pipe == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	transport->kind = TransportKind::Local;
+	transport->read_handle = pipe;
+	transport->write_handle = pipe;
+	transport->read_event = CreateEvent(nullptr, true, false, nullptr);
+	transport->write_event = CreateEvent(nullptr, true, false, nullptr);
+	return true;
+}
+
+static bool ConnectTcp(Transport *transport, const char *host, const char *port) {
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		return false;
+	}
+
+	addrinfo hints {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP
+	};
+	addrinfo *addresses;
+	if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+		WSACleanup();
+		return false;
+	}
+
+	SOCKET connection = INVALID_SOCKET;
+	for (addrinfo *address = addresses; address; address = address->ai_next) {
+		connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (connection == INVALID_SOCKET) {
+			continue;
+		}
+		if (connect(connection, address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0) {
+			break;
+		}
+		closesocket(connection);
+		connection = INVALID_SOCKET;
+	}
+	freeaddrinfo(addresses);
+	if (connection == INVALID_SOCKET) {
+		WSACleanup();
+		return false;
+	}
+
+	// Input is written as soon as it is flushed, don't let it wait for an ACK
+	BOOL no_delay = true;
+	setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&no_delay), sizeof(no_delay));
+	transport->kind = TransportKind::Tcp;
+	transport->socket = connection;
+	return true;
+}
+
+bool TransportConnect(Transport *transport, const char *address) {
+	*transport = Transport { .socket = INVALID_SOCKET };
+
+	char host[256];
+	const char *port;
+	if (TransportSplitTcpAddress(address, host, sizeof(host), &port)) {
+		return ConnectTcp(transport, host, port);
+	}
+	return OpenNamedPipe(transport, address);
+}
+
+static size_t TransferOverlapped(HANDLE handle, HANDLE event, bool read, char *buffer, size_t count) {
+	OVERLAPPED overlapped { .hEvent = event };
+	DWORD bytes_transferred = 0;
+	BOOL success = read ?
+		ReadFile(handle, buffer, static_cast<DWORD>(count), nullptr, &overlapped) :
+		WriteFile(handle, buffer, static_cast<DWORD>(count), nullptr, &overlapped);
+	if (!success && GetLastError() != ERROR_IO_PENDING) {
+		return 0;
+	}
+	if (!GetOverlappedResult(handle, &overlapped, &bytes_transferred, true)) {
+		return 0;
+	}
+	return bytes_transferred;
+}
+
+size_t TransportRead(void *context, char *buffer, size_t count) {
+	Transport *transport = static_cast<Transport *>(context);
+	switch (transport->kind) {
+	case TransportKind::Process: {
+		DWORD bytes_read;
+		if (!ReadFile(transport->read_handle, buffer, static_cast<DWORD>(count), &bytes_read, nullptr)) {
+			return 0;
+		}
+		return bytes_read;
+	}
+	case TransportKind::Local: {
+		return TransferOverlapped(transport->read_handle, transport->read_event, true, buffer, count);
+	}
+	case TransportKind::Tcp: {
+		int received = recv(transport->socket, buffer, static_cast<int>(count), 0);
+		return received > 0 ? static_cast<size_t>(received) : 0;
+	}
+	case TransportKind::Replay: {
+		return ReadReplay(transport->replay, buffer, count);
+	}
+	}
+	return 0;
+}
+
+size_t TransportWrite(void *context, const char *data, size_t count) {
+	Transport *transport = static_cast<Transport *>(context);
+	switch (transport->kind) {
+	case TransportKind::Process: {
+		DWORD bytes_written;
+		if (!WriteFile(transport->write_handle, data, static_cast<DWORD>(count), &bytes_written, nullptr)) {
+			return 0;
+		}
+		return bytes_written;
+	}
+	case TransportKind::Local: {
+		return TransferOverlapped(transport->write_handle, transport->write_event, false,
+			const_cast<char *>(data), count);
+	}
+	case TransportKind::Tcp: {
+		int sent = send(transport->socket, data, static_cast<int>(count), 0);
+		return sent > 0 ? static_cast<size_t>(sent) : 0;
+	}
+	case TransportKind::Replay: {
+		return count;
+	}
+	}
+	return 0;
+}
+
+ReactorHandle TransportExitHandle(Transport *transport) {
+	return transport->process;
+}
+
+void TransportShutdown(Transport *transport) {
+	switch (transport->kind) {
+	case TransportKind::Process: {
+		if (WaitForSingleObject(transport->process, 0) == WAIT_TIMEOUT) {
+			TerminateProcess(transport->process, 0);
+			WaitForSingleObject(transport->process, INFINITE);
+		}
+		DWORD exit_code;
+		GetExitCodeProcess(transport->process, &exit_code);
+		transport->exit_code = exit_code;
+	} break;
+	case TransportKind::Local: {
+		CancelIoEx(transport->read_handle, nullptr);
+	} break;
+	case TransportKind::Tcp: {
+		shutdown(transport->socket, SD_BOTH);
+	} break;
+	case TransportKind::Replay: {
+		StopReplay(transport->replay);
+	} break;
+	}
+}
+
+void TransportClose(Transport *transport) {
+	switch (transport->kind) {
+	case TransportKind::Process: {
+		CloseHandle(transport->read_handle);
+		CloseHandle(transport->write_handle);
+		CloseHandle(transport->process);
+	} break;
+	case TransportKind::Local: {
+		CloseHandle(transport->read_handle);
+		CloseHandle(transport->read_event);
+		CloseHandle(transport->write_event);
+	} break;
+	case TransportKind::Tcp: {
+		closesocket(transport->socket);
+		WSACleanup();
+	} break;
+	case TransportKind::Replay: {
+		CloseReplay(transport->replay);
+	} break;
+	}
+}
+#else
+bool TransportSpawn(Transport *transport, TransportCommandLine command_line) {
+	*transport = Transport { .kind = TransportKind::Process, .read_fd = -1, .write_fd = -1, .exit_fd = -1 };
+
+	// Writes to a process that has exited should fail, not kill Nvy
+	signal(SIGPIPE, SIG_IGN);
+
+	int stdin_pipe[2];
+	int stdout_pipe[2];
+	if (pipe2(stdin_pipe, O_CLOEXEC) != 0) {
+		return false;
+	}
+	if (pipe2(stdout_pipe, O_CLOEXEC) != 0) {
+		close(stdin_pipe[0]);
+		close(stdin_pipe[1]);
+		return false;
+	}
+
+	posix_spawn_file_actions_t file_actions;
+	posix_spawn_file_actions_init(&file_actions);
+	posix_spawn_file_actions_adddup2(&file_actions, stdin_pipe[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&file_actions, stdout_pipe[1], STDOUT_FILENO);
+	char shell[] = "/bin/sh";
+	char shell_flag[] = "-c";
+	char *argv[] = { shell, shell_flag, const_cast<char *>(command_line), nullptr };
+
+	// A process group of its own plays the part of the job object on Windows,
+	// the shell and everything it started are killed together
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+	posix_spawnattr_setpgroup(&attributes, 0);
+	pid_t process_id;
+	int result = posix_spawn(&process_id, shell, &file_actions, &attributes, argv, environ);
+	posix_spawnattr_destroy(&attributes);
+	posix_spawn_file_actions_destroy(&file_actions);
+
+	// Only the child should hold its ends of the pipes, otherwise reads
+	// never see the end of the stream once it exits
+	close(stdin_pipe[0]);
+	close(stdout_pipe[1]);
+	if (result != 0) {
+		close(stdin_pipe[1]);
+		close(stdout_pipe[0]);
+		return false;
+	}
+
+	transport->read_fd = stdout_pipe[0];
+	transport->write_fd = stdin_pipe[1];
+	transport->process_id = process_id;
+#ifdef SYS_pidfd_open
+	// Fails before Linux 5.3, the end of the process then only shows up as the end of its output
+	transport->exit_fd = static_cast<int>(syscall(SYS_pidfd_open, process_id, 0));
+#endif
+	return true;
+}
+
+static int ConnectUnix(const char *path) {
+	sockaddr_un address { .sun_family = AF_UNIX };
+	size_t path_length = strlen(path);
+	if (path_length >= sizeof(address.sun_path)) {
+		return -1;
+	}
+	memcpy(address.sun_path, path, path_length + 1);
+
+	int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (connection < 0) {
+		return -1;
+	}
+	if (connect(connection, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+		close(connection);
+		return -1;
+	}
+	return connection;
+}
+
+static int ConnectTcp(const char *host, const char *port) {
+	addrinfo hints {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP
+	};
+	addrinfo *addresses;
+	if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+		return -1;
+	}
+
+	int connection = -1;
+	for (addrinfo *address = addresses; address; address = address->ai_next) {
+		connection = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+		if (connection < 0) {
+			continue;
+		}
+		if (connect(connection, address->ai_addr, address->ai_addrlen) == 0) {
+			break;
+		}
+		close(connection);
+		connection = -1;
+	}
+	freeaddrinfo(addresses);
+	if (connection < 0) {
+		return -1;
+	}
+
+	// Input is written as soon as it is flushed, don't let it wait for an ACK
+	int no_delay = 1;
+	setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+	return connection;
+}
+
+bool TransportConnect(Transport *transport, const char *address) {
+	*transport = Transport { .read_fd = -1, .write_fd = -1, .exit_fd = -1 };
+
+	char host[256];
+	const char *port;
+	int connection;
+	if (TransportSplitTcpAddress(address, host, sizeof(host), &port)) {
+		transport->kind = TransportKind::Tcp;
+		connection = ConnectTcp(host, port);
+	}
+	else {
+		transport->kind = TransportKind::Local;
+		connection = ConnectUnix(address);
+	}
+	if (connection < 0) {
+		return false;
+	}
+
+	transport->read_fd = connection;
+	transport->write_fd = connection;
+	return true;
+}
+
+size_t TransportRead(void *context, char *buffer, size_t count) {
+	Transport *transport = static_cast<Transport *>(context);
+	if (transport->kind == TransportKind::Replay) {
+		return ReadReplay(transport->replay, buffer, count);
+	}
+	while (true) {
+		ssize_t bytes_read = read(transport->read_fd, buffer, count);
+		if (bytes_read >= 0) {
+			return static_cast<size_t>(bytes_read);
+		}
+		if (errno != EINTR) {
+			return 0;
+		}
+	}
+}
+
+size_t TransportWrite(void *context, const char *data, size_t count) {
+	Transport *transport = static_cast<Transport *>(context);
+	if (transport->kind == TransportKind::Replay) {
+		return count;
+	}
+	while (true) {
+		ssize_t bytes_written = transport->kind == TransportKind::Process ?
+			write(transport->write_fd, data, count) :
+			send(transport->write_fd, data, count, MSG_NOSIGNAL);
+		if (bytes_written > 0) {
+			return static_cast<size_t>(bytes_written);
+		}
+		if (bytes_written == 0 || errno != EINTR) {
+			return 0;
+		}
+	}
+}
+
+ReactorHandle TransportExitHandle(Transport *transport) {
+	return transport->kind == TransportKind::Process ? transport->exit_fd : -1;
+}
+
+void TransportShutdown(Transport *transport) {
+	if (transport->kind == TransportKind::Process) {
+		int status = 0;
+		if (waitpid(transport->process_id, &status, WNOHANG) == 0) {
+			kill(-transport->process_id, SIGKILL);
+			waitpid(transport->process_id, &status, 0);
+		}
+		transport->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+	}
+	else if (transport->kind == TransportKind::Replay) {
+		StopReplay(transport->replay);
+	}
+	else {
+		shutdown(transport->read_fd, SHUT_RDWR);
+	}
+}
+
+void TransportClose(Transport *transport) {
+	if (transport->kind == TransportKind::Replay) {
+		CloseReplay(transport->replay);
+		return;
+	}
+	if (transport->write_fd != transport->read_fd) {
+		close(transport->write_fd);
+	}
+	close(transport->read_fd);
+	if (transport->exit_fd >= 0) {
+		close(transport->exit_fd);
+	}
+	transport->read_fd = -1;
+	transport->write_fd = -1;
+	transport->exit_fd = -1;
+}
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "common/reactor.h"
+
+enum class TransportKind : uint8_t {
+	// A child process talking over its stdin and stdout
+	Process,
+	// The local socket of a running `nvim --listen`, a named pipe on
+	// Windows and a Unix domain socket everywhere else
+	Local,
+	// A running `nvim --listen host:port`
+	Tcp,
+	// Plays back the inbound side of a capture file, see rpc_capture.h.
+	// Writes are accepted and dropped.
+	Replay
+};
+struct TransportReplayState;
+
+// The byte stream between Nvy and nvim. TransportRead matches MPackStreamReadFn
+// and TransportWrite matches OutboundWriteFn, with the transport as their context,
+// so reads and writes may happen on two threads at once.
+struct Transport {
+	TransportKind kind;
+#ifdef _WIN32
+	// HANDLEs, both ends are the same handle for named pipes
+	void *read_handle;
+	void *write_handle;
+	// Named pipes are opened for overlapped I/O, otherwise a blocked read
+	// would hold up every write on the same handle
+	void *read_event;
+	void *write_event;
+	void *process;
+	uintptr_t socket;
+#else
+	int read_fd;
+	int write_fd;
+	int process_id;
+	// A pidfd of the process on Linux, which becomes readable once it exits
+	int exit_fd;
+#endif
+	TransportReplayState *replay;
+	uint32_t exit_code;
+};
+
+#ifdef _WIN32
+// Passed to CreateProcessW, which may modify it
+using TransportCommandLine = wchar_t *;
+#else
+// Run through /bin/sh -c
+using TransportCommandLine = const char *;
+#endif
+
+bool TransportSpawn(Transport *transport, TransportCommandLine command_line);
+// Addresses of the form host:port connect over TCP, anything else
+// (or anything containing a path separator) is a local socket path
+bool TransportConnect(Transport *transport, const char *address);
+// Splits host:port, where host may be a bracketed IPv6 address. Paths and
+// Windows drive letters are told apart by their path separators.
+bool TransportSplitTcpAddress(const char *address, char *host, size_t host_capacity, const char **port);
+// Hands out the inbound records of a capture file either at the pace they were
+// captured at or as fast as they are read. The end of the file ends the stream.
+bool TransportReplay(Transport *transport, const char *path, bool original_pace);
+
+size_t TransportRead(void *context, char *buffer, size_t count);
+size_t TransportWrite(void *context, const char *data, size_t count);
+
+// Signaled once a spawned process exits. Connections have no exit handle,
+// their end shows up as a failing read instead, nor do processes on POSIX
+// systems other than Linux.
+ReactorHandle TransportExitHandle(Transport *transport);
+// Fails pending and future reads and writes. A spawned process is killed if it is
+// still running and its exit code collected, a connection is only closed on our end.
+// May be called again in case a read started after the previous call.
+void TransportShutdown(Transport *transport);
+// Only once neither side is reading or writing anymore
+void TransportClose(Transport *transport);
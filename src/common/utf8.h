@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint32_t UTF8_REPLACEMENT_CHARACTER = 0xFFFD;
+
+// Decodes the first codepoint of a UTF-8 string and returns the amount of bytes
+// it took up. Malformed sequences decode to U+FFFD and consume a single byte.
+inline size_t Utf8DecodeCodepoint(const char *str, size_t length, uint32_t *codepoint) {
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(str);
+	if (length == 0) {
+		*codepoint = 0;
+		return 0;
+	}
+
+	uint8_t lead = bytes[0];
+	if (lead < 0x80) {
+		*codepoint = lead;
+		return 1;
+	}
+
+	size_t sequence_length;
+	uint32_t value;
+	uint32_t min_value;
+	if ((lead & 0xE0) == 0xC0) {
+		sequence_length = 2;
+		value = lead & 0x1F;
+		min_value = 0x80;
+	}
+	else if ((lead & 0xF0) == 0xE0) {
+		sequence_length = 3;
+		value = lead & 0x0F;
+		min_value = 0x800;
+	}
+	else if ((lead & 0xF8) == 0xF0) {
+		sequence_length = 4;
+		value = lead & 0x07;
+		min_value = 0x10000;
+	}
+	else {
+		*codepoint = UTF8_REPLACEMENT_CHARACTER;
+		return 1;
+	}
+
+	if (length < sequence_length) {
+		*codepoint = UTF8_REPLACEMENT_CHARACTER;
+		return 1;
+	}
+	for (size_t i = 1; i < sequence_length; ++i) {
+		if ((bytes[i] & 0xC0) != 0x80) {
+			*codepoint = UTF8_REPLACEMENT_CHARACTER;
+			return 1;
+		}
+		value = (value << 6) | (bytes[i] & 0x3F);
+	}
+
+	// Reject overlong encodings, surrogates and values past the unicode range
+	if (value < min_value || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) {
+		*codepoint = UTF8_REPLACEMENT_CHARACTER;
+		return 1;
+	}
+
+	*codepoint = value;
+	return sequence_length;
+}
@@ -1,7 +1,11 @@
 #pragma once
 
-// WPARAM: mpack_tree_t *, LPARAM: none
+// WPARAM: none, LPARAM: none
+// Messages are waiting in Nvim::message_queue
 #define WM_NVIM_MESSAGE WM_USER
 
 // WPARAM: none, LPARAM: none
-#define WM_RENDERER_FONT_UPDATE (WM_USER + 1)
\ No newline at end of file
+#define WM_RENDERER_FONT_UPDATE (WM_USER + 1)
+
+// WPARAM: none, LPARAM: NvimDroppedFiles *, owned by the receiver
+#define WM_NVIM_FILES_DROPPED (WM_USER + 2)
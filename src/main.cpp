@@ -4,6 +4,7 @@
 struct Context {
 	GridSize start_grid_size;
 	bool start_maximized;
+	bool gui_paste;
 	HWND hwnd;
 	Nvim *nvim;
 	Renderer *renderer;
@@ -38,57 +39,64 @@ void ToggleFullscreen(HWND hwnd, Context *context) {
 	}
 }
 
-void ProcessMPackMessage(Context *context, mpack_tree_t *tree) {
-	MPackMessageResult result = MPackExtractMessageResult(tree);
+// The whole clipboard goes to nvim as one paste instead of one WM_CHAR per character
+void PasteClipboard(HWND hwnd, Context *context) {
+	if (!IsClipboardFormatAvailable(CF_UNICODETEXT) || !OpenClipboard(hwnd)) {
+		return;
+	}
 
-	if (result.type == MPackMessageType::Response) {
-		assert(result.response.msg_id <= context->nvim->next_msg_id);
-		switch (context->nvim->msg_id_to_method[result.response.msg_id]) {
-		case NvimRequest::vim_get_api_info: {
-			mpack_node_t top_level_map = mpack_node_array_at(result.params, 1);
-			mpack_node_t version_map = mpack_node_map_value_at(top_level_map, 0);
-			int64_t api_level = mpack_node_map_cstr(version_map, "api_level").data->value.i;
-			assert(api_level > 6);
-		} break;
-		case NvimRequest::nvim_eval: {
-			Vec<char> guifont_buffer;
-			NvimParseConfig(context->nvim, result.params, &guifont_buffer);
-
-			if (!guifont_buffer.empty()) {
-				RendererUpdateGuiFont(context->renderer, guifont_buffer.data(), strlen(guifont_buffer.data()));
-			}
+	HANDLE clipboard_data = GetClipboardData(CF_UNICODETEXT);
+	if (clipboard_data) {
+		const wchar_t *text = static_cast<const wchar_t *>(GlobalLock(clipboard_data));
+		if (text) {
+			NvimPaste(context->nvim, text, wcslen(text));
+			GlobalUnlock(clipboard_data);
+		}
+	}
+	CloseClipboard();
+}
 
-			if (context->start_grid_size.rows != 0 &&
-				context->start_grid_size.cols != 0) {
-				PixelSize start_size = RendererGridToPixelSize(context->renderer,
-					context->start_grid_size.rows, context->start_grid_size.cols);
-				RECT client_rect;
-				GetClientRect(context->hwnd, &client_rect);
-				MoveWindow(context->hwnd, client_rect.left, client_rect.top,
-					start_size.width, start_size.height, false);
-			}
+void OnConfigPath(void *param, RequestStatus status, mpack_node_t config_node) {
+	Context *context = static_cast<Context *>(param);
 
-			// Attach the renderer now that the window size is determined
-			RendererAttach(context->renderer);
-			auto [rows, cols] = RendererPixelsToGridSize(context->renderer,
-				context->renderer->pixel_size.width, context->renderer->pixel_size.height);
-			NvimSendUIAttach(context->nvim, rows, cols);
+	// Without a config path the UI still has to be attached, just without a guifont
+	if (status == RequestStatus::Success) {
+		Vec<char> guifont_buffer;
+		NvimParseConfig(context->nvim, config_node, &guifont_buffer);
 
-			if (context->start_maximized) {
-				ToggleFullscreen(context->hwnd, context);
-			}
-			ShowWindow(context->hwnd, SW_SHOWDEFAULT);
-		} break;
-        case NvimRequest::nvim_input:
-        case NvimRequest::nvim_input_mouse:
-        case NvimRequest::nvim_command: {
-        } break;
+		if (!guifont_buffer.empty()) {
+			RendererUpdateGuiFont(context->renderer, guifont_buffer.data(), strlen(guifont_buffer.data()));
 		}
 	}
-	else if (result.type == MPackMessageType::Notification) {
-		if (MPackMatchString(result.notification.name, "redraw")) {
-			RendererRedraw(context->renderer, result.params);
-		}
+
+	if (context->start_grid_size.rows != 0 &&
+		context->start_grid_size.cols != 0) {
+		PixelSize start_size = RendererGridToPixelSize(context->renderer,
+			context->start_grid_size.rows, context->start_grid_size.cols);
+		RECT client_rect;
+		GetClientRect(context->hwnd, &client_rect);
+		MoveWindow(context->hwnd, client_rect.left, client_rect.top,
+			start_size.width, start_size.height, false);
+	}
+
+	// Attach the renderer now that the window size is determined
+	RendererAttach(context->renderer);
+	auto [rows, cols] = RendererPixelsToGridSize(context->renderer,
+		context->renderer->pixel_size.width, context->renderer->pixel_size.height);
+	NvimSendUIAttach(context->nvim, rows, cols);
+
+	if (context->start_maximized) {
+		ToggleFullscreen(context->hwnd, context);
+	}
+	ShowWindow(context->hwnd, SW_SHOWDEFAULT);
+}
+
+void ProcessMPackMessage(Context *context, mpack_tree_t *tree) {
+	MPackMessageResult result = MPackExtractMessageResult(tree);
+
+	if (result.type == MPackMessageType::Response) {
+		NvimCompleteRequest(context->nvim, static_cast<uint32_t>(result.response.msg_id),
+			result.response.error, result.params);
 	}
 }
 
@@ -136,8 +144,9 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 			RendererUpdateFont(context->renderer, context->renderer->last_requested_font_size);
 			auto [rows, cols] = RendererPixelsToGridSize(context->renderer,
 				context->renderer->pixel_size.width, context->renderer->pixel_size.height);
-			if (rows != context->renderer->grid_rows || cols != context->renderer->grid_cols) {
+			if (rows != context->renderer->grid.rows || cols != context->renderer->grid.cols) {
 				NvimSendResize(context->nvim, rows, cols);
+				NvimFlush(context->nvim);
 			}
 
 			context->saved_dpi_scaling = current_dpi;
@@ -147,8 +156,20 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 		PostQuitMessage(0);
 	} return 0;
 	case WM_NVIM_MESSAGE: {
-		mpack_tree_t *tree = reinterpret_cast<mpack_tree_t *>(wparam);
-		ProcessMPackMessage(context, tree);
+		while (NvimMessage *message = NvimFrontMessage(context->nvim)) {
+			switch (message->type) {
+			case NvimMessageType::Rpc: {
+				ProcessMPackMessage(context, &message->tree);
+			} break;
+			case NvimMessageType::RedrawCommands: {
+				RendererRedraw(context->renderer, &message->commands);
+			} break;
+			}
+			NvimPopMessage(context->nvim);
+		}
+
+		// Also delivered inside modal size/move loops, which bypass the main loop
+		NvimFlush(context->nvim);
 	} return 0;
 	case WM_RENDERER_FONT_UPDATE: {
 		auto [rows, cols] = RendererPixelsToGridSize(context->renderer,
@@ -170,18 +191,27 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 			NvimSendInput(context->nvim, "<Nul>");
 			return 0;
 		}
-		NvimSendChar(context->nvim, static_cast<wchar_t>(wparam));
+		// Bit 30 is set for auto-repeated keys
+		NvimSendChar(context->nvim, static_cast<wchar_t>(wparam), (lparam & (1 << 30)) != 0);
 	} return 0;
 	case WM_SYSCHAR: {
 		context->dead_char_pending = false;
-		NvimSendSysChar(context->nvim, static_cast<wchar_t>(wparam));
+		NvimSendSysChar(context->nvim, static_cast<wchar_t>(wparam), (lparam & (1 << 30)) != 0);
 	} return 0;
 	case WM_KEYDOWN:
 	case WM_SYSKEYDOWN: {
+		int modifiers = NvimKeyModifiers();
 		// Special case for <ALT+ENTER> (fullscreen transition)
-		if (((GetKeyState(VK_MENU) & 0x80) != 0) && wparam == VK_RETURN) {
+		if ((modifiers & KEY_MODIFIER_ALT) && wparam == VK_RETURN) {
 			ToggleFullscreen(hwnd, context);
 		}
+		// With --gui-paste, <S-Insert> and <C-S-V> paste the clipboard instead of going
+		// to nvim, but only with exactly those modifiers so mappings with Alt still work
+		else if (context->gui_paste &&
+			((wparam == VK_INSERT && modifiers == KEY_MODIFIER_SHIFT) ||
+			(wparam == 'V' && modifiers == (KEY_MODIFIER_CTRL | KEY_MODIFIER_SHIFT)))) {
+			PasteClipboard(hwnd, context);
+		}
 		else {
 			LONG msg_pos = GetMessagePos();
 			POINTS pt = MAKEPOINTS(msg_pos);
@@ -205,7 +235,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 			}
 
 			// If none of the special keys were hit, process in WM_CHAR
-			if(!NvimProcessKeyDown(context->nvim, static_cast<int>(wparam))) {
+			if(!NvimProcessKeyDown(context->nvim, static_cast<int>(wparam), (lparam & (1 << 30)) != 0)) {
 				TranslateMessage(&current_msg);
 			}
 		}
@@ -216,13 +246,13 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 		if (context->cached_cursor_grid_pos.col != grid_pos.col || context->cached_cursor_grid_pos.row != grid_pos.row) {
 			switch (wparam) {
 			case MK_LBUTTON: {
-				NvimSendMouseInput(context->nvim, MouseButton::Left, MouseAction::Drag, grid_pos.row, grid_pos.col);
+				NvimSendMouseDrag(context->nvim, MouseButton::Left, grid_pos.row, grid_pos.col);
 			} break;
 			case MK_MBUTTON: {
-				NvimSendMouseInput(context->nvim, MouseButton::Middle, MouseAction::Drag, grid_pos.row, grid_pos.col);
+				NvimSendMouseDrag(context->nvim, MouseButton::Middle, grid_pos.row, grid_pos.col);
 			} break;
 			case MK_RBUTTON: {
-				NvimSendMouseInput(context->nvim, MouseButton::Right, MouseAction::Drag, grid_pos.row, grid_pos.col);
+				NvimSendMouseDrag(context->nvim, MouseButton::Right, grid_pos.row, grid_pos.col);
 			} break;
 			}
 			context->cached_cursor_grid_pos = grid_pos;
@@ -288,45 +318,29 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 		short wheel_distance = GET_WHEEL_DELTA_WPARAM(wparam);
 		short scroll_amount = wheel_distance / WHEEL_DELTA;
 		auto [row, col] = RendererCursorToGridPoint(context->renderer, client_point.x, client_point.y);
-		MouseAction action = scroll_amount > 0 ? MouseAction::MouseWheelUp : MouseAction::MouseWheelDown;
 
 		if (should_resize_font) {
 			RendererUpdateFont(context->renderer, context->renderer->last_requested_font_size + (scroll_amount * 2.0f));
 			auto [rows, cols] = RendererPixelsToGridSize(context->renderer,
 				context->renderer->pixel_size.width, context->renderer->pixel_size.height);
-			if (rows != context->renderer->grid_rows || cols != context->renderer->grid_cols) {
+			if (rows != context->renderer->grid.rows || cols != context->renderer->grid.cols) {
 				NvimSendResize(context->nvim, rows, cols);
 			}
 		}
 		else {
-			for (int i = 0; i < abs(scroll_amount); ++i) {
-				NvimSendMouseInput(context->nvim, MouseButton::Wheel, action, row, col);
-			}
+			// Summed up and sent once per message loop pass, partial ticks carry over
+			NvimSendMouseWheel(context->nvim, wheel_distance, row, col);
 		}
 	} return 0;
 	case WM_DROPFILES: {
-		wchar_t file_to_open[MAX_PATH];
-		uint32_t num_files = DragQueryFileW(reinterpret_cast<HDROP>(wparam), 0xFFFFFFFF, file_to_open, MAX_PATH);
-		for(int i = 0; i < num_files; ++i) {
-			DragQueryFileW(reinterpret_cast<HDROP>(wparam), i, file_to_open, MAX_PATH);
-
-			// Click left mouse button to ensure file is opened in the appropriate neovim split
-			POINT screen_point;
-			GetCursorPos(&screen_point);
-			POINT client_point {
-				.x = static_cast<LONG>(screen_point.x),
-				.y = static_cast<LONG>(screen_point.y),
-			};
-			ScreenToClient(hwnd, &client_point);
-			auto [row, col] = RendererCursorToGridPoint(context->renderer, client_point.x, client_point.y);
-			NvimSendMouseInput(context->nvim, MouseButton::Left, MouseAction::Press, row, col);
-			NvimSendMouseInput(context->nvim, MouseButton::Left, MouseAction::Release, row, col);
-
-			// Not the most elegant solution, but must wait for mouseclick to be registered with nvim
-			Sleep(10);
-
-			NvimOpenFile(context->nvim, file_to_open);
-		}
+		HDROP drop = reinterpret_cast<HDROP>(wparam);
+		POINT drop_point;
+		DragQueryPoint(drop, &drop_point);
+		auto [row, col] = RendererCursorToGridPoint(context->renderer, drop_point.x, drop_point.y);
+		NvimDropFiles(context->nvim, drop, row, col);
+	} return 0;
+	case WM_NVIM_FILES_DROPPED: {
+		NvimSendDroppedFiles(context->nvim, reinterpret_cast<NvimDroppedFiles *>(lparam));
 	} return 0;
 	case WM_SETFOCUS: {
 		NvimSetFocus(context->nvim);
@@ -356,6 +370,14 @@ BOOL ShouldUseDarkMode()
 	return false;
 }
 
+// Returns a malloc'd copy of the string converted to UTF-8
+char *Utf8FromWide(const wchar_t *str) {
+	int size = WideCharToMultiByte(CP_UTF8, 0, str, -1, nullptr, 0, nullptr, nullptr);
+	char *utf8 = static_cast<char *>(malloc(size));
+	WideCharToMultiByte(CP_UTF8, 0, str, -1, utf8, size, nullptr, nullptr);
+	return utf8;
+}
+
 int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR p_cmd_line, int n_cmd_show) {
 	SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE);
 
@@ -363,14 +385,24 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR p_cmd_lin
 	LPWSTR *cmd_line_args = CommandLineToArgvW(GetCommandLineW(), &n_args);
 	bool start_maximized = false;
 	bool disable_ligatures = false;
+	bool report_input_errors = false;
+	bool gui_paste = false;
 	float linespace_factor = 1.0f;
+	// UTF-8, nvim --listen address of a server to attach to
+	char *server_address = nullptr;
+	// UTF-8, capture files to record to or play back instead of running nvim
+	char *capture_path = nullptr;
+	char *replay_path = nullptr;
+	bool replay_fast = false;
 	int64_t rows = 0;
 	int64_t cols = 0;
 
+	// Anything speaking the nvim --embed protocol on stdio can stand in for nvim,
+	// e.g. nvy_fake_nvim to generate a redraw workload
+	const wchar_t *nvim_program = L"nvim --embed";
 	constexpr int MAX_NVIM_CMD_LINE_SIZE = 32767;
-	wchar_t nvim_command_line[MAX_NVIM_CMD_LINE_SIZE] = {};
-	wcscpy_s(nvim_command_line, MAX_NVIM_CMD_LINE_SIZE, L"nvim --embed");
-	int cmd_line_size_left = MAX_NVIM_CMD_LINE_SIZE - wcslen(L"nvim --embed");
+	wchar_t nvim_files[MAX_NVIM_CMD_LINE_SIZE] = {};
+	int cmd_line_size_left = MAX_NVIM_CMD_LINE_SIZE - 1;
 
 
 	// Skip argv[0]
@@ -381,11 +413,35 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR p_cmd_lin
 		else if(!wcscmp(cmd_line_args[i], L"--disable-ligatures")) {
 			disable_ligatures = true;
 		}
+		else if(!wcscmp(cmd_line_args[i], L"--report-input-errors")) {
+			report_input_errors = true;
+		}
+		else if(!wcscmp(cmd_line_args[i], L"--gui-paste")) {
+			gui_paste = true;
+		}
 		else if(!wcsncmp(cmd_line_args[i], L"--geometry=", wcslen(L"--geometry="))) {
 			wchar_t *end_ptr;
 			cols = wcstol(&cmd_line_args[i][11], &end_ptr, 10);
 			rows = wcstol(end_ptr + 1, nullptr, 10);
 		}
+		else if(!wcsncmp(cmd_line_args[i], L"--server=", wcslen(L"--server="))) {
+			free(server_address);
+			server_address = Utf8FromWide(&cmd_line_args[i][9]);
+		}
+		else if(!wcsncmp(cmd_line_args[i], L"--capture=", wcslen(L"--capture="))) {
+			free(capture_path);
+			capture_path = Utf8FromWide(&cmd_line_args[i][10]);
+		}
+		else if(!wcsncmp(cmd_line_args[i], L"--replay=", wcslen(L"--replay="))) {
+			free(replay_path);
+			replay_path = Utf8FromWide(&cmd_line_args[i][9]);
+		}
+		else if(!wcscmp(cmd_line_args[i], L"--replay-fast")) {
+			replay_fast = true;
+		}
+		else if(!wcsncmp(cmd_line_args[i], L"--nvim-command=", wcslen(L"--nvim-command="))) {
+			nvim_program = &cmd_line_args[i][15];
+		}
 		else if(!wcsncmp(cmd_line_args[i], L"--linespace-factor=", wcslen(L"--linespace-factor="))) {
 			wchar_t *end_ptr;
 			float factor = wcstof(&cmd_line_args[i][19], &end_ptr);
@@ -397,16 +453,19 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR p_cmd_lin
 		else {
 			size_t arg_size = wcslen(cmd_line_args[i]);
 			if(arg_size <= (cmd_line_size_left + 3)) {
-				wcscat_s(nvim_command_line, cmd_line_size_left, L" \"");
+				wcscat_s(nvim_files, MAX_NVIM_CMD_LINE_SIZE, L" \"");
 				cmd_line_size_left -= 2;
-				wcscat_s(nvim_command_line, cmd_line_size_left, cmd_line_args[i]);
+				wcscat_s(nvim_files, MAX_NVIM_CMD_LINE_SIZE, cmd_line_args[i]);
 				cmd_line_size_left -= arg_size;
-				wcscat_s(nvim_command_line, cmd_line_size_left, L"\"");
+				wcscat_s(nvim_files, MAX_NVIM_CMD_LINE_SIZE, L"\"");
 				cmd_line_size_left -= 1;
 			}
 		}
 	}
 
+	wchar_t nvim_command_line[MAX_NVIM_CMD_LINE_SIZE] = {};
+	swprintf_s(nvim_command_line, MAX_NVIM_CMD_LINE_SIZE, L"%s%s", nvim_program, nvim_files);
+
 	const wchar_t *window_class_name = L"Nvy_Class";
 	const wchar_t *window_title = L"Nvy";
 	BOOL should_use_dark_mode = ShouldUseDarkMode();
@@ -427,7 +486,38 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR p_cmd_lin
 		return 1;
 	}
 
-	Nvim nvim {};
+	Nvim nvim {
+		.report_input_errors = report_input_errors
+	};
+	// Attaching to a running server skips starting nvim and loading its plugins
+	bool connected;
+	const wchar_t *connect_error;
+	if (replay_path) {
+		connected = TransportReplay(&nvim.transport, replay_path, !replay_fast);
+		connect_error = L"Could not open the capture file to replay";
+	}
+	else if (server_address) {
+		connected = TransportConnect(&nvim.transport, server_address);
+		connect_error = L"Could not connect to the nvim server";
+	}
+	else {
+		connected = TransportSpawn(&nvim.transport, nvim_command_line);
+		connect_error = L"Could not start nvim";
+	}
+	free(server_address);
+	free(replay_path);
+	if (!connected) {
+		MessageBoxW(nullptr, connect_error, window_title, MB_ICONERROR);
+		free(capture_path);
+		UnregisterClass(window_class_name, instance);
+		DeleteObject(bg_brush);
+		return 1;
+	}
+	if (capture_path && !RpcCaptureOpen(&nvim.capture, capture_path)) {
+		MessageBoxW(nullptr, L"Could not create the capture file, continuing without capture",
+			window_title, MB_ICONWARNING);
+	}
+	free(capture_path);
 	Renderer renderer {};
 	Context context {
 		.start_grid_size {
@@ -435,6 +525,7 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR p_cmd_lin
 			.cols = static_cast<int>(cols)
 		},
 		.start_maximized = start_maximized,
+		.gui_paste = gui_paste,
 
 		.nvim = &nvim,
 		.renderer = &renderer,
@@ -464,24 +555,48 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR p_cmd_lin
 	constexpr int DWMWA_USE_IMMERSIVE_DARK_MODE = 20;
 	DwmSetWindowAttribute(hwnd, DWMWA_USE_IMMERSIVE_DARK_MODE, &should_use_dark_mode, sizeof(BOOL));
 	RendererInitialize(&renderer, hwnd, disable_ligatures, linespace_factor, context.saved_dpi_scaling);
-	NvimInitialize(&nvim, nvim_command_line, hwnd);
+	Reactor reactor;
+	ReactorInitialize(&reactor);
+	int frame_source = ReactorAdd(&reactor, nullptr, RendererSignalFrameReady, &renderer);
+	NvimInitialize(&nvim, hwnd, &reactor);
+	NvimQueryConfigPath(&nvim, OnConfigPath, &context);
+	NvimFlush(&nvim);
 	
+	// Window messages, nvim exiting and the swapchain becoming ready are all
+	// waited on at once, the thread sleeps until one of them happens
 	MSG msg;
 	uint32_t previous_width = 0, previous_height = 0;
-	while (GetMessage(&msg, 0, 0, 0)) {
-		// TranslateMessage(&msg);
-		DispatchMessage(&msg);
-		if (previous_width != context.saved_window_width || previous_height != context.saved_window_height) {
-			previous_width = context.saved_window_width;
-			previous_height = context.saved_window_height;
-			auto [rows, cols] = RendererPixelsToGridSize(context.renderer, context.saved_window_width, context.saved_window_height);
-			RendererResize(context.renderer, context.saved_window_width, context.saved_window_height);
-			NvimSendResize(context.nvim, rows, cols);
+	bool running = true;
+	while (running) {
+		ReactorUpdate(&reactor, frame_source, RendererFrameWaitHandle(&renderer));
+		// Wake up in time to time out the oldest pending request
+		ReactorWait(&reactor, NvimRequestTimeout(&nvim));
+		NvimExpireRequests(&nvim);
+
+		while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+			if (msg.message == WM_QUIT) {
+				running = false;
+				break;
+			}
+
+			// TranslateMessage(&msg);
+			DispatchMessage(&msg);
+			if (previous_width != context.saved_window_width || previous_height != context.saved_window_height) {
+				previous_width = context.saved_window_width;
+				previous_height = context.saved_window_height;
+				auto [rows, cols] = RendererPixelsToGridSize(context.renderer, context.saved_window_width, context.saved_window_height);
+				RendererResize(context.renderer, context.saved_window_width, context.saved_window_height);
+				NvimSendResize(context.nvim, rows, cols);
+			}
 		}
+
+		// Everything the messages of this pass produced goes out in one write
+		NvimFlush(context.nvim);
 	}
 
 	RendererShutdown(&renderer);
 	NvimShutdown(&nvim);
+	ReactorDestroy(&reactor);
 	UnregisterClass(window_class_name, instance);
 	DeleteObject(bg_brush);
 	DestroyWindow(hwnd);
@@ -0,0 +1,66 @@
+#include "input_coalescer.h"
+#include <cstdlib>
+#include <cstring>
+
+void InputCoalescerDestroy(InputCoalescer *coalescer) {
+	free(coalescer->pending);
+	coalescer->pending = nullptr;
+	coalescer->pending_size = 0;
+	coalescer->pending_capacity = 0;
+	coalescer->pending_repeats = 0;
+}
+
+bool InputCoalescerAddRepeat(InputCoalescer *coalescer, const char *input, size_t length) {
+	if (coalescer->unacknowledged_repeats + coalescer->pending_repeats >= INPUT_MAX_UNACKNOWLEDGED_REPEATS) {
+		coalescer->repeats_dropped += 1;
+		return false;
+	}
+
+	if (coalescer->pending_size + length > coalescer->pending_capacity) {
+		size_t new_capacity = coalescer->pending_capacity ? coalescer->pending_capacity : INPUT_COALESCER_INITIAL_SIZE;
+		while (new_capacity < coalescer->pending_size + length) {
+			new_capacity *= 2;
+		}
+		coalescer->pending = static_cast<char *>(realloc(coalescer->pending, new_capacity));
+		coalescer->pending_capacity = new_capacity;
+	}
+
+	memcpy(coalescer->pending + coalescer->pending_size, input, length);
+	coalescer->pending_size += length;
+	if (coalescer->pending_repeats > 0) {
+		coalescer->repeats_coalesced += 1;
+	}
+	coalescer->pending_repeats += 1;
+	return true;
+}
+
+bool InputCoalescerSent(InputCoalescer *coalescer) {
+	if (coalescer->pending_repeats == 0) {
+		return false;
+	}
+
+	coalescer->unacknowledged_repeats += coalescer->pending_repeats;
+	coalescer->pending_repeats = 0;
+	coalescer->pending_size = 0;
+	coalescer->batches_sent += 1;
+
+	if (coalescer->sync_in_flight) {
+		return false;
+	}
+	coalescer->sync_in_flight = true;
+	coalescer->synced_repeats = coalescer->unacknowledged_repeats;
+	return true;
+}
+
+bool InputCoalescerAcknowledge(InputCoalescer *coalescer) {
+	coalescer->unacknowledged_repeats -= coalescer->synced_repeats;
+	coalescer->synced_repeats = 0;
+	coalescer->sync_in_flight = false;
+
+	if (coalescer->unacknowledged_repeats == 0) {
+		return false;
+	}
+	coalescer->sync_in_flight = true;
+	coalescer->synced_repeats = coalescer->unacknowledged_repeats;
+	return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// At most this many auto-repeated keys may be on their way to nvim before it
+// has confirmed processing them, anything beyond that is dropped
+constexpr uint32_t INPUT_MAX_UNACKNOWLEDGED_REPEATS = 4;
+constexpr size_t INPUT_COALESCER_INITIAL_SIZE = 256;
+
+// Folds the auto-repeated keys of one message loop pass into a single input
+// string, and stops taking repeats while nvim lags behind, so that a held key
+// stops once it is released instead of replaying a backlog of repeats.
+//
+// Processing is confirmed by a sync request sent after repeats go out. nvim
+// only answers it once it has consumed the input queued before it.
+// Keys that aren't repeats are never dropped.
+struct InputCoalescer {
+	char *pending;
+	size_t pending_size;
+	size_t pending_capacity;
+	uint32_t pending_repeats;
+
+	uint32_t unacknowledged_repeats;
+	// Repeats that were sent before the sync request in flight
+	uint32_t synced_repeats;
+	bool sync_in_flight;
+
+	uint64_t repeats_coalesced;
+	uint64_t repeats_dropped;
+	uint64_t batches_sent;
+};
+
+void InputCoalescerDestroy(InputCoalescer *coalescer);
+
+// Returns false if the repeat was dropped
+bool InputCoalescerAddRepeat(InputCoalescer *coalescer, const char *input, size_t length);
+
+inline std::string_view InputCoalescerPending(const InputCoalescer *coalescer) {
+	return std::string_view(coalescer->pending, coalescer->pending_size);
+}
+
+// To be called once the pending input has been sent. Returns true if
+// a sync request has to follow it.
+bool InputCoalescerSent(InputCoalescer *coalescer);
+
+// To be called when the sync request completes, or times out. Returns true
+// if more repeats went out in the meantime and need another sync request.
+bool InputCoalescerAcknowledge(InputCoalescer *coalescer);
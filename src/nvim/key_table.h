@@ -0,0 +1,101 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "common/rpc_encoder.h"
+
+enum KeyModifier : uint8_t {
+	KEY_MODIFIER_SHIFT = 1 << 0,
+	KEY_MODIFIER_CTRL = 1 << 1,
+	KEY_MODIFIER_ALT = 1 << 2
+};
+constexpr int KEY_MODIFIER_COMBINATIONS = 8;
+constexpr int KEY_TABLE_VIRTUAL_KEY_COUNT = 256;
+constexpr size_t KEY_INPUT_FRAME_CAPACITY = 48;
+
+struct KeyName {
+	uint8_t virtual_key;
+	std::string_view name;
+};
+
+// A complete, already encoded nvim_input notification for one key and one
+// combination of modifiers. The <C-S-M-...> string sits at the end of the frame.
+struct KeyInput {
+	char frame[KEY_INPUT_FRAME_CAPACITY];
+	uint8_t frame_size;
+	uint8_t input_offset;
+};
+
+// Built at compile time from a list of key names, so sending a special key
+// is a table lookup and a copy of the ready-made frame
+template<size_t N>
+struct KeyTable {
+	// Index into inputs plus one, 0 for virtual keys without a name
+	uint8_t slots[KEY_TABLE_VIRTUAL_KEY_COUNT];
+	KeyInput inputs[N][KEY_MODIFIER_COMBINATIONS];
+};
+
+constexpr void KeyAppend(char *buffer, size_t *length, std::string_view str) {
+	for (char c : str) {
+		buffer[(*length)++] = c;
+	}
+}
+
+// Modifiers appear in the order Nvy has always sent them, <C-S-M-key>
+constexpr KeyInput KeyEncodeInput(const RpcMethod<std::string_view> &input_method, std::string_view name, int modifiers) {
+	char input[KEY_INPUT_FRAME_CAPACITY] {};
+	size_t input_length = 0;
+	KeyAppend(input, &input_length, "<");
+	if (modifiers & KEY_MODIFIER_CTRL) {
+		KeyAppend(input, &input_length, "C-");
+	}
+	if (modifiers & KEY_MODIFIER_SHIFT) {
+		KeyAppend(input, &input_length, "S-");
+	}
+	if (modifiers & KEY_MODIFIER_ALT) {
+		KeyAppend(input, &input_length, "M-");
+	}
+	KeyAppend(input, &input_length, name);
+	KeyAppend(input, &input_length, ">");
+
+	KeyInput key_input {};
+	RpcBufferWriter writer { .data = key_input.frame, .size = 0 };
+	RpcEncodeNotification(&writer, input_method, std::string_view(input, input_length));
+	key_input.frame_size = static_cast<uint8_t>(writer.size);
+	key_input.input_offset = static_cast<uint8_t>(writer.size - input_length);
+	return key_input;
+}
+
+template<size_t N>
+constexpr KeyTable<N> BuildKeyTable(const RpcMethod<std::string_view> &input_method, const std::array<KeyName, N> &names) {
+	static_assert(N < 0xFF, "Key table slots are stored in a byte");
+
+	KeyTable<N> table {};
+	for (size_t i = 0; i < N; ++i) {
+		table.slots[names[i].virtual_key] = static_cast<uint8_t>(i + 1);
+		for (int modifiers = 0; modifiers < KEY_MODIFIER_COMBINATIONS; ++modifiers) {
+			table.inputs[i][modifiers] = KeyEncodeInput(input_method, names[i].name, modifiers);
+		}
+	}
+	return table;
+}
+
+// Returns nullptr for keys that aren't in the table
+template<size_t N>
+constexpr const KeyInput *KeyTableLookup(const KeyTable<N> *table, int virtual_key, int modifiers) {
+	if (virtual_key < 0 || virtual_key >= KEY_TABLE_VIRTUAL_KEY_COUNT) {
+		return nullptr;
+	}
+
+	uint8_t slot = table->slots[virtual_key];
+	if (slot == 0) {
+		return nullptr;
+	}
+	return &table->inputs[slot - 1][modifiers & (KEY_MODIFIER_COMBINATIONS - 1)];
+}
+
+constexpr std::string_view KeyInputString(const KeyInput *key_input) {
+	return std::string_view(key_input->frame + key_input->input_offset,
+		key_input->frame_size - key_input->input_offset);
+}
@@ -0,0 +1,44 @@
+#include "mouse_batcher.h"
+
+void MouseBatcherDrag(MouseBatcher *batcher, MouseButton button, int modifiers, int row, int col) {
+	if (batcher->drag_pending) {
+		batcher->drags_collapsed += 1;
+	}
+
+	batcher->drag_pending = true;
+	batcher->drag_button = button;
+	batcher->drag_modifiers = modifiers;
+	batcher->drag_row = row;
+	batcher->drag_col = col;
+}
+
+void MouseBatcherWheel(MouseBatcher *batcher, int delta, int modifiers, int row, int col) {
+	batcher->wheel_events += 1;
+
+	// A fraction left over from scrolling the other way doesn't count towards this direction
+	if ((delta > 0 && batcher->wheel_remainder < 0) || (delta < 0 && batcher->wheel_remainder > 0)) {
+		batcher->wheel_remainder = 0;
+	}
+
+	batcher->wheel_remainder += delta;
+	int ticks = batcher->wheel_remainder / MOUSE_WHEEL_DELTA;
+	batcher->wheel_remainder -= ticks * MOUSE_WHEEL_DELTA;
+
+	batcher->wheel_ticks += ticks;
+	batcher->wheel_modifiers = modifiers;
+	batcher->wheel_row = row;
+	batcher->wheel_col = col;
+}
+
+int MouseBatcherCallCount(const MouseBatcher *batcher) {
+	int wheel_calls = batcher->wheel_ticks < 0 ? -batcher->wheel_ticks : batcher->wheel_ticks;
+	return (batcher->drag_pending ? 1 : 0) + wheel_calls;
+}
+
+void MouseBatcherClear(MouseBatcher *batcher) {
+	if (batcher->drag_pending || batcher->wheel_ticks != 0) {
+		batcher->batches += 1;
+	}
+	batcher->drag_pending = false;
+	batcher->wheel_ticks = 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+
+enum class MouseButton {
+	Left,
+	Right,
+	Middle,
+	Wheel
+};
+enum class MouseAction {
+	Press,
+	Drag,
+	Release,
+	MouseWheelUp,
+	MouseWheelDown,
+	MouseWheelLeft,
+	MouseWheelRight
+};
+
+// Wheel deltas are reported in multiples or fractions of this, one detent of a regular wheel
+constexpr int MOUSE_WHEEL_DELTA = 120;
+
+// Collects the mouse input of one message loop pass, so it is sent once per
+// pass instead of once per event. Drags collapse to their latest position,
+// wheel deltas are summed into whole ticks and any fraction of a tick left
+// over, e.g. from touchpads and high resolution wheels, is kept for later.
+struct MouseBatcher {
+	bool drag_pending;
+	MouseButton drag_button;
+	int drag_modifiers;
+	int drag_row;
+	int drag_col;
+
+	// Positive ticks scroll up
+	int wheel_ticks;
+	int wheel_remainder;
+	int wheel_modifiers;
+	int wheel_row;
+	int wheel_col;
+
+	uint64_t drags_collapsed;
+	uint64_t wheel_events;
+	uint64_t batches;
+};
+
+void MouseBatcherDrag(MouseBatcher *batcher, MouseButton button, int modifiers, int row, int col);
+void MouseBatcherWheel(MouseBatcher *batcher, int delta, int modifiers, int row, int col);
+
+// Number of nvim_input_mouse calls the pending input turns into
+int MouseBatcherCallCount(const MouseBatcher *batcher);
+// Forgets the pending drag and whole wheel ticks, the wheel remainder is kept
+void MouseBatcherClear(MouseBatcher *batcher);
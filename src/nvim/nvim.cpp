@@ -1,106 +1,453 @@
 #include "nvim.h"
 #include "common/mpack_helper.h"
+#include "common/mpack_stream.h"
+#include "common/outbound_buffer.h"
+#include "common/outbound_writer.h"
+#include "common/reactor.h"
+#include "common/rpc_encoder.h"
+#include "nvim/input_coalescer.h"
+#include "nvim/key_table.h"
+#include "nvim/mouse_batcher.h"
+#include "nvim/paste_stream.h"
+#include "nvim/redraw_commands.h"
+#include "nvim/redraw_decoder.h"
+#include "nvim/request_table.h"
 #include "third_party/mpack/mpack.h"
 
-constexpr int Megabytes(int n) {
-    return 1024 * 1024 * n;
+static uint64_t NowMicroseconds() {
+	static LARGE_INTEGER frequency;
+	if (!frequency.QuadPart) {
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+	uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+	return seconds * 1000000 + remainder * 1000000 / frequency.QuadPart;
 }
 
-int64_t RegisterRequest(Nvim *nvim, NvimRequest request) {
-	nvim->msg_id_to_method.push_back(request);
-	return nvim->next_msg_id++;
+// Messages are measured first and then encoded straight into the outbound
+// buffer, see common/rpc_encoder.h
+template<typename... Args>
+static void QueueNotification(Nvim *nvim, OutboundMessageKind kind, const RpcMethod<Args...> &method,
+	std::type_identity_t<const Args &>... args) {
+	RpcSizeCounter counter {};
+	RpcEncodeNotification(&counter, method, args...);
+
+	RpcBufferWriter writer { .data = OutboundBufferReserve(&nvim->outbound, counter.size), .size = 0 };
+	RpcEncodeNotification(&writer, method, args...);
+	OutboundBufferCommit(&nvim->outbound, writer.size, kind);
 }
 
-static size_t ReadFromNvim(mpack_tree_t *tree, char *buffer, size_t count) {
-	HANDLE nvim_stdout_read = mpack_tree_context(tree);
-	DWORD bytes_read;
-	BOOL success = ReadFile(nvim_stdout_read, buffer, static_cast<DWORD>(count), &bytes_read, nullptr);
-	if (!success) {
-		mpack_tree_flag_error(tree, mpack_error_io);
+// timeout_us may be REQUEST_NO_DEADLINE for requests nvim can take arbitrarily long to answer
+template<typename... Args>
+static void QueueRequest(Nvim *nvim, RequestCallback callback, void *context, uint64_t timeout_us,
+	const RpcMethod<Args...> &method, std::type_identity_t<const Args &>... args) {
+	uint32_t msg_id = RequestTableRegister(&nvim->requests, method.id, callback, context,
+		NowMicroseconds(), timeout_us);
+
+	RpcSizeCounter counter {};
+	RpcEncodeRequest(&counter, msg_id, method, args...);
+
+	RpcBufferWriter writer { .data = OutboundBufferReserve(&nvim->outbound, counter.size), .size = 0 };
+	RpcEncodeRequest(&writer, msg_id, method, args...);
+	OutboundBufferCommit(&nvim->outbound, writer.size);
+}
+
+static void OnApiInfo(void *context, RequestStatus status, mpack_node_t api_info) {
+	if (status != RequestStatus::Success) {
+		return;
+	}
+
+	mpack_node_t top_level_map = mpack_node_array_at(api_info, 1);
+	mpack_node_t version_map = mpack_node_map_value_at(top_level_map, 0);
+	int64_t api_level = mpack_node_map_cstr(version_map, "api_level").data->value.i;
+	assert(api_level > 6);
+}
+
+// Writes any error message to the debugger output, errors arrive as [type, message]
+// or, for nvim_call_atomic, as [index, type, message]
+static void ReportInputError(Nvim *nvim, mpack_node_t error) {
+	nvim->input_error_count += 1;
+	if (mpack_node_type(error) != mpack_type_array || mpack_node_array_length(error) < 2) {
+		return;
+	}
+
+	mpack_node_t message = mpack_node_array_at(error, mpack_node_array_length(error) - 1);
+	if (mpack_node_type(message) == mpack_type_str) {
+		char buffer[512];
+		snprintf(buffer, sizeof(buffer), "Nvy: input error: %.*s\n",
+			static_cast<int>(mpack_node_strlen(message)), mpack_node_str(message));
+		OutputDebugStringA(buffer);
+	}
+}
+
+static void OnInputResponse(void *context, RequestStatus status, mpack_node_t error) {
+	if (status == RequestStatus::Error) {
+		ReportInputError(static_cast<Nvim *>(context), error);
+	}
+}
+
+// nvim_call_atomic succeeds even if one of its calls fails, the
+// failure is reported in the result as [results, error]
+static void OnInputBatchResponse(void *context, RequestStatus status, mpack_node_t result) {
+	if (status == RequestStatus::Error) {
+		ReportInputError(static_cast<Nvim *>(context), result);
+	}
+	else if (status == RequestStatus::Success && mpack_node_type(result) == mpack_type_array &&
+		mpack_node_array_length(result) == 2 && mpack_node_type(mpack_node_array_at(result, 1)) != mpack_type_nil) {
+		ReportInputError(static_cast<Nvim *>(context), mpack_node_array_at(result, 1));
+	}
+}
+
+// Input is fire and forget, it goes out as a notification so nvim doesn't
+// answer every keystroke. With error reporting turned on it is sent as a
+// request instead, and only error responses are acted upon.
+template<typename... Args>
+static void QueueInput(Nvim *nvim, OutboundMessageKind kind, const RpcMethod<Args...> &method,
+	std::type_identity_t<const Args &>... args) {
+	if (nvim->report_input_errors) {
+		QueueRequest(nvim, OnInputResponse, nvim, NVIM_REQUEST_TIMEOUT_MS * 1000, method, args...);
+	}
+	else {
+		QueueNotification(nvim, kind, method, args...);
+	}
+}
+
+// Queues one nvim_call_atomic message, encode_calls is called with the
+// writer once to measure and once to encode exactly call_count calls
+template<typename EncodeCallsFn>
+static void QueueInputBatch(Nvim *nvim, size_t call_count, EncodeCallsFn encode_calls) {
+	uint32_t msg_id = 0;
+	if (nvim->report_input_errors) {
+		msg_id = RequestTableRegister(&nvim->requests, NVIM_CALL_ATOMIC.id, OnInputBatchResponse, nvim,
+			NowMicroseconds(), NVIM_REQUEST_TIMEOUT_MS * 1000);
+	}
+
+	auto encode = [&](auto *out) {
+		if (nvim->report_input_errors) {
+			RpcBeginBatchRequest(out, msg_id, NVIM_CALL_ATOMIC, call_count);
+		}
+		else {
+			RpcBeginBatchNotification(out, NVIM_CALL_ATOMIC, call_count);
+		}
+		encode_calls(out);
+	};
+
+	RpcSizeCounter counter {};
+	encode(&counter);
+	RpcBufferWriter writer { .data = OutboundBufferReserve(&nvim->outbound, counter.size), .size = 0 };
+	encode(&writer);
+	OutboundBufferCommit(&nvim->outbound, writer.size);
+}
+
+// Indexed by MouseButton and MouseAction
+constexpr const char *MOUSE_BUTTON_NAMES[] {
+	"left",
+	"right",
+	"middle",
+	"wheel"
+};
+constexpr const char *MOUSE_ACTION_NAMES[] {
+	"press",
+	"drag",
+	"release",
+	"up",
+	"down",
+	"left",
+	"right"
+};
+// Indexed by KeyModifier flags
+constexpr const char *MOUSE_MODIFIER_STRINGS[KEY_MODIFIER_COMBINATIONS] {
+	"", "S-", "C-", "C-S-", "M-", "S-M-", "C-M-", "C-S-M-"
+};
+
+static void FlushPendingMouse(Nvim *nvim) {
+	MouseBatcher *batcher = &nvim->mouse_batcher;
+	int call_count = MouseBatcherCallCount(batcher);
+	if (call_count == 0) {
+		return;
+	}
+
+	// A lone drag stays a plain message, so the writer can still
+	// replace it with a newer one while it waits to be written
+	if (call_count == 1 && batcher->drag_pending) {
+		QueueInput(nvim, OutboundMessageKind::MouseDrag, NVIM_INPUT_MOUSE, MOUSE_BUTTON_NAMES[static_cast<int>(batcher->drag_button)],
+			"drag", MOUSE_MODIFIER_STRINGS[batcher->drag_modifiers], 0, batcher->drag_row, batcher->drag_col);
+	}
+	else {
+		QueueInputBatch(nvim, call_count, [batcher](auto *out) {
+			if (batcher->drag_pending) {
+				RpcEncodeCall(out, NVIM_INPUT_MOUSE, MOUSE_BUTTON_NAMES[static_cast<int>(batcher->drag_button)], "drag",
+					MOUSE_MODIFIER_STRINGS[batcher->drag_modifiers], 0, batcher->drag_row, batcher->drag_col);
+			}
+
+			const char *direction = batcher->wheel_ticks > 0 ? "up" : "down";
+			int wheel_calls = batcher->wheel_ticks > 0 ? batcher->wheel_ticks : -batcher->wheel_ticks;
+			for (int i = 0; i < wheel_calls; ++i) {
+				RpcEncodeCall(out, NVIM_INPUT_MOUSE, "wheel", direction,
+					MOUSE_MODIFIER_STRINGS[batcher->wheel_modifiers], 0, batcher->wheel_row, batcher->wheel_col);
+			}
+		});
+	}
+	MouseBatcherClear(batcher);
+}
+
+// nvim only answers the sync request once it has consumed the input sent before it
+static void OnInputSync(void *context, RequestStatus status, mpack_node_t result) {
+	Nvim *nvim = static_cast<Nvim *>(context);
+	if (InputCoalescerAcknowledge(&nvim->input_coalescer)) {
+		QueueRequest(nvim, OnInputSync, nvim, NVIM_REQUEST_TIMEOUT_MS * 1000, NVIM_EVAL, "0");
+	}
+}
+
+// Coalesced key repeats and batched mouse input go out before anything queued after them
+static void FlushPendingInput(Nvim *nvim) {
+	std::string_view pending = InputCoalescerPending(&nvim->input_coalescer);
+	if (!pending.empty()) {
+		QueueInput(nvim, OutboundMessageKind::Default, NVIM_INPUT, pending);
+		if (InputCoalescerSent(&nvim->input_coalescer)) {
+			QueueRequest(nvim, OnInputSync, nvim, NVIM_REQUEST_TIMEOUT_MS * 1000, NVIM_EVAL, "0");
+		}
+	}
+
+	FlushPendingMouse(nvim);
+}
+
+template<typename... Args>
+static void SendNotification(Nvim *nvim, OutboundMessageKind kind, const RpcMethod<Args...> &method,
+	std::type_identity_t<const Args &>... args) {
+	FlushPendingInput(nvim);
+	QueueNotification(nvim, kind, method, args...);
+}
+
+template<typename... Args>
+static void SendRequest(Nvim *nvim, RequestCallback callback, void *context,
+	const RpcMethod<Args...> &method, std::type_identity_t<const Args &>... args) {
+	FlushPendingInput(nvim);
+	QueueRequest(nvim, callback, context, NVIM_REQUEST_TIMEOUT_MS * 1000, method, args...);
+}
+
+template<typename... Args>
+static void SendInput(Nvim *nvim, OutboundMessageKind kind, const RpcMethod<Args...> &method,
+	std::type_identity_t<const Args &>... args) {
+	FlushPendingInput(nvim);
+	QueueInput(nvim, kind, method, args...);
+}
+
+// Commands that never change are serialized at compile time and copied
+// into the outbound buffer as they are
+struct ConstantCommand {
+	std::string_view command;
+	RpcConstantMessage notification;
+};
+static constexpr ConstantCommand MakeConstantCommand(std::string_view command) {
+	return ConstantCommand {
+		.command = command,
+		.notification = RpcConstantNotification(NVIM_COMMAND, command)
+	};
+}
+constexpr ConstantCommand FOCUS_GAINED_COMMAND = MakeConstantCommand("doautocmd <nomodeline> FocusGained");
+constexpr ConstantCommand FOCUS_LOST_COMMAND = MakeConstantCommand("doautocmd <nomodeline> FocusLost");
+constexpr ConstantCommand QUIT_COMMAND = MakeConstantCommand("qa");
+constexpr RpcConstantMessage SET_NVY_VAR_NOTIFICATION = RpcConstantNotification(NVIM_SET_VAR, "nvy", 1);
+
+static void SendConstantCommand(Nvim *nvim, const ConstantCommand &command) {
+	if (nvim->report_input_errors) {
+		SendRequest(nvim, OnInputResponse, nvim, NVIM_COMMAND, command.command);
+	}
+	else {
+		FlushPendingInput(nvim);
+		OutboundBufferAppend(&nvim->outbound, command.notification.data,
+			command.notification.size, OutboundMessageKind::Default);
+	}
+}
+
+// Auto-repeated keys are held back and sent together once per message loop pass
+static void SendKeyInput(Nvim *nvim, std::string_view input, bool is_repeat) {
+	if (is_repeat) {
+		InputCoalescerAddRepeat(&nvim->input_coalescer, input.data(), input.size());
+	}
+	else {
+		SendInput(nvim, OutboundMessageKind::Default, NVIM_INPUT, input);
+	}
+}
+
+static size_t ReadFromNvim(void *context, char *buffer, size_t count) {
+	Nvim *nvim = static_cast<Nvim *>(context);
+	if (nvim->shutting_down.load()) {
+		return 0;
+	}
+
+	size_t bytes_read = TransportRead(&nvim->transport, buffer, count);
+	if (bytes_read > 0 && nvim->capture.file) {
+		RpcCaptureWrite(&nvim->capture, RpcCaptureDirection::Inbound, buffer, bytes_read);
 	}
 	return bytes_read;
 }
 
-DWORD WINAPI NvimMessageHandler(LPVOID param) {
-	Nvim *nvim = static_cast<Nvim *>(param);
-	mpack_tree_t *tree = static_cast<mpack_tree_t *>(malloc(sizeof(mpack_tree_t)));
-	mpack_tree_init_stream(tree, ReadFromNvim, nvim->stdout_read, Megabytes(20), 1024 * 1024);
+static size_t WriteToNvim(void *context, const char *data, size_t count) {
+	Nvim *nvim = static_cast<Nvim *>(context);
+	size_t bytes_written = TransportWrite(&nvim->transport, data, count);
+	if (bytes_written > 0 && nvim->capture.file) {
+		RpcCaptureWrite(&nvim->capture, RpcCaptureDirection::Outbound, data, bytes_written);
+	}
+	return bytes_written;
+}
 
-	while (true) {
-		mpack_tree_parse(tree);
-		if (mpack_tree_error(tree) != mpack_ok) {
-			break;
+// Returns nullptr once the UI thread has started shutting down
+static NvimMessage *BeginMessage(Nvim *nvim) {
+	while (!nvim->shutting_down.load()) {
+		NvimMessage *message = SpscQueueBeginPush(nvim->message_queue);
+		if (message) {
+			return message;
 		}
 
-		// Blocking, dubious thread safety. Seems to work though...
-		SendMessage(nvim->hwnd, WM_NVIM_MESSAGE, reinterpret_cast<WPARAM>(tree), 0);
+		// Queue is full, wait for the UI thread to hand back a slot
+		nvim->message_producer_waiting.store(true);
+		message = SpscQueueBeginPush(nvim->message_queue);
+		if (message) {
+			nvim->message_producer_waiting.store(false);
+			return message;
+		}
+		WaitForSingleObject(nvim->message_queue_space_event, INFINITE);
 	}
+	return nullptr;
+}
 
-	mpack_tree_destroy(tree);
-	free(tree);
-	PostMessage(nvim->hwnd, WM_DESTROY, 0, 0);
-	return 0;
+static void EndMessage(Nvim *nvim) {
+	SpscQueueEndPush(nvim->message_queue);
+
+	// Only wake the UI thread if it isn't already going to drain the queue
+	if (!nvim->message_wakeup_pending.exchange(true)) {
+		PostMessage(nvim->hwnd, WM_NVIM_MESSAGE, 0, 0);
+	}
+}
+
+static bool CopyFrameToMessage(NvimMessage *message, const MPackFrame *frame) {
+	if (frame->size > message->data_capacity) {
+		size_t new_capacity = message->data_capacity ? message->data_capacity : 256;
+		while (new_capacity < frame->size) {
+			new_capacity *= 2;
+		}
+		free(message->data);
+		message->data = static_cast<char *>(malloc(new_capacity));
+		message->data_capacity = new_capacity;
+	}
+	memcpy(message->data, frame->data, frame->size);
+
+	MPackFrame owned_frame {
+		.data = message->data,
+		.size = frame->size,
+		.node_count = frame->node_count
+	};
+	if (!MPackParseFrame(&owned_frame, &message->tree, &message->node_pool, &message->node_pool_capacity)) {
+		mpack_tree_destroy(&message->tree);
+		return false;
+	}
+	return true;
+}
+
+struct RedrawBatch {
+	Nvim *nvim;
+	NvimMessage *message;
+};
+
+static void PublishRedrawBatch(RedrawBatch *batch) {
+	if (batch->message) {
+		EndMessage(batch->nvim);
+		batch->message = nullptr;
+	}
+}
+
+static bool DecodeRedrawEvent(void *context, RedrawEvent *event) {
+	RedrawBatch *batch = static_cast<RedrawBatch *>(context);
+	if (!batch->message) {
+		batch->message = BeginMessage(batch->nvim);
+		if (!batch->message) {
+			return false;
+		}
+		batch->message->type = NvimMessageType::RedrawCommands;
+		RedrawCommandBufferClear(&batch->message->commands);
+	}
+
+	RedrawDecodeResult result = RedrawCommandsDecodeEvent(&batch->message->commands, event);
+	if (result == RedrawDecodeResult::Unhandled) {
+		batch->nvim->unhandled_redraw_event_count += 1;
+	}
+	if (result == RedrawDecodeResult::Flush || batch->message->commands.size >= REDRAW_COMMAND_BATCH_SIZE) {
+		PublishRedrawBatch(batch);
+	}
+	return true;
 }
 
-DWORD WINAPI NvimProcessMonitor(LPVOID param) {
+DWORD WINAPI NvimMessageHandler(LPVOID param) {
 	Nvim *nvim = static_cast<Nvim *>(param);
+	MPackStream *stream = static_cast<MPackStream *>(malloc(sizeof(MPackStream)));
+	MPackStreamInitialize(stream, ReadFromNvim, nvim);
+
+	// Messages are parsed into slots owned by the queue, so this thread can
+	// parse the next message while the UI thread is still rendering
 	while (true) {
-		DWORD exit_code;
-		if (GetExitCodeProcess(nvim->process_info.hProcess, &exit_code) && exit_code == STILL_ACTIVE) {
-			Sleep(1);
+		// Redraw notifications are decoded event by event into commands,
+		// which are handed over at every flush, so the UI thread never
+		// touches msgpack for them
+		uint32_t event_count;
+		if (MPackStreamBeginNotification(stream, "redraw", &event_count)) {
+			RedrawBatch batch { .nvim = nvim };
+			bool success = RedrawDecoderRun(stream, event_count, DecodeRedrawEvent, &batch);
+			PublishRedrawBatch(&batch);
+			if (!success) {
+				break;
+			}
+			continue;
 		}
-		else {
-			nvim->exit_code = exit_code;
+
+		MPackFrame frame;
+		if (!MPackStreamNextFrame(stream, &frame)) {
+			break;
+		}
+
+		NvimMessage *message = BeginMessage(nvim);
+		if (!message) {
 			break;
 		}
+		if (CopyFrameToMessage(message, &frame)) {
+			message->type = NvimMessageType::Rpc;
+			EndMessage(nvim);
+		}
+	}
+
+	MPackStreamDestroy(stream);
+	free(stream);
+	if (!nvim->shutting_down.load()) {
+		PostMessage(nvim->hwnd, WM_DESTROY, 0, 0);
 	}
-	PostMessage(nvim->hwnd, WM_DESTROY, 0, 0);
 	return 0;
 }
 
-void NvimInitialize(Nvim *nvim, wchar_t *command_line, HWND hwnd) {
-	nvim->hwnd = hwnd;
+static bool OnNvimExit(void *context) {
+	Nvim *nvim = static_cast<Nvim *>(context);
+	PostMessage(nvim->hwnd, WM_DESTROY, 0, 0);
 
-	HANDLE job_object = CreateJobObjectW(nullptr, nullptr);
-	JOBOBJECT_EXTENDED_LIMIT_INFORMATION job_info {
-		.BasicLimitInformation = JOBOBJECT_BASIC_LIMIT_INFORMATION {
-			.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE
-		}
-	};
-	SetInformationJobObject(job_object, JobObjectExtendedLimitInformation, &job_info, sizeof(job_info));
-	
-	SECURITY_ATTRIBUTES sec_attribs {
-		.nLength = sizeof(SECURITY_ATTRIBUTES),
-		.bInheritHandle = true
-	};
-	CreatePipe(&nvim->stdin_read, &nvim->stdin_write, &sec_attribs, 0);
-	CreatePipe(&nvim->stdout_read, &nvim->stdout_write, &sec_attribs, 0);
-
-	STARTUPINFO startup_info {
-		.cb = sizeof(STARTUPINFO),
-		.dwFlags = STARTF_USESTDHANDLES,
-		.hStdInput = nvim->stdin_read,
-		.hStdOutput = nvim->stdout_write,
-		.hStdError = nvim->stdout_write
-	};
+	// The process handle stays signaled from here on
+	return false;
+}
 
-	// wchar_t command_line[] = L"nvim --embed";
-	CreateProcessW(
-		nullptr,
-		command_line,
-		nullptr,
-		nullptr,
-		true,
-		CREATE_NO_WINDOW,
-		nullptr,
-		nullptr,
-		&startup_info,
-		&nvim->process_info
-	);
-	AssignProcessToJobObject(job_object, nvim->process_info.hProcess);
+void NvimInitialize(Nvim *nvim, HWND hwnd, Reactor *reactor) {
+	nvim->hwnd = hwnd;
+	nvim->message_queue = new NvimMessageQueue {};
+	nvim->message_queue_space_event = CreateEvent(nullptr, false, false, nullptr);
+	OutboundBufferInitialize(&nvim->outbound);
+
+	// Process exit is picked up by the UI thread's reactor instead of
+	// a thread polling the exit code
+	ReactorAdd(reactor, TransportExitHandle(&nvim->transport), OnNvimExit, nvim);
+	OutboundWriterStart(&nvim->outbound_writer, WriteToNvim, nvim);
 
 	DWORD _;
-	CreateThread(
+	nvim->reader_thread = CreateThread(
 		nullptr,
 		0,
 		NvimMessageHandler,
@@ -108,55 +455,117 @@ void NvimInitialize(Nvim *nvim, wchar_t *command_line, HWND hwnd) {
 		0,
 		&_
 	);
-	CreateThread(
-		nullptr,
-		0, NvimProcessMonitor,
-		nvim,
-		0, &_
-	);
 
 	// Query api info
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, vim_get_api_info), NVIM_REQUEST_NAMES[vim_get_api_info], &writer);
-	mpack_start_array(&writer, 0);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	SendRequest(nvim, OnApiInfo, nullptr, NVIM_GET_API_INFO);
 
 	// Set g:nvy global variable
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartNotification(NVIM_OUTBOUND_NOTIFICATION_NAMES[nvim_set_var], &writer);
-	mpack_start_array(&writer, 2);
-	mpack_write_cstr(&writer, "nvy");
-	mpack_write_int(&writer, 1);
-	mpack_finish_array(&writer);
-	size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	OutboundBufferAppend(&nvim->outbound, SET_NVY_VAR_NOTIFICATION.data,
+		SET_NVY_VAR_NOTIFICATION.size, OutboundMessageKind::Default);
 
-	// Query stdpath to find the users init.vim
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_eval), NVIM_REQUEST_NAMES[nvim_eval], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, "stdpath('config')");
-	mpack_finish_array(&writer);
-	size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	NvimFlush(nvim);
+}
+
+// Writes how the session's outbound traffic was batched to the debugger output
+static void ReportOutboundStats(Nvim *nvim) {
+	const OutboundWriter *writer = &nvim->outbound_writer;
+	const OutboundBuffer *written = &writer->writing;
+	char buffer[512];
+	snprintf(buffer, sizeof(buffer), "Nvy: wrote %llu messages (%llu bytes) in %llu flushes and %llu write calls, "
+		"%.1f messages per flush, last flush %zu messages (%zu bytes); %llu merged, %llu drags dropped, "
+		"%llu queued past the pending limit\n",
+		static_cast<unsigned long long>(written->messages_written),
+		static_cast<unsigned long long>(written->bytes_written),
+		static_cast<unsigned long long>(written->flushes),
+		static_cast<unsigned long long>(written->write_calls),
+		written->flushes ? written->messages_written / static_cast<double>(written->flushes) : 0.0,
+		written->last_flush_message_count, written->last_flush_size,
+		static_cast<unsigned long long>(writer->merged_messages),
+		static_cast<unsigned long long>(writer->dropped_messages),
+		static_cast<unsigned long long>(writer->overflowed_messages));
+	OutputDebugStringA(buffer);
 }
 
 void NvimShutdown(Nvim *nvim) {
-	DWORD exit_code;
-	GetExitCodeProcess(nvim->process_info.hProcess, &exit_code);
+	// With nvim gone or the connection closed, writes fail instead of blocking
+	TransportShutdown(&nvim->transport);
+	nvim->exit_code = nvim->transport.exit_code;
+	OutboundWriterStop(&nvim->outbound_writer);
+	ReportOutboundStats(nvim);
+
+	// Stop the reader thread before tearing down the queue. It is either
+	// blocked waiting for queue space or inside a read, which is cancelled
+	// in case something else still holds the write end of the pipe, or the
+	// read only started after the transport was shut down.
+	nvim->shutting_down.store(true);
+	SetEvent(nvim->message_queue_space_event);
+	while (WaitForSingleObject(nvim->reader_thread, 10) == WAIT_TIMEOUT) {
+		CancelSynchronousIo(nvim->reader_thread);
+		TransportShutdown(&nvim->transport);
+	}
+	CloseHandle(nvim->reader_thread);
 
-	if(exit_code == STILL_ACTIVE) {
-		CloseHandle(nvim->stdin_read);
-		CloseHandle(nvim->stdin_write);
-		CloseHandle(nvim->stdout_read);
-		CloseHandle(nvim->stdout_write);
-		CloseHandle(nvim->process_info.hThread);
-		TerminateProcess(nvim->process_info.hProcess, 0);
-		CloseHandle(nvim->process_info.hProcess);
+	for (NvimMessage &message : nvim->message_queue->slots) {
+		free(message.data);
+		free(message.node_pool);
+		RedrawCommandBufferDestroy(&message.commands);
+	}
+	delete nvim->message_queue;
+	nvim->message_queue = nullptr;
+	CloseHandle(nvim->message_queue_space_event);
+
+	OutboundBufferDestroy(&nvim->outbound);
+	InputCoalescerDestroy(&nvim->input_coalescer);
+	PasteStreamDestroy(&nvim->paste);
+	TransportClose(&nvim->transport);
+	RpcCaptureClose(&nvim->capture);
+}
+
+void NvimQueryConfigPath(Nvim *nvim, RequestCallback callback, void *context) {
+	// Query stdpath to find the users init.vim
+	SendRequest(nvim, callback, context, NVIM_EVAL, "stdpath('config')");
+}
+
+void NvimCompleteRequest(Nvim *nvim, uint32_t msg_id, mpack_node_t error, mpack_node_t result) {
+	RequestTableComplete(&nvim->requests, msg_id, error, result, NowMicroseconds());
+}
+
+void NvimExpireRequests(Nvim *nvim) {
+	RequestTableExpire(&nvim->requests, NowMicroseconds());
+}
+
+uint32_t NvimRequestTimeout(Nvim *nvim) {
+	uint64_t deadline = RequestTableNextDeadline(&nvim->requests);
+	if (deadline == REQUEST_NO_DEADLINE) {
+		return REACTOR_WAIT_INFINITE;
+	}
+
+	uint64_t now = NowMicroseconds();
+	// Round up, so the wait doesn't end just before the deadline
+	return deadline <= now ? 0 : static_cast<uint32_t>((deadline - now + 999) / 1000);
+}
+
+void NvimFlush(Nvim *nvim) {
+	FlushPendingInput(nvim);
+	OutboundWriterSubmit(&nvim->outbound_writer, &nvim->outbound);
+}
+
+NvimMessage *NvimFrontMessage(Nvim *nvim) {
+	// Clear the wakeup before looking at the queue, anything pushed
+	// after this point posts a new WM_NVIM_MESSAGE
+	nvim->message_wakeup_pending.store(false);
+	return SpscQueueFront(nvim->message_queue);
+}
+
+void NvimPopMessage(Nvim *nvim) {
+	NvimMessage *message = SpscQueueFront(nvim->message_queue);
+	if (message->type == NvimMessageType::Rpc) {
+		mpack_tree_destroy(&message->tree);
+	}
+	SpscQueuePop(nvim->message_queue);
+
+	if (nvim->message_producer_waiting.load() && nvim->message_producer_waiting.exchange(false)) {
+		SetEvent(nvim->message_queue_space_event);
 	}
 }
 
@@ -228,42 +637,40 @@ void NvimParseConfig(Nvim *nvim, mpack_node_t config_node, Vec<char> *guifont_ou
 }
 
 void NvimSendUIAttach(Nvim *nvim, int grid_rows, int grid_cols) {
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-
 	// Send UI attach notification
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartNotification(NVIM_OUTBOUND_NOTIFICATION_NAMES[nvim_ui_attach], &writer);
-	mpack_start_array(&writer, 3);
-	mpack_write_int(&writer, grid_cols);
-	mpack_write_int(&writer, grid_rows);
-	mpack_start_map(&writer, 1);
-	mpack_write_cstr(&writer, "ext_linegrid");
-	mpack_write_true(&writer);
-	mpack_finish_map(&writer);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	SendNotification(nvim, OutboundMessageKind::Default, NVIM_UI_ATTACH, grid_cols, grid_rows,
+		RpcOptions<1> { RpcOption { .name = "ext_linegrid", .value = true } });
 }
 
 void NvimSendResize(Nvim *nvim, int grid_rows, int grid_cols) {
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
+	SendNotification(nvim, OutboundMessageKind::Resize, NVIM_UI_TRY_RESIZE, grid_cols, grid_rows);
+}
+
+// One snapshot of the keyboard state instead of a GetKeyState call per modifier
+int NvimKeyModifiers() {
+	BYTE key_state[256];
+	if (!GetKeyboardState(key_state)) {
+		return 0;
+	}
 
-	MPackStartNotification(NVIM_OUTBOUND_NOTIFICATION_NAMES[nvim_ui_try_resize], &writer);
-	mpack_start_array(&writer, 2);
-	mpack_write_int(&writer, grid_cols);
-	mpack_write_int(&writer, grid_rows);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	int modifiers = 0;
+	if (key_state[VK_SHIFT] & 0x80) {
+		modifiers |= KEY_MODIFIER_SHIFT;
+	}
+	if (key_state[VK_CONTROL] & 0x80) {
+		modifiers |= KEY_MODIFIER_CTRL;
+	}
+	if (key_state[VK_MENU] & 0x80) {
+		modifiers |= KEY_MODIFIER_ALT;
+	}
+	return modifiers;
 }
 
-void NvimSendModifiedInput(Nvim *nvim, const char *input, bool virtual_key) {
-	bool shift_down = (GetKeyState(VK_SHIFT) & 0x80) != 0;
-	bool ctrl_down = (GetKeyState(VK_CONTROL) & 0x80) != 0;
-	bool alt_down = (GetKeyState(VK_MENU) & 0x80) != 0;
+void NvimSendModifiedInput(Nvim *nvim, const char *input, bool virtual_key, bool is_repeat) {
+	int modifiers = NvimKeyModifiers();
+	bool shift_down = (modifiers & KEY_MODIFIER_SHIFT) != 0;
+	bool ctrl_down = (modifiers & KEY_MODIFIER_CTRL) != 0;
+	bool alt_down = (modifiers & KEY_MODIFIER_ALT) != 0;
 
 	constexpr int MAX_INPUT_STRING_SIZE = 64;
 	char input_string[MAX_INPUT_STRING_SIZE];
@@ -271,22 +678,14 @@ void NvimSendModifiedInput(Nvim *nvim, const char *input, bool virtual_key) {
 	snprintf(input_string, MAX_INPUT_STRING_SIZE, "<%s%s%s%s>", ctrl_down ? "C-" : "", 
 			shift_down ? "S-" : "", alt_down ? "M-" : "", input);
 
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_input), NVIM_REQUEST_NAMES[nvim_input], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, input_string);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	SendKeyInput(nvim, input_string, is_repeat);
 }
 
-void NvimSendChar(Nvim *nvim, wchar_t input_char) {
+void NvimSendChar(Nvim *nvim, wchar_t input_char, bool is_repeat) {
 	// If the space is simply a regular space,
 	// simply send the modified input
 	if(input_char == VK_SPACE) {
-		NvimSendModifiedInput(nvim, "Space", true);
+		NvimSendModifiedInput(nvim, "Space", true, is_repeat);
 		return;
 	}
 
@@ -296,333 +695,307 @@ void NvimSendChar(Nvim *nvim, wchar_t input_char) {
 	}
 	WideCharToMultiByte(CP_UTF8, 0, &input_char, 1, utf8_encoded, 64, NULL, NULL);
 
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_input), NVIM_REQUEST_NAMES[nvim_input], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, utf8_encoded);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	SendKeyInput(nvim, utf8_encoded, is_repeat);
 }
 
-void NvimSendSysChar(Nvim *nvim, wchar_t input_char) {
+void NvimSendSysChar(Nvim *nvim, wchar_t input_char, bool is_repeat) {
 	char utf8_encoded[64]{};
 	if(!WideCharToMultiByte(CP_UTF8, 0, &input_char, 1, 0, 0, NULL, NULL)) {
 		return;
 	}
 	WideCharToMultiByte(CP_UTF8, 0, &input_char, 1, utf8_encoded, 64, NULL, NULL);
 
-	NvimSendModifiedInput(nvim, utf8_encoded, true);
+	NvimSendModifiedInput(nvim, utf8_encoded, true, is_repeat);
 }
 
 void NvimSendInput(Nvim *nvim, const char *input_chars) {
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-
-	MPackStartRequest(RegisterRequest(nvim, nvim_input), NVIM_REQUEST_NAMES[nvim_input], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, input_chars);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	SendInput(nvim, OutboundMessageKind::Default, NVIM_INPUT, input_chars);
 }
 
 void NvimSendMouseInput(Nvim *nvim, MouseButton button, MouseAction action, int mouse_row, int mouse_col) {
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_input_mouse), NVIM_REQUEST_NAMES[nvim_input_mouse], &writer);
-	mpack_start_array(&writer, 6);
-
-	switch (button) {
-	case MouseButton::Left: {
-		mpack_write_cstr(&writer, "left");
-	} break;
-	case MouseButton::Right: {
-		mpack_write_cstr(&writer, "right");
-	} break;
-	case MouseButton::Middle: {
-		mpack_write_cstr(&writer, "middle");
-	} break;
-	case MouseButton::Wheel: {
-		mpack_write_cstr(&writer, "wheel");
-	} break;
-	}
-	switch (action) {
-	case MouseAction::Press: {
-		mpack_write_cstr(&writer, "press");
-	} break;
-	case MouseAction::Drag: {
-		mpack_write_cstr(&writer, "drag");
-	} break;
-	case MouseAction::Release: {
-		mpack_write_cstr(&writer, "release");
-	} break;
-	case MouseAction::MouseWheelUp: {
-		mpack_write_cstr(&writer, "up");
-	} break;
-	case MouseAction::MouseWheelDown: {
-		mpack_write_cstr(&writer, "down");
-	} break;
-	case MouseAction::MouseWheelLeft: {
-		mpack_write_cstr(&writer, "left");
-	} break;
-	case MouseAction::MouseWheelRight: {
-		mpack_write_cstr(&writer, "right");
-	} break;
-	}
-
-	bool ctrl_down = (GetKeyState(VK_CONTROL) & 0x80) != 0;
-	bool shift_down = (GetKeyState(VK_SHIFT) & 0x80) != 0;
-	bool alt_down = (GetKeyState(VK_MENU) & 0x80) != 0;
-	constexpr int MAX_INPUT_STRING_SIZE = 64;
-	char input_string[MAX_INPUT_STRING_SIZE];
-	snprintf(input_string, MAX_INPUT_STRING_SIZE, "%s%s%s", ctrl_down ? "C-" : "", shift_down ? "S-" : "", alt_down ? "M-" : "");
-	mpack_write_cstr(&writer, input_string);
-
-	mpack_write_i64(&writer, 0);
-	mpack_write_i64(&writer, mouse_row);
-	mpack_write_i64(&writer, mouse_col);
-	mpack_finish_array(&writer);
-
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
-}
-
-bool NvimProcessKeyDown(Nvim *nvim, int virtual_key) {
-	const char *key;
-	switch (virtual_key) {
-	case VK_BACK: {
-		key = "BS";
-	} break;
-	case VK_TAB: {
-		key = "Tab";
-	} break;
-	case VK_RETURN: {
-		key = "CR";
-	} break;
-	case VK_ESCAPE: {
-		key = "Esc";
-	} break;
-	case VK_PRIOR: {
-		key = "PageUp";
-	} break;
-	case VK_NEXT: {
-		key = "PageDown";
-	} break;
-	case VK_HOME: {
-		key = "Home";
-	} break;
-	case VK_END: {
-		key = "End";
-	} break;
-	case VK_LEFT: {
-		key = "Left";
-	} break;
-	case VK_UP: {
-		key = "Up";
-	} break;
-	case VK_RIGHT: {
-		key = "Right";
-	} break;
-	case VK_DOWN: {
-		key = "Down";
-	} break;
-	case VK_INSERT: {
-		key = "Insert";
-	} break;
-	case VK_DELETE: {
-		key = "Del";
-	} break;
-	case VK_NUMPAD0: {
-		key = "k0";
-	} break;
-	case VK_NUMPAD1: {
-		key = "k1";
-	} break;
-	case VK_NUMPAD2: {
-		key = "k2";
-	} break;
-	case VK_NUMPAD3: {
-		key = "k3";
-	} break;
-	case VK_NUMPAD4: {
-		key = "k4";
-	} break;
-	case VK_NUMPAD5: {
-		key = "k5";
-	} break;
-	case VK_NUMPAD6: {
-		key = "k6";
-	} break;
-	case VK_NUMPAD7: {
-		key = "k7";
-	} break;
-	case VK_NUMPAD8: {
-		key = "k8";
-	} break;
-	case VK_NUMPAD9: {
-		key = "k9";
-	} break;
-	case VK_MULTIPLY: {
-		key = "kMultiply";
-	} break;
-	case VK_ADD: {
-		key = "kPlus";
-	} break;
-	case VK_SEPARATOR: {
-		key = "kComma";
-	} break;
-	case VK_SUBTRACT: {
-		key = "kMinus";
-	} break;
-	case VK_DECIMAL: {
-		key = "kPoint";
-	} break;
-	case VK_DIVIDE: {
-		key = "kDivide";
-	} break;
-	case VK_F1: {
-		key = "F1";
-	} break;
-	case VK_F2: {
-		key = "F2";
-	} break;
-	case VK_F3: {
-		key = "F3";
-	} break;
-	case VK_F4: {
-		key = "F4";
-	} break;
-	case VK_F5: {
-		key = "F5";
-	} break;
-	case VK_F6: {
-		key = "F6";
-	} break;
-	case VK_F7: {
-		key = "F7";
-	} break;
-	case VK_F8: {
-		key = "F8";
-	} break;
-	case VK_F9: {
-		key = "F9";
-	} break;
-	case VK_F10: {
-		key = "F10";
-	} break;
-	case VK_F11: {
-		key = "F11";
-	} break;
-	case VK_F12: {
-		key = "F12";
-	} break;
-	case VK_F13: {
-		key = "F13";
-	} break;
-	case VK_F14: {
-		key = "F14";
-	} break;
-	case VK_F15: {
-		key = "F15";
-	} break;
-	case VK_F16: {
-		key = "F16";
-	} break;
-	case VK_F17: {
-		key = "F17";
-	} break;
-	case VK_F18: {
-		key = "F18";
-	} break;
-	case VK_F19: {
-		key = "F19";
-	} break;
-	case VK_F20: {
-		key = "F20";
-	} break;
-	case VK_F21: {
-		key = "F21";
-	} break;
-	case VK_F22: {
-		key = "F22";
-	} break;
-	case VK_F23: {
-		key = "F23";
-	} break;
-	case VK_F24: {
-		key = "F24";
-	} break;
-	default: {
-	} return false;
-	}
-
-	NvimSendModifiedInput(nvim, key, true);
+	SendInput(nvim, action == MouseAction::Drag ? OutboundMessageKind::MouseDrag : OutboundMessageKind::Default,
+		NVIM_INPUT_MOUSE, MOUSE_BUTTON_NAMES[static_cast<int>(button)], MOUSE_ACTION_NAMES[static_cast<int>(action)],
+		MOUSE_MODIFIER_STRINGS[NvimKeyModifiers()], 0, mouse_row, mouse_col);
+}
+
+void NvimSendMouseDrag(Nvim *nvim, MouseButton button, int mouse_row, int mouse_col) {
+	MouseBatcherDrag(&nvim->mouse_batcher, button, NvimKeyModifiers(), mouse_row, mouse_col);
+}
+
+void NvimSendMouseWheel(Nvim *nvim, int wheel_delta, int mouse_row, int mouse_col) {
+	MouseBatcherWheel(&nvim->mouse_batcher, wheel_delta, NvimKeyModifiers(), mouse_row, mouse_col);
+}
+
+static void OnPasteChunk(void *context, RequestStatus status, mpack_node_t result);
+
+// Chunks have no deadline, nvim may well take longer than a request is
+// normally given to insert one, e.g. with autocommands or syntax on a long
+// line, and timing out a chunk that is still being inserted cancels the paste
+static void SendPasteChunks(Nvim *nvim) {
+	std::string_view chunk;
+	PastePhase phase;
+	while (PasteStreamNextChunk(&nvim->paste, &chunk, &phase)) {
+		FlushPendingInput(nvim);
+		QueueRequest(nvim, OnPasteChunk, nvim, REQUEST_NO_DEADLINE, NVIM_PASTE, chunk, true, phase);
+	}
+}
+
+// nvim answers false if the paste should be cancelled, e.g. because it was interrupted
+static void OnPasteChunk(void *context, RequestStatus status, mpack_node_t result) {
+	Nvim *nvim = static_cast<Nvim *>(context);
+	PasteChunkStatus chunk_status = PasteChunkStatus::Failed;
+	if (status == RequestStatus::Success) {
+		bool keep_going = mpack_node_type(result) == mpack_type_bool && mpack_node_bool(result);
+		chunk_status = keep_going ? PasteChunkStatus::Accepted : PasteChunkStatus::Cancelled;
+	}
+	else if (status == RequestStatus::Error) {
+		ReportInputError(nvim, result);
+	}
+
+	if (PasteStreamChunkDone(&nvim->paste, chunk_status, NowMicroseconds())) {
+		// A paste we gave up on, rather than nvim, is still open on its side
+		if (PasteStreamNeedsEnd(&nvim->paste)) {
+			SendRequest(nvim, OnInputResponse, nvim, NVIM_PASTE, "", true, PASTE_PHASE_END);
+		}
+
+		char buffer[128];
+		snprintf(buffer, sizeof(buffer), "Nvy: pasted %llu bytes in %.1f ms (%.1f MB/s)\n",
+			static_cast<unsigned long long>(nvim->paste.last_paste_size), nvim->paste.last_paste_us / 1000.0,
+			PasteStreamThroughput(&nvim->paste) / (1024.0 * 1024.0));
+		OutputDebugStringA(buffer);
+	}
+	else {
+		SendPasteChunks(nvim);
+	}
+}
+
+void NvimPaste(Nvim *nvim, const wchar_t *text, size_t length) {
+	if (length == 0) {
+		return;
+	}
+
+	int utf8_length = WideCharToMultiByte(CP_UTF8, 0, text, static_cast<int>(length), nullptr, 0, nullptr, nullptr);
+	if (utf8_length <= 0) {
+		return;
+	}
+	char *utf8_text = PasteStreamReserve(&nvim->paste, utf8_length);
+	if (!utf8_text) {
+		return;
+	}
+
+	WideCharToMultiByte(CP_UTF8, 0, text, static_cast<int>(length), utf8_text, utf8_length, nullptr, nullptr);
+	PasteStreamBegin(&nvim->paste, utf8_length, NowMicroseconds());
+	SendPasteChunks(nvim);
+}
+
+// Keys that are sent by name instead of through WM_CHAR
+constexpr auto NVIM_KEY_NAMES = std::to_array<KeyName>({
+	KeyName { VK_BACK, "BS" },
+	KeyName { VK_TAB, "Tab" },
+	KeyName { VK_RETURN, "CR" },
+	KeyName { VK_ESCAPE, "Esc" },
+	KeyName { VK_PRIOR, "PageUp" },
+	KeyName { VK_NEXT, "PageDown" },
+	KeyName { VK_HOME, "Home" },
+	KeyName { VK_END, "End" },
+	KeyName { VK_LEFT, "Left" },
+	KeyName { VK_UP, "Up" },
+	KeyName { VK_RIGHT, "Right" },
+	KeyName { VK_DOWN, "Down" },
+	KeyName { VK_INSERT, "Insert" },
+	KeyName { VK_DELETE, "Del" },
+	KeyName { VK_NUMPAD0, "k0" },
+	KeyName { VK_NUMPAD1, "k1" },
+	KeyName { VK_NUMPAD2, "k2" },
+	KeyName { VK_NUMPAD3, "k3" },
+	KeyName { VK_NUMPAD4, "k4" },
+	KeyName { VK_NUMPAD5, "k5" },
+	KeyName { VK_NUMPAD6, "k6" },
+	KeyName { VK_NUMPAD7, "k7" },
+	KeyName { VK_NUMPAD8, "k8" },
+	KeyName { VK_NUMPAD9, "k9" },
+	KeyName { VK_MULTIPLY, "kMultiply" },
+	KeyName { VK_ADD, "kPlus" },
+	KeyName { VK_SEPARATOR, "kComma" },
+	KeyName { VK_SUBTRACT, "kMinus" },
+	KeyName { VK_DECIMAL, "kPoint" },
+	KeyName { VK_DIVIDE, "kDivide" },
+	KeyName { VK_F1, "F1" },
+	KeyName { VK_F2, "F2" },
+	KeyName { VK_F3, "F3" },
+	KeyName { VK_F4, "F4" },
+	KeyName { VK_F5, "F5" },
+	KeyName { VK_F6, "F6" },
+	KeyName { VK_F7, "F7" },
+	KeyName { VK_F8, "F8" },
+	KeyName { VK_F9, "F9" },
+	KeyName { VK_F10, "F10" },
+	KeyName { VK_F11, "F11" },
+	KeyName { VK_F12, "F12" },
+	KeyName { VK_F13, "F13" },
+	KeyName { VK_F14, "F14" },
+	KeyName { VK_F15, "F15" },
+	KeyName { VK_F16, "F16" },
+	KeyName { VK_F17, "F17" },
+	KeyName { VK_F18, "F18" },
+	KeyName { VK_F19, "F19" },
+	KeyName { VK_F20, "F20" },
+	KeyName { VK_F21, "F21" },
+	KeyName { VK_F22, "F22" },
+	KeyName { VK_F23, "F23" },
+	KeyName { VK_F24, "F24" }
+});
+constexpr auto NVIM_KEY_TABLE = BuildKeyTable(NVIM_INPUT, NVIM_KEY_NAMES);
+
+bool NvimProcessKeyDown(Nvim *nvim, int virtual_key, bool is_repeat) {
+	const KeyInput *key_input = KeyTableLookup(&NVIM_KEY_TABLE, virtual_key, NvimKeyModifiers());
+	if (!key_input) {
+		return false;
+	}
+
+	if (is_repeat) {
+		std::string_view input = KeyInputString(key_input);
+		InputCoalescerAddRepeat(&nvim->input_coalescer, input.data(), input.size());
+	}
+	else if (nvim->report_input_errors) {
+		SendRequest(nvim, OnInputResponse, nvim, NVIM_INPUT, KeyInputString(key_input));
+	}
+	else {
+		FlushPendingInput(nvim);
+		OutboundBufferAppend(&nvim->outbound, key_input->frame, key_input->frame_size, OutboundMessageKind::Default);
+	}
 	return true;
 }
 
-void NvimOpenFile(Nvim *nvim, const wchar_t *file_name) {
+// Built on a worker thread and handed back with WM_NVIM_FILES_DROPPED
+struct NvimDroppedFiles {
+	HWND hwnd;
+	HDROP drop;
+	int row;
+	int col;
+	uint32_t file_count;
+	// UTF-8 paths, each followed by a null
+	char *paths;
+	size_t paths_size;
+	size_t paths_capacity;
+};
+
+static void AppendDroppedPath(NvimDroppedFiles *files, const char *path, size_t length) {
+	if (files->paths_size + length + 1 > files->paths_capacity) {
+		size_t new_capacity = files->paths_capacity ? files->paths_capacity : 1024;
+		while (new_capacity < files->paths_size + length + 1) {
+			new_capacity *= 2;
+		}
+		files->paths = static_cast<char *>(realloc(files->paths, new_capacity));
+		files->paths_capacity = new_capacity;
+	}
+	memcpy(files->paths + files->paths_size, path, length);
+	files->paths[files->paths_size + length] = '\0';
+	files->paths_size += length + 1;
+}
+
+static DWORD WINAPI CollectDroppedFiles(LPVOID param) {
+	NvimDroppedFiles *files = static_cast<NvimDroppedFiles *>(param);
+	files->file_count = DragQueryFileW(files->drop, 0xFFFFFFFF, nullptr, 0);
+
+	wchar_t *path = nullptr;
+	size_t path_capacity = 0;
+	char *utf8_path = nullptr;
+	size_t utf8_path_capacity = 0;
+	for (uint32_t i = 0; i < files->file_count; ++i) {
+		UINT path_length = DragQueryFileW(files->drop, i, nullptr, 0);
+		if (path_length + 1 > path_capacity) {
+			path_capacity = path_length + 1;
+			path = static_cast<wchar_t *>(realloc(path, path_capacity * sizeof(wchar_t)));
+		}
+		DragQueryFileW(files->drop, i, path, path_length + 1);
+
+		int utf8_length = WideCharToMultiByte(CP_UTF8, 0, path, path_length, nullptr, 0, nullptr, nullptr);
+		if (static_cast<size_t>(utf8_length) > utf8_path_capacity) {
+			utf8_path_capacity = utf8_length;
+			utf8_path = static_cast<char *>(realloc(utf8_path, utf8_path_capacity));
+		}
+		WideCharToMultiByte(CP_UTF8, 0, path, path_length, utf8_path, utf8_length, nullptr, nullptr);
+		AppendDroppedPath(files, utf8_path, utf8_length);
+	}
+
+	free(path);
+	free(utf8_path);
+	DragFinish(files->drop);
+
+	if (!PostMessage(files->hwnd, WM_NVIM_FILES_DROPPED, 0, reinterpret_cast<LPARAM>(files))) {
+		free(files->paths);
+		free(files);
+	}
+	return 0;
+}
+
+void NvimDropFiles(Nvim *nvim, HDROP drop, int row, int col) {
+	NvimDroppedFiles *files = static_cast<NvimDroppedFiles *>(calloc(1, sizeof(NvimDroppedFiles)));
+	files->hwnd = nvim->hwnd;
+	files->drop = drop;
+	files->row = row;
+	files->col = col;
 
-	char utf8_encoded[MAX_PATH]{};
-	WideCharToMultiByte(CP_UTF8, 0, file_name, -1, utf8_encoded, MAX_PATH, NULL, NULL);
+	DWORD _;
+	HANDLE thread = CreateThread(nullptr, 0, CollectDroppedFiles, files, 0, &_);
+	if (thread) {
+		CloseHandle(thread);
+	}
+	else {
+		CollectDroppedFiles(files);
+	}
+}
 
-	char file_command[MAX_PATH + 2] = {};
-	strcpy_s(file_command, MAX_PATH, "e ");
-	strcat_s(file_command, MAX_PATH - 3, utf8_encoded);
+// Makes the topmost focusable window at the given grid position current
+constexpr std::string_view FOCUS_WINDOW_AT_LUA =
+	"local row, col = ...\n"
+	"local wins = vim.api.nvim_tabpage_list_wins(0)\n"
+	"for i = #wins, 1, -1 do\n"
+	"  local pos = vim.api.nvim_win_get_position(wins[i])\n"
+	"  if row >= pos[1] and row < pos[1] + vim.api.nvim_win_get_height(wins[i]) and\n"
+	"    col >= pos[2] and col < pos[2] + vim.api.nvim_win_get_width(wins[i]) and\n"
+	"    vim.api.nvim_win_get_config(wins[i]).focusable ~= false then\n"
+	"    vim.api.nvim_set_current_win(wins[i])\n"
+	"    return\n"
+	"  end\n"
+	"end\n";
+
+// The first file is edited in the window the files were dropped on and the rest are
+// added to the argument list. Each path goes to nvim_cmd as its own argument, so it
+// needs no escaping. The window is picked by position rather than with a click, as
+// a click would only be handled as input after the calls have already run.
+void NvimSendDroppedFiles(Nvim *nvim, NvimDroppedFiles *files) {
+	if (files->file_count > 0) {
+		FlushPendingInput(nvim);
+		QueueInputBatch(nvim, 1 + files->file_count, [files](auto *out) {
+			RpcEncodeCall(out, NVIM_EXEC_LUA, FOCUS_WINDOW_AT_LUA, std::array<int64_t, 2> { files->row, files->col });
+			const char *path = files->paths;
+			for (uint32_t i = 0; i < files->file_count; ++i) {
+				std::string_view path_view(path);
+				RpcEncodeCall(out, NVIM_CMD, RpcExCommand { i == 0 ? "edit" : "argadd", path_view }, RpcOptions<0> {});
+				path += path_view.size() + 1;
+			}
+		});
+	}
 
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_command), NVIM_REQUEST_NAMES[nvim_command], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, file_command);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	free(files->paths);
+	free(files);
 }
 
 void NvimSetFocus(Nvim *nvim) {
-	const char *set_focus_command = "doautocmd <nomodeline> FocusGained";
-
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_command), NVIM_REQUEST_NAMES[nvim_command], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, set_focus_command);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	SendConstantCommand(nvim, FOCUS_GAINED_COMMAND);
 }
 
 void NvimKillFocus(Nvim *nvim) {
-	const char *set_focus_command = "doautocmd <nomodeline> FocusLost";
-
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_command), NVIM_REQUEST_NAMES[nvim_command], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, set_focus_command);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	SendConstantCommand(nvim, FOCUS_LOST_COMMAND);
 }
 void NvimQuit(Nvim *nvim)
 {
-	const char *quit_command = "qa";
-
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_command), NVIM_REQUEST_NAMES[nvim_command], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, quit_command);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	// Closing the window only detaches from a server, its session lives on
+	if (nvim->transport.kind != TransportKind::Process) {
+		PostMessage(nvim->hwnd, WM_DESTROY, 0, 0);
+		return;
+	}
+	SendConstantCommand(nvim, QUIT_COMMAND);
 }
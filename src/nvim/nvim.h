@@ -1,73 +1,139 @@
 #pragma once
+#include "common/outbound_buffer.h"
+#include "common/outbound_writer.h"
+#include "common/reactor.h"
+#include "common/rpc_capture.h"
+#include "common/rpc_encoder.h"
+#include "common/spsc_queue.h"
+#include "common/transport.h"
+#include "nvim/input_coalescer.h"
+#include "nvim/key_table.h"
+#include "nvim/mouse_batcher.h"
+#include "nvim/paste_stream.h"
+#include "nvim/redraw_commands.h"
+#include "nvim/request_table.h"
 
-enum NvimRequest : uint8_t {
-	vim_get_api_info = 0,
-	nvim_input = 1,
-	nvim_input_mouse = 2,
-	nvim_eval = 3,
-	nvim_command = 4
+// Every nvim API function Nvy calls. The id tells the methods apart in the request statistics.
+constexpr RpcMethod<> NVIM_GET_API_INFO { .id = 0, .name = "nvim_get_api_info" };
+constexpr RpcMethod<std::string_view> NVIM_INPUT { .id = 1, .name = "nvim_input" };
+// button, action, modifier, grid, row, col
+constexpr RpcMethod<std::string_view, std::string_view, std::string_view, int64_t, int64_t, int64_t> NVIM_INPUT_MOUSE {
+	.id = 2, .name = "nvim_input_mouse"
 };
-constexpr const char *NVIM_REQUEST_NAMES[] {
-	"nvim_get_api_info",
-	"nvim_input",
-	"nvim_input_mouse",
-	"nvim_eval",
-	"nvim_command"
+constexpr RpcMethod<std::string_view> NVIM_EVAL { .id = 3, .name = "nvim_eval" };
+constexpr RpcMethod<std::string_view> NVIM_COMMAND { .id = 4, .name = "nvim_command" };
+// width, height, options
+constexpr RpcMethod<int64_t, int64_t, RpcOptions<1>> NVIM_UI_ATTACH { .id = 5, .name = "nvim_ui_attach" };
+constexpr RpcMethod<int64_t, int64_t> NVIM_UI_TRY_RESIZE { .id = 6, .name = "nvim_ui_try_resize" };
+constexpr RpcMethod<std::string_view, int64_t> NVIM_SET_VAR { .id = 7, .name = "nvim_set_var" };
+constexpr RpcMethod<RpcBatch> NVIM_CALL_ATOMIC { .id = 8, .name = "nvim_call_atomic" };
+// data, crlf, phase
+constexpr RpcMethod<std::string_view, bool, int64_t> NVIM_PASTE { .id = 9, .name = "nvim_paste" };
+// command, options
+constexpr RpcMethod<RpcExCommand, RpcOptions<0>> NVIM_CMD { .id = 10, .name = "nvim_cmd" };
+// code, args
+constexpr RpcMethod<std::string_view, std::array<int64_t, 2>> NVIM_EXEC_LUA { .id = 11, .name = "nvim_exec_lua" };
+enum class NvimMessageType {
+	Rpc,
+	RedrawCommands
 };
-enum NvimOutboundNotification : uint8_t {
-	nvim_ui_attach = 0,
-	nvim_ui_try_resize = 1,
-	nvim_set_var = 2
+// An owned message handed from the reader thread to the UI thread. RPC
+// messages are parsed into the tree, redraw events arrive already decoded
+// into commands. The buffers stay with the queue slot and are reused.
+struct NvimMessage {
+	NvimMessageType type;
+	char *data;
+	size_t data_capacity;
+	mpack_node_data_t *node_pool;
+	size_t node_pool_capacity;
+	mpack_tree_t tree;
+	RedrawCommandBuffer commands;
 };
-constexpr const char *NVIM_OUTBOUND_NOTIFICATION_NAMES[] {
-	"nvim_ui_attach",
-	"nvim_ui_try_resize",
-	"nvim_set_var"
-};
-enum class MouseButton {
-	Left,
-	Right,
-	Middle,
-	Wheel
-};
-enum class MouseAction {
-	Press,
-	Drag,
-	Release,
-	MouseWheelUp,
-	MouseWheelDown,
-	MouseWheelLeft,
-	MouseWheelRight
-};
-constexpr int MAX_MPACK_OUTBOUND_MESSAGE_SIZE = 4096;
+constexpr size_t NVIM_MESSAGE_QUEUE_SIZE = 64;
+using NvimMessageQueue = SpscQueue<NvimMessage, NVIM_MESSAGE_QUEUE_SIZE>;
+
+constexpr uint64_t NVIM_REQUEST_TIMEOUT_MS = 5000;
 
 struct Nvim {
-	int64_t next_msg_id;
-	Vec<NvimRequest> msg_id_to_method;
+	// Only touched by the UI thread
+	RequestTable requests;
+	// Sends input as requests, so failing input shows up in the debug output
+	bool report_input_errors;
+	uint64_t input_error_count;
+	InputCoalescer input_coalescer;
+	MouseBatcher mouse_batcher;
+	PasteStream paste;
+
+	NvimMessageQueue *message_queue;
+	HANDLE message_queue_space_event;
+	std::atomic<bool> message_wakeup_pending;
+	std::atomic<bool> message_producer_waiting;
+	// Only touched by the reader thread
+	uint64_t unhandled_redraw_event_count;
+
+	HANDLE reader_thread;
+	std::atomic<bool> shutting_down;
+
+	// Written by the UI thread, handed to the writer once per message loop pass
+	OutboundBuffer outbound;
+	OutboundWriter outbound_writer;
 
 	HWND hwnd;
-	HANDLE stdin_read;
-	HANDLE stdin_write;
-	HANDLE stdout_read;
-	HANDLE stdout_write;
-	PROCESS_INFORMATION process_info;
+	// A spawned `nvim --embed`, a connection to a running `nvim --listen` or a replay
+	Transport transport;
+	// Records everything read and written while its file is open
+	RpcCapture capture;
 	DWORD exit_code;
 };
 
-void NvimInitialize(Nvim *nvim, wchar_t *command_line, HWND hwnd);
+// The transport has to be spawned or connected already. A spawned process is
+// registered with the reactor, so its exit ends the message loop.
+void NvimInitialize(Nvim *nvim, HWND hwnd, Reactor *reactor);
 void NvimShutdown(Nvim *nvim);
 
+// Requests are matched to their responses by NvimCompleteRequest, which runs the
+// request's callback. Requests without a response are timed out by NvimExpireRequests,
+// NvimRequestTimeout returns the time in ms until the next request expires.
+void NvimCompleteRequest(Nvim *nvim, uint32_t msg_id, mpack_node_t error, mpack_node_t result);
+void NvimExpireRequests(Nvim *nvim);
+uint32_t NvimRequestTimeout(Nvim *nvim);
+
+// The NvimSend* functions only queue their messages, NvimFlush hands
+// everything queued so far to the writer thread, which writes it to nvim
+// in a single write. Never blocks, even if nvim stops reading its input.
+void NvimFlush(Nvim *nvim);
+
+// UI thread side of the message queue, WM_NVIM_MESSAGE signals that messages are
+// available. Returns nullptr once the queue has been drained.
+NvimMessage *NvimFrontMessage(Nvim *nvim);
+void NvimPopMessage(Nvim *nvim);
+
+void NvimQueryConfigPath(Nvim *nvim, RequestCallback callback, void *context);
 void NvimParseConfig(Nvim *nvim, mpack_node_t config_node, Vec<char> *guifont_out);
 
 void NvimSendUIAttach(Nvim *nvim, int grid_rows, int grid_cols);
 void NvimSendResize(Nvim *nvim, int grid_rows, int grid_cols);
-void NvimSendChar(Nvim *nvim, wchar_t input_char);
-void NvimSendSysChar(Nvim *nvim, wchar_t sys_char);
+void NvimSendChar(Nvim *nvim, wchar_t input_char, bool is_repeat);
+void NvimSendSysChar(Nvim *nvim, wchar_t sys_char, bool is_repeat);
 void NvimSendInput(Nvim *nvim, const char* input_chars);
 void NvimSendInput(Nvim *nvim, int virtual_key, int flags);
 void NvimSendMouseInput(Nvim *nvim, MouseButton button, MouseAction action, int mouse_row, int mouse_col);
-bool NvimProcessKeyDown(Nvim *nvim, int virtual_key);
-void NvimOpenFile(Nvim *nvim, const wchar_t *file_name);
+// Drags and wheel movement are batched and sent once per message loop pass.
+// The wheel delta is in WHEEL_DELTA units, fractions of a tick add up over time.
+void NvimSendMouseDrag(Nvim *nvim, MouseButton button, int mouse_row, int mouse_col);
+void NvimSendMouseWheel(Nvim *nvim, int wheel_delta, int mouse_row, int mouse_col);
+// Converts the text to UTF-8 in one go and streams it to nvim through nvim_paste.
+// Ignored while an earlier paste is still being sent.
+void NvimPaste(Nvim *nvim, const wchar_t *text, size_t length);
+
+// The KEY_MODIFIER_* bits of the modifiers held down, from one snapshot of the keyboard state
+int NvimKeyModifiers();
+bool NvimProcessKeyDown(Nvim *nvim, int virtual_key, bool is_repeat);
+// The dropped files are collected on a worker thread, which posts WM_NVIM_FILES_DROPPED
+// once it is done. The files are then opened with a single batch of calls.
+struct NvimDroppedFiles;
+void NvimDropFiles(Nvim *nvim, HDROP drop, int row, int col);
+void NvimSendDroppedFiles(Nvim *nvim, NvimDroppedFiles *files);
 void NvimSetFocus(Nvim *nvim);
 void NvimKillFocus(Nvim *nvim);
 void NvimQuit(Nvim *nvim);
@@ -0,0 +1,114 @@
+#include "paste_stream.h"
+#include <cstdlib>
+
+void PasteStreamDestroy(PasteStream *stream) {
+	free(stream->data);
+	stream->data = nullptr;
+	stream->size = 0;
+	stream->capacity = 0;
+	stream->offset = 0;
+	stream->active = false;
+}
+
+char *PasteStreamReserve(PasteStream *stream, size_t size) {
+	if (stream->active) {
+		return nullptr;
+	}
+
+	if (size > stream->capacity) {
+		free(stream->data);
+		stream->data = static_cast<char *>(malloc(size));
+		stream->capacity = size;
+	}
+	return stream->data;
+}
+
+void PasteStreamBegin(PasteStream *stream, size_t size, uint64_t now_us) {
+	stream->size = size;
+	stream->offset = 0;
+	stream->active = size > 0;
+	stream->cancelled = false;
+	stream->failed = false;
+	stream->chunks_in_flight = 0;
+	stream->started_us = now_us;
+}
+
+static bool IsUtf8Continuation(char c) {
+	return (static_cast<uint8_t>(c) & 0xC0) == 0x80;
+}
+
+static size_t ChunkEnd(const PasteStream *stream) {
+	size_t end = stream->offset + PASTE_CHUNK_SIZE;
+	if (end >= stream->size) {
+		return stream->size;
+	}
+
+	// Prefer ending the chunk after a line break in its last quarter
+	for (size_t i = end; i > end - PASTE_CHUNK_SIZE / 4; --i) {
+		if (stream->data[i - 1] == '\n') {
+			return i;
+		}
+	}
+
+	while (end > stream->offset + 1 &&
+		(IsUtf8Continuation(stream->data[end]) || (stream->data[end - 1] == '\r' && stream->data[end] == '\n'))) {
+		end -= 1;
+	}
+	return end;
+}
+
+bool PasteStreamNextChunk(PasteStream *stream, std::string_view *chunk, PastePhase *phase) {
+	if (!stream->active || stream->cancelled || stream->offset == stream->size ||
+		stream->chunks_in_flight == PASTE_MAX_CHUNKS_IN_FLIGHT) {
+		return false;
+	}
+
+	size_t start = stream->offset;
+	size_t end = ChunkEnd(stream);
+	if (start == 0) {
+		*phase = end == stream->size ? PASTE_PHASE_SINGLE : PASTE_PHASE_START;
+	}
+	else {
+		*phase = end == stream->size ? PASTE_PHASE_END : PASTE_PHASE_CONTINUE;
+	}
+
+	*chunk = std::string_view(stream->data + start, end - start);
+	stream->offset = end;
+	stream->chunks_in_flight += 1;
+	stream->chunks_sent += 1;
+	return true;
+}
+
+bool PasteStreamChunkDone(PasteStream *stream, PasteChunkStatus status, uint64_t now_us) {
+	if (!stream->active) {
+		return false;
+	}
+
+	stream->chunks_in_flight -= 1;
+	if (status != PasteChunkStatus::Accepted) {
+		stream->cancelled = true;
+	}
+	if (status == PasteChunkStatus::Failed) {
+		stream->failed = true;
+	}
+	if (stream->chunks_in_flight > 0 || (!stream->cancelled && stream->offset < stream->size)) {
+		return false;
+	}
+
+	stream->active = false;
+	stream->pastes += 1;
+	stream->last_paste_size = stream->offset;
+	stream->last_paste_us = now_us - stream->started_us;
+	return true;
+}
+
+bool PasteStreamNeedsEnd(const PasteStream *stream) {
+	return !stream->active && stream->failed && stream->offset < stream->size;
+}
+
+double PasteStreamThroughput(const PasteStream *stream) {
+	if (stream->last_paste_us == 0) {
+		return 0.0;
+	}
+	return static_cast<double>(stream->last_paste_size) * 1000000.0 / static_cast<double>(stream->last_paste_us);
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Chunks are cut at a line break near this size where there is one
+constexpr size_t PASTE_CHUNK_SIZE = 64 * 1024;
+// Chunks sent but not yet answered by nvim
+constexpr int PASTE_MAX_CHUNKS_IN_FLIGHT = 2;
+
+// nvim_paste phases, a paste that fits into one chunk is sent as a single call
+enum PastePhase : int {
+	PASTE_PHASE_SINGLE = -1,
+	PASTE_PHASE_START = 1,
+	PASTE_PHASE_CONTINUE = 2,
+	PASTE_PHASE_END = 3
+};
+
+// How nvim_paste answered a chunk. Cancelled is nvim answering false, which
+// ends the paste on its side. Failed is an error response or a timeout, after
+// which nvim still waits for the rest of the paste.
+enum class PasteChunkStatus {
+	Accepted,
+	Cancelled,
+	Failed
+};
+
+// Streams a large paste to nvim in chunks through nvim_paste. A new chunk is
+// only handed out once nvim answered an earlier one, so a paste never piles
+// up in the outbound queue, and nvim can cancel a paste by answering false.
+// Chunks never split a UTF-8 sequence or a CRLF pair.
+struct PasteStream {
+	char *data;
+	size_t size;
+	size_t capacity;
+	size_t offset;
+	bool active;
+	bool cancelled;
+	bool failed;
+	int chunks_in_flight;
+	uint64_t started_us;
+
+	uint64_t pastes;
+	uint64_t chunks_sent;
+	uint64_t last_paste_size;
+	uint64_t last_paste_us;
+};
+
+void PasteStreamDestroy(PasteStream *stream);
+
+// Returns a buffer to convert the text to paste into, or nullptr if a paste is still in progress
+char *PasteStreamReserve(PasteStream *stream, size_t size);
+void PasteStreamBegin(PasteStream *stream, size_t size, uint64_t now_us);
+
+// Returns false when no chunk may be sent right now
+bool PasteStreamNextChunk(PasteStream *stream, std::string_view *chunk, PastePhase *phase);
+// Returns true if this completed the paste
+bool PasteStreamChunkDone(PasteStream *stream, PasteChunkStatus status, uint64_t now_us);
+// True once a paste failed before its last chunk was sent, nvim then has to
+// be sent an empty PASTE_PHASE_END chunk to close the paste
+bool PasteStreamNeedsEnd(const PasteStream *stream);
+
+// Throughput of the last completed paste in bytes per second
+double PasteStreamThroughput(const PasteStream *stream);
@@ -0,0 +1,357 @@
+#include "redraw_commands.h"
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include "common/utf8.h"
+#include "nvim/redraw_decoder.h"
+
+void RedrawCommandBufferClear(RedrawCommandBuffer *buffer) {
+	buffer->size = 0;
+	buffer->command_count = 0;
+}
+
+void RedrawCommandBufferDestroy(RedrawCommandBuffer *buffer) {
+	free(buffer->data);
+	*buffer = RedrawCommandBuffer {};
+}
+
+void *RedrawCommandBufferPush(RedrawCommandBuffer *buffer, RedrawCommandType type, size_t payload_size) {
+	size_t command_size = sizeof(RedrawCommand) + payload_size;
+	command_size = (command_size + REDRAW_COMMAND_ALIGNMENT - 1) & ~(REDRAW_COMMAND_ALIGNMENT - 1);
+
+	if (buffer->size + command_size > buffer->capacity) {
+		size_t new_capacity = buffer->capacity ? buffer->capacity : 4096;
+		while (new_capacity < buffer->size + command_size) {
+			new_capacity *= 2;
+		}
+		buffer->data = static_cast<uint8_t *>(realloc(buffer->data, new_capacity));
+		buffer->capacity = new_capacity;
+	}
+
+	RedrawCommand *command = reinterpret_cast<RedrawCommand *>(buffer->data + buffer->size);
+	command->type = type;
+	command->size = static_cast<uint32_t>(command_size);
+	memset(command + 1, 0, command_size - sizeof(RedrawCommand));
+
+	buffer->size += command_size;
+	buffer->command_count += 1;
+	return command + 1;
+}
+
+static int32_t ArrayInt(mpack_node_t array, size_t index) {
+	return static_cast<int32_t>(mpack_node_array_at(array, index).data->value.i);
+}
+
+static bool StringIs(mpack_node_t node, const char *str) {
+	return node.data->type == mpack_type_str &&
+		mpack_node_strlen(node) == strlen(str) &&
+		memcmp(mpack_node_str(node), str, mpack_node_strlen(node)) == 0;
+}
+
+static void PushString(RedrawCommandBuffer *buffer, RedrawCommandType type, mpack_node_t str) {
+	if (str.data->type != mpack_type_str) {
+		return;
+	}
+
+	uint32_t length = static_cast<uint32_t>(mpack_node_strlen(str));
+	StringCommand *command = static_cast<StringCommand *>(
+		RedrawCommandBufferPush(buffer, type, sizeof(StringCommand) + length));
+	command->length = length;
+	memcpy(StringCommandText(command), mpack_node_str(str), length);
+}
+
+// The size of the cell text stored as a cluster, 0 for a single codepoint
+static size_t ClusterSize(mpack_node_t text) {
+	const char *str = mpack_node_str(text);
+	size_t length = mpack_node_strlen(text);
+	uint32_t codepoint;
+	size_t size = Utf8DecodeCodepoint(str, length, &codepoint);
+	if (size == length) {
+		return 0;
+	}
+
+	// Cut after the last whole codepoint that fits
+	while (size < length) {
+		size_t next_size = Utf8DecodeCodepoint(str + size, length - size, &codepoint);
+		if (size + next_size > REDRAW_CELL_MAX_CLUSTER_SIZE) {
+			break;
+		}
+		size += next_size;
+	}
+	return size;
+}
+
+static void DecodeGridLine(RedrawCommandBuffer *buffer, mpack_node_t grid_line) {
+	mpack_node_t cell_array = mpack_node_array_at(grid_line, 3);
+	size_t cell_count = mpack_node_array_length(cell_array);
+
+	// Single chars take a single byte, only longer text can be a cluster
+	size_t cluster_text_size = 0;
+	for (size_t i = 0; i < cell_count; ++i) {
+		mpack_node_t text = mpack_node_array_at(mpack_node_array_at(cell_array, i), 0);
+		if (mpack_node_strlen(text) > 1) {
+			size_t cluster_size = ClusterSize(text);
+			cluster_text_size += cluster_size ? 1 + cluster_size : 0;
+		}
+	}
+
+	GridLineCommand *command = static_cast<GridLineCommand *>(RedrawCommandBufferPush(buffer,
+		RedrawCommandType::GridLine, sizeof(GridLineCommand) + cell_count * sizeof(RedrawCell) + cluster_text_size));
+	command->row = ArrayInt(grid_line, 1);
+	command->col_start = ArrayInt(grid_line, 2);
+	command->cell_count = static_cast<uint32_t>(cell_count);
+	command->cluster_text_size = static_cast<uint32_t>(cluster_text_size);
+
+	RedrawCell *cells = GridLineCells(command);
+	char *cluster_text = GridLineClusterText(command);
+	uint32_t cluster_offset = 0;
+	uint16_t hl_attrib_id = 0;
+	for (size_t i = 0; i < cell_count; ++i) {
+		mpack_node_t cell = mpack_node_array_at(cell_array, i);
+		size_t cell_length = mpack_node_array_length(cell);
+
+		if (cell_length > 1) {
+			hl_attrib_id = static_cast<uint16_t>(ArrayInt(cell, 1));
+		}
+		int32_t repeat = 1;
+		if (cell_length > 2) {
+			repeat = ArrayInt(cell, 2);
+		}
+
+		// An empty string is the right half of a wide char
+		mpack_node_t text = mpack_node_array_at(cell, 0);
+		uint32_t codepoint = REDRAW_CELL_WIDE_CHAR_CONTINUATION;
+		size_t cluster_size = mpack_node_strlen(text) > 1 ? ClusterSize(text) : 0;
+		if (cluster_size) {
+			codepoint = REDRAW_CELL_CLUSTER | cluster_offset;
+			cluster_text[cluster_offset] = static_cast<char>(cluster_size);
+			memcpy(&cluster_text[cluster_offset + 1], mpack_node_str(text), cluster_size);
+			cluster_offset += static_cast<uint32_t>(1 + cluster_size);
+		}
+		else if (mpack_node_strlen(text) > 0) {
+			Utf8DecodeCodepoint(mpack_node_str(text), mpack_node_strlen(text), &codepoint);
+		}
+
+		cells[i] = RedrawCell {
+			.codepoint = codepoint,
+			.hl_attrib_id = hl_attrib_id,
+			.repeat = static_cast<uint16_t>(repeat)
+		};
+	}
+}
+
+static void DecodeHighlightAttributes(RedrawCommandBuffer *buffer, mpack_node_t hl_attr_define) {
+	HlAttrDefineCommand *command = static_cast<HlAttrDefineCommand *>(
+		RedrawCommandBufferPush(buffer, RedrawCommandType::HlAttrDefine, sizeof(HlAttrDefineCommand)));
+	command->id = static_cast<uint32_t>(ArrayInt(hl_attr_define, 0));
+
+	mpack_node_t attrib_map = mpack_node_array_at(hl_attr_define, 1);
+	const auto GetColor = [&](const char *name) {
+		mpack_node_t color_node = mpack_node_map_cstr_optional(attrib_map, name);
+		return mpack_node_is_missing(color_node) ? DEFAULT_COLOR : static_cast<uint32_t>(color_node.data->value.u);
+	};
+	command->foreground = GetColor("foreground");
+	command->background = GetColor("background");
+	command->special = GetColor("special");
+
+	const auto GetFlag = [&](const char *flag_name, HighlightAttributeFlags flag) {
+		mpack_node_t flag_node = mpack_node_map_cstr_optional(attrib_map, flag_name);
+		if (!mpack_node_is_missing(flag_node)) {
+			command->flags_mask |= flag;
+			if (flag_node.data->value.b) {
+				command->flags |= flag;
+			}
+		}
+	};
+	GetFlag("reverse", HL_ATTRIB_REVERSE);
+	GetFlag("italic", HL_ATTRIB_ITALIC);
+	GetFlag("bold", HL_ATTRIB_BOLD);
+	GetFlag("strikethrough", HL_ATTRIB_STRIKETHROUGH);
+	GetFlag("underline", HL_ATTRIB_UNDERLINE);
+	GetFlag("undercurl", HL_ATTRIB_UNDERCURL);
+}
+
+static void DecodeModeInfos(RedrawCommandBuffer *buffer, mpack_node_t mode_info_set) {
+	ModeInfoSetCommand *command = static_cast<ModeInfoSetCommand *>(
+		RedrawCommandBufferPush(buffer, RedrawCommandType::ModeInfoSet, sizeof(ModeInfoSetCommand)));
+
+	mpack_node_t mode_infos = mpack_node_array_at(mode_info_set, 1);
+	size_t mode_infos_length = mpack_node_array_length(mode_infos);
+	if (mode_infos_length > MAX_CURSOR_MODE_INFOS) {
+		mode_infos_length = MAX_CURSOR_MODE_INFOS;
+	}
+	command->count = static_cast<uint32_t>(mode_infos_length);
+
+	for (size_t i = 0; i < mode_infos_length; ++i) {
+		mpack_node_t mode_info_map = mpack_node_array_at(mode_infos, i);
+
+		CursorModeInfo *mode_info = &command->mode_infos[i];
+		mode_info->shape = CursorShape::None;
+		mpack_node_t cursor_shape = mpack_node_map_cstr_optional(mode_info_map, "cursor_shape");
+		if (StringIs(cursor_shape, "block")) {
+			mode_info->shape = CursorShape::Block;
+		}
+		else if (StringIs(cursor_shape, "vertical")) {
+			mode_info->shape = CursorShape::Vertical;
+		}
+		else if (StringIs(cursor_shape, "horizontal")) {
+			mode_info->shape = CursorShape::Horizontal;
+		}
+
+		mode_info->hl_attrib_id = 0;
+		mpack_node_t hl_attrib_index = mpack_node_map_cstr_optional(mode_info_map, "attr_id");
+		if (!mpack_node_is_missing(hl_attrib_index)) {
+			mode_info->hl_attrib_id = static_cast<uint16_t>(hl_attrib_index.data->value.i);
+		}
+	}
+}
+
+static void DecodeGridScroll(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	GridScrollCommand *command = static_cast<GridScrollCommand *>(
+		RedrawCommandBufferPush(buffer, RedrawCommandType::GridScroll, sizeof(GridScrollCommand)));
+	command->top = ArrayInt(args, 1);
+	command->bottom = ArrayInt(args, 2);
+	command->left = ArrayInt(args, 3);
+	command->right = ArrayInt(args, 4);
+	command->rows = ArrayInt(args, 5);
+	command->cols = ArrayInt(args, 6);
+}
+
+static void DecodeGridCursorGoto(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	GridCursorGotoCommand *command = static_cast<GridCursorGotoCommand *>(
+		RedrawCommandBufferPush(buffer, RedrawCommandType::GridCursorGoto, sizeof(GridCursorGotoCommand)));
+	command->row = ArrayInt(args, 1);
+	command->col = ArrayInt(args, 2);
+}
+
+static void DecodeGridResize(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	GridResizeCommand *command = static_cast<GridResizeCommand *>(
+		RedrawCommandBufferPush(buffer, RedrawCommandType::GridResize, sizeof(GridResizeCommand)));
+	command->cols = ArrayInt(args, 1);
+	command->rows = ArrayInt(args, 2);
+}
+
+static void DecodeGridClear(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	RedrawCommandBufferPush(buffer, RedrawCommandType::GridClear, 0);
+}
+
+static void DecodeDefaultColors(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	DefaultColorsSetCommand *command = static_cast<DefaultColorsSetCommand *>(
+		RedrawCommandBufferPush(buffer, RedrawCommandType::DefaultColorsSet, sizeof(DefaultColorsSetCommand)));
+	command->foreground = static_cast<uint32_t>(mpack_node_array_at(args, 0).data->value.u);
+	command->background = static_cast<uint32_t>(mpack_node_array_at(args, 1).data->value.u);
+	command->special = static_cast<uint32_t>(mpack_node_array_at(args, 2).data->value.u);
+}
+
+static void DecodeModeChange(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	ModeChangeCommand *command = static_cast<ModeChangeCommand *>(
+		RedrawCommandBufferPush(buffer, RedrawCommandType::ModeChange, sizeof(ModeChangeCommand)));
+	command->mode_index = static_cast<uint32_t>(mpack_node_array_at(args, 1).data->value.u);
+}
+
+static void DecodeOptionSet(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	if (StringIs(mpack_node_array_at(args, 0), "guifont")) {
+		PushString(buffer, RedrawCommandType::GuiFontSet, mpack_node_array_at(args, 1));
+	}
+}
+
+static void DecodeSetTitle(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	PushString(buffer, RedrawCommandType::SetTitle, mpack_node_array_at(args, 0));
+}
+
+static void DecodeBusyStart(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	RedrawCommandBufferPush(buffer, RedrawCommandType::BusyStart, 0);
+}
+
+static void DecodeBusyStop(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	RedrawCommandBufferPush(buffer, RedrawCommandType::BusyStop, 0);
+}
+
+static void DecodeFlush(RedrawCommandBuffer *buffer, mpack_node_t args) {
+	RedrawCommandBufferPush(buffer, RedrawCommandType::Flush, 0);
+}
+
+using RedrawEventDecodeFn = void (*)(RedrawCommandBuffer *buffer, mpack_node_t args);
+struct RedrawEventHandler {
+	std::string_view name;
+	RedrawEventDecodeFn decode;
+};
+constexpr RedrawEventHandler REDRAW_EVENT_HANDLERS[] {
+	{ "grid_line", DecodeGridLine },
+	{ "grid_scroll", DecodeGridScroll },
+	{ "grid_cursor_goto", DecodeGridCursorGoto },
+	{ "grid_resize", DecodeGridResize },
+	{ "grid_clear", DecodeGridClear },
+	{ "hl_attr_define", DecodeHighlightAttributes },
+	{ "default_colors_set", DecodeDefaultColors },
+	{ "mode_info_set", DecodeModeInfos },
+	{ "mode_change", DecodeModeChange },
+	{ "option_set", DecodeOptionSet },
+	{ "set_title", DecodeSetTitle },
+	{ "busy_start", DecodeBusyStart },
+	{ "busy_stop", DecodeBusyStop },
+	{ "flush", DecodeFlush }
+};
+
+// The handlers are laid out in a table indexed by a multiplicative hash of
+// the name length and its first and last char, which are unique among the
+// event names. The multiplier is searched for at compile time so that no
+// two handlers share a slot, a lookup is then a single hash and compare.
+constexpr uint32_t REDRAW_EVENT_TABLE_BITS = 6;
+constexpr uint32_t REDRAW_EVENT_TABLE_SIZE = 1 << REDRAW_EVENT_TABLE_BITS;
+
+constexpr uint32_t RedrawEventSlot(const char *name, size_t length, uint32_t multiplier) {
+	uint32_t key = static_cast<uint32_t>(length) |
+		(static_cast<uint32_t>(static_cast<uint8_t>(name[0])) << 8) |
+		(static_cast<uint32_t>(static_cast<uint8_t>(name[length - 1])) << 16);
+	return (key * multiplier) >> (32 - REDRAW_EVENT_TABLE_BITS);
+}
+
+constexpr uint32_t FindRedrawEventMultiplier() {
+	for (uint32_t multiplier = 0x9E3779B1; multiplier != 0; multiplier += 2) {
+		bool taken[REDRAW_EVENT_TABLE_SIZE] {};
+		bool collision = false;
+		for (const RedrawEventHandler &handler : REDRAW_EVENT_HANDLERS) {
+			uint32_t slot = RedrawEventSlot(handler.name.data(), handler.name.size(), multiplier);
+			if (taken[slot]) {
+				collision = true;
+				break;
+			}
+			taken[slot] = true;
+		}
+		if (!collision) {
+			return multiplier;
+		}
+	}
+	return 0;
+}
+constexpr uint32_t REDRAW_EVENT_MULTIPLIER = FindRedrawEventMultiplier();
+static_assert(REDRAW_EVENT_MULTIPLIER != 0, "Redraw event names have no perfect hash");
+
+struct RedrawEventTable {
+	RedrawEventHandler slots[REDRAW_EVENT_TABLE_SIZE];
+};
+constexpr RedrawEventTable BuildRedrawEventTable() {
+	RedrawEventTable table {};
+	for (const RedrawEventHandler &handler : REDRAW_EVENT_HANDLERS) {
+		table.slots[RedrawEventSlot(handler.name.data(), handler.name.size(), REDRAW_EVENT_MULTIPLIER)] = handler;
+	}
+	return table;
+}
+constexpr RedrawEventTable REDRAW_EVENT_TABLE = BuildRedrawEventTable();
+
+RedrawDecodeResult RedrawCommandsDecodeEvent(RedrawCommandBuffer *buffer, RedrawEvent *event) {
+	// Overlong names were truncated by the decoder and never match
+	size_t length = event->name_length;
+	if (length == 0 || length >= MAX_REDRAW_EVENT_NAME_LENGTH) {
+		return RedrawDecodeResult::Unhandled;
+	}
+
+	const RedrawEventHandler &handler = REDRAW_EVENT_TABLE.slots[RedrawEventSlot(event->name, length, REDRAW_EVENT_MULTIPLIER)];
+	if (handler.name.size() != length || memcmp(handler.name.data(), event->name, length) != 0) {
+		return RedrawDecodeResult::Unhandled;
+	}
+
+	handler.decode(buffer, event->args);
+	return handler.decode == DecodeFlush ? RedrawDecodeResult::Flush : RedrawDecodeResult::Decoded;
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+struct RedrawEvent;
+
+constexpr uint32_t DEFAULT_COLOR = 0x46464646;
+enum HighlightAttributeFlags : uint16_t {
+	HL_ATTRIB_REVERSE			= 1 << 0,
+	HL_ATTRIB_ITALIC			= 1 << 1,
+	HL_ATTRIB_BOLD				= 1 << 2,
+	HL_ATTRIB_STRIKETHROUGH		= 1 << 3,
+	HL_ATTRIB_UNDERLINE			= 1 << 4,
+	HL_ATTRIB_UNDERCURL			= 1 << 5
+};
+struct HighlightAttributes {
+	uint32_t foreground;
+	uint32_t background;
+	uint32_t special;
+	uint16_t flags;
+};
+
+enum class CursorShape {
+	None,
+	Block,
+	Vertical,
+	Horizontal
+};
+struct CursorModeInfo {
+	CursorShape shape;
+	uint16_t hl_attrib_id;
+};
+constexpr int MAX_CURSOR_MODE_INFOS = 64;
+
+// Redraw events decoded off the UI thread into plain structs. A batch is a
+// flat byte buffer of commands, each a RedrawCommand header followed by the
+// payload struct of its type, padded to REDRAW_COMMAND_ALIGNMENT.
+enum class RedrawCommandType : uint8_t {
+	GuiFontSet,
+	GridResize,
+	GridClear,
+	DefaultColorsSet,
+	HlAttrDefine,
+	GridLine,
+	GridCursorGoto,
+	ModeInfoSet,
+	ModeChange,
+	SetTitle,
+	BusyStart,
+	BusyStop,
+	GridScroll,
+	Flush
+};
+constexpr size_t REDRAW_COMMAND_ALIGNMENT = 8;
+struct RedrawCommand {
+	RedrawCommandType type;
+	uint32_t size;
+};
+
+// The cell text is decoded to its codepoint, the right half of a wide char
+// is stored as REDRAW_CELL_WIDE_CHAR_CONTINUATION. Text of more than one
+// codepoint, a char with combining marks, emoji joined by ZWJs or with a skin
+// tone, a flag, is a cluster. Its UTF-8 goes after the cells of the line,
+// preceded by a byte holding its size, and the cell holds REDRAW_CELL_CLUSTER
+// or'ed with its offset there. Clusters are cut to REDRAW_CELL_MAX_CLUSTER_SIZE
+// bytes, the most nvim puts into a cell. The hl id is resolved, cells that
+// omit it carry the one inherited from the left.
+constexpr uint32_t REDRAW_CELL_WIDE_CHAR_CONTINUATION = 0;
+constexpr uint32_t REDRAW_CELL_CLUSTER = 0x80000000;
+constexpr size_t REDRAW_CELL_MAX_CLUSTER_SIZE = 32;
+struct RedrawCell {
+	uint32_t codepoint;
+	uint16_t hl_attrib_id;
+	uint16_t repeat;
+};
+struct GridLineCommand {
+	int32_t row;
+	int32_t col_start;
+	uint32_t cell_count;
+	uint32_t cluster_text_size;
+	// RedrawCell cells[cell_count];
+	// char cluster_text[cluster_text_size];
+};
+inline RedrawCell *GridLineCells(GridLineCommand *command) {
+	return reinterpret_cast<RedrawCell *>(command + 1);
+}
+inline char *GridLineClusterText(GridLineCommand *command) {
+	return reinterpret_cast<char *>(GridLineCells(command) + command->cell_count);
+}
+
+struct GridResizeCommand {
+	int32_t cols;
+	int32_t rows;
+};
+struct GridCursorGotoCommand {
+	int32_t row;
+	int32_t col;
+};
+struct GridScrollCommand {
+	int32_t top;
+	int32_t bottom;
+	int32_t left;
+	int32_t right;
+	int32_t rows;
+	int32_t cols;
+};
+struct DefaultColorsSetCommand {
+	uint32_t foreground;
+	uint32_t background;
+	uint32_t special;
+};
+// Only the flags in flags_mask were present in the definition
+struct HlAttrDefineCommand {
+	uint32_t id;
+	uint32_t foreground;
+	uint32_t background;
+	uint32_t special;
+	uint16_t flags;
+	uint16_t flags_mask;
+};
+struct ModeInfoSetCommand {
+	uint32_t count;
+	CursorModeInfo mode_infos[MAX_CURSOR_MODE_INFOS];
+};
+struct ModeChangeCommand {
+	uint32_t mode_index;
+};
+// UTF-8 text follows the struct, used by GuiFontSet and SetTitle
+struct StringCommand {
+	uint32_t length;
+	// char text[length];
+};
+inline char *StringCommandText(StringCommand *command) {
+	return reinterpret_cast<char *>(command + 1);
+}
+
+// A batch of redraw commands is handed over once it reaches this size,
+// even if nvim hasn't flushed yet
+constexpr size_t REDRAW_COMMAND_BATCH_SIZE = 64 * 1024;
+struct RedrawCommandBuffer {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+	size_t command_count;
+};
+
+void RedrawCommandBufferClear(RedrawCommandBuffer *buffer);
+void RedrawCommandBufferDestroy(RedrawCommandBuffer *buffer);
+// Appends a command and returns its zeroed payload
+void *RedrawCommandBufferPush(RedrawCommandBuffer *buffer, RedrawCommandType type, size_t payload_size);
+
+inline RedrawCommand *RedrawCommandsBegin(RedrawCommandBuffer *buffer) {
+	return buffer->size ? reinterpret_cast<RedrawCommand *>(buffer->data) : nullptr;
+}
+inline RedrawCommand *RedrawCommandsNext(RedrawCommandBuffer *buffer, RedrawCommand *command) {
+	uint8_t *next = reinterpret_cast<uint8_t *>(command) + command->size;
+	return next < buffer->data + buffer->size ? reinterpret_cast<RedrawCommand *>(next) : nullptr;
+}
+template<typename T>
+inline T *RedrawCommandPayload(RedrawCommand *command) {
+	return reinterpret_cast<T *>(command + 1);
+}
+
+enum class RedrawDecodeResult {
+	Decoded,
+	// A flush ends the batch
+	Flush,
+	// Events the renderer doesn't use are dropped
+	Unhandled
+};
+// Decodes a single redraw event call into commands appended to the buffer.
+// The event name is looked up in a perfect hash table built at compile time.
+RedrawDecodeResult RedrawCommandsDecodeEvent(RedrawCommandBuffer *buffer, RedrawEvent *event);
@@ -0,0 +1,40 @@
+#include "redraw_decoder.h"
+#include <cstring>
+
+bool RedrawDecoderRun(MPackStream *stream, uint32_t event_count, RedrawEventFn event_fn, void *context) {
+	RedrawEvent event {};
+	for (uint32_t i = 0; i < event_count; ++i) {
+		// [name, args1, args2, ...]
+		uint32_t event_length;
+		if (!MPackStreamReadArrayHeader(stream, &event_length) || event_length == 0) {
+			return false;
+		}
+
+		const char *name;
+		uint32_t name_length;
+		if (!MPackStreamReadString(stream, &name, &name_length)) {
+			return false;
+		}
+		// Overlong names are kept at their real length so they never match
+		size_t copy_length = name_length < MAX_REDRAW_EVENT_NAME_LENGTH ? name_length : MAX_REDRAW_EVENT_NAME_LENGTH - 1;
+		memcpy(event.name, name, copy_length);
+		event.name[copy_length] = '\0';
+		event.name_length = name_length;
+
+		for (uint32_t j = 1; j < event_length; ++j) {
+			MPackFrame args_frame;
+			if (!MPackStreamNextFrame(stream, &args_frame)) {
+				return false;
+			}
+			mpack_tree_t *args_tree = MPackStreamParseFrame(stream, &args_frame);
+			if (!args_tree) {
+				return false;
+			}
+			event.args = mpack_tree_root(args_tree);
+			if (!event_fn(context, &event)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "common/mpack_stream.h"
+
+constexpr size_t MAX_REDRAW_EVENT_NAME_LENGTH = 64;
+
+// A single call of a redraw event, e.g. one line of a grid_line event
+struct RedrawEvent {
+	char name[MAX_REDRAW_EVENT_NAME_LENGTH];
+	size_t name_length;
+	mpack_node_t args;
+};
+// Returning false stops decoding
+using RedrawEventFn = bool (*)(void *context, RedrawEvent *event);
+
+inline bool RedrawEventIs(const RedrawEvent *event, const char *name) {
+	return event->name_length == strlen(name) && memcmp(event->name, name, event->name_length) == 0;
+}
+
+// Decodes the params of a redraw notification that has been opened with
+// MPackStreamBeginNotification, emitting every event call as soon as its
+// bytes have arrived. Only a single call is held in memory at a time, so
+// the size of the batch doesn't matter. The args are parsed into the
+// stream's node pool and only valid for the duration of the callback.
+bool RedrawDecoderRun(MPackStream *stream, uint32_t event_count, RedrawEventFn event_fn, void *context);
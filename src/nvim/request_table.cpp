@@ -0,0 +1,116 @@
+#include "request_table.h"
+
+static mpack_node_t NilNode() {
+	static mpack_node_data_t nil_data { .type = mpack_type_nil };
+	return mpack_node_t { .data = &nil_data, .tree = nullptr };
+}
+
+static void FreeSlot(RequestTable *table, RequestSlot *slot) {
+	slot->in_use = false;
+	slot->generation = (slot->generation + 1) & REQUEST_TABLE_GENERATION_MASK;
+	table->in_flight -= 1;
+}
+
+static void TimeOut(RequestTable *table, RequestSlot *slot) {
+	RequestCallback callback = slot->callback;
+	void *context = slot->context;
+	FreeSlot(table, slot);
+
+	table->timed_out += 1;
+	if (callback) {
+		callback(context, RequestStatus::TimedOut, NilNode());
+	}
+}
+
+uint32_t RequestTableRegister(RequestTable *table, uint8_t method, RequestCallback callback,
+	void *context, uint64_t now_us, uint64_t timeout_us) {
+	if (table->in_flight == REQUEST_TABLE_SIZE) {
+		RequestSlot *oldest = &table->slots[0];
+		for (RequestSlot &slot : table->slots) {
+			if (slot.sent_at_us < oldest->sent_at_us) {
+				oldest = &slot;
+			}
+		}
+		table->evicted += 1;
+		TimeOut(table, oldest);
+	}
+
+	uint32_t index = table->next_slot;
+	while (table->slots[index].in_use) {
+		index = (index + 1) & (REQUEST_TABLE_SIZE - 1);
+	}
+	table->next_slot = (index + 1) & (REQUEST_TABLE_SIZE - 1);
+
+	RequestSlot *slot = &table->slots[index];
+	slot->in_use = true;
+	slot->method = method;
+	slot->callback = callback;
+	slot->context = context;
+	slot->sent_at_us = now_us;
+	slot->deadline_us = timeout_us == REQUEST_NO_DEADLINE ? REQUEST_NO_DEADLINE : now_us + timeout_us;
+	table->in_flight += 1;
+
+	return (slot->generation << REQUEST_TABLE_SLOT_BITS) | index;
+}
+
+bool RequestTableComplete(RequestTable *table, uint32_t msg_id, mpack_node_t error,
+	mpack_node_t result, uint64_t now_us) {
+	RequestSlot *slot = &table->slots[msg_id & (REQUEST_TABLE_SIZE - 1)];
+	if (!slot->in_use || slot->generation != (msg_id >> REQUEST_TABLE_SLOT_BITS)) {
+		table->stale_responses += 1;
+		return false;
+	}
+
+	uint64_t latency_us = now_us - slot->sent_at_us;
+	table->completed += 1;
+	table->total_latency_us += latency_us;
+	if (latency_us > table->max_latency_us) {
+		table->max_latency_us = latency_us;
+	}
+	table->last_latency_us[slot->method] = latency_us;
+
+	int bucket = 0;
+	while (bucket < REQUEST_LATENCY_BUCKET_COUNT - 1 && (latency_us >> (bucket + REQUEST_LATENCY_MIN_BUCKET_SHIFT)) != 0) {
+		bucket += 1;
+	}
+	table->latency_histogram[bucket] += 1;
+
+	RequestCallback callback = slot->callback;
+	void *context = slot->context;
+	FreeSlot(table, slot);
+
+	bool is_error = error.data->type != mpack_type_nil;
+	if (is_error) {
+		table->failed += 1;
+	}
+	if (callback) {
+		callback(context, is_error ? RequestStatus::Error : RequestStatus::Success, is_error ? error : result);
+	}
+	return true;
+}
+
+void RequestTableExpire(RequestTable *table, uint64_t now_us) {
+	if (table->in_flight == 0) {
+		return;
+	}
+
+	for (RequestSlot &slot : table->slots) {
+		if (slot.in_use && slot.deadline_us <= now_us) {
+			TimeOut(table, &slot);
+		}
+	}
+}
+
+uint64_t RequestTableNextDeadline(RequestTable *table) {
+	uint64_t next_deadline = REQUEST_NO_DEADLINE;
+	if (table->in_flight == 0) {
+		return next_deadline;
+	}
+
+	for (RequestSlot &slot : table->slots) {
+		if (slot.in_use && slot.deadline_us < next_deadline) {
+			next_deadline = slot.deadline_us;
+		}
+	}
+	return next_deadline;
+}
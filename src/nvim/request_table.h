@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "third_party/mpack/mpack.h"
+
+// The low bits of a msg id select the slot, the rest is the slot's
+// generation, so responses to a slot's previous occupants never match
+constexpr uint32_t REQUEST_TABLE_SLOT_BITS = 8;
+constexpr uint32_t REQUEST_TABLE_SIZE = 1 << REQUEST_TABLE_SLOT_BITS;
+constexpr uint32_t REQUEST_TABLE_GENERATION_MASK = 0xFFFFFFFF >> REQUEST_TABLE_SLOT_BITS;
+constexpr uint64_t REQUEST_NO_DEADLINE = UINT64_MAX;
+constexpr int REQUEST_MAX_METHODS = 256;
+// Round trip times are bucketed by powers of two, starting at 64us
+constexpr int REQUEST_LATENCY_BUCKET_COUNT = 16;
+constexpr int REQUEST_LATENCY_MIN_BUCKET_SHIFT = 6;
+
+enum class RequestStatus {
+	Success,
+	Error,
+	TimedOut
+};
+// result holds the error object for RequestStatus::Error and is nil on timeout
+using RequestCallback = void (*)(void *context, RequestStatus status, mpack_node_t result);
+
+struct RequestSlot {
+	uint32_t generation;
+	bool in_use;
+	uint8_t method;
+	RequestCallback callback;
+	void *context;
+	uint64_t sent_at_us;
+	uint64_t deadline_us;
+};
+
+// Fixed size table of in-flight requests, so tracking requests costs the
+// same amount of memory no matter how long the session lasts
+struct RequestTable {
+	RequestSlot slots[REQUEST_TABLE_SIZE];
+	uint32_t next_slot;
+	uint32_t in_flight;
+
+	uint64_t completed;
+	uint64_t failed;
+	uint64_t timed_out;
+	uint64_t evicted;
+	uint64_t stale_responses;
+	uint64_t total_latency_us;
+	uint64_t max_latency_us;
+	uint64_t last_latency_us[REQUEST_MAX_METHODS];
+	uint64_t latency_histogram[REQUEST_LATENCY_BUCKET_COUNT];
+};
+
+// Returns the msg id to send the request with. If every slot is taken the
+// oldest request is timed out early to make room.
+uint32_t RequestTableRegister(RequestTable *table, uint8_t method, RequestCallback callback,
+	void *context, uint64_t now_us, uint64_t timeout_us);
+
+// Matches a response to its request and runs the request's callback.
+// Returns false for responses with an unknown or outdated msg id.
+bool RequestTableComplete(RequestTable *table, uint32_t msg_id, mpack_node_t error,
+	mpack_node_t result, uint64_t now_us);
+
+// Times out every request whose deadline has passed
+void RequestTableExpire(RequestTable *table, uint64_t now_us);
+uint64_t RequestTableNextDeadline(RequestTable *table);
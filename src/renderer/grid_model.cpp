@@ -0,0 +1,588 @@
+#include "grid_model.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include "common/utf8.h"
+
+// SSE2 is part of x64, elsewhere everything takes the scalar path. Defining
+// GRID_MODEL_SCALAR takes it everywhere, to test the two against each other.
+#if !defined(GRID_MODEL_SCALAR) && \
+	(defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define GRID_MODEL_SSE2
+#include <emmintrin.h>
+#endif
+
+static size_t DirtyWordCount(int rows) {
+	return (static_cast<size_t>(rows) + 63) / 64;
+}
+
+static bool IsRowDirty(GridModel *grid, int row) {
+	return grid->dirty_rows[row / 64] & (uint64_t(1) << (row % 64));
+}
+
+static void AddDirtySpan(GridModel *grid, int row, int start_col, int end_col) {
+	GridSpan *span = &grid->dirty_spans[row];
+	if (IsRowDirty(grid, row)) {
+		span->start = start_col < span->start ? start_col : span->start;
+		span->end = end_col > span->end ? end_col : span->end;
+	}
+	else {
+		grid->dirty_rows[row / 64] |= uint64_t(1) << (row % 64);
+		span->start = start_col;
+		span->end = end_col;
+	}
+}
+
+static void MarkSpanDirty(GridModel *grid, int row, int start_col, int end_col) {
+	AddDirtySpan(grid, row, start_col, end_col);
+	grid->rows_marked += 1;
+}
+
+static void MarkRangeDirty(GridModel *grid, int first_row, int end_row, int start_col, int end_col) {
+	for (int row = first_row; row < end_row; ++row) {
+		MarkSpanDirty(grid, row, start_col, end_col);
+	}
+}
+
+// Repeated cells are common, a blank line is a single cell repeated to the
+// end of the row
+static void FillCells(GridModel *grid, size_t offset, size_t count, uint32_t codepoint, uint16_t attrib) {
+	uint32_t *text = &grid->text[offset];
+	uint16_t *attribs = &grid->attribs[offset];
+	size_t i = 0;
+#ifdef GRID_MODEL_SSE2
+	__m128i text_fill = _mm_set1_epi32(static_cast<int>(codepoint));
+	__m128i attrib_fill = _mm_set1_epi16(static_cast<short>(attrib));
+	for (; i + 8 <= count; i += 8) {
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&text[i]), text_fill);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&text[i + 4]), text_fill);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&attribs[i]), attrib_fill);
+	}
+#endif
+	for (; i < count; ++i) {
+		text[i] = codepoint;
+		attribs[i] = attrib;
+	}
+}
+
+static void BlankCells(GridModel *grid, size_t offset, size_t count) {
+	FillCells(grid, offset, count, GRID_BLANK, 0);
+}
+
+static uint32_t ClusterHash(const char16_t *units, uint32_t length) {
+	uint32_t hash = 2166136261u;
+	for (uint32_t i = 0; i < length; ++i) {
+		hash = (hash ^ units[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static uint32_t ClusterLength(const GridClusters *clusters, uint32_t index) {
+	return clusters->starts[index + 1] - clusters->starts[index];
+}
+
+// Returns the slot holding the cluster, or the empty one it would go into
+static uint16_t *FindClusterSlot(GridClusters *clusters, const char16_t *units, uint32_t length) {
+	for (uint32_t probe = ClusterHash(units, length);; ++probe) {
+		uint16_t *slot = &clusters->slots[probe & (GRID_CLUSTER_SLOT_COUNT - 1)];
+		if (*slot == 0) {
+			return slot;
+		}
+		uint32_t index = *slot - 1u;
+		if (ClusterLength(clusters, index) == length &&
+			memcmp(&clusters->text[clusters->starts[index]], units, length * sizeof(char16_t)) == 0) {
+			return slot;
+		}
+	}
+}
+
+static void ResetClusters(GridClusters *clusters) {
+	clusters->count = 0;
+	if (clusters->slots) {
+		clusters->starts[0] = 0;
+		memset(clusters->slots, 0, GRID_CLUSTER_SLOT_COUNT * sizeof(uint16_t));
+	}
+}
+
+// Drops the clusters no cell holds anymore and renumbers the rest in order
+static void CollectClusters(GridModel *grid) {
+	GridClusters *clusters = &grid->clusters;
+	// Index + 1 of the clusters that are kept, 0 for those that are dropped
+	uint16_t *renumbered = static_cast<uint16_t *>(calloc(clusters->count, sizeof(uint16_t)));
+	size_t cell_count = static_cast<size_t>(grid->rows) * grid->cols;
+	for (size_t i = 0; i < cell_count; ++i) {
+		uint32_t index = grid->text[i] - GRID_FIRST_CLUSTER_ID;
+		if (grid->text[i] >= GRID_FIRST_CLUSTER_ID && index < clusters->count) {
+			renumbered[index] = 1;
+		}
+	}
+
+	uint32_t kept = 0;
+	uint32_t text_size = 0;
+	for (uint32_t index = 0; index < clusters->count; ++index) {
+		if (!renumbered[index]) {
+			continue;
+		}
+		// Moves text to the left only, the start of the next cluster is still in place
+		uint32_t start = clusters->starts[index];
+		uint32_t length = ClusterLength(clusters, index);
+		memmove(&clusters->text[text_size], &clusters->text[start], length * sizeof(char16_t));
+		clusters->starts[kept] = text_size;
+		text_size += length;
+		kept += 1;
+		renumbered[index] = static_cast<uint16_t>(kept);
+	}
+	clusters->starts[kept] = text_size;
+
+	for (size_t i = 0; i < cell_count; ++i) {
+		uint32_t index = grid->text[i] - GRID_FIRST_CLUSTER_ID;
+		if (grid->text[i] >= GRID_FIRST_CLUSTER_ID && index < clusters->count) {
+			grid->text[i] = GRID_FIRST_CLUSTER_ID + renumbered[index] - 1;
+		}
+	}
+	free(renumbered);
+
+	clusters->count = kept;
+	memset(clusters->slots, 0, GRID_CLUSTER_SLOT_COUNT * sizeof(uint16_t));
+	for (uint32_t index = 0; index < kept; ++index) {
+		*FindClusterSlot(clusters, &clusters->text[clusters->starts[index]], ClusterLength(clusters, index)) =
+			static_cast<uint16_t>(index + 1);
+	}
+	clusters->collections += 1;
+}
+
+// Returns the cell text for the UTF-8 of a cluster, its id or, if the table
+// is full of clusters that are all still in the grid, its first codepoint
+static uint32_t InternCluster(GridModel *grid, const char *utf8, size_t size) {
+	char16_t units[GRID_MAX_CLUSTER_UNITS];
+	uint32_t length = 0;
+	uint32_t first_codepoint = UTF8_REPLACEMENT_CHARACTER;
+	for (size_t i = 0; i < size;) {
+		uint32_t codepoint;
+		i += Utf8DecodeCodepoint(&utf8[i], size - i, &codepoint);
+		if (length == 0) {
+			first_codepoint = codepoint;
+		}
+		if (codepoint < 0x10000) {
+			units[length++] = static_cast<char16_t>(codepoint);
+		}
+		else {
+			codepoint -= 0x10000;
+			units[length++] = static_cast<char16_t>(0xD800 + (codepoint >> 10));
+			units[length++] = static_cast<char16_t>(0xDC00 + (codepoint & 0x3FF));
+		}
+	}
+
+	GridClusters *clusters = &grid->clusters;
+	if (!clusters->slots) {
+		clusters->starts = static_cast<uint32_t *>(calloc(GRID_MAX_CLUSTERS + 1, sizeof(uint32_t)));
+		clusters->slots = static_cast<uint16_t *>(calloc(GRID_CLUSTER_SLOT_COUNT, sizeof(uint16_t)));
+	}
+	uint16_t *slot = FindClusterSlot(clusters, units, length);
+	if (*slot) {
+		return GRID_FIRST_CLUSTER_ID + *slot - 1;
+	}
+	if (clusters->count == GRID_MAX_CLUSTERS) {
+		CollectClusters(grid);
+		if (clusters->count == GRID_MAX_CLUSTERS) {
+			clusters->truncated += 1;
+			return first_codepoint;
+		}
+		slot = FindClusterSlot(clusters, units, length);
+	}
+
+	uint32_t start = clusters->starts[clusters->count];
+	if (start + length > clusters->text_capacity) {
+		clusters->text_capacity = clusters->text_capacity ? 2 * clusters->text_capacity : 1024;
+		clusters->text = static_cast<char16_t *>(realloc(clusters->text, clusters->text_capacity * sizeof(char16_t)));
+	}
+	memcpy(&clusters->text[start], units, length * sizeof(char16_t));
+	clusters->count += 1;
+	clusters->starts[clusters->count] = start + length;
+	*slot = static_cast<uint16_t>(clusters->count);
+	return GRID_FIRST_CLUSTER_ID + clusters->count - 1;
+}
+
+// Cell text past the unicode range is either a cluster stored with the line
+// or invalid, which is drawn as a replacement character
+static uint32_t ResolveCellText(GridModel *grid, GridLineCommand *grid_line, uint32_t codepoint) {
+	if (!(codepoint & REDRAW_CELL_CLUSTER)) {
+		return UTF8_REPLACEMENT_CHARACTER;
+	}
+	uint32_t offset = codepoint & ~REDRAW_CELL_CLUSTER;
+	const char *cluster_text = GridLineClusterText(grid_line);
+	if (offset >= grid_line->cluster_text_size) {
+		return UTF8_REPLACEMENT_CHARACTER;
+	}
+	size_t size = static_cast<uint8_t>(cluster_text[offset]);
+	if (size == 0 || size > REDRAW_CELL_MAX_CLUSTER_SIZE || offset + 1 + size > grid_line->cluster_text_size) {
+		return UTF8_REPLACEMENT_CHARACTER;
+	}
+	return InternCluster(grid, &cluster_text[offset + 1], size);
+}
+
+void GridModelDestroy(GridModel *grid) {
+	free(grid->row_index);
+	free(grid->text);
+	free(grid->attribs);
+	free(grid->row_info);
+	free(grid->dirty_rows);
+	free(grid->dirty_spans);
+	free(grid->clusters.starts);
+	free(grid->clusters.text);
+	free(grid->clusters.slots);
+	*grid = GridModel {};
+}
+
+bool GridModelResize(GridModel *grid, int rows, int cols) {
+	if (grid->text && grid->rows == rows && grid->cols == cols) {
+		return false;
+	}
+
+	size_t cell_count = static_cast<size_t>(rows) * cols;
+	GridModel resized {
+		.rows = rows,
+		.cols = cols,
+		.row_index = static_cast<int *>(malloc(rows * sizeof(int))),
+		.text = static_cast<uint32_t *>(malloc(cell_count * sizeof(uint32_t))),
+		.attribs = static_cast<uint16_t *>(malloc(cell_count * sizeof(uint16_t))),
+		.row_info = static_cast<GridRow *>(calloc(rows, sizeof(GridRow))),
+		.dirty_rows = static_cast<uint64_t *>(calloc(DirtyWordCount(rows), sizeof(uint64_t))),
+		.dirty_spans = static_cast<GridSpan *>(calloc(rows, sizeof(GridSpan))),
+		// Cells are copied over with their cluster ids
+		.clusters = grid->clusters,
+		.events_applied = grid->events_applied + 1,
+		.rows_marked = grid->rows_marked,
+		.rows_repainted = grid->rows_repainted,
+		.cells_repainted = grid->cells_repainted
+	};
+	for (int row = 0; row < rows; ++row) {
+		resized.row_index[row] = row;
+	}
+	BlankCells(&resized, 0, cell_count);
+	// Nothing that was drawn lines up with the new size anymore
+	MarkRangeDirty(&resized, 0, rows, 0, cols);
+
+	int kept_rows = rows < grid->rows ? rows : grid->rows;
+	int kept_cols = cols < grid->cols ? cols : grid->cols;
+	for (int row = 0; row < kept_rows; ++row) {
+		memcpy(&resized.text[GridModelOffset(&resized, row, 0)], &grid->text[GridModelOffset(grid, row, 0)],
+			kept_cols * sizeof(uint32_t));
+		memcpy(&resized.attribs[GridModelOffset(&resized, row, 0)], &grid->attribs[GridModelOffset(grid, row, 0)],
+			kept_cols * sizeof(uint16_t));
+		*GridModelRow(&resized, row) = *GridModelRow(grid, row);
+
+		// A wide char cut in half by the new right edge becomes a blank
+		if (kept_cols < grid->cols && kept_cols > 0 &&
+			grid->text[GridModelOffset(grid, row, kept_cols)] == GRID_WIDE_CONTINUATION) {
+			BlankCells(&resized, GridModelOffset(&resized, row, kept_cols - 1), 1);
+		}
+	}
+
+	grid->clusters = GridClusters {};
+	GridModelDestroy(grid);
+	*grid = resized;
+	return true;
+}
+
+void GridModelClear(GridModel *grid) {
+	BlankCells(grid, 0, static_cast<size_t>(grid->rows) * grid->cols);
+	grid->events_applied += 1;
+	memset(grid->row_info, 0, grid->rows * sizeof(GridRow));
+	ResetClusters(&grid->clusters);
+	MarkRangeDirty(grid, 0, grid->rows, 0, grid->cols);
+}
+
+void GridModelApplyLine(GridModel *grid, GridLineCommand *grid_line) {
+	assert(grid_line->row >= 0 && grid_line->row < grid->rows);
+	assert(grid_line->col_start >= 0 && grid_line->col_start <= grid->cols);
+	if (grid_line->row < 0 || grid_line->row >= grid->rows ||
+		grid_line->col_start < 0 || grid_line->col_start > grid->cols) {
+		return;
+	}
+
+	size_t row_start = GridModelOffset(grid, grid_line->row, 0);
+	size_t row_end = row_start + grid->cols;
+	size_t offset = row_start + grid_line->col_start;
+	uint16_t row_flags = 0;
+
+	RedrawCell *cells = GridLineCells(grid_line);
+	for (uint32_t i = 0; i < grid_line->cell_count && offset < row_end; ++i) {
+		RedrawCell *cell = &cells[i];
+		if (cell->codepoint == GRID_WIDE_CONTINUATION) {
+			// The right half of a wide char, grid_line events may be split
+			// between the two halves so the left half is updated here.
+			// The right half itself inherits the hl id of the left one.
+			grid->text[offset] = GRID_WIDE_CONTINUATION;
+			if (offset > row_start) {
+				grid->attribs[offset - 1] |= GRID_CELL_WIDE;
+				grid->attribs[offset] = GridCellHl(grid->attribs[offset - 1]);
+			}
+			else {
+				grid->attribs[offset] = 0;
+			}
+			row_flags |= GRID_ROW_WIDE_CHARS;
+			++offset;
+			continue;
+		}
+
+		// A single width char or the left half of a wide char, in which case
+		// the flag is set once its right half shows up. The cell to the left
+		// can't be the left half of a wide char anymore.
+		if (offset > row_start) {
+			grid->attribs[offset - 1] &= ~GRID_CELL_WIDE;
+		}
+
+		uint32_t codepoint = cell->codepoint;
+		if (codepoint > GRID_MAX_CODEPOINT) {
+			codepoint = ResolveCellText(grid, grid_line, codepoint);
+		}
+		uint16_t attrib = cell->hl_attrib_id <= GRID_MAX_HL_ID ? cell->hl_attrib_id : 0;
+		size_t repeat = cell->repeat;
+		if (repeat > row_end - offset) {
+			repeat = row_end - offset;
+		}
+		FillCells(grid, offset, repeat, codepoint, attrib);
+		if (codepoint > 0xFF) {
+			row_flags |= GRID_ROW_NON_LATIN1;
+		}
+		offset += repeat;
+	}
+
+	// A line covering the whole row tells us everything the row contains
+	GridRow *row_info = GridModelRow(grid, grid_line->row);
+	if (grid_line->col_start == 0 && offset == row_end) {
+		row_info->flags = row_flags;
+	}
+	else {
+		row_info->flags |= row_flags;
+	}
+	// The cell to the left may have lost its wide flag
+	grid->events_applied += 1;
+	int start_col = grid_line->col_start > 0 ? grid_line->col_start - 1 : 0;
+	MarkSpanDirty(grid, grid_line->row, start_col, static_cast<int>(offset - row_start));
+}
+
+void GridModelScroll(GridModel *grid, GridScrollCommand *grid_scroll) {
+	int top = grid_scroll->top;
+	int bottom = grid_scroll->bottom;
+	int left = grid_scroll->left;
+	int right = grid_scroll->right;
+	int rows = grid_scroll->rows;
+
+	// Currently nvim does not support horizontal scrolling,
+	// the parameter is reserved for later use
+	assert(grid_scroll->cols == 0);
+	assert(top >= 0 && bottom <= grid->rows && left >= 0 && right <= grid->cols);
+	if (top < 0 || bottom > grid->rows || left < 0 || right > grid->cols || left >= right) {
+		return;
+	}
+
+	// Scrolling by rows > 0 moves the region up, what the rows it leaves
+	// behind contain doesn't matter as nvim redraws them next
+	grid->events_applied += 1;
+	int moved_rows = bottom - top - abs(rows);
+	if (rows == 0 || moved_rows <= 0) {
+		return;
+	}
+	int destination = rows > 0 ? top : top - rows;
+	int source = rows > 0 ? top + rows : top;
+
+	// Rows are drawn where they were before until they are marked dirty, so
+	// what changed in a row before it moved is still drawn at its new place
+	for (int i = 0; i < moved_rows; ++i) {
+		int row = rows > 0 ? i : moved_rows - 1 - i;
+		int to = destination + row;
+		int from = source + row;
+		// The columns of the region are replaced, those outside it stay dirty
+		GridSpan *span = &grid->dirty_spans[to];
+		if (IsRowDirty(grid, to) && span->start >= left && span->end <= right) {
+			grid->dirty_rows[to / 64] &= ~(uint64_t(1) << (to % 64));
+			*span = GridSpan {};
+		}
+		GridSpan *moved = &grid->dirty_spans[from];
+		int start_col = moved->start > left ? moved->start : left;
+		int end_col = moved->end < right ? moved->end : right;
+		if (IsRowDirty(grid, from) && start_col < end_col) {
+			AddDirtySpan(grid, to, start_col, end_col);
+		}
+	}
+
+	if (left == 0 && right == grid->cols) {
+		// Whole rows of storage are moved by rotating the region's row indices, so the
+		// rows left behind now show what scrolled out, which is as good as anything
+		int *region = &grid->row_index[top];
+		int *first = rows > 0 ? region + rows : region + moved_rows;
+		std::rotate(region, first, &grid->row_index[bottom]);
+		return;
+	}
+
+	// Otherwise the columns are copied row by row, in the order that doesn't
+	// overwrite rows still to be moved
+	int width = right - left;
+	for (int i = 0; i < moved_rows; ++i) {
+		int row = rows > 0 ? i : moved_rows - 1 - i;
+		size_t to = GridModelOffset(grid, destination + row, left);
+		size_t from = GridModelOffset(grid, source + row, left);
+		memcpy(&grid->text[to], &grid->text[from], width * sizeof(uint32_t));
+		memcpy(&grid->attribs[to], &grid->attribs[from], width * sizeof(uint16_t));
+		GridModelRow(grid, destination + row)->flags |= GridModelRow(grid, source + row)->flags;
+	}
+}
+
+void GridModelMarkDirty(GridModel *grid, int row, int start_col, int end_col) {
+	start_col = start_col < 0 ? 0 : start_col;
+	end_col = end_col > grid->cols ? grid->cols : end_col;
+	if (row >= 0 && row < grid->rows && start_col < end_col) {
+		MarkSpanDirty(grid, row, start_col, end_col);
+	}
+}
+
+void GridModelMarkAllDirty(GridModel *grid) {
+	MarkRangeDirty(grid, 0, grid->rows, 0, grid->cols);
+}
+
+bool GridModelDirtySpan(GridModel *grid, int row, int *start_col, int *end_col) {
+	if (row < 0 || row >= grid->rows || !IsRowDirty(grid, row)) {
+		return false;
+	}
+	*start_col = grid->dirty_spans[row].start;
+	*end_col = grid->dirty_spans[row].end;
+	return true;
+}
+
+int GridModelTakeDirtyRow(GridModel *grid, int row, int *start_col, int *end_col) {
+	if (row < 0) {
+		row = 0;
+	}
+	size_t word_count = DirtyWordCount(grid->rows);
+	for (size_t word = row / 64; word < word_count; ++word) {
+		uint64_t bits = grid->dirty_rows[word];
+		// Only rows at or after the start in its word
+		if (word == static_cast<size_t>(row / 64)) {
+			bits &= ~uint64_t(0) << (row % 64);
+		}
+		if (bits) {
+			int bit = std::countr_zero(bits);
+			grid->dirty_rows[word] &= ~(uint64_t(1) << bit);
+			int dirty_row = static_cast<int>(word * 64) + bit;
+			GridSpan *span = &grid->dirty_spans[dirty_row];
+			*start_col = span->start;
+			*end_col = span->end;
+			*span = GridSpan {};
+			grid->rows_repainted += 1;
+			grid->cells_repainted += *end_col - *start_col;
+			return dirty_row;
+		}
+	}
+	return -1;
+}
+
+void GridModelWidenToBlanks(GridModel *grid, int row, int *start_col, int *end_col) {
+	uint32_t *text = &grid->text[GridModelOffset(grid, row, 0)];
+	while (*start_col > 0 && text[*start_col - 1] != GRID_BLANK) {
+		--*start_col;
+	}
+	while (*end_col < grid->cols && text[*end_col] != GRID_BLANK) {
+		++*end_col;
+	}
+}
+
+#ifdef GRID_MODEL_SSE2
+// Writes the text of eight columns if none of them is past the BMP or the right
+// half of a wide char, so each takes a single unit
+static bool WidenBmpRun(const uint32_t *cells, char16_t *text, uint32_t *offsets, uint32_t length) {
+	__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cells));
+	__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cells + 4));
+	__m128i upper_mask = _mm_set1_epi32(static_cast<int>(0xFFFF0000));
+	__m128i zero = _mm_setzero_si128();
+	__m128i bmp = _mm_and_si128(
+		_mm_cmpeq_epi32(_mm_and_si128(low, upper_mask), zero),
+		_mm_cmpeq_epi32(_mm_and_si128(high, upper_mask), zero));
+	__m128i continuation = _mm_or_si128(_mm_cmpeq_epi32(low, zero), _mm_cmpeq_epi32(high, zero));
+	if (_mm_movemask_epi8(_mm_andnot_si128(continuation, bmp)) != 0xFFFF) {
+		return false;
+	}
+
+	// Biased into the signed range so packing doesn't saturate
+	__m128i bias = _mm_set1_epi32(0x8000);
+	__m128i units = _mm_packs_epi32(_mm_sub_epi32(low, bias), _mm_sub_epi32(high, bias));
+	units = _mm_xor_si128(units, _mm_set1_epi16(static_cast<short>(0x8000)));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(text), units);
+
+	__m128i base = _mm_set1_epi32(static_cast<int>(length));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(offsets), _mm_add_epi32(base, _mm_setr_epi32(0, 1, 2, 3)));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(offsets + 4), _mm_add_epi32(base, _mm_setr_epi32(4, 5, 6, 7)));
+	return true;
+}
+#endif
+
+static bool IsCluster(const GridModel *grid, uint32_t codepoint) {
+	return codepoint >= GRID_FIRST_CLUSTER_ID && codepoint - GRID_FIRST_CLUSTER_ID < grid->clusters.count;
+}
+
+uint32_t GridModelRowText(GridModel *grid, int row, int start_col, int end_col,
+	char16_t *text, uint32_t *offsets) {
+	uint32_t *row_text = &grid->text[GridModelOffset(grid, row, 0)];
+	uint32_t length = 0;
+	// Every cluster takes more than one unit
+	bool left_took_more = start_col > 0 && ((row_text[start_col - 1] >= 0x10000 &&
+		row_text[start_col - 1] <= GRID_MAX_CODEPOINT) || IsCluster(grid, row_text[start_col - 1]));
+	int col = start_col;
+#ifdef GRID_MODEL_SSE2
+	int scalar_run = 4;
+#endif
+	while (col < end_col) {
+		int scalar_end = end_col;
+#ifdef GRID_MODEL_SSE2
+		// Eight columns at a time while they are all plain BMP chars. Once that
+		// fails columns take the scalar path for a while, longer each time it
+		// fails again right away, so rows full of wide chars aren't slowed down.
+		int run_start = col;
+		while (col + 8 <= end_col && WidenBmpRun(&row_text[col], &text[length], &offsets[col - start_col], length)) {
+			length += 8;
+			col += 8;
+			left_took_more = false;
+		}
+		scalar_run = col > run_start ? 8 : (scalar_run < 64 ? scalar_run * 2 : 64);
+		scalar_end = col + scalar_run < end_col ? col + scalar_run : end_col;
+#endif
+		for (; col < scalar_end; ++col) {
+			offsets[col - start_col] = length;
+			uint32_t codepoint = row_text[col];
+			if (codepoint == GRID_WIDE_CONTINUATION) {
+				if (!left_took_more) {
+					text[length++] = u'\0';
+				}
+				left_took_more = false;
+				continue;
+			}
+
+			if (IsCluster(grid, codepoint)) {
+				uint32_t index = codepoint - GRID_FIRST_CLUSTER_ID;
+				uint32_t cluster_length = ClusterLength(&grid->clusters, index);
+				memcpy(&text[length], &grid->clusters.text[grid->clusters.starts[index]], cluster_length * sizeof(char16_t));
+				length += cluster_length;
+				left_took_more = true;
+				continue;
+			}
+			if (codepoint > GRID_MAX_CODEPOINT) {
+				codepoint = UTF8_REPLACEMENT_CHARACTER;
+			}
+			if (codepoint < 0x10000) {
+				text[length++] = static_cast<char16_t>(codepoint);
+				left_took_more = false;
+			}
+			else {
+				codepoint -= 0x10000;
+				text[length++] = static_cast<char16_t>(0xD800 + (codepoint >> 10));
+				text[length++] = static_cast<char16_t>(0xDC00 + (codepoint & 0x3FF));
+				left_took_more = true;
+			}
+		}
+	}
+	offsets[end_col - start_col] = length;
+	return length;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "nvim/redraw_commands.h"
+
+// The cell text is a codepoint, the right half of a wide char holds
+// GRID_WIDE_CONTINUATION and its left half has GRID_CELL_WIDE set. Cells
+// whose text is a cluster of codepoints hold GRID_FIRST_CLUSTER_ID plus the
+// index of the cluster's text in the grid's cluster table.
+constexpr uint32_t GRID_WIDE_CONTINUATION = REDRAW_CELL_WIDE_CHAR_CONTINUATION;
+constexpr uint32_t GRID_MAX_CODEPOINT = 0x10FFFF;
+constexpr uint32_t GRID_FIRST_CLUSTER_ID = GRID_MAX_CODEPOINT + 1;
+constexpr uint32_t GRID_BLANK = ' ';
+
+// Identical clusters share an index. Once the table is full the clusters no
+// cell holds anymore are dropped and the rest renumbered, and it is emptied
+// when the grid is cleared. Should the grid itself hold more clusters than
+// fit, new ones are cut to their first codepoint.
+constexpr uint32_t GRID_MAX_CLUSTERS = 4096;
+constexpr uint32_t GRID_CLUSTER_SLOT_COUNT = 2 * GRID_MAX_CLUSTERS;
+// UTF-16 never takes more units than UTF-8 takes bytes
+constexpr uint32_t GRID_MAX_CLUSTER_UNITS = REDRAW_CELL_MAX_CLUSTER_SIZE;
+// The most UTF-16 units GridModelRowText writes for a single column
+constexpr uint32_t GRID_MAX_COLUMN_UNITS = GRID_MAX_CLUSTER_UNITS;
+struct GridClusters {
+	uint32_t count;
+	// Where the UTF-16 text of each cluster starts, count + 1 entries are in use
+	uint32_t *starts;
+	char16_t *text;
+	uint32_t text_capacity;
+	// Open addressing by the hash of the text, holding index + 1, 0 when empty
+	uint16_t *slots;
+
+	// Times the table was full and clusters no longer in the grid were dropped,
+	// and clusters cut to their first codepoint because it stayed full
+	uint64_t collections;
+	uint64_t truncated;
+};
+
+// A cell's hl id with the wide flag packed into the top bit. Cells with
+// ids that don't fit are drawn with the default highlight.
+constexpr uint16_t GRID_CELL_WIDE = 0x8000;
+constexpr uint16_t GRID_CELL_HL_MASK = 0x7FFF;
+constexpr uint16_t GRID_MAX_HL_ID = GRID_CELL_HL_MASK;
+inline uint16_t GridCellHl(uint16_t attrib) {
+	return attrib & GRID_CELL_HL_MASK;
+}
+inline bool GridCellIsWide(uint16_t attrib) {
+	return attrib & GRID_CELL_WIDE;
+}
+
+// What a row may contain, set as cells are written and only reset once
+// a grid_line rewrites the whole row or the grid is cleared
+enum GridRowFlags : uint16_t {
+	GRID_ROW_WIDE_CHARS = 1 << 0,
+	// Codepoints past Latin-1, whose glyphs may not be exactly one cell wide
+	GRID_ROW_NON_LATIN1 = 1 << 1
+};
+struct GridRow {
+	uint16_t flags;
+};
+// The columns of a screen row changed since it was last taken for repainting
+struct GridSpan {
+	int start;
+	int end;
+};
+
+// The grid as nvim describes it, kept apart from how it is drawn. Cells are
+// stored as a structure of arrays, text and attribs are both rows * cols long,
+// in rows of storage that screen rows are mapped to through row_index.
+// Scrolling the full width of the grid only rotates row_index.
+struct GridModel {
+	int rows;
+	int cols;
+	int *row_index;
+	uint32_t *text;
+	uint16_t *attribs;
+	// By row of storage, so it moves along with the cells
+	GridRow *row_info;
+	// A bit per screen row, set by every change until the row is taken for
+	// repainting, so a row changed many times within a frame is only drawn once
+	uint64_t *dirty_rows;
+	GridSpan *dirty_spans;
+	GridClusters clusters;
+
+	// Grid events applied, rows marked dirty (counting rows that already
+	// were), rows taken for repainting and the columns changed in them
+	uint64_t events_applied;
+	uint64_t rows_marked;
+	uint64_t rows_repainted;
+	uint64_t cells_repainted;
+};
+
+inline size_t GridModelOffset(GridModel *grid, int row, int col) {
+	return static_cast<size_t>(grid->row_index[row]) * grid->cols + col;
+}
+inline GridRow *GridModelRow(GridModel *grid, int row) {
+	return &grid->row_info[grid->row_index[row]];
+}
+
+void GridModelDestroy(GridModel *grid);
+// Keeps the cells that are still inside the grid, new cells are blank.
+// Returns false if the size didn't change.
+bool GridModelResize(GridModel *grid, int rows, int cols);
+// These mark the rows they change dirty
+void GridModelClear(GridModel *grid);
+void GridModelApplyLine(GridModel *grid, GridLineCommand *grid_line);
+// Except for this one, the rows that move take the columns that were dirty in
+// them along, for targets that can move what was drawn of them as well. Others
+// mark the moved rows dirty, see ScrollPlan.
+void GridModelScroll(GridModel *grid, GridScrollCommand *grid_scroll);
+
+// For cells that have to be drawn again without changing, e.g. to remove
+// the cursor. Rows outside the grid are ignored, columns are clamped.
+void GridModelMarkDirty(GridModel *grid, int row, int start_col, int end_col);
+void GridModelMarkAllDirty(GridModel *grid);
+// The columns of a row that are dirty, false if it isn't
+bool GridModelDirtySpan(GridModel *grid, int row, int *start_col, int *end_col);
+// Clears and returns the first dirty row at or after row, -1 if there is none,
+// along with the columns that changed in it. Loop with
+// row = GridModelTakeDirtyRow(grid, row + 1, ...) to take them all in order.
+int GridModelTakeDirtyRow(GridModel *grid, int row, int *start_col, int *end_col);
+
+// Ligatures, wide chars and realigned glyphs can reach past the cells that
+// changed, so a span is widened to the blanks around it. Text between blanks
+// is laid out the same way on its own as in the whole row.
+void GridModelWidenToBlanks(GridModel *grid, int row, int *start_col, int *end_col);
+
+// Writes the UTF-16 text of the columns [start_col, end_col) of a row, at most
+// GRID_MAX_COLUMN_UNITS per column, and where each column starts in it to
+// offsets, which takes end_col - start_col + 1 entries. The right half of a
+// wide char is a NUL unless the left half took more than one unit, so text
+// positions only run ahead of columns after narrow chars outside the BMP and
+// clusters. Returns the length of the text.
+uint32_t GridModelRowText(GridModel *grid, int row, int start_col, int end_col,
+	char16_t *text, uint32_t *offsets);
@@ -1,5 +1,9 @@
 #include "renderer.h"
 #include "renderer/glyph_renderer.h"
+#include "renderer/scroll_planner.h"
+
+// Row text is built as UTF-16 by the portable grid model
+static_assert(sizeof(wchar_t) == sizeof(char16_t));
 
 void InitializeD2D(Renderer *renderer) {
 	D2D1_FACTORY_OPTIONS options {};
@@ -137,6 +141,24 @@ void InitializeWindowDependentResources(Renderer *renderer, uint32_t width, uint
 	renderer->d2d_context->SetAntialiasMode(D2D1_ANTIALIAS_MODE_ALIASED);
 
 	SafeRelease(&dxgi_backbuffer);
+
+	SafeRelease(&renderer->d2d_canvas_bitmap);
+	SafeRelease(&renderer->d2d_scroll_bitmap);
+	D2D1_SIZE_U canvas_size = renderer->d2d_target_bitmap->GetPixelSize();
+	D2D1_BITMAP_PROPERTIES1 canvas_bitmap_properties {
+		.pixelFormat = target_bitmap_properties.pixelFormat,
+		.dpiX = DEFAULT_DPI,
+		.dpiY = DEFAULT_DPI,
+		.bitmapOptions = D2D1_BITMAP_OPTIONS_TARGET
+	};
+	WIN_CHECK(renderer->d2d_context->CreateBitmap(canvas_size, nullptr, 0,
+		&canvas_bitmap_properties, &renderer->d2d_canvas_bitmap));
+	canvas_bitmap_properties.bitmapOptions = D2D1_BITMAP_OPTIONS_NONE;
+	WIN_CHECK(renderer->d2d_context->CreateBitmap(canvas_size, nullptr, 0,
+		&canvas_bitmap_properties, &renderer->d2d_scroll_bitmap));
+
+	// A new canvas starts out empty
+	GridModelMarkAllDirty(&renderer->grid);
 }
 
 void HandleDeviceLost(Renderer *renderer) {
@@ -147,6 +169,8 @@ void HandleDeviceLost(Renderer *renderer) {
 	SafeRelease(&renderer->d2d_device);
 	SafeRelease(&renderer->d2d_context);
 	SafeRelease(&renderer->d2d_target_bitmap);
+	SafeRelease(&renderer->d2d_canvas_bitmap);
+	SafeRelease(&renderer->d2d_scroll_bitmap);
 	SafeRelease(&renderer->d2d_background_rect_brush);
 	SafeRelease(&renderer->dwrite_factory);
 	SafeRelease(&renderer->dwrite_text_format);
@@ -199,13 +223,16 @@ void RendererShutdown(Renderer *renderer) {
 	SafeRelease(&renderer->d2d_device);
 	SafeRelease(&renderer->d2d_context);
 	SafeRelease(&renderer->d2d_target_bitmap);
+	SafeRelease(&renderer->d2d_canvas_bitmap);
+	SafeRelease(&renderer->d2d_scroll_bitmap);
 	SafeRelease(&renderer->d2d_background_rect_brush);
 	SafeRelease(&renderer->dwrite_factory);
 	SafeRelease(&renderer->dwrite_text_format);
 	delete renderer->glyph_renderer;
 
-	free(renderer->grid_chars);
-	free(renderer->grid_cell_properties);
+	GridModelDestroy(&renderer->grid);
+	free(renderer->row_text);
+	free(renderer->row_text_offsets);
 }
 
 void RendererResize(Renderer *renderer, uint32_t width, uint32_t height) {
@@ -324,59 +351,25 @@ void RendererUpdateFont(Renderer *renderer, float font_size, const char *font_st
 	UpdateFontMetrics(renderer, font_size, font_string, strlen);
 }
 
-void UpdateDefaultColors(Renderer *renderer, mpack_node_t default_colors) {
-	size_t default_colors_arr_length = mpack_node_array_length(default_colors);
-
-	for (size_t i = 1; i < default_colors_arr_length; ++i) {
-		mpack_node_t color_arr = mpack_node_array_at(default_colors, i);
-
-		// Default colors occupy the first index of the highlight attribs array
-		renderer->hl_attribs[0].foreground = static_cast<uint32_t>(mpack_node_array_at(color_arr, 0).data->value.u);
-		renderer->hl_attribs[0].background = static_cast<uint32_t>(mpack_node_array_at(color_arr, 1).data->value.u);
-		renderer->hl_attribs[0].special = static_cast<uint32_t>(mpack_node_array_at(color_arr, 2).data->value.u);
-		renderer->hl_attribs[0].flags = 0;
-	}
+void UpdateDefaultColors(Renderer *renderer, DefaultColorsSetCommand *default_colors) {
+	// Default colors occupy the first index of the highlight attribs array
+	renderer->hl_attribs[0].foreground = default_colors->foreground;
+	renderer->hl_attribs[0].background = default_colors->background;
+	renderer->hl_attribs[0].special = default_colors->special;
+	renderer->hl_attribs[0].flags = 0;
 }
 
-void UpdateHighlightAttributes(Renderer *renderer, mpack_node_t highlight_attribs) {
-	uint64_t attrib_count = mpack_node_array_length(highlight_attribs);
-	for (uint64_t i = 1; i < attrib_count; ++i) {
-		int64_t attrib_index = mpack_node_array_at(mpack_node_array_at(highlight_attribs, i), 0).data->value.i;
-		assert(attrib_index <= MAX_HIGHLIGHT_ATTRIBS);
+void UpdateHighlightAttributes(Renderer *renderer, HlAttrDefineCommand *highlight_attribs) {
+	uint32_t attrib_index = highlight_attribs->id;
+	assert(attrib_index <= MAX_HIGHLIGHT_ATTRIBS);
 
-		mpack_node_t attrib_map = mpack_node_array_at(mpack_node_array_at(highlight_attribs, i), 1);
+	HighlightAttributes *hl_attribs = &renderer->hl_attribs[attrib_index];
+	hl_attribs->foreground = highlight_attribs->foreground;
+	hl_attribs->background = highlight_attribs->background;
+	hl_attribs->special = highlight_attribs->special;
 
-		const auto SetColor = [&](const char *name, uint32_t *color) {
-			mpack_node_t color_node = mpack_node_map_cstr_optional(attrib_map, name);
-			if (!mpack_node_is_missing(color_node)) {
-				*color = static_cast<uint32_t>(color_node.data->value.u);
-			}
-			else {
-				*color = DEFAULT_COLOR;
-			}
-		};
-		SetColor("foreground", &renderer->hl_attribs[attrib_index].foreground);
-		SetColor("background", &renderer->hl_attribs[attrib_index].background);
-		SetColor("special", &renderer->hl_attribs[attrib_index].special);
-
-		const auto SetFlag = [&](const char *flag_name, HighlightAttributeFlags flag) {
-			mpack_node_t flag_node = mpack_node_map_cstr_optional(attrib_map, flag_name);
-			if (!mpack_node_is_missing(flag_node)) {
-				if (flag_node.data->value.b) {
-					renderer->hl_attribs[attrib_index].flags |= flag;
-				}
-				else {
-					renderer->hl_attribs[attrib_index].flags &= ~flag;
-				}
-			}
-		};
-		SetFlag("reverse", HL_ATTRIB_REVERSE);
-		SetFlag("italic", HL_ATTRIB_ITALIC);
-		SetFlag("bold", HL_ATTRIB_BOLD);
-		SetFlag("strikethrough", HL_ATTRIB_STRIKETHROUGH);
-		SetFlag("underline", HL_ATTRIB_UNDERLINE);
-		SetFlag("undercurl", HL_ATTRIB_UNDERCURL);
-	}
+	// Flags missing from the definition keep their previous value
+	hl_attribs->flags = (hl_attribs->flags & ~highlight_attribs->flags_mask) | highlight_attribs->flags;
 }
 
 uint32_t CreateForegroundColor(Renderer *renderer, HighlightAttributes *hl_attribs) {
@@ -472,20 +465,31 @@ void DrawHighlightedText(Renderer *renderer, D2D1_RECT_F rect, wchar_t *text, ui
 	renderer->d2d_context->PopAxisAlignedClip();
 }
 
-void DrawGridLine(Renderer *renderer, int row) {
-	int base = row * renderer->grid_cols;
+// Builds the text of part of a row into the renderer's scratch space
+uint32_t BuildRowText(Renderer *renderer, int row, int start_col, int end_col) {
+	return GridModelRowText(&renderer->grid, row, start_col, end_col,
+		reinterpret_cast<char16_t *>(renderer->row_text), renderer->row_text_offsets);
+}
+
+// Draws the columns [start_col, end_col) of a row, clipped to them
+void DrawGridLine(Renderer *renderer, int row, int start_col, int end_col) {
+	GridModel *grid = &renderer->grid;
+	size_t base = GridModelOffset(grid, row, 0);
+	wchar_t *text = renderer->row_text;
+	uint32_t *offsets = renderer->row_text_offsets;
+	uint32_t text_length = BuildRowText(renderer, row, start_col, end_col);
 
 	D2D1_RECT_F rect {
-		.left = 0.0f,
+		.left = start_col * renderer->font_width,
 		.top = row * renderer->font_height,
-		.right = renderer->grid_cols * renderer->font_width,
+		.right = end_col * renderer->font_width,
 		.bottom = (row * renderer->font_height) + renderer->font_height
 	};
 
 	IDWriteTextLayout *temp_text_layout = nullptr;
 	WIN_CHECK(renderer->dwrite_factory->CreateTextLayout(
-		&renderer->grid_chars[base],
-		renderer->grid_cols,
+		text,
+		text_length,
 		renderer->dwrite_text_format,
 		rect.right - rect.left,
 		rect.bottom - rect.top,
@@ -495,30 +499,38 @@ void DrawGridLine(Renderer *renderer, int row) {
 	temp_text_layout->QueryInterface<IDWriteTextLayout1>(&text_layout);
 	temp_text_layout->Release();
 
-	uint16_t hl_attrib_id = renderer->grid_cell_properties[base].hl_attrib_id;
-	int col_offset = 0;
-	for (int i = 0; i < renderer->grid_cols; ++i) {
-		// Add spacing for wide chars
-		if (renderer->grid_cell_properties[base + i].is_wide_char) {
-			float char_width = GetTextWidth(renderer, &renderer->grid_chars[base + i], 2);
-			DWRITE_TEXT_RANGE range { .startPosition = static_cast<uint32_t>(i), .length = 1 };
+	// Rows of plain Latin-1 text never need their spacing adjusted
+	bool adjust_spacing = GridModelRow(grid, row)->flags & (GRID_ROW_WIDE_CHARS | GRID_ROW_NON_LATIN1);
+	uint16_t hl_attrib_id = GridCellHl(grid->attribs[base + start_col]);
+	int col_offset = start_col;
+	for (int i = start_col; i < end_col; ++i) {
+		// Text positions are relative to the start of the span
+		int span_col = i - start_col;
+		uint16_t attrib = grid->attribs[base + i];
+		DWRITE_TEXT_RANGE range {
+			.startPosition = offsets[span_col],
+			.length = offsets[span_col + 1] - offsets[span_col]
+		};
+
+		// Add spacing for wide chars, measured together with their right half
+		if (adjust_spacing && GridCellIsWide(attrib) && i + 1 < end_col) {
+			float char_width = GetTextWidth(renderer, &text[offsets[span_col]], offsets[span_col + 2] - offsets[span_col]);
 			text_layout->SetCharacterSpacing(0, (renderer->font_width * 2) - char_width, 0, range);
 		}
 
 		// Add spacing for unicode chars. These characters are still single char width, 
 		// but some of them by default will take up a bit more or less, leading to issues. 
 		// So we realign them here.	
-		else if(renderer->grid_chars[base + i] > 0xFF) {
-			float char_width = GetTextWidth(renderer, &renderer->grid_chars[base + i], 1);
+		else if(adjust_spacing && grid->text[base + i] > 0xFF) {
+			float char_width = GetTextWidth(renderer, &text[offsets[span_col]], range.length);
 			if(abs(char_width - renderer->font_width) > 0.01f) {
-				DWRITE_TEXT_RANGE range { .startPosition = static_cast<uint32_t>(i), .length = 1 };
 				text_layout->SetCharacterSpacing(0, renderer->font_width - char_width, 0, range);
 			}
 		}
 
 		// Check if the attributes change, 
 		// if so draw until this point and continue with the new attributes
-		if (renderer->grid_cell_properties[base + i].hl_attrib_id != hl_attrib_id) {
+		if (GridCellHl(attrib) != hl_attrib_id) {
 			D2D1_RECT_F bg_rect {
 				.left = col_offset * renderer->font_width,
 				.top = row * renderer->font_height,
@@ -526,9 +538,10 @@ void DrawGridLine(Renderer *renderer, int row) {
 				.bottom = (row * renderer->font_height) + renderer->font_height
 			};
 			DrawBackgroundRect(renderer, bg_rect, &renderer->hl_attribs[hl_attrib_id]);
-			ApplyHighlightAttributes(renderer, &renderer->hl_attribs[hl_attrib_id], text_layout, col_offset, i);
+			ApplyHighlightAttributes(renderer, &renderer->hl_attribs[hl_attrib_id], text_layout,
+				offsets[col_offset - start_col], offsets[span_col]);
 
-			hl_attrib_id = renderer->grid_cell_properties[base + i].hl_attrib_id;
+			hl_attrib_id = GridCellHl(attrib);
 			col_offset = i;
 		}
 	}
@@ -538,136 +551,55 @@ void DrawGridLine(Renderer *renderer, int row) {
 	D2D1_RECT_F last_rect = rect;
 	last_rect.left = col_offset * renderer->font_width;
 	DrawBackgroundRect(renderer, last_rect, &renderer->hl_attribs[hl_attrib_id]);
-	ApplyHighlightAttributes(renderer, &renderer->hl_attribs[hl_attrib_id], text_layout, col_offset, renderer->grid_cols);
+	ApplyHighlightAttributes(renderer, &renderer->hl_attribs[hl_attrib_id], text_layout,
+		offsets[col_offset - start_col], text_length);
 
 	renderer->d2d_context->PushAxisAlignedClip(rect, D2D1_ANTIALIAS_MODE_ALIASED);
 	if(renderer->disable_ligatures) {
 		text_layout->SetTypography(renderer->dwrite_typography, DWRITE_TEXT_RANGE { 
 			.startPosition = 0, 
-			.length = static_cast<uint32_t>(renderer->grid_cols) 
+			.length = text_length
 		});
 	}
-	text_layout->Draw(renderer, renderer->glyph_renderer, 0.0f, rect.top);
+	text_layout->Draw(renderer, renderer->glyph_renderer, rect.left, rect.top);
 	renderer->d2d_context->PopAxisAlignedClip();
 	text_layout->Release();
 }
 
-bool IsSurrogatePair(wchar_t left, wchar_t right) {
-	return (0xD800 <= left && left <= 0xDBFF) && (0xDC00 <= right && right <= 0xDFFF);
-}
-
-void DrawGridLines(Renderer *renderer, mpack_node_t grid_lines) {
-	assert(renderer->grid_chars != nullptr);
-	assert(renderer->grid_cell_properties != nullptr);
-	
-	int grid_size = renderer->grid_cols * renderer->grid_rows;
-	size_t line_count = mpack_node_array_length(grid_lines);
-	for (size_t i = 1; i < line_count; ++i) {
-		mpack_node_t grid_line = mpack_node_array_at(grid_lines, i);
-
-		int row = MPackIntFromArray(grid_line, 1);
-		int col_start = MPackIntFromArray(grid_line, 2);
-
-		mpack_node_t cell_array = mpack_node_array_at(grid_line, 3);
-		size_t cell_array_length = mpack_node_array_length(cell_array);
-
-		int hl_attrib_id = 0;
-		int offset = row * renderer->grid_cols + col_start;
-		for (size_t j = 0; j < cell_array_length; ++j) {
-			mpack_node_t cell = mpack_node_array_at(cell_array, j);
-			size_t cell_length = mpack_node_array_length(cell);
-
-			mpack_node_t text = mpack_node_array_at(cell, 0);
-			const char *str = mpack_node_str(text);
-
-			if (cell_length > 1) {
-				hl_attrib_id = MPackIntFromArray(cell, 1);
-			}
-
-			int repeat = 1;
-			if (cell_length > 2) {
-				repeat = MPackIntFromArray(cell, 2);
-			}
-
-			int strlen = static_cast<int>(mpack_node_strlen(text));
-			if (strlen == 0) {
-				// This is the right part of the wide char. Sadly grid_line
-				// event can be splitted at the middle of wide character.
-
-				// Be careful not to overwrite right half of surrogate pair.
-				// It never happens that offset == 0, since it is the right
-				// half of wide char, but add check for safety.
-				if (offset == 0 || !IsSurrogatePair(renderer->grid_chars[offset - 1], renderer->grid_chars[offset])) {
-					renderer->grid_chars[offset] = L'\0';
-				}
-
-				// This cell itself is not a wide character.
-				renderer->grid_cell_properties[offset].is_wide_char = false;
-
-				// Adjust properties. Again it never happens that offset == 0,
-				// since it is the right half of wide char, but adding check
-				// for safety.
-				if (offset > 0) {
-					// Set is_wide_char flag for the left cell to true.
-					renderer->grid_cell_properties[offset - 1].is_wide_char = true;
-
-					// Inherit hl_attrib_id from left half.
-					renderer->grid_cell_properties[offset].hl_attrib_id = renderer->grid_cell_properties[offset - 1].hl_attrib_id;
-				}
-
-				++offset;
-			} else {
-				// This is single width character or left half cell of wide
-				// character.
-
-				// Left cell should not be a wide character, so reset the
-				// flag. This time checking offset > 0 is mandatory.
-				if (offset > 0) {
-					renderer->grid_cell_properties[offset - 1].is_wide_char = false;
-				}
-
-				// Wide character will never be repeated, so we don't have to
-				// handle wide character specially.
-				for (int k = 0; k < repeat; ++k) {
-					int wstrlen = MultiByteToWideChar(CP_UTF8, 0, str, strlen, &renderer->grid_chars[offset], grid_size - offset);
-					if (wstrlen == 2) {
-						// If the str takes two wchars, it must be a surrogate pair.
-						bool is_surrogate_pair = IsSurrogatePair(renderer->grid_chars[offset], renderer->grid_chars[offset + 1]);
-						assert(is_surrogate_pair && repeat == 1);
-					}
-					renderer->grid_cell_properties[offset].hl_attrib_id = hl_attrib_id;
-
-					// Here we set is_wide_char to be always false. This is
-					// because if it is actually a wide character, then the
-					// right half of the char, empty string, should be appear
-					// soon, and the flag will be set there (first branch of
-					// this `if`).
-					renderer->grid_cell_properties[offset].is_wide_char = false;
-
-					++offset;
-				}
-			}
+// Rows are only drawn once per frame, however often they changed, and
+// only around the cells that did
+void DrawDirtyRows(Renderer *renderer) {
+	int start_col;
+	int end_col;
+	for (int row = GridModelTakeDirtyRow(&renderer->grid, 0, &start_col, &end_col); row >= 0;
+		row = GridModelTakeDirtyRow(&renderer->grid, row + 1, &start_col, &end_col)) {
+		GridModelWidenToBlanks(&renderer->grid, row, &start_col, &end_col);
+		if (start_col < end_col) {
+			DrawGridLine(renderer, row, start_col, end_col);
 		}
-
-		DrawGridLine(renderer, row);
 	}
 }
 
+// The cells the cursor covers, wide enough for a wide char
+void MarkCursorDirty(Renderer *renderer, int row) {
+	GridModelMarkDirty(&renderer->grid, row, renderer->cursor.col, renderer->cursor.col + 2);
+}
+
 void DrawCursor(Renderer *renderer) {
 	if (!renderer->cursor.mode_info) return;
-	int cursor_grid_offset = renderer->cursor.row * renderer->grid_cols + renderer->cursor.col;
+	GridModel *grid = &renderer->grid;
+	if (renderer->cursor.row >= grid->rows || renderer->cursor.col >= grid->cols) return;
+	uint16_t attrib_under_cursor = grid->attribs[GridModelOffset(grid, renderer->cursor.row, renderer->cursor.col)];
 
 	int double_width_char_factor = 1;
-	if (cursor_grid_offset < (renderer->grid_rows * renderer->grid_cols) &&
-		renderer->grid_cell_properties[cursor_grid_offset].is_wide_char) {
+	if (GridCellIsWide(attrib_under_cursor) && renderer->cursor.col + 1 < grid->cols) {
 		double_width_char_factor += 1;
 	}
 
 	HighlightAttributes cursor_hl_attribs = renderer->hl_attribs[renderer->cursor.mode_info->hl_attrib_id];
 
 	// Inherit GUI options for char under cursor (like italic)
-	int hl_attrib_id_under_cursor = renderer->grid_cell_properties[cursor_grid_offset].hl_attrib_id;
-	HighlightAttributes under_cursor_hl_attribs = renderer->hl_attribs[hl_attrib_id_under_cursor];
+	HighlightAttributes under_cursor_hl_attribs = renderer->hl_attribs[GridCellHl(attrib_under_cursor)];
 	cursor_hl_attribs.flags = under_cursor_hl_attribs.flags;
 
 	if (renderer->cursor.mode_info->hl_attrib_id == 0) {
@@ -684,38 +616,25 @@ void DrawCursor(Renderer *renderer) {
 	DrawBackgroundRect(renderer, cursor_fg_rect, &cursor_hl_attribs);
 
 	if (renderer->cursor.mode_info->shape == CursorShape::Block) {
-		DrawHighlightedText(renderer, cursor_fg_rect, &renderer->grid_chars[cursor_grid_offset], 
-			double_width_char_factor, &cursor_hl_attribs);
+		uint32_t length = BuildRowText(renderer, renderer->cursor.row,
+			renderer->cursor.col, renderer->cursor.col + double_width_char_factor);
+		DrawHighlightedText(renderer, cursor_fg_rect, renderer->row_text, length, &cursor_hl_attribs);
 	}
 }
 
-void UpdateGridSize(Renderer *renderer, mpack_node_t grid_resize) {
-	mpack_node_t grid_resize_params = mpack_node_array_at(grid_resize, 1);
-	int grid_cols = MPackIntFromArray(grid_resize_params, 1);
-	int grid_rows = MPackIntFromArray(grid_resize_params, 2);
-
-	if (renderer->grid_chars == nullptr ||
-		renderer->grid_cell_properties == nullptr ||
-		renderer->grid_cols != grid_cols ||
-		renderer->grid_rows != grid_rows) {
-		
-		renderer->grid_cols = grid_cols;
-		renderer->grid_rows = grid_rows;
-
-		renderer->grid_chars = static_cast<wchar_t *>(malloc(static_cast<size_t>(grid_cols) * grid_rows * sizeof(wchar_t)));
-        // Initialize all grid character to a space. An empty
-        // grid cell is equivalent to a space in a text layout
-		for (int i = 0; i < grid_cols * grid_rows; ++i) {
-			renderer->grid_chars[i] = L' ';
-		}
-		renderer->grid_cell_properties = static_cast<CellProperty *>(calloc(static_cast<size_t>(grid_cols) * grid_rows, sizeof(CellProperty)));
+void UpdateGridSize(Renderer *renderer, GridResizeCommand *grid_resize) {
+	if (GridModelResize(&renderer->grid, grid_resize->rows, grid_resize->cols)) {
+		// A column takes at most a cluster
+		free(renderer->row_text);
+		free(renderer->row_text_offsets);
+		renderer->row_text = static_cast<wchar_t *>(malloc(GRID_MAX_COLUMN_UNITS * static_cast<size_t>(grid_resize->cols) * sizeof(wchar_t)));
+		renderer->row_text_offsets = static_cast<uint32_t *>(malloc((static_cast<size_t>(grid_resize->cols) + 1) * sizeof(uint32_t)));
 	}
 }
 
-void UpdateCursorPos(Renderer *renderer, mpack_node_t cursor_goto) {
-	mpack_node_t cursor_goto_params = mpack_node_array_at(cursor_goto, 1);
-	renderer->cursor.row = MPackIntFromArray(cursor_goto_params, 1);
-	renderer->cursor.col = MPackIntFromArray(cursor_goto_params, 2);
+void UpdateCursorPos(Renderer *renderer, GridCursorGotoCommand *cursor_goto) {
+	renderer->cursor.row = cursor_goto->row;
+	renderer->cursor.col = cursor_goto->col;
 }
 
 void UpdateImePos(Renderer* renderer) {
@@ -739,12 +658,10 @@ void UpdateImePos(Renderer* renderer) {
 	ImmReleaseContext(renderer->hwnd, input_context);
 }
 
-void UpdateWindowTitle(Renderer *renderer, mpack_node_t set_title) {
+void UpdateWindowTitle(Renderer *renderer, StringCommand *set_title) {
 	// Get new title
-	mpack_node_t params = mpack_node_array_at(set_title, 1);
-	mpack_node_t value = mpack_node_array_at(params, 0);
-	const char *new_title = mpack_node_str(value);
-	int len = mpack_node_strlen(value);
+	const char *new_title = StringCommandText(set_title);
+	int len = static_cast<int>(set_title->length);
 
 	// Append " - Nvy" to the title. If title is empty, do not add " - ".
 	const char *append = len == 0 ? "Nvy" : " - Nvy";
@@ -767,103 +684,60 @@ void UpdateWindowTitle(Renderer *renderer, mpack_node_t set_title) {
 	free(wbuf);
 }
 
-void UpdateCursorMode(Renderer *renderer, mpack_node_t mode_change) {
-	mpack_node_t mode_change_params = mpack_node_array_at(mode_change, 1);
-	renderer->cursor.mode_info = &renderer->cursor_mode_infos[mpack_node_array_at(mode_change_params, 1).data->value.u];
+void UpdateCursorMode(Renderer *renderer, ModeChangeCommand *mode_change) {
+	renderer->cursor.mode_info = &renderer->cursor_mode_infos[mode_change->mode_index];
 }
 
-void UpdateCursorModeInfos(Renderer *renderer, mpack_node_t mode_info_set_params) {
-	mpack_node_t mode_info_params = mpack_node_array_at(mode_info_set_params, 1);
-	mpack_node_t mode_infos = mpack_node_array_at(mode_info_params, 1);
-	size_t mode_infos_length = mpack_node_array_length(mode_infos);
-	assert(mode_infos_length <= MAX_CURSOR_MODE_INFOS);
-
-	for (size_t i = 0; i < mode_infos_length; ++i) {
-		mpack_node_t mode_info_map = mpack_node_array_at(mode_infos, i);
-
-		renderer->cursor_mode_infos[i].shape = CursorShape::None;
-		mpack_node_t cursor_shape = mpack_node_map_cstr_optional(mode_info_map, "cursor_shape");
-		if (!mpack_node_is_missing(cursor_shape)) {
-			const char *cursor_shape_str = mpack_node_str(cursor_shape);
-			size_t strlen = mpack_node_strlen(cursor_shape);
-			if (!strncmp(cursor_shape_str, "block", strlen)) {
-				renderer->cursor_mode_infos[i].shape = CursorShape::Block;
-			}
-			else if (!strncmp(cursor_shape_str, "vertical", strlen)) {
-				renderer->cursor_mode_infos[i].shape = CursorShape::Vertical;
-			}
-			else if (!strncmp(cursor_shape_str, "horizontal", strlen)) {
-				renderer->cursor_mode_infos[i].shape = CursorShape::Horizontal;
-			}
-		}
-
-		renderer->cursor_mode_infos[i].hl_attrib_id = 0;
-		mpack_node_t hl_attrib_index = mpack_node_map_cstr_optional(mode_info_map, "attr_id");
-		if (!mpack_node_is_missing(hl_attrib_index)) {
-			renderer->cursor_mode_infos[i].hl_attrib_id = static_cast<int>(hl_attrib_index.data->value.i);
-		}
-	}
+void UpdateCursorModeInfos(Renderer *renderer, ModeInfoSetCommand *mode_info_set) {
+	assert(mode_info_set->count <= MAX_CURSOR_MODE_INFOS);
+	memcpy(renderer->cursor_mode_infos, mode_info_set->mode_infos, mode_info_set->count * sizeof(CursorModeInfo));
 }
 
-void ScrollRegion(Renderer *renderer, mpack_node_t scroll_region) {
-	mpack_node_t scroll_region_params = mpack_node_array_at(scroll_region, 1);
-
-	int64_t top = mpack_node_array_at(scroll_region_params, 1).data->value.i;
-	int64_t bottom = mpack_node_array_at(scroll_region_params, 2).data->value.i;
-	int64_t left = mpack_node_array_at(scroll_region_params, 3).data->value.i;
-	int64_t right = mpack_node_array_at(scroll_region_params, 4).data->value.i;
-	int64_t rows = mpack_node_array_at(scroll_region_params, 5).data->value.i;
-	int64_t cols = mpack_node_array_at(scroll_region_params, 6).data->value.i;
-
-	// Currently nvim does not support horizontal scrolling, 
-	// the parameter is reserved for later use
-	assert(cols == 0);
-
-	// This part is slightly cryptic, basically we're just
-	// iterating from top to bottom or vice versa depending on scroll direction.
-	bool scrolling_down = rows > 0;
-	int64_t start_row = scrolling_down ? top : bottom - 1;
-	int64_t end_row = scrolling_down ? bottom - 1 : top;
-	int64_t increment = scrolling_down ? 1 : -1;
-
-	for (int64_t i = start_row; scrolling_down ? i <= end_row : i >= end_row; i += increment) {
-		// Clip anything outside the scroll region
-		int64_t target_row = i - rows;
-		if (target_row < top || target_row >= bottom) {
-			continue;
-		}
-
-		memcpy(
-			&renderer->grid_chars[target_row * renderer->grid_cols + left],
-			&renderer->grid_chars[i * renderer->grid_cols + left],
-			(right - left) * sizeof(wchar_t)
-		);
+// Nothing is drawn to the canvas until the flush, so its pixels are still
+// those of the last frame, and it is only the context's target while that
+// frame is drawn, so it can be copied from and into here. A bitmap can't be
+// copied onto itself, the pixels go through the scroll bitmap.
+void MoveCanvasPixels(Renderer *renderer, ScrollBlit *blit) {
+	D2D1_RECT_U source_rect {
+		.left = static_cast<uint32_t>(blit->left),
+		.top = static_cast<uint32_t>(blit->top),
+		.right = static_cast<uint32_t>(blit->right),
+		.bottom = static_cast<uint32_t>(blit->bottom)
+	};
+	D2D1_POINT_2U scroll_point {
+		.x = source_rect.left,
+		.y = source_rect.top
+	};
+	WIN_CHECK(renderer->d2d_scroll_bitmap->CopyFromBitmap(&scroll_point, renderer->d2d_canvas_bitmap, &source_rect));
 
-		memcpy(
-			&renderer->grid_cell_properties[target_row * renderer->grid_cols + left],
-			&renderer->grid_cell_properties[i * renderer->grid_cols + left],
-			(right - left) * sizeof(CellProperty)
-		);
+	D2D1_POINT_2U destination_point {
+		.x = source_rect.left,
+		.y = static_cast<uint32_t>(blit->destination_top)
+	};
+	WIN_CHECK(renderer->d2d_canvas_bitmap->CopyFromBitmap(&destination_point, renderer->d2d_scroll_bitmap, &source_rect));
+}
 
-        // Sadly I have given up on making use of IDXGISwapChain1::Present1
-        // scroll_rects or bitmap copies. The former seems insufficient for
-        // nvim since it can require multiple scrolls per frame, the latter
-        // I can't seem to make work with the FLIP_SEQUENTIAL swapchain model.
-        // Thus we fall back to drawing the appropriate scrolled grid lines
-        DrawGridLine(renderer, target_row);
+void ScrollRegion(Renderer *renderer, GridScrollCommand *scroll_region) {
+	// IDXGISwapChain1::Present1 scroll_rects are insufficient for nvim since
+	// it can require multiple scrolls per frame, and the FLIP_SEQUENTIAL
+	// swapchain's buffers don't keep their pixels. The canvas does, so the
+	// pixels of the scrolled rows are moved along with them, unless they
+	// don't line up with the pixels afterwards and have to be drawn again.
+	ScrollBlit blit;
+	ScrollPlan(&renderer->grid, scroll_region, renderer->font_width, renderer->font_height,
+		static_cast<int>(renderer->pixel_size.width), static_cast<int>(renderer->pixel_size.height), &blit);
+	if (blit.top < blit.bottom) {
+		MoveCanvasPixels(renderer, &blit);
 	}
 
     // Redraw the line which the cursor has moved to, as it is no
     // longer guaranteed that the cursor is still there
-    int cursor_row = renderer->cursor.row - rows;
-    if(cursor_row >= 0 && cursor_row < renderer->grid_rows) {
-        DrawGridLine(renderer, cursor_row);
-    }
+    MarkCursorDirty(renderer, renderer->cursor.row - scroll_region->rows);
 }
 
 void DrawBorderRectangles(Renderer *renderer) {
-	float left_border = renderer->font_width * renderer->grid_cols;
-	float top_border = renderer->font_height * renderer->grid_rows;
+	float left_border = renderer->font_width * renderer->grid.cols;
+	float top_border = renderer->font_height * renderer->grid.rows;
 
     if(left_border != static_cast<float>(renderer->pixel_size.width)) {
         D2D1_RECT_F vertical_rect {
@@ -926,148 +800,129 @@ void RendererUpdateGuiFont(Renderer *renderer, const char *guifont, size_t strle
 	RendererUpdateFont(renderer, font_size, guifont, static_cast<int>(font_str_len));
 }
 
-void SetGuiOptions(Renderer *renderer, mpack_node_t option_set) {
-	uint64_t option_set_length = mpack_node_array_length(option_set);
+void SetGuiFont(Renderer *renderer, StringCommand *guifont) {
+	RendererUpdateGuiFont(renderer, StringCommandText(guifont), guifont->length);
 
-	for (uint64_t i = 1; i < option_set_length; ++i) {
-		mpack_node_t name = mpack_node_array_at(mpack_node_array_at(option_set, i), 0);
-		mpack_node_t value = mpack_node_array_at(mpack_node_array_at(option_set, i), 1);
-		if (MPackMatchString(name, "guifont")) {
-			const char *font_str = mpack_node_str(value);
-			size_t strlen = mpack_node_strlen(value);
-			RendererUpdateGuiFont(renderer, font_str, strlen);
-
-			// Send message to window in order to update nvim row/col count
-			PostMessage(renderer->hwnd, WM_RENDERER_FONT_UPDATE, 0, 0);
-		}
-	}
+	// Send message to window in order to update nvim row/col count
+	PostMessage(renderer->hwnd, WM_RENDERER_FONT_UPDATE, 0, 0);
 }
 
 void ClearGrid(Renderer *renderer) {
-	// Initialize all grid character to a space.
-	for (int i = 0; i < renderer->grid_cols * renderer->grid_rows; ++i) {
-		renderer->grid_chars[i] = L' ';
-	}
-	memset(renderer->grid_cell_properties, 0, renderer->grid_cols * renderer->grid_rows * sizeof(CellProperty));
-	D2D1_RECT_F rect {
-		.left = 0.0f,
-		.top = 0.0f,
-		.right = renderer->grid_cols * renderer->font_width,
-		.bottom = renderer->grid_rows * renderer->font_height
-	};
-	DrawBackgroundRect(renderer, rect, &renderer->hl_attribs[0]);
+	// Every row is drawn again with the default background at the flush
+	GridModelClear(&renderer->grid);
 }
 
 void StartDraw(Renderer *renderer) {
 	if (!renderer->draw_active) {
-		WaitForSingleObjectEx(
-			renderer->swapchain_wait_handle,
-			1000,
-			true
-		);
+		// The reactor may have already consumed the swapchain signal
+		if (!renderer->frame_ready) {
+			WaitForSingleObjectEx(
+				renderer->swapchain_wait_handle,
+				1000,
+				true
+			);
+		}
+		renderer->frame_ready = false;
 
-		renderer->d2d_context->SetTarget(renderer->d2d_target_bitmap);
+		renderer->d2d_context->SetTarget(renderer->d2d_canvas_bitmap);
 		renderer->d2d_context->BeginDraw();
 		renderer->d2d_context->SetTransform(D2D1::IdentityMatrix());
 		renderer->draw_active = true;
 	}
 }
 
-void CopyFrontToBack(Renderer *renderer) {
-	ID3D11Resource *front;
-	ID3D11Resource *back;
-	WIN_CHECK(renderer->dxgi_swapchain->GetBuffer(0, IID_PPV_ARGS(&back)));
-	WIN_CHECK(renderer->dxgi_swapchain->GetBuffer(1, IID_PPV_ARGS(&front)));
-	renderer->d3d_context->CopyResource(back, front);
-
-	SafeRelease(&front);
-	SafeRelease(&back);
-}
-
 void FinishDraw(Renderer *renderer) {
 	renderer->d2d_context->EndDraw();
+	// The canvas can't be copied from while it is the target
+	renderer->d2d_context->SetTarget(nullptr);
 
+	// The whole backbuffer is replaced, so it doesn't matter what it held before
+	WIN_CHECK(renderer->d2d_target_bitmap->CopyFromBitmap(nullptr, renderer->d2d_canvas_bitmap, nullptr));
 	HRESULT hr = renderer->dxgi_swapchain->Present(0, DXGI_PRESENT_ALLOW_TEARING);
 	renderer->draw_active = false;
 
-	CopyFrontToBack(renderer);
-
 	if (hr == DXGI_ERROR_DEVICE_REMOVED) {
 		HandleDeviceLost(renderer);
 	}
 }
 
-void RendererRedraw(Renderer *renderer, mpack_node_t params) {
-	StartDraw(renderer);
-
-	uint64_t redraw_commands_length = mpack_node_array_length(params);
-	for (uint64_t i = 0; i < redraw_commands_length; ++i) {
-		mpack_node_t redraw_command_arr = mpack_node_array_at(params, i);
-		mpack_node_t redraw_command_name = mpack_node_array_at(redraw_command_arr, 0);
-
-		if (MPackMatchString(redraw_command_name, "option_set")) {
-			SetGuiOptions(renderer, redraw_command_arr);
-		}
-		if (MPackMatchString(redraw_command_name, "grid_resize")) {
-			UpdateGridSize(renderer, redraw_command_arr);
-		}
-		if (MPackMatchString(redraw_command_name, "grid_clear")) {
+void RendererRedraw(Renderer *renderer, RedrawCommandBuffer *commands) {
+	for (RedrawCommand *command = RedrawCommandsBegin(commands); command;
+		command = RedrawCommandsNext(commands, command)) {
+		switch (command->type) {
+		case RedrawCommandType::GuiFontSet: {
+			SetGuiFont(renderer, RedrawCommandPayload<StringCommand>(command));
+		} break;
+		case RedrawCommandType::GridResize: {
+			UpdateGridSize(renderer, RedrawCommandPayload<GridResizeCommand>(command));
+		} break;
+		case RedrawCommandType::GridClear: {
 			ClearGrid(renderer);
-		}
-		else if (MPackMatchString(redraw_command_name, "default_colors_set")) {
-			UpdateDefaultColors(renderer, redraw_command_arr);
-		}
-		else if (MPackMatchString(redraw_command_name, "hl_attr_define")) {
-			UpdateHighlightAttributes(renderer, redraw_command_arr);
-		}
-		else if (MPackMatchString(redraw_command_name, "grid_line")) {
-			DrawGridLines(renderer, redraw_command_arr);
-		}
-		else if (MPackMatchString(redraw_command_name, "grid_cursor_goto")) {
+		} break;
+		case RedrawCommandType::DefaultColorsSet: {
+			UpdateDefaultColors(renderer, RedrawCommandPayload<DefaultColorsSetCommand>(command));
+		} break;
+		case RedrawCommandType::HlAttrDefine: {
+			UpdateHighlightAttributes(renderer, RedrawCommandPayload<HlAttrDefineCommand>(command));
+		} break;
+		case RedrawCommandType::GridLine: {
+			assert(renderer->grid.text != nullptr);
+			GridModelApplyLine(&renderer->grid, RedrawCommandPayload<GridLineCommand>(command));
+		} break;
+		case RedrawCommandType::GridCursorGoto: {
 			// If the old cursor position is still within the row bounds,
 			// redraw the line to get rid of the cursor
-			if(renderer->cursor.row < renderer->grid_rows) {
-				DrawGridLine(renderer, renderer->cursor.row);
-			}
-			UpdateCursorPos(renderer, redraw_command_arr);
+			MarkCursorDirty(renderer, renderer->cursor.row);
+			UpdateCursorPos(renderer, RedrawCommandPayload<GridCursorGotoCommand>(command));
 			UpdateImePos(renderer);
-		}
-		else if (MPackMatchString(redraw_command_name, "mode_info_set")) {
-			UpdateCursorModeInfos(renderer, redraw_command_arr);
-		}
-		else if (MPackMatchString(redraw_command_name, "mode_change")) {
+		} break;
+		case RedrawCommandType::ModeInfoSet: {
+			UpdateCursorModeInfos(renderer, RedrawCommandPayload<ModeInfoSetCommand>(command));
+		} break;
+		case RedrawCommandType::ModeChange: {
 			// Redraw cursor if its inside the bounds
-			if(renderer->cursor.row < renderer->grid_rows) {
-				DrawGridLine(renderer, renderer->cursor.row);
-			}
-			UpdateCursorMode(renderer, redraw_command_arr);
-		}
-		else if (MPackMatchString(redraw_command_name, "set_title")) {
-			UpdateWindowTitle(renderer, redraw_command_arr);
-		}
-		else if (MPackMatchString(redraw_command_name, "busy_start")) {
+			MarkCursorDirty(renderer, renderer->cursor.row);
+			UpdateCursorMode(renderer, RedrawCommandPayload<ModeChangeCommand>(command));
+		} break;
+		case RedrawCommandType::SetTitle: {
+			UpdateWindowTitle(renderer, RedrawCommandPayload<StringCommand>(command));
+		} break;
+		case RedrawCommandType::BusyStart: {
 			renderer->ui_busy = true;
 			// Hide cursor while UI is busy
-			if(renderer->cursor.row < renderer->grid_rows) {
-				DrawGridLine(renderer, renderer->cursor.row);
-			}
-		}
-		else if (MPackMatchString(redraw_command_name, "busy_stop")) {
+			MarkCursorDirty(renderer, renderer->cursor.row);
+		} break;
+		case RedrawCommandType::BusyStop: {
 			renderer->ui_busy = false;
-		}
-		else if (MPackMatchString(redraw_command_name, "grid_scroll")) {
-			ScrollRegion(renderer, redraw_command_arr);
-		}
-		else if (MPackMatchString(redraw_command_name, "flush")) {
+		} break;
+		case RedrawCommandType::GridScroll: {
+			ScrollRegion(renderer, RedrawCommandPayload<GridScrollCommand>(command));
+		} break;
+		case RedrawCommandType::Flush: {
+			// Scrolls before the flush have moved the canvas pixels already,
+			// drawing only begins now
+			StartDraw(renderer);
+			DrawDirtyRows(renderer);
 			if(!renderer->ui_busy) {
 				DrawCursor(renderer);
 			}
-            DrawBorderRectangles(renderer);
-            FinishDraw(renderer);
+			DrawBorderRectangles(renderer);
+			FinishDraw(renderer);
+		} break;
 		}
 	}
 }
 
+bool RendererSignalFrameReady(void *context) {
+	Renderer *renderer = static_cast<Renderer *>(context);
+	renderer->frame_ready = true;
+	return true;
+}
+
+HANDLE RendererFrameWaitHandle(Renderer *renderer) {
+	return renderer->frame_ready ? nullptr : renderer->swapchain_wait_handle;
+}
+
 PixelSize RendererGridToPixelSize(Renderer *renderer, int rows, int cols) {
 	int requested_width = static_cast<int>(ceilf(renderer->font_width) * cols);
 	int requested_height = static_cast<int>(ceilf(renderer->font_height) * rows);
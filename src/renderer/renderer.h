@@ -1,31 +1,10 @@
 #pragma once
+#include "nvim/redraw_commands.h"
+#include "renderer/grid_model.h"
 
 constexpr const char *DEFAULT_FONT = "Consolas";
 constexpr float DEFAULT_FONT_SIZE = 14.0f;
 
-constexpr uint32_t DEFAULT_COLOR = 0x46464646;
-enum HighlightAttributeFlags : uint16_t {
-	HL_ATTRIB_REVERSE			= 1 << 0,
-	HL_ATTRIB_ITALIC			= 1 << 1,
-	HL_ATTRIB_BOLD				= 1 << 2,
-	HL_ATTRIB_STRIKETHROUGH		= 1 << 3,
-	HL_ATTRIB_UNDERLINE			= 1 << 4,
-	HL_ATTRIB_UNDERCURL			= 1 << 5
-};
-struct HighlightAttributes {
-	uint32_t foreground;
-	uint32_t background;
-	uint32_t special;
-	uint16_t flags;
-};
-
-enum class CursorShape {
-	None,
-	Block,
-	Vertical,
-	Horizontal
-};
-
 struct GridPoint {
 	int row;
 	int col;
@@ -39,23 +18,13 @@ struct PixelSize {
 	int height;
 };
 
-struct CursorModeInfo {
-	CursorShape shape;
-	uint16_t hl_attrib_id;
-};
 struct Cursor {
 	CursorModeInfo *mode_info;
 	int row;
 	int col;
 };
 
-struct CellProperty {
-	uint16_t hl_attrib_id;
-	bool is_wide_char;
-};
-
 constexpr int MAX_HIGHLIGHT_ATTRIBS = 0xFFFF;
-constexpr int MAX_CURSOR_MODE_INFOS = 64;
 constexpr int MAX_FONT_LENGTH = 128;
 constexpr float DEFAULT_DPI = 96.0f;
 constexpr float POINTS_PER_INCH = 72.0f;
@@ -73,10 +42,16 @@ struct Renderer {
 	ID3D11DeviceContext2 *d3d_context;
 	IDXGISwapChain2 *dxgi_swapchain;
 	HANDLE swapchain_wait_handle;
+	bool frame_ready;
 	ID2D1Factory5 *d2d_factory;
 	ID2D1Device4 *d2d_device;
 	ID2D1DeviceContext4 *d2d_context;
 	ID2D1Bitmap1 *d2d_target_bitmap;
+	// Everything is drawn to the canvas, which keeps what was drawn between
+	// frames, and copied to the backbuffer to be presented. Scrolls move its
+	// pixels through the scroll bitmap, see scroll_planner.h.
+	ID2D1Bitmap1 *d2d_canvas_bitmap;
+	ID2D1Bitmap1 *d2d_scroll_bitmap;
 	ID2D1SolidColorBrush *d2d_background_rect_brush;
 
     IDWriteFontFace1 *font_face;
@@ -101,10 +76,10 @@ struct Renderer {
     float font_descent;
 
 	D2D1_SIZE_U pixel_size;
-	int grid_rows;
-	int grid_cols;
-	wchar_t *grid_chars;
-	CellProperty *grid_cell_properties;
+	GridModel grid;
+	// Scratch space for the text of the row being drawn, see GridModelRowText
+	wchar_t *row_text;
+	uint32_t *row_text_offsets;
 
 	HWND hwnd;
 	bool draw_active;
@@ -118,7 +93,13 @@ void RendererShutdown(Renderer *renderer);
 void RendererResize(Renderer *renderer, uint32_t width, uint32_t height);
 void RendererUpdateGuiFont(Renderer *renderer, const char *guifont, size_t strlen);
 void RendererUpdateFont(Renderer *renderer, float font_size, const char *font_string = "", int strlen = 0);
-void RendererRedraw(Renderer *renderer, mpack_node_t params);
+void RendererRedraw(Renderer *renderer, RedrawCommandBuffer *commands);
+
+// The swapchain's frame latency waitable is watched by the UI thread's reactor
+// rather than blocked on when drawing starts. RendererFrameWaitHandle returns
+// nullptr while a signaled frame hasn't been used yet.
+bool RendererSignalFrameReady(void *context);
+HANDLE RendererFrameWaitHandle(Renderer *renderer);
 
 PixelSize RendererGridToPixelSize(Renderer *renderer, int rows, int cols);
 GridSize RendererPixelsToGridSize(Renderer *renderer, int width, int height);
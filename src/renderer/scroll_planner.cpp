@@ -0,0 +1,102 @@
+#include "scroll_planner.h"
+#include <cstdlib>
+
+static void MarkRowsDirty(GridModel *grid, int first_row, int end_row, int start_col, int end_col) {
+	for (int row = first_row; row < end_row; ++row) {
+		GridModelMarkDirty(grid, row, start_col, end_col);
+	}
+}
+
+static bool IsBlank(uint32_t codepoint) {
+	return codepoint == GRID_BLANK;
+}
+
+bool ScrollPlan(GridModel *grid, GridScrollCommand *grid_scroll, float cell_width, float cell_height,
+	int canvas_width, int canvas_height, ScrollBlit *blit) {
+	*blit = ScrollBlit {};
+	int top = grid_scroll->top;
+	int bottom = grid_scroll->bottom;
+	int left = grid_scroll->left;
+	int right = grid_scroll->right;
+	int rows = grid_scroll->rows;
+	int moved_rows = bottom - top - abs(rows);
+	if (top < 0 || bottom > grid->rows || left < 0 || right > grid->cols || left >= right ||
+		rows == 0 || moved_rows <= 0) {
+		GridModelScroll(grid, grid_scroll);
+		return true;
+	}
+	int destination = rows > 0 ? top : top - rows;
+	int source = rows > 0 ? top + rows : top;
+
+	// Part of a row is drawn again along with the blanks around it, so cells
+	// inside the region may be stale because of cells outside of it that
+	// changed, and only the part inside moves
+	if (left > 0 || right < grid->cols) {
+		for (int row = source; row < source + moved_rows; ++row) {
+			int start_col;
+			int end_col;
+			if (GridModelDirtySpan(grid, row, &start_col, &end_col)) {
+				GridModelWidenToBlanks(grid, row, &start_col, &end_col);
+				GridModelMarkDirty(grid, row, start_col, end_col);
+			}
+		}
+	}
+	GridModelScroll(grid, grid_scroll);
+
+	// Rows only look the same after moving by a whole number of pixels
+	float distance = rows * cell_height;
+	if (fabsf(distance - roundf(distance)) > 1e-3f) {
+		MarkRowsDirty(grid, destination, destination + moved_rows, left, right);
+		return false;
+	}
+
+	// Both where the pixels come from and where they go have to be on the canvas
+	int source_top = CanvasPixel(source * cell_height);
+	int offset = CanvasPixel(destination * cell_height) - source_top;
+	int source_bottom = CanvasPixel((source + moved_rows) * cell_height);
+	int clipped_top = source_top > -offset ? source_top : -offset;
+	int clipped_bottom = source_bottom < canvas_height - offset ? source_bottom : canvas_height - offset;
+	clipped_top = clipped_top > 0 ? clipped_top : 0;
+	clipped_bottom = clipped_bottom < canvas_height ? clipped_bottom : canvas_height;
+	int pixel_left = CanvasPixel(left * cell_width);
+	int pixel_right = CanvasPixel(right * cell_width);
+	pixel_right = pixel_right < canvas_width ? pixel_right : canvas_width;
+	if (clipped_top < clipped_bottom && pixel_left < pixel_right) {
+		*blit = ScrollBlit {
+			.left = pixel_left,
+			.top = clipped_top,
+			.right = pixel_right,
+			.bottom = clipped_bottom,
+			.destination_top = clipped_top + offset
+		};
+	}
+
+	for (int row = destination; row < destination + moved_rows; ++row) {
+		// Rows cut off by the canvas, unless they aren't on it at all
+		int row_top = CanvasPixel(row * cell_height);
+		int row_bottom = CanvasPixel((row + 1) * cell_height);
+		bool visible = row_top < canvas_height && pixel_left < canvas_width;
+		if (visible && (row_top < blit->destination_top || row_bottom > blit->bottom + offset ||
+			blit->top == blit->bottom)) {
+			GridModelMarkDirty(grid, row, left, right);
+			continue;
+		}
+
+		// Rows are laid out in runs of text between blanks, see GridModelWidenToBlanks.
+		// A run reaching an edge of the region from outside may have gone on inside
+		// it, and one reaching it from inside may have gone on outside where it
+		// came from, either way it looks different now.
+		int moved_from = row - destination + source;
+		uint32_t *text = &grid->text[GridModelOffset(grid, row, 0)];
+		uint32_t *text_left_behind = &grid->text[GridModelOffset(grid, moved_from, 0)];
+		if (left > 0 && (!IsBlank(text[left - 1]) ||
+			(!IsBlank(text[left]) && !IsBlank(text_left_behind[left - 1])))) {
+			GridModelMarkDirty(grid, row, left - 1, left + 1);
+		}
+		if (right < grid->cols && (!IsBlank(text[right]) ||
+			(!IsBlank(text[right - 1]) && !IsBlank(text_left_behind[right])))) {
+			GridModelMarkDirty(grid, row, right - 1, right + 1);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cmath>
+#include "nvim/redraw_commands.h"
+#include "renderer/grid_model.h"
+
+// Scrolling a canvas that keeps what was drawn of the grid between frames.
+// Rather than drawing every row a grid_scroll moves again, its pixels are
+// moved along with it and only the rows nvim redraws are drawn.
+
+// The first pixel past an edge at a position on the canvas, aliased drawing
+// covers the pixels whose centers are inside what is drawn
+inline int CanvasPixel(float position) {
+	return static_cast<int>(ceilf(position - 0.5f));
+}
+
+// The pixels to move, the rectangle [left, right) x [top, bottom) is moved to
+// destination_top. The rectangles may overlap. Empty if there is nothing to move.
+struct ScrollBlit {
+	int left;
+	int top;
+	int right;
+	int bottom;
+	int destination_top;
+};
+
+// Scrolls the grid and plans moving the pixels of a canvas of the given size
+// along with it, with cells of the given size in pixels. Returns false if they
+// can't be moved, as cells don't line up with pixels after the move, in which
+// case the moved rows are marked dirty instead. Rows whose pixels aren't all on
+// the canvas before and after the move are marked dirty either way.
+bool ScrollPlan(GridModel *grid, GridScrollCommand *grid_scroll, float cell_width, float cell_height,
+	int canvas_width, int canvas_height, ScrollBlit *blit);
@@ -0,0 +1,39 @@
+# Records a short nvy_fake_nvim session with nvy_replay --capture, then replays
+# the capture with --fast. The replay fails by itself on timestamps that go back
+# and on data it couldn't parse, the records it read are checked against the
+# ones captured here.
+# cmake -DNVY_REPLAY=<path> -DFAKE_NVIM=<path> -DCAPTURE=<file> -P capture_replay_test.cmake
+execute_process(
+    COMMAND ${NVY_REPLAY} "--nvim-command=${FAKE_NVIM} --embed --workload=mixed --frames=40 --rate=0" --capture=${CAPTURE}
+    RESULT_VARIABLE result
+    OUTPUT_VARIABLE output
+)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "Recording failed with ${result}:\n${output}")
+endif()
+if(NOT output MATCHES "captured: ([0-9]+) records \\(([0-9]+) bytes\\)")
+	message(FATAL_ERROR "Nothing was captured:\n${output}")
+endif()
+set(captured_records ${CMAKE_MATCH_1})
+set(captured_bytes ${CMAKE_MATCH_2})
+
+execute_process(
+    COMMAND ${NVY_REPLAY} --fast ${CAPTURE}
+    RESULT_VARIABLE result
+    OUTPUT_VARIABLE output
+)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "Replay failed with ${result}:\n${output}")
+endif()
+if(NOT output MATCHES "capture:  ([0-9]+) inbound records \\(([0-9]+) bytes\\), ([0-9]+) outbound records \\(([0-9]+) bytes\\)")
+	message(FATAL_ERROR "The replay didn't report the capture:\n${output}")
+endif()
+math(EXPR replayed_records "${CMAKE_MATCH_1} + ${CMAKE_MATCH_3}")
+math(EXPR replayed_bytes "${CMAKE_MATCH_2} + ${CMAKE_MATCH_4}")
+if(NOT replayed_records EQUAL captured_records OR NOT replayed_bytes EQUAL captured_bytes)
+	message(FATAL_ERROR "Captured ${captured_records} records (${captured_bytes} bytes), "
+		"replayed ${replayed_records} records (${replayed_bytes} bytes)")
+endif()
+if(NOT output MATCHES "redraw batches, [1-9][0-9]* commands")
+	message(FATAL_ERROR "No redraw commands were replayed:\n${output}")
+endif()
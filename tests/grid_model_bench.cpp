@@ -0,0 +1,178 @@
+// Time taken by GridModel to apply grid_line, grid_scroll and grid_resize on
+// a large grid, with lines of ASCII text, of wide chars and of clusters. The
+// dirty rows are taken after every frame, as the renderer does.
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "renderer/grid_model.h"
+
+constexpr int ROWS = 120;
+constexpr int COLS = 400;
+
+enum class LineText {
+	Ascii,
+	Wide,
+	Cluster
+};
+constexpr const char *LINE_TEXT_NAMES[] = { "ascii", "wide", "cluster" };
+
+// A GridLineCommand followed by its cells and cluster text
+struct Line {
+	std::vector<uint64_t> command;
+};
+
+static GridLineCommand *LineCommand(Line *line) {
+	return reinterpret_cast<GridLineCommand *>(line->command.data());
+}
+
+// Words in a few highlights separated by blanks, covering the whole row
+static Line BuildLine(LineText line_text, int row, uint32_t frame) {
+	std::vector<RedrawCell> cells;
+	std::vector<char> cluster_text;
+	for (int col = 0; col < COLS;) {
+		uint16_t hl = static_cast<uint16_t>(1 + (row + col / 8) % 40);
+		uint32_t letter = (row + col + frame) % 26;
+		if (col % 8 == 7) {
+			cells.push_back(RedrawCell { GRID_BLANK, 0, 1 });
+			col += 1;
+		}
+		else if (line_text == LineText::Wide && col % 8 < 6) {
+			cells.push_back(RedrawCell { 0x4E00 + letter, hl, 1 });
+			cells.push_back(RedrawCell { REDRAW_CELL_WIDE_CHAR_CONTINUATION, hl, 1 });
+			col += 2;
+		}
+		else if (line_text == LineText::Cluster) {
+			// A letter and a combining acute accent
+			uint32_t offset = static_cast<uint32_t>(cluster_text.size());
+			const char utf8[] = { 3, static_cast<char>('a' + letter), '\xCC', '\x81' };
+			cluster_text.insert(cluster_text.end(), utf8, utf8 + sizeof(utf8));
+			cells.push_back(RedrawCell { REDRAW_CELL_CLUSTER | offset, hl, 1 });
+			col += 1;
+		}
+		else {
+			cells.push_back(RedrawCell { 'a' + letter, hl, 1 });
+			col += 1;
+		}
+	}
+
+	size_t size = sizeof(GridLineCommand) + cells.size() * sizeof(RedrawCell) + cluster_text.size();
+	Line line { .command = std::vector<uint64_t>((size + 7) / 8) };
+	GridLineCommand *grid_line = LineCommand(&line);
+	grid_line->row = row;
+	grid_line->col_start = 0;
+	grid_line->cell_count = static_cast<uint32_t>(cells.size());
+	grid_line->cluster_text_size = static_cast<uint32_t>(cluster_text.size());
+	memcpy(GridLineCells(grid_line), cells.data(), cells.size() * sizeof(RedrawCell));
+	if (!cluster_text.empty()) {
+		memcpy(GridLineClusterText(grid_line), cluster_text.data(), cluster_text.size());
+	}
+	return line;
+}
+
+static uint64_t TakeAllDirtyRows(GridModel *grid) {
+	uint64_t cells = 0;
+	int start_col, end_col;
+	for (int row = 0; (row = GridModelTakeDirtyRow(grid, row, &start_col, &end_col)) >= 0; ++row) {
+		cells += end_col - start_col;
+	}
+	return cells;
+}
+
+static void FillGrid(GridModel *grid, std::vector<Line> *lines) {
+	for (int row = 0; row < grid->rows; ++row) {
+		GridModelApplyLine(grid, LineCommand(&(*lines)[row % lines->size()]));
+	}
+	TakeAllDirtyRows(grid);
+}
+
+static double Seconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Full screen redraws, each frame's lines differ from the last frame's
+static double LineNanosecondsPerCell(GridModel *grid, std::vector<Line> *frames, uint32_t frame_count) {
+	uint64_t cells = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t frame = 0; frame < frame_count; ++frame) {
+		for (int row = 0; row < ROWS; ++row) {
+			GridModelApplyLine(grid, LineCommand(&frames[frame % 2][row]));
+		}
+		cells += TakeAllDirtyRows(grid);
+	}
+	double seconds = Seconds(start);
+	return cells ? seconds * 1e9 / cells : 0.0;
+}
+
+// Scrolls by a line down and back up, each followed by the line scrolled in
+static double ScrollMicroseconds(GridModel *grid, std::vector<Line> *lines, int left, int right, uint32_t scroll_count) {
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < scroll_count; ++i) {
+		int rows = i % 2 ? -1 : 1;
+		GridScrollCommand scroll { 0, ROWS, left, right, rows, 0 };
+		GridModelScroll(grid, &scroll);
+		GridModelApplyLine(grid, LineCommand(&(*lines)[rows > 0 ? ROWS - 1 : 0]));
+		TakeAllDirtyRows(grid);
+	}
+	return Seconds(start) * 1e6 / scroll_count;
+}
+
+// Shrinks and grows the grid back, keeping the cells that stay inside
+static double ResizeMicroseconds(GridModel *grid, uint32_t resize_count) {
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < resize_count; ++i) {
+		if (i % 2) {
+			GridModelResize(grid, ROWS, COLS);
+		}
+		else {
+			GridModelResize(grid, ROWS - 7, COLS - 13);
+		}
+		TakeAllDirtyRows(grid);
+	}
+	return Seconds(start) * 1e6 / resize_count;
+}
+
+// grid_model_bench [--quick]
+int main(int argc, char **argv) {
+	uint32_t frame_count = 2000;
+	uint32_t scroll_count = 20000;
+	uint32_t resize_count = 2000;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--quick")) {
+			frame_count = 4;
+			scroll_count = 40;
+			resize_count = 4;
+		}
+	}
+
+	printf("%dx%d grid, %u frames, %u scrolls, %u resizes\n", COLS, ROWS, frame_count, scroll_count, resize_count);
+	printf("%-8s %14s %19s %22s %14s\n", "text", "grid_line", "grid_scroll full", "grid_scroll partial", "grid_resize");
+	for (LineText line_text : { LineText::Ascii, LineText::Wide, LineText::Cluster }) {
+		std::vector<Line> frames[2];
+		for (uint32_t frame = 0; frame < 2; ++frame) {
+			for (int row = 0; row < ROWS; ++row) {
+				frames[frame].push_back(BuildLine(line_text, row, frame));
+			}
+		}
+
+		GridModel grid {};
+		GridModelResize(&grid, ROWS, COLS);
+		FillGrid(&grid, &frames[0]);
+		double line = LineNanosecondsPerCell(&grid, frames, frame_count);
+		double full_scroll = ScrollMicroseconds(&grid, &frames[0], 0, COLS, scroll_count);
+		// Left of a vertical split, the cells have to be copied
+		double partial_scroll = ScrollMicroseconds(&grid, &frames[0], 0, COLS / 2, scroll_count);
+		double resize = ResizeMicroseconds(&grid, resize_count);
+
+		if (grid.clusters.truncated) {
+			fprintf(stderr, "clusters were cut short\n");
+			return 1;
+		}
+		printf("%-8s %8.2f ns/cell %13.2f us %16.2f us %11.2f us\n", LINE_TEXT_NAMES[static_cast<int>(line_text)],
+			line, full_scroll, partial_scroll, resize);
+		GridModelDestroy(&grid);
+	}
+	return 0;
+}
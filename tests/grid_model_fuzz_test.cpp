@@ -0,0 +1,216 @@
+// Applies random grid_lines and builds the text of random rows, checking both
+// against plain scalar versions written here. It is built twice, once as is
+// and once with GRID_MODEL_SCALAR, so the SSE2 paths of the grid model and its
+// scalar fallbacks are held to the same results.
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "common/utf8.h"
+#include "renderer/grid_model.h"
+#include "test.h"
+
+static uint32_t random_state;
+static uint32_t Random(uint32_t n) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state % n;
+}
+
+struct Cluster {
+	const char *utf8;
+	const char16_t *utf16;
+};
+
+static const Cluster CLUSTERS[] = {
+	{ "e\xCC\x81", u"e\u0301" },
+	{ "a\xCC\x88\xCC\xA3", u"a\u0308\u0323" },
+	{ "\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBD", u"\U0001F44D\U0001F3FD" },
+	{ "\xF0\x9F\x87\xAF\xF0\x9F\x87\xB5", u"\U0001F1EF\U0001F1F5" },
+	{ "\xE0\xA4\x95\xE0\xA5\x8D\xE0\xA4\xB7", u"\u0915\u094D\u0937" },
+};
+constexpr uint32_t CLUSTER_COUNT = sizeof(CLUSTERS) / sizeof(CLUSTERS[0]);
+
+// Mostly around the edges the vector paths check for
+static uint32_t RandomCodepoint() {
+	switch (Random(12)) {
+	case 0: return GRID_WIDE_CONTINUATION;
+	case 1: return 0x10000 + Random(0x100000);
+	case 2: return GRID_FIRST_CLUSTER_ID + Random(CLUSTER_COUNT + 2);
+	case 3: return 0x80 + Random(0xFF80);
+	case 4: return 0x7FFF + Random(3);
+	case 5: return 0xFFFF + Random(3);
+	case 6: return 0xFFFFFFFF - Random(3);
+	case 7: return 0xD800 + Random(0x800);
+	default: return 0x20 + Random(0x5F);
+	}
+}
+
+// The units of a column, how many a cluster takes comes from the grid's table
+static uint32_t ReferenceCellUnits(const GridModel *grid, uint32_t codepoint) {
+	uint32_t index = codepoint - GRID_FIRST_CLUSTER_ID;
+	if (codepoint >= GRID_FIRST_CLUSTER_ID && index < grid->clusters.count) {
+		return grid->clusters.starts[index + 1] - grid->clusters.starts[index];
+	}
+	return codepoint >= 0x10000 && codepoint <= GRID_MAX_CODEPOINT ? 2 : 1;
+}
+
+static uint32_t ReferenceRowText(const GridModel *grid, const uint32_t *row_text, int start_col, int end_col,
+	char16_t *text, uint32_t *offsets) {
+	uint32_t length = 0;
+	bool left_was_pair = start_col > 0 && row_text[start_col - 1] != GRID_WIDE_CONTINUATION &&
+		ReferenceCellUnits(grid, row_text[start_col - 1]) > 1;
+	for (int col = start_col; col < end_col; ++col) {
+		offsets[col - start_col] = length;
+		uint32_t codepoint = row_text[col];
+		if (codepoint == GRID_WIDE_CONTINUATION) {
+			if (!left_was_pair) {
+				text[length++] = u'\0';
+			}
+			left_was_pair = false;
+			continue;
+		}
+		uint32_t index = codepoint - GRID_FIRST_CLUSTER_ID;
+		if (codepoint >= GRID_FIRST_CLUSTER_ID && index < grid->clusters.count) {
+			uint32_t units = ReferenceCellUnits(grid, codepoint);
+			for (uint32_t i = 0; i < units; ++i) {
+				text[length++] = grid->clusters.text[grid->clusters.starts[index] + i];
+			}
+			left_was_pair = units > 1;
+			continue;
+		}
+		if (codepoint > GRID_MAX_CODEPOINT) {
+			codepoint = UTF8_REPLACEMENT_CHARACTER;
+		}
+		if (codepoint < 0x10000) {
+			text[length++] = static_cast<char16_t>(codepoint);
+			left_was_pair = false;
+		}
+		else {
+			codepoint -= 0x10000;
+			text[length++] = static_cast<char16_t>(0xD800 + (codepoint >> 10));
+			text[length++] = static_cast<char16_t>(0xDC00 + (codepoint & 0x3FF));
+			left_was_pair = true;
+		}
+	}
+	offsets[end_col - start_col] = length;
+	return length;
+}
+
+static bool HasClusterText(const GridModel *grid, uint32_t codepoint, const char16_t *utf16) {
+	uint32_t index = codepoint - GRID_FIRST_CLUSTER_ID;
+	if (codepoint < GRID_FIRST_CLUSTER_ID || index >= grid->clusters.count) {
+		return false;
+	}
+	uint32_t length = grid->clusters.starts[index + 1] - grid->clusters.starts[index];
+	return std::char_traits<char16_t>::length(utf16) == length &&
+		memcmp(&grid->clusters.text[grid->clusters.starts[index]], utf16, length * sizeof(char16_t)) == 0;
+}
+
+// Runs of repeated cells without wide chars, so only the fill and the
+// clusters are exercised
+static void FuzzFill(GridModel *grid, int rows, int cols) {
+	std::vector<uint32_t> expected_text(grid->text, grid->text + static_cast<size_t>(rows) * cols);
+	std::vector<uint16_t> expected_attribs(grid->attribs, grid->attribs + static_cast<size_t>(rows) * cols);
+	// The cluster each cell is expected to hold, its id is only known once applied
+	std::vector<int> expected_clusters(expected_text.size(), -1);
+
+	uint32_t cell_count = 1 + Random(6);
+	std::string cluster_text;
+	std::vector<int> cell_clusters(cell_count, -1);
+	for (uint32_t i = 0; i < cell_count; ++i) {
+		if (Random(6) == 0) {
+			cell_clusters[i] = static_cast<int>(Random(CLUSTER_COUNT));
+		}
+	}
+
+	std::vector<uint64_t> command((sizeof(GridLineCommand) + cell_count * sizeof(RedrawCell) + 64 * cell_count + 7) / 8);
+	GridLineCommand *grid_line = reinterpret_cast<GridLineCommand *>(command.data());
+	grid_line->row = static_cast<int32_t>(Random(rows));
+	grid_line->col_start = static_cast<int32_t>(Random(cols + 1));
+	grid_line->cell_count = cell_count;
+	RedrawCell *cells = GridLineCells(grid_line);
+	size_t offset = GridModelOffset(grid, grid_line->row, grid_line->col_start);
+	size_t row_end = GridModelOffset(grid, grid_line->row, 0) + cols;
+	for (uint32_t i = 0; i < cell_count; ++i) {
+		uint32_t codepoint = Random(4) ? 0x20 + Random(0x5F) : RandomCodepoint();
+		if (cell_clusters[i] >= 0) {
+			const char *utf8 = CLUSTERS[cell_clusters[i]].utf8;
+			codepoint = REDRAW_CELL_CLUSTER | static_cast<uint32_t>(cluster_text.size());
+			cluster_text += static_cast<char>(strlen(utf8));
+			cluster_text += utf8;
+		}
+		cells[i] = RedrawCell {
+			.codepoint = codepoint == GRID_WIDE_CONTINUATION ? 'z' : codepoint,
+			.hl_attrib_id = static_cast<uint16_t>(Random(3) ? Random(5) : 0xFFFF - Random(3)),
+			.repeat = static_cast<uint16_t>(1 + Random(40))
+		};
+		// Past the unicode range without cluster text is invalid
+		uint32_t expected = cells[i].codepoint > GRID_MAX_CODEPOINT ? UTF8_REPLACEMENT_CHARACTER : cells[i].codepoint;
+		uint16_t attrib = cells[i].hl_attrib_id <= GRID_MAX_HL_ID ? cells[i].hl_attrib_id : 0;
+		for (uint16_t repeat = 0; repeat < cells[i].repeat && offset < row_end; ++repeat, ++offset) {
+			expected_text[offset] = expected;
+			expected_attribs[offset] = attrib;
+			expected_clusters[offset] = cell_clusters[i];
+		}
+	}
+	grid_line->cluster_text_size = static_cast<uint32_t>(cluster_text.size());
+	memcpy(GridLineClusterText(grid_line), cluster_text.data(), cluster_text.size());
+
+	GridModelApplyLine(grid, grid_line);
+	for (size_t i = 0; i < expected_text.size(); ++i) {
+		if (expected_clusters[i] >= 0) {
+			CHECK(HasClusterText(grid, grid->text[i], CLUSTERS[expected_clusters[i]].utf16));
+			expected_text[i] = grid->text[i];
+		}
+	}
+	CHECK(memcmp(grid->text, expected_text.data(), expected_text.size() * sizeof(uint32_t)) == 0);
+	CHECK(memcmp(grid->attribs, expected_attribs.data(), expected_attribs.size() * sizeof(uint16_t)) == 0);
+}
+
+// Buffers are sized exactly so writes past them show up under ASan
+static void FuzzRowText(GridModel *grid, int cols) {
+	int row = static_cast<int>(Random(grid->rows));
+	uint32_t *row_text = &grid->text[GridModelOffset(grid, row, 0)];
+	bool mostly_bmp = Random(2);
+	for (int col = 0; col < cols; ++col) {
+		row_text[col] = mostly_bmp && Random(20) ? 0x20 + Random(0x5F) : RandomCodepoint();
+	}
+
+	int start_col = static_cast<int>(Random(cols + 1));
+	int end_col = start_col + static_cast<int>(Random(cols - start_col + 1));
+	size_t offset_count = static_cast<size_t>(end_col - start_col) + 1;
+	std::vector<char16_t> expected_text(GRID_MAX_COLUMN_UNITS * static_cast<size_t>(end_col - start_col));
+	std::vector<uint32_t> expected_offsets(offset_count);
+	uint32_t expected_length = ReferenceRowText(grid, row_text, start_col, end_col,
+		expected_text.data(), expected_offsets.data());
+	std::vector<char16_t> text(expected_length);
+	std::vector<uint32_t> offsets(offset_count);
+	uint32_t length = GridModelRowText(grid, row, start_col, end_col, text.data(), offsets.data());
+	CHECK(length == expected_length);
+	CHECK(length == 0 || memcmp(text.data(), expected_text.data(), length * sizeof(char16_t)) == 0);
+	CHECK(memcmp(offsets.data(), expected_offsets.data(), offset_count * sizeof(uint32_t)) == 0);
+}
+
+// grid_model_fuzz_test [iterations] [seed]
+int main(int argc, char **argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+	random_state = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) | 1 : 99;
+
+	for (int i = 0; i < iterations && !test_failures; ++i) {
+		GridModel grid {};
+		int rows = 1 + static_cast<int>(Random(3));
+		int cols = 1 + static_cast<int>(Random(70));
+		GridModelResize(&grid, rows, cols);
+		for (int j = 0; j < 4; ++j) {
+			FuzzFill(&grid, rows, cols);
+			FuzzRowText(&grid, cols);
+		}
+		if (test_failures) {
+			fprintf(stderr, "iteration %d\n", i);
+		}
+		GridModelDestroy(&grid);
+	}
+	return TestResult("grid_model_fuzz_test");
+}
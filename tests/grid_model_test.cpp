@@ -0,0 +1,438 @@
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include "nvim/redraw_decoder.h"
+#include "renderer/grid_model.h"
+#include "third_party/mpack/mpack.h"
+#include "test.h"
+
+// Cluster cells point into cluster_text, see GridLineCommand
+static void ApplyLine(GridModel *grid, int row, int col_start, std::initializer_list<RedrawCell> cells,
+	std::string_view cluster_text = {}) {
+	std::vector<uint64_t> command((sizeof(GridLineCommand) + cells.size() * sizeof(RedrawCell) + cluster_text.size() + 7) / 8);
+	GridLineCommand *grid_line = reinterpret_cast<GridLineCommand *>(command.data());
+	grid_line->row = row;
+	grid_line->col_start = col_start;
+	grid_line->cell_count = static_cast<uint32_t>(cells.size());
+	grid_line->cluster_text_size = static_cast<uint32_t>(cluster_text.size());
+	memcpy(GridLineCells(grid_line), cells.begin(), cells.size() * sizeof(RedrawCell));
+	if (!cluster_text.empty()) {
+		memcpy(GridLineClusterText(grid_line), cluster_text.data(), cluster_text.size());
+	}
+	GridModelApplyLine(grid, grid_line);
+}
+
+static void ApplyCluster(GridModel *grid, int row, int col, const std::string &utf8) {
+	ApplyLine(grid, row, col, { { REDRAW_CELL_CLUSTER, 1, 1 } }, static_cast<char>(utf8.size()) + utf8);
+}
+
+static std::string Utf8(uint32_t codepoint) {
+	std::string utf8;
+	if (codepoint < 0x80) {
+		utf8 += static_cast<char>(codepoint);
+	}
+	else if (codepoint < 0x800) {
+		utf8 += static_cast<char>(0xC0 | (codepoint >> 6));
+		utf8 += static_cast<char>(0x80 | (codepoint & 0x3F));
+	}
+	else if (codepoint < 0x10000) {
+		utf8 += static_cast<char>(0xE0 | (codepoint >> 12));
+		utf8 += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+		utf8 += static_cast<char>(0x80 | (codepoint & 0x3F));
+	}
+	else {
+		utf8 += static_cast<char>(0xF0 | (codepoint >> 18));
+		utf8 += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+		utf8 += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+		utf8 += static_cast<char>(0x80 | (codepoint & 0x3F));
+	}
+	return utf8;
+}
+
+static std::u16string RowText(GridModel *grid, int row, int start_col, int end_col) {
+	std::u16string text(GRID_MAX_COLUMN_UNITS * static_cast<size_t>(end_col - start_col), u'?');
+	std::vector<uint32_t> offsets(static_cast<size_t>(end_col - start_col) + 1);
+	text.resize(GridModelRowText(grid, row, start_col, end_col, text.data(), offsets.data()));
+	return text;
+}
+
+static uint32_t CellText(GridModel *grid, int row, int col) {
+	return grid->text[GridModelOffset(grid, row, col)];
+}
+static uint16_t CellAttrib(GridModel *grid, int row, int col) {
+	return grid->attribs[GridModelOffset(grid, row, col)];
+}
+
+static void TakeAllDirtyRows(GridModel *grid) {
+	int start_col, end_col;
+	for (int row = 0; (row = GridModelTakeDirtyRow(grid, row, &start_col, &end_col)) >= 0; ++row) {
+	}
+}
+
+static void TestResizeKeepsOverlap() {
+	GridModel grid {};
+	CHECK(GridModelResize(&grid, 4, 6));
+	CHECK(!GridModelResize(&grid, 4, 6));
+	for (int row = 0; row < 4; ++row) {
+		ApplyLine(&grid, row, 0, { { 'a' + static_cast<uint32_t>(row), static_cast<uint16_t>(row + 1), 6 } });
+	}
+	// Screen rows keep their cells even when storage has been rotated
+	GridScrollCommand scroll { 0, 4, 0, 6, 1, 0 };
+	GridModelScroll(&grid, &scroll);
+	ApplyLine(&grid, 3, 0, { { 'z', 7, 6 } });
+	ApplyLine(&grid, 1, 4, { { 0x4E16, 2, 1 }, { GRID_WIDE_CONTINUATION, 0, 1 } });
+	TakeAllDirtyRows(&grid);
+
+	CHECK(GridModelResize(&grid, 3, 5));
+	CHECK(grid.rows == 3 && grid.cols == 5);
+	for (int row = 0; row < 3; ++row) {
+		for (int col = 0; col < 4; ++col) {
+			CHECK(CellText(&grid, row, col) == 'b' + static_cast<uint32_t>(row));
+			CHECK(CellAttrib(&grid, row, col) == row + 2);
+		}
+	}
+	// The wide char cut in half by the new edge is blanked, the row keeps its flags
+	CHECK(CellText(&grid, 1, 4) == GRID_BLANK && CellAttrib(&grid, 1, 4) == 0);
+	CHECK(GridModelRow(&grid, 1)->flags == (GRID_ROW_WIDE_CHARS | GRID_ROW_NON_LATIN1));
+	CHECK(CellText(&grid, 0, 4) == 'b');
+
+	CHECK(GridModelResize(&grid, 5, 8));
+	for (int row = 0; row < 5; ++row) {
+		for (int col = 0; col < 8; ++col) {
+			bool kept = row < 3 && col < 5 && !(row == 1 && col == 4);
+			CHECK(kept ? CellText(&grid, row, col) == 'b' + static_cast<uint32_t>(row) : CellText(&grid, row, col) == GRID_BLANK);
+			CHECK(kept ? CellAttrib(&grid, row, col) == row + 2 : CellAttrib(&grid, row, col) == 0);
+		}
+	}
+	CHECK(GridModelRow(&grid, 4)->flags == 0);
+
+	// Nothing drawn before lines up with the new size
+	int start_col, end_col;
+	for (int row = 0; row < 5; ++row) {
+		CHECK(GridModelDirtySpan(&grid, row, &start_col, &end_col) && start_col == 0 && end_col == 8);
+	}
+	GridModelDestroy(&grid);
+}
+
+static void TestWideFlagAcrossLines() {
+	GridModel grid {};
+	GridModelResize(&grid, 2, 6);
+
+	// The left half in one grid_line, its right half in the next
+	ApplyLine(&grid, 0, 0, { { 'a', 1, 1 }, { 0x4E16, 2, 1 } });
+	CHECK(!GridCellIsWide(CellAttrib(&grid, 0, 1)));
+	ApplyLine(&grid, 0, 2, { { GRID_WIDE_CONTINUATION, 0, 1 }, { 'b', 3, 3 } });
+	CHECK(GridCellIsWide(CellAttrib(&grid, 0, 1)) && GridCellHl(CellAttrib(&grid, 0, 1)) == 2);
+	CHECK(CellText(&grid, 0, 2) == GRID_WIDE_CONTINUATION && CellAttrib(&grid, 0, 2) == 2);
+	CHECK(GridModelRow(&grid, 0)->flags == (GRID_ROW_WIDE_CHARS | GRID_ROW_NON_LATIN1));
+
+	// The right half replaced on its own clears the flag of the left half
+	ApplyLine(&grid, 0, 2, { { 'c', 4, 1 } });
+	CHECK(!GridCellIsWide(CellAttrib(&grid, 0, 1)) && GridCellHl(CellAttrib(&grid, 0, 1)) == 2);
+	// The cell to the left of a line is repainted along with it
+	int start_col, end_col;
+	CHECK(GridModelDirtySpan(&grid, 0, &start_col, &end_col) && start_col == 0 && end_col == 6);
+
+	// A right half at the start of a row has nothing to inherit from
+	ApplyLine(&grid, 1, 0, { { GRID_WIDE_CONTINUATION, 5, 1 } });
+	CHECK(CellAttrib(&grid, 1, 0) == 0);
+
+	// Rewriting the whole row resets its flags
+	ApplyLine(&grid, 0, 0, { { 'z', 0, 6 } });
+	CHECK(GridModelRow(&grid, 0)->flags == 0);
+	GridModelDestroy(&grid);
+}
+
+static void TestRepeatClamped() {
+	GridModel grid {};
+	GridModelResize(&grid, 3, 6);
+	TakeAllDirtyRows(&grid);
+
+	ApplyLine(&grid, 1, 4, { { 'q', 5, 100 }, { 'r', 6, 3 } });
+	CHECK(CellText(&grid, 1, 3) == GRID_BLANK);
+	CHECK(CellText(&grid, 1, 4) == 'q' && CellText(&grid, 1, 5) == 'q' && CellAttrib(&grid, 1, 5) == 5);
+	for (int col = 0; col < 6; ++col) {
+		CHECK(CellText(&grid, 2, col) == GRID_BLANK && CellAttrib(&grid, 2, col) == 0);
+	}
+	int start_col, end_col;
+	CHECK(GridModelTakeDirtyRow(&grid, 0, &start_col, &end_col) == 1 && start_col == 3 && end_col == 6);
+	CHECK(GridModelTakeDirtyRow(&grid, 2, &start_col, &end_col) == -1);
+
+	// Long enough for the vector fill, with ids past the mask drawn with the default
+	GridModelResize(&grid, 2, 37);
+	ApplyLine(&grid, 0, 3, { { 0x1F600, 40000, 60 } });
+	for (int col = 0; col < 37; ++col) {
+		CHECK(CellText(&grid, 0, col) == (col < 3 ? GRID_BLANK : 0x1F600) && CellAttrib(&grid, 0, col) == 0);
+		CHECK(CellText(&grid, 1, col) == (col == 4 || col == 5 ? 'q' : GRID_BLANK));
+	}
+	GridModelDestroy(&grid);
+}
+
+static void TestScroll() {
+	constexpr int ROWS = 8;
+	constexpr int COLS = 10;
+	GridModel grid {};
+	GridModelResize(&grid, ROWS, COLS);
+	for (int row = 0; row < ROWS; ++row) {
+		ApplyLine(&grid, row, 0, { { 'a' + static_cast<uint32_t>(row), 0, COLS } });
+	}
+	std::vector<uint32_t> storage(grid.text, grid.text + ROWS * COLS);
+
+	// The full width is scrolled by rotating rows, cells stay in place in storage
+	GridScrollCommand up { 1, 7, 0, COLS, 2, 0 };
+	GridModelScroll(&grid, &up);
+	CHECK(memcmp(storage.data(), grid.text, storage.size() * sizeof(uint32_t)) == 0);
+	const int rotated[ROWS] = { 0, 3, 4, 5, 6, 1, 2, 7 };
+	for (int row = 0; row < ROWS; ++row) {
+		CHECK(grid.row_index[row] == rotated[row]);
+		CHECK(CellText(&grid, row, 0) == 'a' + static_cast<uint32_t>(rotated[row]));
+	}
+	GridScrollCommand down { 1, 7, 0, COLS, -2, 0 };
+	GridModelScroll(&grid, &down);
+	for (int row = 0; row < ROWS; ++row) {
+		CHECK(grid.row_index[row] == row);
+	}
+
+	// Part of the width is copied, what is outside the region stays put
+	GridScrollCommand partial { 0, 6, 2, 7, 3, 0 };
+	GridModelScroll(&grid, &partial);
+	for (int row = 0; row < ROWS; ++row) {
+		CHECK(grid.row_index[row] == row);
+		for (int col = 0; col < COLS; ++col) {
+			bool moved = row < 3 && col >= 2 && col < 7;
+			CHECK(CellText(&grid, row, col) == 'a' + static_cast<uint32_t>(moved ? row + 3 : row));
+		}
+	}
+	GridModelDestroy(&grid);
+
+	// Against a plain copy of the cells, with the rows left behind skipped as
+	// what they hold after a scroll is left unspecified
+	GridModel random {};
+	GridModelResize(&random, 37, 23);
+	std::vector<uint32_t> expected(37 * 23, GRID_BLANK);
+	std::vector<bool> known(37, true);
+	srand(7);
+	for (int i = 0; i < 20000; ++i) {
+		if (rand() % 2) {
+			int row = rand() % 37;
+			uint32_t codepoint = 'a' + rand() % 26;
+			ApplyLine(&random, row, 0, { { codepoint, 0, 23 } });
+			for (int col = 0; col < 23; ++col) {
+				expected[row * 23 + col] = codepoint;
+			}
+			known[row] = true;
+			continue;
+		}
+
+		int top = rand() % 37;
+		int bottom = top + 1 + rand() % (37 - top);
+		int left = rand() % 2 ? 0 : rand() % 23;
+		int right = rand() % 2 ? 23 : left + 1 + rand() % (23 - left);
+		int rows = 1 + rand() % (bottom - top);
+		rows = rand() % 2 ? rows : -rows;
+		bool full_width = left == 0 && right == 23;
+		GridScrollCommand scroll { top, bottom, left, right, rows, 0 };
+		GridModelScroll(&random, &scroll);
+
+		std::vector<uint32_t> before = expected;
+		std::vector<bool> known_before = known;
+		for (int row = top; row < bottom; ++row) {
+			int source = row + rows;
+			if (source < top || source >= bottom) {
+				known[row] = known[row] && !full_width;
+				continue;
+			}
+			for (int col = left; col < right; ++col) {
+				expected[row * 23 + col] = before[source * 23 + col];
+			}
+			known[row] = full_width ? known_before[source] : known[row] && known_before[source];
+		}
+
+		std::vector<int> rows_seen(37);
+		for (int row = 0; row < 37; ++row) {
+			rows_seen[random.row_index[row]] += 1;
+			for (int col = 0; known[row] && col < 23; ++col) {
+				CHECK(CellText(&random, row, col) == expected[row * 23 + col]);
+			}
+		}
+		for (int seen : rows_seen) {
+			CHECK(seen == 1);
+		}
+		if (test_failures) {
+			break;
+		}
+	}
+	GridModelDestroy(&random);
+}
+
+static void TestTakeDirtyRows() {
+	GridModel grid {};
+	GridModelResize(&grid, 130, 100);
+	int start_col, end_col;
+	CHECK(GridModelTakeDirtyRow(&grid, 0, &start_col, &end_col) == 0 && start_col == 0 && end_col == 100);
+	TakeAllDirtyRows(&grid);
+	CHECK(GridModelTakeDirtyRow(&grid, 0, &start_col, &end_col) == -1);
+	uint64_t rows_repainted = grid.rows_repainted;
+
+	// Changes to a row are merged into a single span, columns clamped
+	ApplyLine(&grid, 1, 40, { { 'x', 1, 5 } });
+	GridModelMarkDirty(&grid, 1, 60, 62);
+	GridModelMarkDirty(&grid, 64, 98, 105);
+	GridModelMarkDirty(&grid, 129, -3, 2);
+	GridModelMarkDirty(&grid, 130, 0, 10);
+	GridModelMarkDirty(&grid, 5, 7, 7);
+	int row = GridModelTakeDirtyRow(&grid, 0, &start_col, &end_col);
+	CHECK(row == 1 && start_col == 39 && end_col == 62);
+	row = GridModelTakeDirtyRow(&grid, row + 1, &start_col, &end_col);
+	CHECK(row == 64 && start_col == 98 && end_col == 100);
+	row = GridModelTakeDirtyRow(&grid, row + 1, &start_col, &end_col);
+	CHECK(row == 129 && start_col == 0 && end_col == 2);
+	CHECK(GridModelTakeDirtyRow(&grid, row + 1, &start_col, &end_col) == -1);
+	CHECK(grid.rows_repainted == rows_repainted + 3);
+
+	// Rows taken are clean until changed again, starting past them skips them
+	GridModelMarkDirty(&grid, 3, 0, 1);
+	GridModelMarkDirty(&grid, 70, 0, 1);
+	CHECK(GridModelTakeDirtyRow(&grid, 4, &start_col, &end_col) == 70);
+	CHECK(GridModelTakeDirtyRow(&grid, 0, &start_col, &end_col) == 3);
+
+	// Scrolled rows take their dirty columns inside the region along, columns
+	// outside it stay dirty where they are
+	GridScrollCommand scroll { 0, 3, 10, 20, 1, 0 };
+	GridModelScroll(&grid, &scroll);
+	CHECK(GridModelTakeDirtyRow(&grid, 0, &start_col, &end_col) == -1);
+	ApplyLine(&grid, 2, 12, { { 'y', 1, 2 } });
+	GridModelMarkDirty(&grid, 1, 0, 3);
+	GridModelMarkDirty(&grid, 1, 15, 16);
+	GridModelScroll(&grid, &scroll);
+	row = GridModelTakeDirtyRow(&grid, 0, &start_col, &end_col);
+	CHECK(row == 0 && start_col == 10 && end_col == 16);
+	row = GridModelTakeDirtyRow(&grid, row + 1, &start_col, &end_col);
+	CHECK(row == 1 && start_col == 0 && end_col == 16);
+	row = GridModelTakeDirtyRow(&grid, row + 1, &start_col, &end_col);
+	CHECK(row == 2 && start_col == 11 && end_col == 14);
+	CHECK(GridModelTakeDirtyRow(&grid, row + 1, &start_col, &end_col) == -1);
+	GridModelDestroy(&grid);
+}
+
+// A grid_line of cells, each [text] or [text, hl_id], decoded like one from nvim
+static void DecodeAndApplyLine(GridModel *grid, int row, std::initializer_list<const char *> cells) {
+	char data[1024];
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, data, sizeof(data));
+	mpack_start_array(&writer, 5);
+	mpack_write_i64(&writer, 1);
+	mpack_write_i64(&writer, row);
+	mpack_write_i64(&writer, 0);
+	mpack_start_array(&writer, static_cast<uint32_t>(cells.size()));
+	for (const char *cell : cells) {
+		mpack_start_array(&writer, 2);
+		mpack_write_cstr(&writer, cell);
+		mpack_write_i64(&writer, 1);
+		mpack_finish_array(&writer);
+	}
+	mpack_finish_array(&writer);
+	mpack_write_false(&writer);
+	mpack_finish_array(&writer);
+	size_t size = mpack_writer_buffer_used(&writer);
+	CHECK(mpack_writer_destroy(&writer) == mpack_ok);
+
+	mpack_tree_t tree;
+	mpack_tree_init_data(&tree, data, size);
+	mpack_tree_parse(&tree);
+	RedrawEvent event { .name = "grid_line", .name_length = 9, .args = mpack_tree_root(&tree) };
+	RedrawCommandBuffer buffer {};
+	CHECK(RedrawCommandsDecodeEvent(&buffer, &event) == RedrawDecodeResult::Decoded);
+	RedrawCommand *command = RedrawCommandsBegin(&buffer);
+	GridModelApplyLine(grid, RedrawCommandPayload<GridLineCommand>(command));
+	RedrawCommandBufferDestroy(&buffer);
+	CHECK(mpack_tree_destroy(&tree) == mpack_ok);
+}
+
+static void TestClusters() {
+	GridModel grid {};
+	GridModelResize(&grid, 2, 8);
+
+	// A combining mark, a wide emoji with a skin tone and its right half, and
+	// a cluster too long to keep whole, cut after its last whole codepoint
+	std::string long_cluster = "a";
+	for (int i = 0; i < 20; ++i) {
+		long_cluster += "\xCC\x81";
+	}
+	DecodeAndApplyLine(&grid, 0, { "e\xCC\x81", "\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBD", "", "x",
+		"e\xCC\x81", long_cluster.c_str(), "\xE4\xB8\x96" });
+	CHECK(grid.clusters.count == 3);
+	CHECK(CellText(&grid, 0, 0) >= GRID_FIRST_CLUSTER_ID && CellText(&grid, 0, 0) == CellText(&grid, 0, 4));
+	CHECK(CellText(&grid, 0, 2) == GRID_WIDE_CONTINUATION && CellText(&grid, 0, 3) == 'x');
+	CHECK(CellText(&grid, 0, 6) == 0x4E16);
+	CHECK(GridModelRow(&grid, 0)->flags & GRID_ROW_NON_LATIN1);
+
+	std::u16string long_text = u"a";
+	for (int i = 0; i < 15; ++i) {
+		long_text += u"\u0301";
+	}
+	// No NUL stands in for the right half of a cluster that took more than one unit
+	CHECK(RowText(&grid, 0, 0, 7) == u"e\u0301\U0001F44D\U0001F3FDxe\u0301" + long_text + u"\u4E16");
+	CHECK(RowText(&grid, 0, 2, 4) == u"x");
+	std::vector<char16_t> text(GRID_MAX_COLUMN_UNITS * 7);
+	uint32_t offsets[8];
+	GridModelRowText(&grid, 0, 0, 7, text.data(), offsets);
+	uint32_t expected_offsets[] = { 0, 2, 6, 6, 7, 9, 25, 26 };
+	CHECK(memcmp(offsets, expected_offsets, sizeof(offsets)) == 0);
+
+	// Cluster cells without valid text are drawn as replacement characters
+	ApplyLine(&grid, 1, 0, { { REDRAW_CELL_CLUSTER | 3, 1, 1 }, { GRID_MAX_CODEPOINT + 1, 1, 1 } }, "\x02\xCC\x81");
+	ApplyLine(&grid, 1, 2, { { REDRAW_CELL_CLUSTER, 1, 1 } }, std::string_view("\x00", 1));
+	ApplyLine(&grid, 1, 3, { { REDRAW_CELL_CLUSTER, 1, 1 } }, "\x05" "ab");
+	CHECK(RowText(&grid, 1, 0, 4) == u"\uFFFD\uFFFD\uFFFD\uFFFD");
+	CHECK(grid.clusters.count == 3);
+
+	// Resizing carries the table along with the cells
+	GridModelResize(&grid, 3, 8);
+	CHECK(RowText(&grid, 0, 0, 2) == u"e\u0301\U0001F44D\U0001F3FD");
+
+	GridModelClear(&grid);
+	CHECK(grid.clusters.count == 0);
+	ApplyCluster(&grid, 0, 0, "o\xCC\x88");
+	CHECK(CellText(&grid, 0, 0) == GRID_FIRST_CLUSTER_ID && RowText(&grid, 0, 0, 1) == u"o\u0308");
+	GridModelDestroy(&grid);
+}
+
+static void TestClustersCollected() {
+	// Clusters overwritten by newer ones are dropped once the table is full
+	GridModel grid {};
+	GridModelResize(&grid, 1, 10);
+	for (uint32_t i = 0; i < GRID_MAX_CLUSTERS + 1000; ++i) {
+		ApplyCluster(&grid, 0, i % 10, Utf8(0x4E00 + i) + "\xCC\x81");
+	}
+	CHECK(grid.clusters.collections == 1 && grid.clusters.truncated == 0);
+	CHECK(grid.clusters.count <= GRID_MAX_CLUSTERS);
+	for (uint32_t i = GRID_MAX_CLUSTERS + 990; i < GRID_MAX_CLUSTERS + 1000; ++i) {
+		CHECK(RowText(&grid, 0, i % 10, i % 10 + 1) == std::u16string(1, static_cast<char16_t>(0x4E00 + i)) + u"\u0301");
+	}
+	GridModelDestroy(&grid);
+
+	// While every cluster is still on screen, new ones keep their first codepoint
+	GridModelResize(&grid, 100, 50);
+	for (uint32_t i = 0; i < 5000; ++i) {
+		ApplyCluster(&grid, i / 50, i % 50, Utf8(0x4E00 + i) + "\xCC\x81");
+	}
+	CHECK(grid.clusters.count == GRID_MAX_CLUSTERS);
+	CHECK(grid.clusters.truncated == 5000 - GRID_MAX_CLUSTERS);
+	CHECK(CellText(&grid, 99, 49) == 0x4E00 + 4999);
+	CHECK(RowText(&grid, 0, 0, 1) == u"\u4E00\u0301");
+	GridModelDestroy(&grid);
+}
+
+int main() {
+	TestResizeKeepsOverlap();
+	TestWideFlagAcrossLines();
+	TestRepeatClamped();
+	TestScroll();
+	TestTakeDirtyRows();
+	TestClusters();
+	TestClustersCollected();
+	return TestResult("grid_model_test");
+}
@@ -0,0 +1,107 @@
+#include <cstring>
+#include <string>
+#include "nvim/input_coalescer.h"
+#include "test.h"
+
+static bool AddRepeat(InputCoalescer *coalescer, const char *input) {
+	return InputCoalescerAddRepeat(coalescer, input, strlen(input));
+}
+
+static void TestFolding() {
+	InputCoalescer coalescer {};
+	CHECK(!InputCoalescerSent(&coalescer));
+	CHECK(AddRepeat(&coalescer, "j"));
+	CHECK(AddRepeat(&coalescer, "<C-d>"));
+	CHECK(AddRepeat(&coalescer, "j"));
+	CHECK(InputCoalescerPending(&coalescer) == "j<C-d>j");
+	CHECK(coalescer.repeats_coalesced == 2);
+
+	// The first batch is followed by a sync request
+	CHECK(InputCoalescerSent(&coalescer));
+	CHECK(InputCoalescerPending(&coalescer).empty());
+	CHECK(coalescer.batches_sent == 1 && coalescer.unacknowledged_repeats == 3);
+	CHECK(!InputCoalescerSent(&coalescer));
+	CHECK(coalescer.batches_sent == 1);
+
+	// A repeat on its own isn't counted as coalesced
+	CHECK(!InputCoalescerAcknowledge(&coalescer));
+	CHECK(AddRepeat(&coalescer, "k"));
+	CHECK(coalescer.repeats_coalesced == 2);
+	InputCoalescerDestroy(&coalescer);
+}
+
+static void TestCap() {
+	InputCoalescer coalescer {};
+	for (uint32_t i = 0; i < INPUT_MAX_UNACKNOWLEDGED_REPEATS; ++i) {
+		CHECK(AddRepeat(&coalescer, "j"));
+	}
+	CHECK(!AddRepeat(&coalescer, "j"));
+	CHECK(coalescer.repeats_dropped == 1);
+	CHECK(InputCoalescerPending(&coalescer).size() == INPUT_MAX_UNACKNOWLEDGED_REPEATS);
+
+	// Repeats on their way count against the cap until nvim has caught up
+	CHECK(InputCoalescerSent(&coalescer));
+	CHECK(!AddRepeat(&coalescer, "j"));
+	CHECK(coalescer.repeats_dropped == 2);
+	CHECK(!InputCoalescerAcknowledge(&coalescer));
+	CHECK(coalescer.unacknowledged_repeats == 0 && !coalescer.sync_in_flight);
+	CHECK(AddRepeat(&coalescer, "j"));
+	InputCoalescerDestroy(&coalescer);
+}
+
+static void TestSyncReissued() {
+	InputCoalescer coalescer {};
+	CHECK(AddRepeat(&coalescer, "j"));
+	CHECK(InputCoalescerSent(&coalescer));
+	CHECK(coalescer.synced_repeats == 1);
+
+	// Repeats sent while a sync is in flight wait for the next one
+	CHECK(AddRepeat(&coalescer, "j"));
+	CHECK(AddRepeat(&coalescer, "j"));
+	CHECK(!InputCoalescerSent(&coalescer));
+	CHECK(coalescer.unacknowledged_repeats == 3 && coalescer.synced_repeats == 1);
+
+	CHECK(InputCoalescerAcknowledge(&coalescer));
+	CHECK(coalescer.sync_in_flight && coalescer.unacknowledged_repeats == 2 && coalescer.synced_repeats == 2);
+	CHECK(AddRepeat(&coalescer, "j"));
+	CHECK(AddRepeat(&coalescer, "j"));
+	CHECK(!AddRepeat(&coalescer, "j"));
+
+	CHECK(!InputCoalescerSent(&coalescer));
+	CHECK(InputCoalescerAcknowledge(&coalescer));
+	CHECK(coalescer.unacknowledged_repeats == 2 && coalescer.synced_repeats == 2);
+	CHECK(!InputCoalescerAcknowledge(&coalescer));
+	CHECK(coalescer.unacknowledged_repeats == 0 && coalescer.synced_repeats == 0 && !coalescer.sync_in_flight);
+	InputCoalescerDestroy(&coalescer);
+}
+
+static void TestBufferGrowth() {
+	InputCoalescer coalescer {};
+	std::string expected;
+	for (uint32_t i = 0; i < INPUT_MAX_UNACKNOWLEDGED_REPEATS; ++i) {
+		std::string input(INPUT_COALESCER_INITIAL_SIZE / 2 + i, static_cast<char>('a' + i));
+		CHECK(InputCoalescerAddRepeat(&coalescer, input.data(), input.size()));
+		expected += input;
+		CHECK(coalescer.pending_capacity >= coalescer.pending_size);
+	}
+	CHECK(InputCoalescerPending(&coalescer) == expected);
+	CHECK(coalescer.pending_capacity == 4 * INPUT_COALESCER_INITIAL_SIZE);
+
+	// Sending keeps the buffer for the next batch
+	char *pending = coalescer.pending;
+	CHECK(InputCoalescerSent(&coalescer));
+	CHECK(!InputCoalescerAcknowledge(&coalescer));
+	CHECK(AddRepeat(&coalescer, "x"));
+	CHECK(coalescer.pending == pending && InputCoalescerPending(&coalescer) == "x");
+
+	InputCoalescerDestroy(&coalescer);
+	CHECK(coalescer.pending == nullptr && coalescer.pending_capacity == 0);
+}
+
+int main() {
+	TestFolding();
+	TestCap();
+	TestSyncReissued();
+	TestBufferGrowth();
+	return TestResult("input_coalescer_test");
+}
@@ -0,0 +1,101 @@
+// Checks every frame of a key table byte for byte against the snprintf and
+// mpack encoding Nvy used to build for each keypress
+#include <cstdio>
+#include <cstring>
+#include "nvim/key_table.h"
+#include "third_party/mpack/mpack.h"
+#include "test.h"
+
+constexpr RpcMethod<std::string_view> INPUT { .id = 1, .name = "nvim_input" };
+
+// The names Nvy sends, with made up virtual keys
+constexpr auto KEY_NAMES = std::to_array<KeyName>({
+	KeyName { 0x08, "BS" },
+	KeyName { 0x09, "Tab" },
+	KeyName { 0x0D, "CR" },
+	KeyName { 0x1B, "Esc" },
+	KeyName { 0x21, "PageUp" },
+	KeyName { 0x22, "PageDown" },
+	KeyName { 0x24, "Home" },
+	KeyName { 0x25, "Left" },
+	KeyName { 0x2D, "Insert" },
+	KeyName { 0x2E, "Del" },
+	KeyName { 0x60, "k0" },
+	KeyName { 0x6A, "kMultiply" },
+	KeyName { 0x6C, "kComma" },
+	KeyName { 0x6E, "kPoint" },
+	KeyName { 0x6F, "kDivide" },
+	KeyName { 0x70, "F1" },
+	KeyName { 0x87, "F24" },
+	KeyName { 0xFF, "Last" }
+});
+constexpr auto KEY_TABLE = BuildKeyTable(INPUT, KEY_NAMES);
+
+static size_t EncodeOldInput(const char *name, int modifiers, char *data, size_t capacity) {
+	char input_string[64];
+	snprintf(input_string, sizeof(input_string), "<%s%s%s%s>", (modifiers & KEY_MODIFIER_CTRL) ? "C-" : "",
+		(modifiers & KEY_MODIFIER_SHIFT) ? "S-" : "", (modifiers & KEY_MODIFIER_ALT) ? "M-" : "", name);
+
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, data, capacity);
+	mpack_start_array(&writer, 3);
+	mpack_write_i64(&writer, RPC_NOTIFICATION);
+	mpack_write_cstr(&writer, "nvim_input");
+	mpack_start_array(&writer, 1);
+	mpack_write_cstr(&writer, input_string);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	size_t size = mpack_writer_buffer_used(&writer);
+	CHECK(mpack_writer_destroy(&writer) == mpack_ok);
+	return size;
+}
+
+static void TestFramesMatchOldEncoding() {
+	for (const KeyName &key_name : KEY_NAMES) {
+		char name[32] {};
+		memcpy(name, key_name.name.data(), key_name.name.size());
+		for (int modifiers = 0; modifiers < KEY_MODIFIER_COMBINATIONS; ++modifiers) {
+			const KeyInput *key_input = KeyTableLookup(&KEY_TABLE, key_name.virtual_key, modifiers);
+			CHECK(key_input != nullptr);
+			if (!key_input) {
+				continue;
+			}
+
+			char expected[256];
+			size_t expected_size = EncodeOldInput(name, modifiers, expected, sizeof(expected));
+			CHECK(key_input->frame_size == expected_size);
+			CHECK(memcmp(key_input->frame, expected, expected_size) == 0);
+
+			// The input string is the tail of the frame
+			std::string_view input = KeyInputString(key_input);
+			CHECK(input.front() == '<' && input.back() == '>');
+			CHECK(input.substr(input.size() - key_name.name.size() - 1, key_name.name.size()) == key_name.name);
+			CHECK(key_input->input_offset + input.size() == expected_size);
+		}
+	}
+}
+
+static void TestLookup() {
+	int named_keys = 0;
+	for (int virtual_key = 0; virtual_key < KEY_TABLE_VIRTUAL_KEY_COUNT; ++virtual_key) {
+		named_keys += KeyTableLookup(&KEY_TABLE, virtual_key, 0) != nullptr;
+	}
+	CHECK(named_keys == static_cast<int>(KEY_NAMES.size()));
+	CHECK(KeyTableLookup(&KEY_TABLE, -1, 0) == nullptr);
+	CHECK(KeyTableLookup(&KEY_TABLE, KEY_TABLE_VIRTUAL_KEY_COUNT, 0) == nullptr);
+
+	// Modifier bits past the table are ignored
+	const KeyInput *key_input = KeyTableLookup(&KEY_TABLE, 0x6A, KEY_MODIFIER_CTRL | 0x10);
+	CHECK(key_input != nullptr && KeyInputString(key_input) == "<C-kMultiply>");
+	key_input = KeyTableLookup(&KEY_TABLE, 0x6A, KEY_MODIFIER_CTRL | KEY_MODIFIER_SHIFT | KEY_MODIFIER_ALT);
+	CHECK(key_input != nullptr && KeyInputString(key_input) == "<C-S-M-kMultiply>");
+
+	// Encoded at compile time
+	static_assert(KeyInputString(KeyTableLookup(&KEY_TABLE, 0x0D, KEY_MODIFIER_SHIFT)) == "<S-CR>");
+}
+
+int main() {
+	TestFramesMatchOldEncoding();
+	TestLookup();
+	return TestResult("key_table_test");
+}
@@ -0,0 +1,180 @@
+// Parse throughput of redraw traffic through MPackStream against the
+// mpack_tree_init_stream setup Nvy used to read nvim's stdout with, both
+// reading from memory in pipe sized chunks. The traffic is full screen
+// redraws of a large grid, or the inbound records of a capture file.
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "common/mpack_stream.h"
+#include "common/rpc_capture.h"
+
+constexpr int ROWS = 120;
+constexpr int COLS = 400;
+constexpr size_t PIPE_READ_SIZE = 64 * 1024;
+
+struct MemorySource {
+	const std::string *data;
+	size_t offset;
+};
+
+static size_t ReadMemory(void *context, char *buffer, size_t count) {
+	MemorySource *source = static_cast<MemorySource *>(context);
+	size_t size = source->data->size() - source->offset;
+	size = size < count ? size : count;
+	size = size < PIPE_READ_SIZE ? size : PIPE_READ_SIZE;
+	memcpy(buffer, source->data->data() + source->offset, size);
+	source->offset += size;
+	return size;
+}
+
+static size_t ReadMemoryTree(mpack_tree_t *tree, char *buffer, size_t count) {
+	return ReadMemory(mpack_tree_context(tree), buffer, count);
+}
+
+// A grid_line per row, runs of words in a few highlights, then a flush
+static void AppendRedraw(std::string *data, uint32_t frame) {
+	char *message;
+	size_t size;
+	mpack_writer_t writer;
+	mpack_writer_init_growable(&writer, &message, &size);
+	mpack_start_array(&writer, 3);
+	mpack_write_int(&writer, 2);
+	mpack_write_cstr(&writer, "redraw");
+	mpack_start_array(&writer, 2);
+	mpack_start_array(&writer, 1 + ROWS);
+	mpack_write_cstr(&writer, "grid_line");
+	for (int row = 0; row < ROWS; ++row) {
+		mpack_start_array(&writer, 5);
+		mpack_write_int(&writer, 1);
+		mpack_write_int(&writer, row);
+		mpack_write_int(&writer, 0);
+		mpack_start_array(&writer, COLS);
+		for (int col = 0; col < COLS; ++col) {
+			char text[2] = { static_cast<char>('a' + (row + col + frame) % 26), '\0' };
+			if (col % 6 == 0) {
+				mpack_start_array(&writer, 2);
+				mpack_write_cstr(&writer, text);
+				mpack_write_int(&writer, (row + col / 6) % 40);
+			}
+			else {
+				mpack_start_array(&writer, 1);
+				mpack_write_cstr(&writer, col % 6 == 5 ? " " : text);
+			}
+			mpack_finish_array(&writer);
+		}
+		mpack_finish_array(&writer);
+		mpack_write_false(&writer);
+		mpack_finish_array(&writer);
+	}
+	mpack_finish_array(&writer);
+	mpack_start_array(&writer, 1);
+	mpack_write_cstr(&writer, "flush");
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	if (mpack_writer_destroy(&writer) == mpack_ok) {
+		data->append(message, size);
+	}
+	MPACK_FREE(message);
+}
+
+static bool AppendCapture(std::string *data, const char *path) {
+	RpcCaptureFile capture_file;
+	if (!RpcCaptureMap(&capture_file, path)) {
+		return false;
+	}
+	size_t offset = RPC_CAPTURE_FIRST_RECORD;
+	RpcCaptureRecord record;
+	const char *record_data;
+	while (RpcCaptureNextRecord(&capture_file, &offset, &record, &record_data)) {
+		if (record.direction == RpcCaptureDirection::Inbound) {
+			data->append(record_data, record.size);
+		}
+	}
+	RpcCaptureUnmap(&capture_file);
+	return true;
+}
+
+static double StreamMilliseconds(const std::string &data, uint64_t *messages, uint64_t *nodes) {
+	MemorySource source { .data = &data };
+	MPackStream *stream = new MPackStream;
+	auto start = std::chrono::steady_clock::now();
+	MPackStreamInitialize(stream, ReadMemory, &source);
+	MPackStreamMessage message;
+	while (MPackStreamNext(stream, &message)) {
+		*messages += 1;
+		*nodes += message.tree->node_count;
+	}
+	MPackStreamDestroy(stream);
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	delete stream;
+	return milliseconds;
+}
+
+static double TreeMilliseconds(const std::string &data, uint64_t *messages, uint64_t *nodes) {
+	MemorySource source { .data = &data };
+	mpack_tree_t tree;
+	auto start = std::chrono::steady_clock::now();
+	mpack_tree_init_stream(&tree, ReadMemoryTree, &source, 20 * 1024 * 1024, 1024 * 1024);
+	// The end of the data ends it with an io error
+	while (true) {
+		mpack_tree_parse(&tree);
+		if (mpack_tree_error(&tree) != mpack_ok) {
+			break;
+		}
+		*messages += 1;
+		*nodes += tree.node_count;
+	}
+	mpack_tree_destroy(&tree);
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// mpack_stream_bench [--quick] [frames | capture file]
+int main(int argc, char **argv) {
+	uint32_t frames = 200;
+	const char *capture_path = nullptr;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--quick")) {
+			frames = 3;
+		}
+		else if (argv[i][0] >= '0' && argv[i][0] <= '9') {
+			frames = static_cast<uint32_t>(strtoul(argv[i], nullptr, 10));
+		}
+		else {
+			capture_path = argv[i];
+		}
+	}
+
+	std::string data;
+	if (capture_path) {
+		if (!AppendCapture(&data, capture_path)) {
+			fprintf(stderr, "Could not open capture file %s\n", capture_path);
+			return 1;
+		}
+	}
+	else {
+		for (uint32_t frame = 0; frame < frames; ++frame) {
+			AppendRedraw(&data, frame);
+		}
+	}
+
+	uint64_t stream_messages = 0;
+	uint64_t stream_nodes = 0;
+	uint64_t tree_messages = 0;
+	uint64_t tree_nodes = 0;
+	double stream = StreamMilliseconds(data, &stream_messages, &stream_nodes);
+	double tree = TreeMilliseconds(data, &tree_messages, &tree_nodes);
+	if (stream_messages == 0 || stream_messages != tree_messages || stream_nodes != tree_nodes) {
+		fprintf(stderr, "the two parsers disagree\n");
+		return 1;
+	}
+	double megabytes = data.size() / (1024.0 * 1024.0);
+	printf("%" PRIu64 " messages, %.1f MB, %" PRIu64 " nodes from %s\n", stream_messages, megabytes, stream_nodes,
+		capture_path ? capture_path : "full screen redraws of a 400x120 grid");
+	printf("MPackStream:       %8.2f ms, %7.1f MB/s\n", stream, megabytes / (stream / 1000.0));
+	printf("mpack tree stream: %8.2f ms, %7.1f MB/s\n", tree, megabytes / (tree / 1000.0));
+	return 0;
+}
@@ -0,0 +1,332 @@
+// Frames messages read in pieces of every size, down to splitting them at
+// every byte, and checks them and their node counts against mpack's own
+// parse of each message on its own
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "common/mpack_stream.h"
+#include "test.h"
+
+static uint32_t random_state = 7;
+static uint32_t Random(uint32_t n) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state % n;
+}
+
+// Hands out the data in reads of at most max_read bytes, or of a random size
+// up to it, the first one ending at first_read if that is set
+struct ReadSource {
+	const std::string *data;
+	size_t offset;
+	size_t first_read;
+	size_t max_read;
+	bool random_sizes;
+};
+
+static size_t ReadPieces(void *context, char *buffer, size_t count) {
+	ReadSource *source = static_cast<ReadSource *>(context);
+	size_t size = source->data->size() - source->offset;
+	if (source->first_read) {
+		size = source->first_read - source->offset;
+		source->first_read = 0;
+	}
+	size_t max_read = source->random_sizes ? 1 + Random(static_cast<uint32_t>(source->max_read)) : source->max_read;
+	size = size < max_read ? size : max_read;
+	size = size < count ? size : count;
+	memcpy(buffer, source->data->data() + source->offset, size);
+	source->offset += size;
+	return size;
+}
+
+using Message = std::string;
+template <typename WriteFn>
+static Message Write(WriteFn write) {
+	char *data;
+	size_t size;
+	mpack_writer_t writer;
+	mpack_writer_init_growable(&writer, &data, &size);
+	write(&writer);
+	CHECK(mpack_writer_destroy(&writer) == mpack_ok);
+	Message message(data, size);
+	MPACK_FREE(data);
+	return message;
+}
+
+static size_t ReferenceNodeCount(const Message &message) {
+	mpack_tree_t tree;
+	mpack_tree_init_data(&tree, message.data(), message.size());
+	mpack_tree_parse(&tree);
+	CHECK(mpack_tree_error(&tree) == mpack_ok && mpack_tree_size(&tree) == message.size());
+	size_t node_count = tree.node_count;
+	mpack_tree_destroy(&tree);
+	return node_count;
+}
+
+static uint64_t CheckStream(const std::vector<Message> &messages, ReadSource source) {
+	std::string data;
+	for (const Message &message : messages) {
+		data += message;
+	}
+	source.data = &data;
+
+	MPackStream *stream = new MPackStream;
+	MPackStreamInitialize(stream, ReadPieces, &source);
+	for (const Message &message : messages) {
+		MPackStreamMessage read;
+		CHECK(MPackStreamNext(stream, &read));
+		if (test_failures) {
+			break;
+		}
+		CHECK(read.size == message.size() && memcmp(read.data, message.data(), read.size) == 0);
+		CHECK(read.tree->node_count == ReferenceNodeCount(message));
+	}
+	// Then the end of the stream
+	MPackStreamMessage read;
+	CHECK(!MPackStreamNext(stream, &read));
+	CHECK(stream->messages_parsed == messages.size() && stream->bytes_read == data.size());
+	uint64_t compactions = stream->compactions;
+	MPackStreamDestroy(stream);
+	delete stream;
+	return compactions;
+}
+
+// The kinds of messages nvim and Nvy send each other
+static std::vector<Message> RealMessages() {
+	std::vector<Message> messages;
+	messages.push_back(Write([](mpack_writer_t *writer) {
+		// [2, "redraw", [["grid_line", [1, 0, 0, cells, false]], ["flush"]]]
+		mpack_start_array(writer, 3);
+		mpack_write_int(writer, 2);
+		mpack_write_cstr(writer, "redraw");
+		mpack_start_array(writer, 3);
+		mpack_start_array(writer, 2);
+		mpack_write_cstr(writer, "grid_line");
+		mpack_start_array(writer, 5);
+		mpack_write_int(writer, 1);
+		mpack_write_int(writer, 0);
+		mpack_write_int(writer, 0);
+		mpack_start_array(writer, 4);
+		mpack_start_array(writer, 2); mpack_write_cstr(writer, "a"); mpack_write_int(writer, 1); mpack_finish_array(writer);
+		mpack_start_array(writer, 1); mpack_write_cstr(writer, "\xE4\xB8\x96"); mpack_finish_array(writer);
+		mpack_start_array(writer, 1); mpack_write_cstr(writer, ""); mpack_finish_array(writer);
+		mpack_start_array(writer, 3); mpack_write_cstr(writer, " "); mpack_write_int(writer, 300); mpack_write_int(writer, 70); mpack_finish_array(writer);
+		mpack_finish_array(writer);
+		mpack_write_false(writer);
+		mpack_finish_array(writer);
+		mpack_finish_array(writer);
+		mpack_start_array(writer, 2);
+		mpack_write_cstr(writer, "hl_attr_define");
+		mpack_start_array(writer, 4);
+		mpack_write_int(writer, 300);
+		mpack_start_map(writer, 2);
+		mpack_write_cstr(writer, "foreground"); mpack_write_uint(writer, 0xFFEEDD);
+		mpack_write_cstr(writer, "bold"); mpack_write_true(writer);
+		mpack_finish_map(writer);
+		mpack_start_map(writer, 0); mpack_finish_map(writer);
+		mpack_start_array(writer, 0); mpack_finish_array(writer);
+		mpack_finish_array(writer);
+		mpack_finish_array(writer);
+		mpack_start_array(writer, 1);
+		mpack_write_cstr(writer, "flush");
+		mpack_finish_array(writer);
+		mpack_finish_array(writer);
+		mpack_finish_array(writer);
+	}));
+	messages.push_back(Write([](mpack_writer_t *writer) {
+		// [1, 5, nil, {...}]
+		mpack_start_array(writer, 4);
+		mpack_write_int(writer, 1);
+		mpack_write_int(writer, 5);
+		mpack_write_nil(writer);
+		mpack_start_map(writer, 4);
+		mpack_write_cstr(writer, "n"); mpack_write_int(writer, -200000);
+		mpack_write_cstr(writer, "big"); mpack_write_u64(writer, 0xFFFFFFFFFFull);
+		mpack_write_cstr(writer, "x"); mpack_write_double(writer, 1.5);
+		mpack_write_cstr(writer, "y"); mpack_write_float(writer, 2.5f);
+		mpack_finish_map(writer);
+		mpack_finish_array(writer);
+	}));
+	messages.push_back(Write([](mpack_writer_t *writer) {
+		// [0, 3, "nvim_input", ["<C-v>"]] and a str8 and bin8 to go with it
+		mpack_start_array(writer, 4);
+		mpack_write_int(writer, 0);
+		mpack_write_int(writer, 3);
+		mpack_write_cstr(writer, "nvim_input");
+		mpack_start_array(writer, 3);
+		mpack_write_cstr(writer, "<C-v>");
+		mpack_write_str(writer, std::string(40, 's').c_str(), 40);
+		mpack_write_bin(writer, "\x00\x01\x02", 3);
+		mpack_finish_array(writer);
+		mpack_finish_array(writer);
+	}));
+	return messages;
+}
+
+static void WriteRandomObject(mpack_writer_t *writer, int depth) {
+	static const uint32_t STRING_SIZES[] = { 0, 1, 31, 32, 255, 256, 65535, 65536 };
+	switch (Random(depth < 4 ? 12 : 9)) {
+	case 0: mpack_write_nil(writer); break;
+	case 1: mpack_write_bool(writer, Random(2)); break;
+	case 2: mpack_write_int(writer, -static_cast<int64_t>(Random(1u << 31)) * (1 + Random(1000))); break;
+	case 3: mpack_write_uint(writer, static_cast<uint64_t>(Random(1u << 31)) << Random(33)); break;
+	case 4: mpack_write_float(writer, static_cast<float>(Random(1000)) / 7); break;
+	case 5: mpack_write_double(writer, static_cast<double>(Random(1000)) / 7); break;
+	case 6:
+	case 7: {
+		// Mostly short, sometimes just past each header size
+		uint32_t size = Random(8) ? Random(40) : STRING_SIZES[Random(8)];
+		std::string text(size, static_cast<char>('a' + Random(26)));
+		if (Random(2)) {
+			mpack_write_str(writer, text.data(), size);
+		}
+		else {
+			mpack_write_bin(writer, text.data(), size);
+		}
+	} break;
+	case 8: mpack_write_int(writer, Random(128)); break;
+	case 9:
+	case 10: {
+		uint32_t count = Random(4) ? Random(5) : 14 + Random(6);
+		mpack_start_array(writer, count);
+		for (uint32_t i = 0; i < count; ++i) {
+			WriteRandomObject(writer, depth + 1);
+		}
+		mpack_finish_array(writer);
+	} break;
+	case 11: {
+		uint32_t count = Random(4) ? Random(4) : 14 + Random(6);
+		mpack_start_map(writer, count);
+		for (uint32_t i = 0; i < 2 * count; ++i) {
+			WriteRandomObject(writer, depth + 1);
+		}
+		mpack_finish_map(writer);
+	} break;
+	}
+}
+
+static std::vector<Message> RandomMessages(size_t count) {
+	std::vector<Message> messages;
+	for (size_t i = 0; i < count; ++i) {
+		messages.push_back(Write([](mpack_writer_t *writer) {
+			mpack_start_array(writer, 3);
+			mpack_write_int(writer, 2);
+			mpack_write_cstr(writer, "redraw");
+			WriteRandomObject(writer, 1);
+			mpack_finish_array(writer);
+		}));
+	}
+	return messages;
+}
+
+static void TestEverySplit() {
+	std::vector<Message> messages = RealMessages();
+	size_t size = 0;
+	for (const Message &message : messages) {
+		size += message.size();
+	}
+	for (size_t split = 1; split < size && !test_failures; ++split) {
+		CheckStream(messages, ReadSource { .first_read = split, .max_read = size });
+	}
+	CheckStream(messages, ReadSource { .max_read = 1 });
+}
+
+static void TestRandomMessages() {
+	for (int round = 0; round < 50 && !test_failures; ++round) {
+		std::vector<Message> messages = RandomMessages(1 + Random(20));
+		CheckStream(messages, ReadSource { .max_read = 1 });
+		CheckStream(messages, ReadSource { .max_read = 1 + Random(300), .random_sizes = true });
+	}
+
+	// Once more than a buffer's worth has been read the buffer wraps, with a
+	// message that has only been read in part moved back to its start
+	std::vector<Message> messages;
+	size_t size = 0;
+	while (size < 3 * MPACK_STREAM_INITIAL_BUFFER_SIZE) {
+		messages.push_back(Write([](mpack_writer_t *writer) {
+			mpack_start_array(writer, 3);
+			mpack_write_int(writer, 2);
+			mpack_write_cstr(writer, "redraw");
+			mpack_start_array(writer, 200);
+			for (int i = 0; i < 200; ++i) {
+				WriteRandomObject(writer, 3);
+			}
+			mpack_finish_array(writer);
+			mpack_finish_array(writer);
+		}));
+		size += messages.back().size();
+	}
+	CHECK(CheckStream(messages, ReadSource { .max_read = 40000, .random_sizes = true }) > 0);
+}
+
+static MPackScanResult Scan(const std::string &data, size_t *node_count = nullptr) {
+	MPackScanState scan {};
+	MPackScanResult result = MPackScanObject(&scan, data.data(), data.size());
+	if (node_count) {
+		*node_count = scan.node_count;
+	}
+	return result;
+}
+
+// Every prefix of an object is incomplete, and the scan can continue from any
+// of them to frame the object as a whole
+static void CheckPrefixes(const std::string &object, size_t node_count) {
+	for (size_t size = 0; size < object.size(); ++size) {
+		CHECK(Scan(object.substr(0, size)) == MPackScanResult::Incomplete);
+	}
+	MPackScanState scan {};
+	for (size_t size = 0; size <= object.size(); ++size) {
+		MPackScanResult result = MPackScanObject(&scan, object.data(), size);
+		CHECK(result == (size < object.size() ? MPackScanResult::Incomplete : MPackScanResult::Complete));
+	}
+	CHECK(scan.offset == object.size() && scan.node_count == node_count);
+}
+
+static void TestScan() {
+	CHECK(Scan("\xC1") == MPackScanResult::Invalid);
+	CHECK(Scan(std::string("\x93\x01\x02\xC1", 4)) == MPackScanResult::Invalid);
+
+	// Headers with a 32-bit length cut short, and then whole
+	std::string payload(70000, 'p');
+	CheckPrefixes(std::string("\xDB\x00\x01\x11\x70", 5) + payload, 1);
+	CheckPrefixes(std::string("\xC6\x00\x01\x11\x70", 5) + payload, 1);
+	CheckPrefixes(std::string("\xC9\x00\x01\x11\x70\x05", 6) + payload, 1);
+	CheckPrefixes(std::string("\xD8\x05", 2) + std::string(16, 'x'), 1);
+	CheckPrefixes(std::string("\x92\xC7\x02\x05xy\xD4\x05z", 9), 3);
+
+	// Counts no data can satisfy are rejected before waiting for it, also once
+	// arrays nested deep enough add up to more than that
+	CHECK(Scan("\xDD\xFF\xFF\xFF\xFF") == MPackScanResult::Invalid);
+	CHECK(Scan(std::string("\xDF\x80\x00\x00\x00", 5)) == MPackScanResult::Invalid);
+	std::string nested;
+	for (int i = 0; i < 5000; ++i) {
+		nested += "\xDC\xFF\xFF";
+	}
+	CHECK(Scan(nested) == MPackScanResult::Invalid);
+
+	// Deep nesting within the limit is framed like mpack parses it
+	std::string deep(10000, '\x91');
+	deep += '\xC0';
+	size_t node_count;
+	CHECK(Scan(deep, &node_count) == MPackScanResult::Complete && node_count == ReferenceNodeCount(deep));
+
+	// The stream stops at invalid data after handing out what came before it
+	std::string data = RealMessages()[1] + "\xC1";
+	ReadSource source { .data = &data, .max_read = 1 };
+	MPackStream *stream = new MPackStream;
+	MPackStreamInitialize(stream, ReadPieces, &source);
+	MPackStreamMessage message;
+	CHECK(MPackStreamNext(stream, &message));
+	CHECK(!MPackStreamNext(stream, &message));
+	MPackStreamDestroy(stream);
+	delete stream;
+}
+
+int main() {
+	TestEverySplit();
+	TestRandomMessages();
+	TestScan();
+	return TestResult("mpack_stream_test");
+}
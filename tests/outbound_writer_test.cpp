@@ -0,0 +1,200 @@
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "common/outbound_writer.h"
+#include "test.h"
+
+// Stands in for the pipe to nvim. It can be held shut, so whatever is
+// submitted meanwhile waits in the writer's pending buffer, and can be made
+// slow by sleeping and taking only part of each write.
+struct FakePipe {
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::string written;
+	int writes_started;
+	bool held;
+	bool broken;
+	size_t max_write_size;
+	std::chrono::microseconds delay;
+};
+
+static size_t WritePipe(void *context, const char *data, size_t count) {
+	FakePipe *pipe = static_cast<FakePipe *>(context);
+	std::unique_lock<std::mutex> lock(pipe->mutex);
+	pipe->writes_started += 1;
+	pipe->changed.notify_all();
+	pipe->changed.wait(lock, [pipe] { return !pipe->held; });
+	if (pipe->broken) {
+		return 0;
+	}
+
+	size_t size = pipe->max_write_size && count > pipe->max_write_size ? pipe->max_write_size : count;
+	pipe->written.append(data, size);
+	std::chrono::microseconds delay = pipe->delay;
+	lock.unlock();
+	std::this_thread::sleep_for(delay);
+	return size;
+}
+
+static void HoldPipe(FakePipe *pipe) {
+	std::lock_guard<std::mutex> lock(pipe->mutex);
+	pipe->held = true;
+}
+
+static void ReleasePipe(FakePipe *pipe) {
+	{
+		std::lock_guard<std::mutex> lock(pipe->mutex);
+		pipe->held = false;
+	}
+	pipe->changed.notify_all();
+}
+
+static void Submit(OutboundWriter *writer, OutboundMessageKind kind, const std::string &message) {
+	OutboundBuffer staged;
+	OutboundBufferInitialize(&staged);
+	OutboundBufferAppend(&staged, message.data(), message.size(), kind);
+	OutboundWriterSubmit(writer, &staged);
+	CHECK(staged.message_count == 0);
+	OutboundBufferDestroy(&staged);
+}
+
+// Submits a first message and waits until the writer is stuck writing it, so
+// everything submitted after it waits in the pending buffer
+static void BlockWriter(OutboundWriter *writer, FakePipe *pipe, const std::string &first) {
+	HoldPipe(pipe);
+	Submit(writer, OutboundMessageKind::Default, first);
+	std::unique_lock<std::mutex> lock(pipe->mutex);
+	pipe->changed.wait(lock, [pipe] { return pipe->writes_started > 0; });
+}
+
+static void TestSlowWriter() {
+	FakePipe pipe {};
+	pipe.max_write_size = 7;
+	pipe.delay = std::chrono::microseconds(200);
+	OutboundWriter *writer = new OutboundWriter {};
+	OutboundWriterStart(writer, WritePipe, &pipe);
+
+	// Submitting doesn't wait for the pipe, everything arrives in order
+	std::string expected;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 200; ++i) {
+		std::string message = "message " + std::to_string(i) + ";";
+		Submit(writer, OutboundMessageKind::Default, message);
+		expected += message;
+	}
+	auto submit_time = std::chrono::steady_clock::now() - start;
+	OutboundWriterStop(writer);
+	auto total_time = std::chrono::steady_clock::now() - start;
+
+	CHECK(pipe.written == expected);
+	CHECK(submit_time < total_time / 2);
+	CHECK(writer->merged_messages == 0 && writer->dropped_messages == 0 && writer->overflowed_messages == 0);
+	// What is reported on shutdown, messages are batched while the pipe is slow
+	const OutboundBuffer *written = &writer->writing;
+	CHECK(written->messages_written == 200 && written->bytes_written == expected.size());
+	CHECK(written->flushes > 0 && written->flushes < 200 && written->write_calls >= written->flushes);
+	delete writer;
+}
+
+static void TestDragsMergedAndDropped() {
+	FakePipe pipe {};
+	OutboundWriter *writer = new OutboundWriter {};
+	OutboundWriterStart(writer, WritePipe, &pipe);
+	BlockWriter(writer, &pipe, "first;");
+
+	// Consecutive drags collapse into the newest one
+	Submit(writer, OutboundMessageKind::MouseDrag, "drag a;");
+	Submit(writer, OutboundMessageKind::MouseDrag, "drag b;");
+	Submit(writer, OutboundMessageKind::Default, "key;");
+	Submit(writer, OutboundMessageKind::MouseDrag, "drag c;");
+	Submit(writer, OutboundMessageKind::MouseDrag, "drag d;");
+	CHECK(writer->merged_messages == 2);
+
+	// Past the limit other messages are still queued, only new drags are dropped
+	std::string expected = "first;drag b;key;drag d;";
+	std::string filler(4096, 'f');
+	while (true) {
+		Submit(writer, OutboundMessageKind::Default, filler);
+		expected += filler;
+		std::lock_guard<std::mutex> lock(writer->mutex);
+		if (writer->pending.size >= OUTBOUND_WRITER_MAX_PENDING_SIZE) {
+			break;
+		}
+	}
+	CHECK(writer->overflowed_messages == 0);
+	Submit(writer, OutboundMessageKind::MouseDrag, "drag e;");
+	CHECK(writer->dropped_messages == 1);
+	Submit(writer, OutboundMessageKind::Default, "key;");
+	expected += "key;";
+	CHECK(writer->overflowed_messages == 1);
+
+	ReleasePipe(&pipe);
+	OutboundWriterStop(writer);
+	CHECK(pipe.written == expected);
+	delete writer;
+}
+
+static void TestResizeReplaced() {
+	FakePipe pipe {};
+	OutboundWriter *writer = new OutboundWriter {};
+	OutboundWriterStart(writer, WritePipe, &pipe);
+	BlockWriter(writer, &pipe, "first;");
+
+	// Only the newest resize is kept, wherever the older ones were queued
+	Submit(writer, OutboundMessageKind::Resize, "resize 1;");
+	Submit(writer, OutboundMessageKind::Default, "key;");
+	Submit(writer, OutboundMessageKind::MouseDrag, "drag;");
+	Submit(writer, OutboundMessageKind::Resize, "resize 2;");
+	Submit(writer, OutboundMessageKind::Resize, "resize 3;");
+	CHECK(writer->merged_messages == 2);
+
+	ReleasePipe(&pipe);
+	OutboundWriterStop(writer);
+	CHECK(pipe.written == "first;key;drag;resize 3;");
+	delete writer;
+}
+
+static void TestStopDrains() {
+	FakePipe pipe {};
+	OutboundWriter *writer = new OutboundWriter {};
+	OutboundWriterStart(writer, WritePipe, &pipe);
+	BlockWriter(writer, &pipe, "first;");
+	Submit(writer, OutboundMessageKind::Default, "second;");
+	Submit(writer, OutboundMessageKind::Default, "third;");
+
+	// Stopping waits for the write in progress and then writes what is pending
+	std::thread release([&pipe]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		ReleasePipe(&pipe);
+	});
+	OutboundWriterStop(writer);
+	release.join();
+	CHECK(pipe.written == "first;second;third;");
+	CHECK(pipe.writes_started == 2);
+	delete writer;
+
+	// Once a write fails, what is pending is dropped and stopping still completes
+	FakePipe broken {};
+	writer = new OutboundWriter {};
+	OutboundWriterStart(writer, WritePipe, &broken);
+	BlockWriter(writer, &broken, "first;");
+	Submit(writer, OutboundMessageKind::Default, "second;");
+	{
+		std::lock_guard<std::mutex> lock(broken.mutex);
+		broken.broken = true;
+	}
+	ReleasePipe(&broken);
+	OutboundWriterStop(writer);
+	CHECK(broken.written.empty() && writer->failed);
+	delete writer;
+}
+
+int main() {
+	TestSlowWriter();
+	TestDragsMergedAndDropped();
+	TestResizeReplaced();
+	TestStopDrains();
+	return TestResult("outbound_writer_test");
+}
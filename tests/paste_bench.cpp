@@ -0,0 +1,136 @@
+// Throughput of a large paste streamed the way Nvy does it, chunks of
+// nvim_paste with at most PASTE_MAX_CHUNKS_IN_FLIGHT unanswered, against
+// nvy_fake_nvim, which answers every chunk with true
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "common/mpack_stream.h"
+#include "common/rpc_capture.h"
+#include "common/rpc_encoder.h"
+#include "common/transport.h"
+#include "nvim/paste_stream.h"
+#include "nvim/request_table.h"
+
+constexpr RpcMethod<std::string_view, bool, int64_t> PASTE { .id = 9, .name = "nvim_paste" };
+
+struct PasteBench {
+	Transport transport;
+	RequestTable requests;
+	PasteStream paste;
+	std::vector<char> message;
+	bool done;
+};
+
+static void OnPasteChunk(void *context, RequestStatus status, mpack_node_t result);
+
+static void SendPasteChunks(PasteBench *bench) {
+	std::string_view chunk;
+	PastePhase phase;
+	while (PasteStreamNextChunk(&bench->paste, &chunk, &phase)) {
+		uint32_t msg_id = RequestTableRegister(&bench->requests, PASTE.id, OnPasteChunk, bench,
+			RpcCaptureNowMicroseconds(), REQUEST_NO_DEADLINE);
+		RpcSizeCounter counter {};
+		RpcEncodeRequest(&counter, msg_id, PASTE, chunk, true, phase);
+		bench->message.resize(counter.size);
+		RpcBufferWriter writer { .data = bench->message.data(), .size = 0 };
+		RpcEncodeRequest(&writer, msg_id, PASTE, chunk, true, phase);
+		TransportWrite(&bench->transport, writer.data, writer.size);
+	}
+}
+
+static void OnPasteChunk(void *context, RequestStatus status, mpack_node_t result) {
+	PasteBench *bench = static_cast<PasteBench *>(context);
+	PasteChunkStatus chunk_status = PasteChunkStatus::Failed;
+	if (status == RequestStatus::Success) {
+		bool keep_going = mpack_node_type(result) == mpack_type_bool && mpack_node_bool(result);
+		chunk_status = keep_going ? PasteChunkStatus::Accepted : PasteChunkStatus::Cancelled;
+	}
+
+	if (PasteStreamChunkDone(&bench->paste, chunk_status, RpcCaptureNowMicroseconds())) {
+		bench->done = true;
+	}
+	else {
+		SendPasteChunks(bench);
+	}
+}
+
+// Lines of mostly ASCII with some two and three byte sequences, CRLF terminated
+// like text from the Windows clipboard
+static void FillText(char *data, size_t size) {
+	static const char LINE[] = "    for (size_t i = 0; i < count; ++i) { total += values[i]; } // \xC3\xA9t\xC3\xA9 \xE2\x82\xAC\r\n";
+	size_t line_size = sizeof(LINE) - 1;
+	for (size_t offset = 0; offset < size; offset += line_size) {
+		memcpy(data + offset, LINE, offset + line_size <= size ? line_size : size - offset);
+	}
+}
+
+// paste_bench [--quick] <path of nvy_fake_nvim> [megabytes]
+int main(int argc, char **argv) {
+	const char *fake_nvim = nullptr;
+	size_t megabytes = 64;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--quick")) {
+			megabytes = 1;
+		}
+		else if (!fake_nvim) {
+			fake_nvim = argv[i];
+		}
+		else {
+			megabytes = strtoull(argv[i], nullptr, 10);
+		}
+	}
+	if (!fake_nvim || megabytes == 0) {
+		fprintf(stderr, "Usage: paste_bench [--quick] <path of nvy_fake_nvim> [megabytes]\n");
+		return 2;
+	}
+
+	// Never attached, so the fake only answers requests
+	PasteBench *bench = new PasteBench {};
+	char command_line[4096];
+	snprintf(command_line, sizeof(command_line), "'%s' --embed", fake_nvim);
+	if (!TransportSpawn(&bench->transport, command_line)) {
+		fprintf(stderr, "Could not start %s\n", fake_nvim);
+		return 1;
+	}
+
+	size_t size = megabytes * 1024 * 1024;
+	FillText(PasteStreamReserve(&bench->paste, size), size);
+	MPackStream *stream = new MPackStream;
+	MPackStreamInitialize(stream, TransportRead, &bench->transport);
+
+	PasteStreamBegin(&bench->paste, size, RpcCaptureNowMicroseconds());
+	SendPasteChunks(bench);
+	MPackStreamMessage message;
+	while (!bench->done && MPackStreamNext(stream, &message)) {
+		// [1, msgid, error, result]
+		mpack_node_t root = mpack_tree_root(message.tree);
+		if (mpack_node_int(mpack_node_array_at(root, 0)) == 1) {
+			RequestTableComplete(&bench->requests, mpack_node_u32(mpack_node_array_at(root, 1)),
+				mpack_node_array_at(root, 2), mpack_node_array_at(root, 3), RpcCaptureNowMicroseconds());
+		}
+	}
+
+	PasteStream *paste = &bench->paste;
+	bool complete = bench->done && !paste->cancelled && paste->last_paste_size == size;
+	MPackStreamDestroy(stream);
+	delete stream;
+	TransportShutdown(&bench->transport);
+	TransportClose(&bench->transport);
+	if (!complete) {
+		fprintf(stderr, "the paste did not complete\n");
+		return 1;
+	}
+
+	printf("%zu MB in %" PRIu64 " chunks of up to %zu KB, %d in flight\n",
+		megabytes, paste->chunks_sent, PASTE_CHUNK_SIZE / 1024, PASTE_MAX_CHUNKS_IN_FLIGHT);
+	printf("paste:   %.1f ms, %.1f MB/s\n", paste->last_paste_us / 1000.0,
+		PasteStreamThroughput(paste) / (1024.0 * 1024.0));
+	printf("chunks:  %.1f us mean round trip, %" PRIu64 " us max\n",
+		bench->requests.completed ? bench->requests.total_latency_us / static_cast<double>(bench->requests.completed) : 0.0,
+		bench->requests.max_latency_us);
+	PasteStreamDestroy(paste);
+	delete bench;
+	return 0;
+}
@@ -0,0 +1,90 @@
+#include <string>
+#include "nvim/paste_stream.h"
+#include "test.h"
+
+static void Begin(PasteStream *stream, size_t size) {
+	char *data = PasteStreamReserve(stream, size);
+	CHECK(data != nullptr);
+	std::string line = "a line of text\r\n";
+	for (size_t i = 0; i < size; ++i) {
+		data[i] = line[i % line.size()];
+	}
+	PasteStreamBegin(stream, size, 0);
+}
+
+static void TestChunks() {
+	PasteStream stream {};
+	Begin(&stream, 3 * PASTE_CHUNK_SIZE);
+
+	// Only PASTE_MAX_CHUNKS_IN_FLIGHT are handed out before one is answered
+	std::string_view chunk;
+	PastePhase phase;
+	size_t pasted = 0;
+	CHECK(PasteStreamNextChunk(&stream, &chunk, &phase) && phase == PASTE_PHASE_START);
+	pasted += chunk.size();
+	CHECK(PasteStreamNextChunk(&stream, &chunk, &phase) && phase == PASTE_PHASE_CONTINUE);
+	pasted += chunk.size();
+	CHECK(!PasteStreamNextChunk(&stream, &chunk, &phase));
+	CHECK(PasteStreamReserve(&stream, 1) == nullptr);
+
+	// Chunks end after a line break and never split a CRLF pair
+	CHECK(chunk.back() == '\n');
+	while (!PasteStreamChunkDone(&stream, PasteChunkStatus::Accepted, 10)) {
+		while (PasteStreamNextChunk(&stream, &chunk, &phase)) {
+			CHECK(phase == (stream.offset == stream.size ? PASTE_PHASE_END : PASTE_PHASE_CONTINUE));
+			pasted += chunk.size();
+		}
+	}
+	CHECK(pasted == 3 * PASTE_CHUNK_SIZE && stream.last_paste_size == pasted);
+	CHECK(!PasteStreamNeedsEnd(&stream));
+
+	Begin(&stream, 10);
+	CHECK(PasteStreamNextChunk(&stream, &chunk, &phase) && phase == PASTE_PHASE_SINGLE && chunk.size() == 10);
+	CHECK(PasteStreamChunkDone(&stream, PasteChunkStatus::Accepted, 0));
+	PasteStreamDestroy(&stream);
+}
+
+static void TestCancelled() {
+	// nvim answering false ends the paste on its side, no end is sent
+	PasteStream stream {};
+	Begin(&stream, 4 * PASTE_CHUNK_SIZE);
+	std::string_view chunk;
+	PastePhase phase;
+	CHECK(PasteStreamNextChunk(&stream, &chunk, &phase));
+	CHECK(PasteStreamNextChunk(&stream, &chunk, &phase));
+	CHECK(!PasteStreamChunkDone(&stream, PasteChunkStatus::Cancelled, 0));
+	CHECK(!PasteStreamNextChunk(&stream, &chunk, &phase));
+	CHECK(PasteStreamChunkDone(&stream, PasteChunkStatus::Accepted, 0));
+	CHECK(stream.cancelled && !PasteStreamNeedsEnd(&stream));
+	PasteStreamDestroy(&stream);
+}
+
+static void TestFailed() {
+	// A chunk that timed out or errored leaves the paste open in nvim
+	PasteStream stream {};
+	Begin(&stream, 4 * PASTE_CHUNK_SIZE);
+	std::string_view chunk;
+	PastePhase phase;
+	CHECK(PasteStreamNextChunk(&stream, &chunk, &phase));
+	CHECK(PasteStreamNextChunk(&stream, &chunk, &phase));
+	CHECK(!PasteStreamChunkDone(&stream, PasteChunkStatus::Failed, 0));
+	CHECK(!PasteStreamNeedsEnd(&stream));
+	CHECK(PasteStreamChunkDone(&stream, PasteChunkStatus::Accepted, 0));
+	CHECK(PasteStreamNeedsEnd(&stream));
+
+	// Unless its last chunk had already been sent
+	Begin(&stream, 2 * PASTE_CHUNK_SIZE);
+	CHECK(PasteStreamNextChunk(&stream, &chunk, &phase));
+	CHECK(PasteStreamNextChunk(&stream, &chunk, &phase) && phase == PASTE_PHASE_END);
+	CHECK(!PasteStreamChunkDone(&stream, PasteChunkStatus::Accepted, 0));
+	CHECK(PasteStreamChunkDone(&stream, PasteChunkStatus::Failed, 0));
+	CHECK(!PasteStreamNeedsEnd(&stream));
+	PasteStreamDestroy(&stream);
+}
+
+int main() {
+	TestChunks();
+	TestCancelled();
+	TestFailed();
+	return TestResult("paste_stream_test");
+}
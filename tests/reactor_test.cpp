@@ -0,0 +1,123 @@
+// The epoll backend of the reactor, on a pipe and then on nvy_fake_nvim's
+// output and exit
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "common/reactor.h"
+#include "common/rpc_encoder.h"
+#include "common/transport.h"
+#include "test.h"
+
+struct PipeSource {
+	int fd;
+	int reads;
+};
+
+static bool OnPipeReadable(void *context) {
+	PipeSource *source = static_cast<PipeSource *>(context);
+	char byte;
+	source->reads += 1;
+	return read(source->fd, &byte, 1) == 1;
+}
+
+static void TestPipe() {
+	Reactor reactor;
+	ReactorInitialize(&reactor);
+	int fds[2];
+	CHECK(pipe2(fds, O_CLOEXEC) == 0);
+
+	PipeSource source { .fd = fds[0] };
+	int index = ReactorAdd(&reactor, fds[0], OnPipeReadable, &source);
+	CHECK(index == 0 && reactor.sources[0].active);
+	CHECK(ReactorWait(&reactor, 0) == ReactorWaitResult::Timeout);
+
+	CHECK(write(fds[1], "ab", 2) == 2);
+	CHECK(ReactorWait(&reactor, 1000) == ReactorWaitResult::SourceReady);
+	CHECK(ReactorWait(&reactor, 1000) == ReactorWaitResult::SourceReady);
+	CHECK(source.reads == 2 && reactor.dispatches == 2);
+	CHECK(ReactorWait(&reactor, 0) == ReactorWaitResult::Timeout);
+
+	// A source switched off is no longer waited on, even while it is readable
+	CHECK(write(fds[1], "c", 1) == 1);
+	ReactorUpdate(&reactor, index, -1);
+	CHECK(!reactor.sources[index].active);
+	CHECK(ReactorWait(&reactor, 0) == ReactorWaitResult::Timeout);
+	ReactorUpdate(&reactor, index, fds[0]);
+	CHECK(ReactorWait(&reactor, 0) == ReactorWaitResult::SourceReady && source.reads == 3);
+
+	// A callback returning false switches its source off, here at the end of the pipe
+	close(fds[1]);
+	CHECK(ReactorWait(&reactor, 1000) == ReactorWaitResult::SourceReady);
+	CHECK(source.reads == 4 && !reactor.sources[index].active);
+	CHECK(ReactorWait(&reactor, 0) == ReactorWaitResult::Timeout);
+	CHECK(reactor.wakeups == 8);
+
+	close(fds[0]);
+	ReactorDestroy(&reactor);
+}
+
+struct ProcessState {
+	Transport *transport;
+	size_t bytes_read;
+	bool output_ended;
+	bool exited;
+};
+
+static bool OnOutput(void *context) {
+	ProcessState *state = static_cast<ProcessState *>(context);
+	char buffer[4096];
+	size_t bytes_read = TransportRead(state->transport, buffer, sizeof(buffer));
+	state->bytes_read += bytes_read;
+	state->output_ended = bytes_read == 0;
+	return !state->output_ended;
+}
+
+static bool OnExit(void *context) {
+	static_cast<ProcessState *>(context)->exited = true;
+	return false;
+}
+
+// Attaches to nvy_fake_nvim, which sends a few frames and exits
+static void TestProcess(const char *fake_nvim) {
+	char command_line[4096];
+	snprintf(command_line, sizeof(command_line), "'%s' --workload=lines --rate=0 --frames=5", fake_nvim);
+	Transport transport;
+	CHECK(TransportSpawn(&transport, command_line));
+	CHECK(TransportExitHandle(&transport) >= 0);
+
+	Reactor reactor;
+	ReactorInitialize(&reactor);
+	ProcessState state { .transport = &transport };
+	ReactorAdd(&reactor, transport.read_fd, OnOutput, &state);
+	ReactorAdd(&reactor, TransportExitHandle(&transport), OnExit, &state);
+
+	constexpr RpcMethod<int64_t, int64_t, RpcOptions<1>> UI_ATTACH { .id = 5, .name = "nvim_ui_attach" };
+	char attach[128];
+	RpcBufferWriter writer { .data = attach, .size = 0 };
+	RpcEncodeRequest(&writer, 1, UI_ATTACH, 80, 24, RpcOptions<1> { RpcOption { "ext_linegrid", true } });
+	CHECK(TransportWrite(&transport, attach, writer.size) == writer.size);
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while ((!state.output_ended || !state.exited) && std::chrono::steady_clock::now() < deadline) {
+		CHECK(ReactorWait(&reactor, 1000) != ReactorWaitResult::Error);
+	}
+	CHECK(state.output_ended && state.exited);
+	// The attach response and five frames of 24 lines
+	CHECK(state.bytes_read > 5 * 24 * 80);
+	CHECK(!reactor.sources[0].active && !reactor.sources[1].active);
+
+	TransportShutdown(&transport);
+	CHECK(transport.exit_code == 0);
+	ReactorDestroy(&reactor);
+	TransportClose(&transport);
+}
+
+// reactor_test <path of nvy_fake_nvim>
+int main(int argc, char **argv) {
+	TestPipe();
+	if (argc > 1) {
+		TestProcess(argv[1]);
+	}
+	return TestResult("reactor_test");
+}
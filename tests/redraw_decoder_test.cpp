@@ -0,0 +1,266 @@
+// Decodes a redraw batch read in single bytes and in random pieces, checking
+// every event call against a parse of the whole notification at once
+#include <cstring>
+#include <string>
+#include "nvim/redraw_commands.h"
+#include "nvim/redraw_decoder.h"
+#include "test.h"
+
+static uint32_t random_state = 11;
+static uint32_t Random(uint32_t n) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state % n;
+}
+
+struct ReadSource {
+	const std::string *data;
+	size_t offset;
+	size_t max_read;
+	bool random_sizes;
+};
+
+static size_t ReadPieces(void *context, char *buffer, size_t count) {
+	ReadSource *source = static_cast<ReadSource *>(context);
+	size_t size = source->data->size() - source->offset;
+	size_t max_read = source->random_sizes ? 1 + Random(static_cast<uint32_t>(source->max_read)) : source->max_read;
+	size = size < max_read ? size : max_read;
+	size = size < count ? size : count;
+	memcpy(buffer, source->data->data() + source->offset, size);
+	source->offset += size;
+	return size;
+}
+
+static const std::string LONG_NAME(64, 'n');
+static const std::string LONGER_NAME = "flush" + std::string(95, 'x');
+
+static void WriteGridLine(mpack_writer_t *writer, int row) {
+	mpack_start_array(writer, 5);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, row);
+	mpack_write_int(writer, 2);
+	mpack_start_array(writer, 3);
+	mpack_start_array(writer, 2); mpack_write_cstr(writer, "a"); mpack_write_int(writer, row + 1); mpack_finish_array(writer);
+	mpack_start_array(writer, 1); mpack_write_cstr(writer, "\xE4\xB8\x96"); mpack_finish_array(writer);
+	mpack_start_array(writer, 3); mpack_write_cstr(writer, " "); mpack_write_int(writer, 0); mpack_write_int(writer, 40); mpack_finish_array(writer);
+	mpack_finish_array(writer);
+	mpack_write_false(writer);
+	mpack_finish_array(writer);
+}
+
+// [2, "redraw", [events...]] followed by a response, which has to be left
+// for the stream once the batch has been decoded
+static std::string BuildMessages() {
+	char *data;
+	size_t size;
+	mpack_writer_t writer;
+	mpack_writer_init_growable(&writer, &data, &size);
+	mpack_start_array(&writer, 3);
+	mpack_write_int(&writer, 2);
+	mpack_write_cstr(&writer, "redraw");
+	mpack_start_array(&writer, 6);
+
+	mpack_start_array(&writer, 1 + 20);
+	mpack_write_cstr(&writer, "grid_line");
+	for (int row = 0; row < 20; ++row) {
+		WriteGridLine(&writer, row);
+	}
+	mpack_finish_array(&writer);
+
+	mpack_start_array(&writer, 2);
+	mpack_write_cstr(&writer, "hl_attr_define");
+	mpack_start_array(&writer, 4);
+	mpack_write_int(&writer, 3);
+	mpack_start_map(&writer, 1);
+	mpack_write_cstr(&writer, "foreground");
+	mpack_write_uint(&writer, 0x123456);
+	mpack_finish_map(&writer);
+	mpack_start_map(&writer, 0);
+	mpack_finish_map(&writer);
+	mpack_start_array(&writer, 0);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+
+	// Names too long for RedrawEvent.name, one of them starting like a known event
+	mpack_start_array(&writer, 2);
+	mpack_write_str(&writer, LONG_NAME.data(), static_cast<uint32_t>(LONG_NAME.size()));
+	mpack_start_array(&writer, 1);
+	mpack_write_int(&writer, 1);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	mpack_start_array(&writer, 3);
+	mpack_write_str(&writer, LONGER_NAME.data(), static_cast<uint32_t>(LONGER_NAME.size()));
+	mpack_start_array(&writer, 0);
+	mpack_finish_array(&writer);
+	mpack_start_array(&writer, 1);
+	mpack_write_cstr(&writer, std::string(300, 's').c_str());
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+
+	mpack_start_array(&writer, 2);
+	mpack_write_cstr(&writer, "grid_scroll");
+	mpack_start_array(&writer, 7);
+	for (int arg : { 1, 0, 20, 0, 80, 3, 0 }) {
+		mpack_write_int(&writer, arg);
+	}
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+
+	mpack_start_array(&writer, 2);
+	mpack_write_cstr(&writer, "flush");
+	mpack_start_array(&writer, 0);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+
+	mpack_start_array(&writer, 4);
+	mpack_write_int(&writer, 1);
+	mpack_write_int(&writer, 9);
+	mpack_write_nil(&writer);
+	mpack_write_true(&writer);
+	mpack_finish_array(&writer);
+
+	std::string messages;
+	if (mpack_writer_destroy(&writer) == mpack_ok) {
+		messages.assign(data, size);
+	}
+	MPACK_FREE(data);
+	return messages;
+}
+
+static bool NodesEqual(mpack_node_t a, mpack_node_t b) {
+	mpack_type_t type = mpack_node_type(a);
+	if (type != mpack_node_type(b)) {
+		return false;
+	}
+	switch (type) {
+	case mpack_type_nil: return true;
+	case mpack_type_bool: return mpack_node_bool(a) == mpack_node_bool(b);
+	case mpack_type_int: return mpack_node_i64(a) == mpack_node_i64(b);
+	case mpack_type_uint: return mpack_node_u64(a) == mpack_node_u64(b);
+	case mpack_type_float: return mpack_node_float(a) == mpack_node_float(b);
+	case mpack_type_double: return mpack_node_double(a) == mpack_node_double(b);
+	case mpack_type_str:
+	case mpack_type_bin: {
+		return mpack_node_data_len(a) == mpack_node_data_len(b) &&
+			memcmp(mpack_node_data(a), mpack_node_data(b), mpack_node_data_len(a)) == 0;
+	}
+	case mpack_type_array: {
+		size_t length = mpack_node_array_length(a);
+		if (length != mpack_node_array_length(b)) {
+			return false;
+		}
+		for (size_t i = 0; i < length; ++i) {
+			if (!NodesEqual(mpack_node_array_at(a, i), mpack_node_array_at(b, i))) {
+				return false;
+			}
+		}
+		return true;
+	}
+	case mpack_type_map: {
+		size_t count = mpack_node_map_count(a);
+		if (count != mpack_node_map_count(b)) {
+			return false;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			if (!NodesEqual(mpack_node_map_key_at(a, i), mpack_node_map_key_at(b, i)) ||
+				!NodesEqual(mpack_node_map_value_at(a, i), mpack_node_map_value_at(b, i))) {
+				return false;
+			}
+		}
+		return true;
+	}
+	default: return false;
+	}
+}
+
+// Walks the events of the whole notification along with the decoder
+struct ExpectedEvents {
+	mpack_node_t events;
+	size_t event;
+	size_t call;
+	size_t calls_seen;
+	size_t unhandled;
+	ReadSource *source;
+	size_t offset_at_first_call;
+};
+
+static bool CheckEvent(void *context, RedrawEvent *event) {
+	ExpectedEvents *expected = static_cast<ExpectedEvents *>(context);
+	if (expected->calls_seen == 0) {
+		expected->offset_at_first_call = expected->source->offset;
+	}
+	expected->calls_seen += 1;
+
+	mpack_node_t expected_event = mpack_node_array_at(expected->events, expected->event);
+	mpack_node_t name = mpack_node_array_at(expected_event, 0);
+	size_t name_length = mpack_node_strlen(name);
+	CHECK(event->name_length == name_length);
+	size_t kept = name_length < MAX_REDRAW_EVENT_NAME_LENGTH ? name_length : MAX_REDRAW_EVENT_NAME_LENGTH - 1;
+	CHECK(memcmp(event->name, mpack_node_str(name), kept) == 0 && event->name[kept] == '\0');
+	CHECK(NodesEqual(event->args, mpack_node_array_at(expected_event, 1 + expected->call)));
+
+	RedrawCommandBuffer buffer {};
+	if (name_length >= MAX_REDRAW_EVENT_NAME_LENGTH) {
+		CHECK(RedrawCommandsDecodeEvent(&buffer, event) == RedrawDecodeResult::Unhandled);
+		expected->unhandled += 1;
+	}
+	else {
+		CHECK(RedrawCommandsDecodeEvent(&buffer, event) != RedrawDecodeResult::Unhandled);
+	}
+	RedrawCommandBufferDestroy(&buffer);
+
+	expected->call += 1;
+	if (expected->call + 1 == mpack_node_array_length(expected_event)) {
+		expected->event += 1;
+		expected->call = 0;
+	}
+	return true;
+}
+
+static void CheckDecode(const std::string &data, ReadSource source) {
+	source.data = &data;
+	mpack_tree_t tree;
+	mpack_tree_init_data(&tree, data.data(), data.size());
+	mpack_tree_parse(&tree);
+	CHECK(mpack_tree_error(&tree) == mpack_ok);
+	ExpectedEvents expected {
+		.events = mpack_node_array_at(mpack_tree_root(&tree), 2),
+		.source = &source
+	};
+
+	MPackStream *stream = new MPackStream;
+	MPackStreamInitialize(stream, ReadPieces, &source);
+	uint32_t event_count;
+	CHECK(MPackStreamBeginNotification(stream, "redraw", &event_count));
+	CHECK(event_count == mpack_node_array_length(expected.events));
+	CHECK(RedrawDecoderRun(stream, event_count, CheckEvent, &expected));
+	CHECK(expected.event == event_count && expected.calls_seen == 20 + 1 + 1 + 2 + 1 + 1);
+	CHECK(expected.unhandled == 3);
+	// Events are handed out before the rest of the batch has been read
+	if (source.max_read == 1) {
+		CHECK(expected.offset_at_first_call < data.size() / 2);
+	}
+
+	MPackStreamMessage message;
+	CHECK(MPackStreamNext(stream, &message));
+	CHECK(mpack_node_u32(mpack_node_array_at(mpack_tree_root(message.tree), 1)) == 9);
+	CHECK(!MPackStreamNext(stream, &message));
+	MPackStreamDestroy(stream);
+	delete stream;
+	mpack_tree_destroy(&tree);
+}
+
+int main() {
+	std::string data = BuildMessages();
+	CHECK(!data.empty());
+	CheckDecode(data, ReadSource { .max_read = 1 });
+	for (int i = 0; i < 200 && !test_failures; ++i) {
+		CheckDecode(data, ReadSource { .max_read = 1 + Random(64), .random_sizes = true });
+	}
+	CheckDecode(data, ReadSource { .max_read = data.size() });
+	return TestResult("redraw_decoder_test");
+}
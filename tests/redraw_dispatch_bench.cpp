@@ -0,0 +1,88 @@
+// Time taken to dispatch a redraw event by name, through the perfect hash
+// table of RedrawCommandsDecodeEvent against the chain of string compares it
+// replaced. Only events whose decoding is trivial are used, unhandled ones and
+// ones without args, so the difference is down to the dispatch.
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "nvim/redraw_commands.h"
+#include "nvim/redraw_decoder.h"
+
+// The events nvim sends besides grid_line that Nvy decodes without args or
+// doesn't handle at all, in roughly the proportions of a busy session
+constexpr const char *EVENT_NAMES[] = {
+	"flush", "win_viewport", "busy_start", "busy_stop", "msg_showmode", "msg_ruler",
+	"flush", "hl_group_set", "win_viewport", "flush", "mouse_on", "mouse_off",
+	"msg_showcmd", "flush", "grid_destroy", "update_menu", "flush", "win_viewport"
+};
+constexpr size_t EVENT_COUNT = sizeof(EVENT_NAMES) / sizeof(EVENT_NAMES[0]);
+
+// As Nvy dispatched them before, the handled events in their old order
+static RedrawDecodeResult DispatchByCompare(RedrawCommandBuffer *buffer, RedrawEvent *event) {
+	if (RedrawEventIs(event, "grid_line") || RedrawEventIs(event, "grid_scroll") ||
+		RedrawEventIs(event, "grid_cursor_goto") || RedrawEventIs(event, "grid_resize") ||
+		RedrawEventIs(event, "grid_clear") || RedrawEventIs(event, "hl_attr_define") ||
+		RedrawEventIs(event, "default_colors_set") || RedrawEventIs(event, "mode_info_set") ||
+		RedrawEventIs(event, "mode_change") || RedrawEventIs(event, "option_set") ||
+		RedrawEventIs(event, "set_title")) {
+		return RedrawDecodeResult::Decoded;
+	}
+	else if (RedrawEventIs(event, "busy_start")) {
+		RedrawCommandBufferPush(buffer, RedrawCommandType::BusyStart, 0);
+		return RedrawDecodeResult::Decoded;
+	}
+	else if (RedrawEventIs(event, "busy_stop")) {
+		RedrawCommandBufferPush(buffer, RedrawCommandType::BusyStop, 0);
+		return RedrawDecodeResult::Decoded;
+	}
+	else if (RedrawEventIs(event, "flush")) {
+		RedrawCommandBufferPush(buffer, RedrawCommandType::Flush, 0);
+		return RedrawDecodeResult::Flush;
+	}
+	return RedrawDecodeResult::Unhandled;
+}
+
+template<typename DispatchFn>
+static double NanosecondsPerEvent(RedrawEvent *events, uint64_t rounds, uint64_t *flushes, DispatchFn dispatch) {
+	RedrawCommandBuffer buffer {};
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t round = 0; round < rounds; ++round) {
+		for (size_t i = 0; i < EVENT_COUNT; ++i) {
+			*flushes += dispatch(&buffer, &events[i]) == RedrawDecodeResult::Flush;
+		}
+		RedrawCommandBufferClear(&buffer);
+	}
+	double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	RedrawCommandBufferDestroy(&buffer);
+	return nanoseconds / (rounds * EVENT_COUNT);
+}
+
+// redraw_dispatch_bench [--quick] [rounds]
+int main(int argc, char **argv) {
+	uint64_t rounds = 5000000;
+	for (int i = 1; i < argc; ++i) {
+		rounds = strcmp(argv[i], "--quick") == 0 ? 10000 : strtoull(argv[i], nullptr, 10);
+	}
+
+	// Args are never looked at by these events
+	RedrawEvent events[EVENT_COUNT] {};
+	for (size_t i = 0; i < EVENT_COUNT; ++i) {
+		events[i].name_length = strlen(EVENT_NAMES[i]);
+		memcpy(events[i].name, EVENT_NAMES[i], events[i].name_length);
+	}
+
+	uint64_t table_flushes = 0;
+	uint64_t compare_flushes = 0;
+	double table = NanosecondsPerEvent(events, rounds, &table_flushes, RedrawCommandsDecodeEvent);
+	double compare = NanosecondsPerEvent(events, rounds, &compare_flushes, DispatchByCompare);
+	if (table_flushes != compare_flushes) {
+		fprintf(stderr, "the two dispatchers disagree\n");
+		return 1;
+	}
+	printf("%" PRIu64 " events\n", rounds * EVENT_COUNT);
+	printf("perfect hash:    %6.2f ns/event\n", table);
+	printf("string compares: %6.2f ns/event\n", compare);
+	return 0;
+}
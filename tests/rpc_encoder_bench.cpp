@@ -0,0 +1,144 @@
+// Encoding throughput of the messages Nvy sends most, through rpc_encoder.h
+// against the mpack writer sequence it replaced. The messages are checked to
+// come out the same both ways.
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "common/rpc_encoder.h"
+#include "third_party/mpack/mpack.h"
+
+constexpr RpcMethod<std::string_view> INPUT { .id = 1, .name = "nvim_input" };
+constexpr RpcMethod<std::string_view, std::string_view, std::string_view, int64_t, int64_t, int64_t> INPUT_MOUSE {
+	.id = 2, .name = "nvim_input_mouse"
+};
+constexpr RpcMethod<int64_t, int64_t> UI_TRY_RESIZE { .id = 6, .name = "nvim_ui_try_resize" };
+
+constexpr size_t MESSAGE_CAPACITY = 4096;
+constexpr const char *INPUTS[] = { "j", "<C-d>", "<C-S-M-PageDown>", "é" };
+
+struct Message {
+	char data[MESSAGE_CAPACITY];
+	size_t size;
+};
+
+// Measured first and then written, as Nvy does into an outbound buffer
+// reservation of the measured size
+static void EncodeRpc(Message *message, uint64_t i) {
+	uint32_t msg_id = static_cast<uint32_t>(i);
+	int64_t row = static_cast<int64_t>(i % 300);
+	int64_t col = static_cast<int64_t>(i % 70000);
+	switch (i % 3) {
+	case 0: {
+		RpcSizeCounter counter {};
+		RpcEncodeNotification(&counter, INPUT, INPUTS[i % 4]);
+		RpcBufferWriter writer { .data = message->data, .size = 0 };
+		RpcEncodeNotification(&writer, INPUT, INPUTS[i % 4]);
+		message->size = counter.size == writer.size ? writer.size : 0;
+	} break;
+	case 1: {
+		RpcSizeCounter counter {};
+		RpcEncodeRequest(&counter, msg_id, INPUT_MOUSE, "wheel", "down", "C-", 0, row, col);
+		RpcBufferWriter writer { .data = message->data, .size = 0 };
+		RpcEncodeRequest(&writer, msg_id, INPUT_MOUSE, "wheel", "down", "C-", 0, row, col);
+		message->size = counter.size == writer.size ? writer.size : 0;
+	} break;
+	case 2: {
+		RpcSizeCounter counter {};
+		RpcEncodeNotification(&counter, UI_TRY_RESIZE, col, row);
+		RpcBufferWriter writer { .data = message->data, .size = 0 };
+		RpcEncodeNotification(&writer, UI_TRY_RESIZE, col, row);
+		message->size = counter.size == writer.size ? writer.size : 0;
+	} break;
+	}
+}
+
+static void EncodeMpack(Message *message, uint64_t i) {
+	uint32_t msg_id = static_cast<uint32_t>(i);
+	int64_t row = static_cast<int64_t>(i % 300);
+	int64_t col = static_cast<int64_t>(i % 70000);
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, message->data, MESSAGE_CAPACITY);
+	switch (i % 3) {
+	case 0: {
+		mpack_start_array(&writer, 3);
+		mpack_write_i64(&writer, RPC_NOTIFICATION);
+		mpack_write_cstr(&writer, "nvim_input");
+		mpack_start_array(&writer, 1);
+		mpack_write_cstr(&writer, INPUTS[i % 4]);
+	} break;
+	case 1: {
+		mpack_start_array(&writer, 4);
+		mpack_write_i64(&writer, RPC_REQUEST);
+		mpack_write_i64(&writer, msg_id);
+		mpack_write_cstr(&writer, "nvim_input_mouse");
+		mpack_start_array(&writer, 6);
+		mpack_write_cstr(&writer, "wheel");
+		mpack_write_cstr(&writer, "down");
+		mpack_write_cstr(&writer, "C-");
+		mpack_write_i64(&writer, 0);
+		mpack_write_i64(&writer, row);
+		mpack_write_i64(&writer, col);
+	} break;
+	case 2: {
+		mpack_start_array(&writer, 3);
+		mpack_write_i64(&writer, RPC_NOTIFICATION);
+		mpack_write_cstr(&writer, "nvim_ui_try_resize");
+		mpack_start_array(&writer, 2);
+		mpack_write_i64(&writer, col);
+		mpack_write_i64(&writer, row);
+	} break;
+	}
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	message->size = mpack_writer_buffer_used(&writer);
+	if (mpack_writer_destroy(&writer) != mpack_ok) {
+		message->size = 0;
+	}
+}
+
+template<typename EncodeFn>
+static double NanosecondsPerMessage(uint64_t count, uint64_t *bytes, EncodeFn encode) {
+	Message message;
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < count; ++i) {
+		encode(&message, i);
+		*bytes += message.size;
+	}
+	double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	return nanoseconds / count;
+}
+
+// rpc_encoder_bench [--quick] [messages]
+int main(int argc, char **argv) {
+	uint64_t count = 30000000;
+	for (int i = 1; i < argc; ++i) {
+		count = strcmp(argv[i], "--quick") == 0 ? 30000 : strtoull(argv[i], nullptr, 10);
+	}
+
+	for (uint64_t i = 0; i < 300000; ++i) {
+		Message rpc;
+		Message mpack;
+		EncodeRpc(&rpc, i * 7);
+		EncodeMpack(&mpack, i * 7);
+		if (rpc.size == 0 || rpc.size != mpack.size || memcmp(rpc.data, mpack.data, rpc.size) != 0) {
+			fprintf(stderr, "message %" PRIu64 " differs from the mpack encoding\n", i * 7);
+			return 1;
+		}
+	}
+
+	uint64_t rpc_bytes = 0;
+	uint64_t mpack_bytes = 0;
+	double rpc = NanosecondsPerMessage(count, &rpc_bytes, EncodeRpc);
+	double mpack = NanosecondsPerMessage(count, &mpack_bytes, EncodeMpack);
+	if (rpc_bytes != mpack_bytes) {
+		fprintf(stderr, "the two encoders disagree\n");
+		return 1;
+	}
+	printf("%" PRIu64 " messages, %.1f bytes on average, nvim_input, nvim_input_mouse and nvim_ui_try_resize\n",
+		count, static_cast<double>(rpc_bytes) / count);
+	printf("rpc_encoder: %6.2f ns/message\n", rpc);
+	printf("mpack:       %6.2f ns/message\n", mpack);
+	return 0;
+}
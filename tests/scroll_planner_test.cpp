@@ -0,0 +1,385 @@
+// Scrolls planned with ScrollPlan against a canvas in memory, drawn the way the
+// renderer draws, that is checked against the grid after every flush. A cell's
+// pixels depend on the whole run of text between blanks it is part of, as text
+// is laid out in runs, so any cell that wasn't drawn again after its run
+// changed is caught along with cells that weren't moved or drawn at all.
+#include <cstring>
+#include <vector>
+#include "renderer/grid_model.h"
+#include "renderer/scroll_planner.h"
+#include "test.h"
+
+static uint32_t random_state = 19;
+static uint32_t Random(uint32_t n) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state % n;
+}
+
+struct TestCanvas {
+	float cell_width;
+	float cell_height;
+	int width;
+	int height;
+	std::vector<uint32_t> pixels;
+};
+
+// The canvas may be smaller than the grid, as the window can be
+static TestCanvas CreateCanvas(GridModel *grid, float cell_width, float cell_height, int cut_width, int cut_height) {
+	TestCanvas canvas {
+		.cell_width = cell_width,
+		.cell_height = cell_height,
+		.width = CanvasPixel(grid->cols * cell_width) - cut_width,
+		.height = CanvasPixel(grid->rows * cell_height) - cut_height
+	};
+	canvas.pixels.assign(static_cast<size_t>(canvas.width) * canvas.height, 0);
+	return canvas;
+}
+
+// Depends on the cell, the run of text between blanks within [start_col,
+// end_col) it is part of and where in the run it is
+static uint32_t CellColor(GridModel *grid, int row, int col, int start_col, int end_col) {
+	uint32_t *text = &grid->text[GridModelOffset(grid, row, 0)];
+	uint16_t *attribs = &grid->attribs[GridModelOffset(grid, row, 0)];
+	uint32_t color = (text[col] * 0x9E3779B1) ^ attribs[col];
+	if (text[col] == GRID_BLANK) {
+		return color;
+	}
+	int run_start = col;
+	while (run_start > start_col && text[run_start - 1] != GRID_BLANK) {
+		--run_start;
+	}
+	uint32_t run = 0x811C9DC5;
+	for (int i = run_start; i < end_col && text[i] != GRID_BLANK; ++i) {
+		run = (run ^ text[i] ^ (static_cast<uint32_t>(attribs[i]) << 21)) * 0x01000193;
+	}
+	return color ^ run ^ static_cast<uint32_t>(col - run_start) * 0x27D4EB2F;
+}
+
+static void CellPixels(TestCanvas *canvas, int row, int col, int *left, int *top, int *right, int *bottom) {
+	*left = CanvasPixel(col * canvas->cell_width);
+	*top = CanvasPixel(row * canvas->cell_height);
+	*right = CanvasPixel((col + 1) * canvas->cell_width);
+	*bottom = CanvasPixel((row + 1) * canvas->cell_height);
+	*right = *right < canvas->width ? *right : canvas->width;
+	*bottom = *bottom < canvas->height ? *bottom : canvas->height;
+}
+
+// Lays out and draws [start_col, end_col) of a row on its own, as DrawGridLine does
+static void DrawCells(TestCanvas *canvas, GridModel *grid, int row, int start_col, int end_col) {
+	for (int col = start_col; col < end_col; ++col) {
+		uint32_t color = CellColor(grid, row, col, start_col, end_col);
+		int left, top, right, bottom;
+		CellPixels(canvas, row, col, &left, &top, &right, &bottom);
+		for (int y = top; y < bottom; ++y) {
+			for (int x = left; x < right; ++x) {
+				canvas->pixels[static_cast<size_t>(y) * canvas->width + x] = color;
+			}
+		}
+	}
+}
+
+static int StaleCells(TestCanvas *canvas, GridModel *grid) {
+	int stale = 0;
+	for (int row = 0; row < grid->rows; ++row) {
+		for (int col = 0; col < grid->cols; ++col) {
+			uint32_t color = CellColor(grid, row, col, 0, grid->cols);
+			int left, top, right, bottom;
+			CellPixels(canvas, row, col, &left, &top, &right, &bottom);
+			bool cell_stale = false;
+			for (int y = top; y < bottom; ++y) {
+				for (int x = left; x < right; ++x) {
+					cell_stale |= canvas->pixels[static_cast<size_t>(y) * canvas->width + x] != color;
+				}
+			}
+			stale += cell_stale;
+		}
+	}
+	return stale;
+}
+
+// Draws the dirty rows widened to blanks, as the renderer does on a flush,
+// and checks the whole canvas
+static void Flush(TestCanvas *canvas, GridModel *grid) {
+	int start_col, end_col;
+	for (int row = 0; (row = GridModelTakeDirtyRow(grid, row, &start_col, &end_col)) >= 0; ++row) {
+		GridModelWidenToBlanks(grid, row, &start_col, &end_col);
+		DrawCells(canvas, grid, row, start_col, end_col);
+	}
+	CHECK(StaleCells(canvas, grid) == 0);
+}
+
+static void MoveCanvasPixels(TestCanvas *canvas, ScrollBlit *blit) {
+	CHECK(blit->left >= 0 && blit->right <= canvas->width && blit->top >= 0 && blit->bottom <= canvas->height);
+	CHECK(blit->destination_top >= 0 && blit->destination_top + blit->bottom - blit->top <= canvas->height);
+	int height = blit->bottom - blit->top;
+	for (int i = 0; i < height; ++i) {
+		int y = blit->destination_top > blit->top ? height - 1 - i : i;
+		memmove(&canvas->pixels[static_cast<size_t>(blit->destination_top + y) * canvas->width + blit->left],
+			&canvas->pixels[static_cast<size_t>(blit->top + y) * canvas->width + blit->left],
+			(blit->right - blit->left) * sizeof(uint32_t));
+	}
+}
+
+// Letters are narrow chars, W is a wide char and _ a blank
+static void ApplyText(GridModel *grid, int row, int col, const char *text, uint16_t hl = 1) {
+	std::vector<RedrawCell> cells;
+	for (const char *c = text; *c; ++c) {
+		if (*c == 'W') {
+			cells.push_back(RedrawCell { 0x4E00 + static_cast<uint32_t>(c - text), hl, 1 });
+			cells.push_back(RedrawCell { REDRAW_CELL_WIDE_CHAR_CONTINUATION, hl, 1 });
+		}
+		else {
+			cells.push_back(RedrawCell { *c == '_' ? GRID_BLANK : static_cast<uint32_t>(*c), hl, 1 });
+		}
+	}
+	std::vector<uint64_t> command((sizeof(GridLineCommand) + cells.size() * sizeof(RedrawCell) + 7) / 8);
+	GridLineCommand *grid_line = reinterpret_cast<GridLineCommand *>(command.data());
+	grid_line->row = row;
+	grid_line->col_start = col;
+	grid_line->cell_count = static_cast<uint32_t>(cells.size());
+	grid_line->cluster_text_size = 0;
+	memcpy(GridLineCells(grid_line), cells.data(), cells.size() * sizeof(RedrawCell));
+	GridModelApplyLine(grid, grid_line);
+}
+
+// Runs of a few letters or wide chars between single blanks
+static void ApplyRandomText(GridModel *grid, int row, int start_col, int end_col) {
+	std::vector<char> text;
+	for (int col = start_col; col < end_col;) {
+		uint32_t kind = Random(6);
+		if (kind == 0 || (kind == 1 && col + 1 < end_col)) {
+			text.push_back(kind == 0 ? '_' : 'W');
+			col += kind == 0 ? 1 : 2;
+		}
+		else {
+			text.push_back(static_cast<char>('a' + Random(26)));
+			col += 1;
+		}
+	}
+	text.push_back('\0');
+	ApplyText(grid, row, start_col, text.data(), static_cast<uint16_t>(1 + Random(3)));
+}
+
+// Plans the scroll and moves the canvas, then nvim redraws the rows the region
+// left behind. Returns what ScrollPlan did.
+static bool Scroll(TestCanvas *canvas, GridModel *grid, int top, int bottom, int left, int right, int rows) {
+	GridScrollCommand grid_scroll { top, bottom, left, right, rows, 0 };
+	ScrollBlit blit;
+	bool planned = ScrollPlan(grid, &grid_scroll, canvas->cell_width, canvas->cell_height,
+		canvas->width, canvas->height, &blit);
+	if (blit.top < blit.bottom) {
+		MoveCanvasPixels(canvas, &blit);
+	}
+	int exposed_top = rows > 0 ? bottom - rows : top;
+	int exposed_bottom = rows > 0 ? bottom : top - rows;
+	exposed_top = exposed_top > top ? exposed_top : top;
+	exposed_bottom = exposed_bottom < bottom ? exposed_bottom : bottom;
+	for (int row = exposed_top; row < exposed_bottom; ++row) {
+		ApplyRandomText(grid, row, left, right);
+	}
+	return planned;
+}
+
+static bool AnyRowDirty(GridModel *grid, int first_row, int end_row) {
+	int start_col, end_col;
+	for (int row = first_row; row < end_row; ++row) {
+		if (GridModelDirtySpan(grid, row, &start_col, &end_col)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void FillGrid(TestCanvas *canvas, GridModel *grid) {
+	for (int row = 0; row < grid->rows; ++row) {
+		ApplyRandomText(grid, row, 0, grid->cols);
+	}
+	Flush(canvas, grid);
+}
+
+static void TestFullWidth() {
+	GridModel grid {};
+	GridModelResize(&grid, 20, 30);
+	TestCanvas canvas = CreateCanvas(&grid, 3.0f, 5.0f, 0, 0);
+	FillGrid(&canvas, &grid);
+
+	// The moved rows are only moved, nothing but what nvim redraws is drawn
+	GridScrollCommand up { 0, 20, 0, 30, 3, 0 };
+	ScrollBlit blit;
+	CHECK(ScrollPlan(&grid, &up, canvas.cell_width, canvas.cell_height, canvas.width, canvas.height, &blit));
+	CHECK(blit.left == 0 && blit.right == 90 && blit.top == 15 && blit.bottom == 100 && blit.destination_top == 0);
+	CHECK(!AnyRowDirty(&grid, 0, 17));
+	MoveCanvasPixels(&canvas, &blit);
+	for (int row = 17; row < 20; ++row) {
+		ApplyRandomText(&grid, row, 0, 30);
+	}
+	Flush(&canvas, &grid);
+
+	CHECK(Scroll(&canvas, &grid, 2, 15, 0, 30, -4));
+	Flush(&canvas, &grid);
+	CHECK(Scroll(&canvas, &grid, 5, 6, 0, 30, 1) && Scroll(&canvas, &grid, 0, 20, 0, 30, -19));
+	Flush(&canvas, &grid);
+	GridModelDestroy(&grid);
+}
+
+static void TestPartialWidth() {
+	GridModel grid {};
+	GridModelResize(&grid, 12, 30);
+	TestCanvas canvas = CreateCanvas(&grid, 3.0f, 5.0f, 0, 0);
+	FillGrid(&canvas, &grid);
+
+	// Runs crossing both edges of the region [8, 20), from outside and from inside
+	for (int row = 0; row < 12; row += 2) {
+		ApplyText(&grid, row, 0, "ab_cdefghij_klmnopqrstu_vwxyzab");
+		ApplyText(&grid, row + 1, 0, "abcdef_W_W_W__ghijklmnop_qrstu_");
+	}
+	ApplyText(&grid, 5, 6, "__");
+	ApplyText(&grid, 6, 19, "_");
+	Flush(&canvas, &grid);
+	CHECK(Scroll(&canvas, &grid, 0, 12, 8, 20, 1));
+	Flush(&canvas, &grid);
+	CHECK(Scroll(&canvas, &grid, 1, 11, 8, 20, -3));
+	Flush(&canvas, &grid);
+
+	// A blank written next to the region before it scrolls splits a run that
+	// went on inside it, whose cells inside are then moved to rows where
+	// nothing next to the region has changed
+	ApplyText(&grid, 4, 0, "abcdefghijkl_nopqrstuvwxyzabcd");
+	ApplyText(&grid, 3, 0, "abcdefg_hijklmnopqrstu_vwxyzab");
+	Flush(&canvas, &grid);
+	ApplyText(&grid, 4, 7, "_");
+	CHECK(Scroll(&canvas, &grid, 3, 12, 8, 20, 1));
+	Flush(&canvas, &grid);
+
+	// Regions against the left and right edge of the grid
+	CHECK(Scroll(&canvas, &grid, 0, 12, 0, 13, 2));
+	Flush(&canvas, &grid);
+	CHECK(Scroll(&canvas, &grid, 0, 12, 17, 30, -2));
+	Flush(&canvas, &grid);
+	GridModelDestroy(&grid);
+}
+
+static void TestFractionalCellHeight() {
+	GridModel grid {};
+	GridModelResize(&grid, 12, 20);
+	TestCanvas canvas = CreateCanvas(&grid, 2.5f, 4.5f, 0, 0);
+	FillGrid(&canvas, &grid);
+
+	// A row is 4.5 pixels, rows don't look the same 4.5 pixels higher
+	GridScrollCommand up { 0, 12, 0, 20, 1, 0 };
+	ScrollBlit blit;
+	CHECK(!ScrollPlan(&grid, &up, canvas.cell_width, canvas.cell_height, canvas.width, canvas.height, &blit));
+	CHECK(blit.top == blit.bottom);
+	ApplyRandomText(&grid, 11, 0, 20);
+	Flush(&canvas, &grid);
+
+	// Two rows are a whole 9 pixels
+	CHECK(Scroll(&canvas, &grid, 0, 12, 0, 20, 2));
+	Flush(&canvas, &grid);
+	CHECK(!Scroll(&canvas, &grid, 1, 10, 3, 17, -3));
+	Flush(&canvas, &grid);
+	CHECK(Scroll(&canvas, &grid, 1, 10, 3, 17, -4));
+	Flush(&canvas, &grid);
+	GridModelDestroy(&grid);
+}
+
+static void TestClippedByCanvas() {
+	// The canvas ends in the middle of the last row and column
+	GridModel grid {};
+	GridModelResize(&grid, 10, 20);
+	TestCanvas canvas = CreateCanvas(&grid, 3.0f, 5.0f, 2, 7);
+	FillGrid(&canvas, &grid);
+	CHECK(Scroll(&canvas, &grid, 0, 10, 0, 20, 1));
+	Flush(&canvas, &grid);
+	CHECK(Scroll(&canvas, &grid, 0, 10, 0, 20, -2));
+	Flush(&canvas, &grid);
+	CHECK(Scroll(&canvas, &grid, 3, 10, 12, 20, 1));
+	Flush(&canvas, &grid);
+	CHECK(Scroll(&canvas, &grid, 3, 10, 12, 20, -3));
+	Flush(&canvas, &grid);
+
+	// Regions that are partly or entirely past the canvas
+	TestCanvas small = CreateCanvas(&grid, 3.0f, 5.0f, 35, 22);
+	FillGrid(&small, &grid);
+	CHECK(Scroll(&small, &grid, 4, 10, 0, 20, 1));
+	Flush(&small, &grid);
+	CHECK(Scroll(&small, &grid, 6, 10, 0, 20, -1));
+	Flush(&small, &grid);
+	CHECK(Scroll(&small, &grid, 0, 10, 14, 20, 2));
+	Flush(&small, &grid);
+	GridModelDestroy(&grid);
+}
+
+static void TestDirtySpansCarried() {
+	GridModel grid {};
+	GridModelResize(&grid, 12, 30);
+	TestCanvas canvas = CreateCanvas(&grid, 3.0f, 5.0f, 0, 0);
+	FillGrid(&canvas, &grid);
+
+	// Changes that weren't drawn yet are drawn where they were moved to
+	ApplyText(&grid, 6, 4, "xyz_");
+	ApplyText(&grid, 7, 20, "W_q");
+	CHECK(Scroll(&canvas, &grid, 0, 12, 0, 30, 2));
+	int start_col, end_col;
+	// Lines mark the cell to their left as well, for its wide flag
+	CHECK(GridModelDirtySpan(&grid, 4, &start_col, &end_col) && start_col == 3 && end_col == 8);
+	CHECK(GridModelDirtySpan(&grid, 5, &start_col, &end_col) && start_col == 19 && end_col == 24);
+	CHECK(!AnyRowDirty(&grid, 6, 10));
+	Flush(&canvas, &grid);
+
+	// Within a region only the columns inside move, the rest stays dirty in place
+	ApplyText(&grid, 3, 2, "mnopqrstuvwxyz");
+	ApplyText(&grid, 8, 25, "ab_c");
+	CHECK(Scroll(&canvas, &grid, 2, 10, 6, 24, -1));
+	Flush(&canvas, &grid);
+	ApplyText(&grid, 9, 0, "abcdefghijklmnopqrstuvwxyzabcd");
+	CHECK(Scroll(&canvas, &grid, 2, 12, 10, 15, 3));
+	Flush(&canvas, &grid);
+	GridModelDestroy(&grid);
+}
+
+// Random regions, cell sizes and canvas sizes, with lines changed anywhere
+// before and after each scroll of a frame
+static void TestRandomScrolls() {
+	constexpr float CELL_SIZES[][2] = { { 1.0f, 1.0f }, { 3.0f, 5.0f }, { 2.5f, 4.5f }, { 7.0f, 13.25f }, { 2.0f, 3.5f } };
+	for (int round = 0; round < 60 && !test_failures; ++round) {
+		GridModel grid {};
+		GridModelResize(&grid, 4 + Random(20), 4 + Random(40));
+		const float *cell_size = CELL_SIZES[Random(5)];
+		TestCanvas canvas = CreateCanvas(&grid, cell_size[0], cell_size[1],
+			Random(2) ? Random(static_cast<uint32_t>(cell_size[0] * 3)) : 0,
+			Random(2) ? Random(static_cast<uint32_t>(cell_size[1] * 3)) : 0);
+		FillGrid(&canvas, &grid);
+		for (int frame = 0; frame < 40 && !test_failures; ++frame) {
+			for (uint32_t change = Random(8); change > 0; --change) {
+				if (Random(3)) {
+					int top = Random(grid.rows);
+					int bottom = top + 1 + Random(grid.rows - top);
+					int left = Random(2) ? 0 : Random(grid.cols - 1);
+					int right = Random(2) ? grid.cols : left + 1 + Random(grid.cols - left);
+					int distance = 1 + Random(bottom - top);
+					Scroll(&canvas, &grid, top, bottom, left, right, Random(2) ? distance : -distance);
+				}
+				else {
+					int row = Random(grid.rows);
+					int start_col = Random(grid.cols);
+					ApplyRandomText(&grid, row, start_col, start_col + 1 + Random(grid.cols - start_col));
+				}
+			}
+			Flush(&canvas, &grid);
+		}
+		GridModelDestroy(&grid);
+	}
+}
+
+int main() {
+	TestFullWidth();
+	TestPartialWidth();
+	TestFractionalCellHeight();
+	TestClippedByCanvas();
+	TestDirtySpansCarried();
+	TestRandomScrolls();
+	return TestResult("scroll_planner_test");
+}
@@ -0,0 +1,124 @@
+// Throughput of handing messages from one thread to another through an
+// SpscQueue, against the same ring guarded by a mutex
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include "common/spsc_queue.h"
+
+struct Message {
+	uint64_t sequence;
+	char payload[56];
+};
+constexpr size_t QUEUE_SIZE = 64;
+
+struct LockedQueue {
+	std::mutex mutex;
+	size_t head;
+	size_t tail;
+	Message slots[QUEUE_SIZE];
+};
+
+static bool LockedPush(LockedQueue *queue, uint64_t sequence) {
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	if (queue->tail - queue->head == QUEUE_SIZE) {
+		return false;
+	}
+	queue->slots[queue->tail % QUEUE_SIZE].sequence = sequence;
+	queue->tail += 1;
+	return true;
+}
+
+static bool LockedPop(LockedQueue *queue, uint64_t *sequence) {
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	if (queue->head == queue->tail) {
+		return false;
+	}
+	*sequence = queue->slots[queue->head % QUEUE_SIZE].sequence;
+	queue->head += 1;
+	return true;
+}
+
+static double Seconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double RunSpsc(uint64_t count) {
+	auto *queue = new SpscQueue<Message, QUEUE_SIZE> {};
+	auto start = std::chrono::steady_clock::now();
+	std::thread producer([queue, count]() {
+		for (uint64_t sequence = 0; sequence < count; ++sequence) {
+			Message *message;
+			while (!(message = SpscQueueBeginPush(queue))) {
+				std::this_thread::yield();
+			}
+			message->sequence = sequence;
+			SpscQueueEndPush(queue);
+		}
+	});
+
+	uint64_t checksum = 0;
+	for (uint64_t received = 0; received < count;) {
+		Message *message = SpscQueueFront(queue);
+		if (!message) {
+			std::this_thread::yield();
+			continue;
+		}
+		checksum += message->sequence;
+		SpscQueuePop(queue);
+		++received;
+	}
+	producer.join();
+	double seconds = Seconds(start);
+	delete queue;
+	return checksum == count * (count - 1) / 2 ? seconds : -1.0;
+}
+
+static double RunLocked(uint64_t count) {
+	auto *queue = new LockedQueue {};
+	auto start = std::chrono::steady_clock::now();
+	std::thread producer([queue, count]() {
+		for (uint64_t sequence = 0; sequence < count; ++sequence) {
+			while (!LockedPush(queue, sequence)) {
+				std::this_thread::yield();
+			}
+		}
+	});
+
+	uint64_t checksum = 0;
+	for (uint64_t received = 0; received < count;) {
+		uint64_t sequence;
+		if (!LockedPop(queue, &sequence)) {
+			std::this_thread::yield();
+			continue;
+		}
+		checksum += sequence;
+		++received;
+	}
+	producer.join();
+	double seconds = Seconds(start);
+	delete queue;
+	return checksum == count * (count - 1) / 2 ? seconds : -1.0;
+}
+
+// spsc_queue_bench [--quick] [messages]
+int main(int argc, char **argv) {
+	uint64_t count = 20000000;
+	for (int i = 1; i < argc; ++i) {
+		count = strcmp(argv[i], "--quick") == 0 ? 100000 : strtoull(argv[i], nullptr, 10);
+	}
+
+	double spsc_seconds = RunSpsc(count);
+	double locked_seconds = RunLocked(count);
+	if (spsc_seconds < 0 || locked_seconds < 0) {
+		fprintf(stderr, "messages were lost or reordered\n");
+		return 1;
+	}
+	printf("%" PRIu64 " messages of %zu bytes through a queue of %zu\n", count, sizeof(Message), QUEUE_SIZE);
+	printf("spsc:   %8.2f M messages/s\n", count / spsc_seconds / 1e6);
+	printf("locked: %8.2f M messages/s\n", count / locked_seconds / 1e6);
+	return 0;
+}
@@ -0,0 +1,109 @@
+// A producer and a consumer thread pass numbered messages of varying length
+// through a small queue, in slots that keep their buffers the way Nvy's
+// message queue does. Build with -DNVY_TEST_SANITIZERS=thread to run it
+// under TSan.
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "common/spsc_queue.h"
+#include "test.h"
+
+struct Message {
+	uint64_t sequence;
+	char *data;
+	size_t size;
+	size_t capacity;
+};
+constexpr size_t QUEUE_SIZE = 8;
+using MessageQueue = SpscQueue<Message, QUEUE_SIZE>;
+
+static size_t MessageSize(uint64_t sequence) {
+	return (sequence * 7919) % 300;
+}
+static char MessageByte(uint64_t sequence, size_t i) {
+	return static_cast<char>(sequence + i * 31);
+}
+
+static void Produce(MessageQueue *queue, uint64_t count) {
+	for (uint64_t sequence = 0; sequence < count; ++sequence) {
+		Message *message;
+		while (!(message = SpscQueueBeginPush(queue))) {
+			std::this_thread::yield();
+		}
+
+		size_t size = MessageSize(sequence);
+		if (size > message->capacity) {
+			message->data = static_cast<char *>(realloc(message->data, size));
+			message->capacity = size;
+		}
+		for (size_t i = 0; i < size; ++i) {
+			message->data[i] = MessageByte(sequence, i);
+		}
+		message->sequence = sequence;
+		message->size = size;
+		SpscQueueEndPush(queue);
+	}
+}
+
+static void TestSingleThread() {
+	MessageQueue *queue = new MessageQueue {};
+	CHECK(SpscQueueFront(queue) == nullptr);
+	for (size_t i = 0; i < QUEUE_SIZE; ++i) {
+		Message *message = SpscQueueBeginPush(queue);
+		CHECK(message != nullptr);
+		message->sequence = i;
+		SpscQueueEndPush(queue);
+	}
+	CHECK(SpscQueueBeginPush(queue) == nullptr);
+
+	// Slots are handed back one at a time, in order, and wrap around
+	for (uint64_t sequence = 0; sequence < 3 * QUEUE_SIZE; ++sequence) {
+		Message *front = SpscQueueFront(queue);
+		CHECK(front != nullptr && front->sequence == sequence);
+		SpscQueuePop(queue);
+		Message *message = SpscQueueBeginPush(queue);
+		CHECK(message == front);
+		message->sequence = sequence + QUEUE_SIZE;
+		SpscQueueEndPush(queue);
+	}
+	delete queue;
+}
+
+static void TestTwoThreads(uint64_t count) {
+	MessageQueue *queue = new MessageQueue {};
+	std::thread producer(Produce, queue, count);
+
+	uint64_t expected = 0;
+	uint64_t mismatches = 0;
+	while (expected < count) {
+		Message *message = SpscQueueFront(queue);
+		if (!message) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		bool intact = message->sequence == expected && message->size == MessageSize(expected);
+		for (size_t i = 0; intact && i < message->size; ++i) {
+			intact = message->data[i] == MessageByte(expected, i);
+		}
+		mismatches += !intact;
+		SpscQueuePop(queue);
+		++expected;
+	}
+	producer.join();
+	CHECK(mismatches == 0);
+	CHECK(SpscQueueFront(queue) == nullptr);
+
+	for (Message &message : queue->slots) {
+		free(message.data);
+	}
+	delete queue;
+}
+
+// spsc_queue_test [messages]
+int main(int argc, char **argv) {
+	uint64_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+	TestSingleThread();
+	TestTwoThreads(count);
+	return TestResult("spsc_queue_test");
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdio>
+
+// Tests are plain executables run by ctest. CHECK keeps checking in release
+// builds, unlike assert, and a test fails once any check has.
+inline int test_failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			++test_failures; \
+		} \
+	} while (0)
+
+// Returned from main
+inline int TestResult(const char *name) {
+	if (test_failures) {
+		fprintf(stderr, "%s: %d checks failed\n", name, test_failures);
+		return 1;
+	}
+	printf("%s: ok\n", name);
+	return 0;
+}
@@ -0,0 +1,116 @@
+// Connections to a listening nvy_fake_nvim over TCP and a Unix domain socket,
+// attaching a UI and reading the response and frames until the fake exits
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "common/mpack_stream.h"
+#include "common/rpc_encoder.h"
+#include "common/transport.h"
+#include "test.h"
+
+constexpr int FRAME_COUNT = 5;
+
+// The fake prints the address it listens on as its first line of output
+static bool ReadListenAddress(Transport *process, char *address, size_t capacity) {
+	size_t length = 0;
+	while (length + 1 < capacity) {
+		char c;
+		if (TransportRead(process, &c, 1) != 1) {
+			return false;
+		}
+		if (c == '\n') {
+			address[length] = '\0';
+			return true;
+		}
+		address[length++] = c;
+	}
+	return false;
+}
+
+static void TestRoundTrip(const char *fake_nvim, const char *listen_address) {
+	char command_line[4096];
+	snprintf(command_line, sizeof(command_line), "'%s' '--listen=%s' --workload=lines --rate=0 --frames=%d",
+		fake_nvim, listen_address, FRAME_COUNT);
+	Transport process;
+	CHECK(TransportSpawn(&process, command_line));
+
+	char address[512];
+	CHECK(ReadListenAddress(&process, address, sizeof(address)));
+	Transport connection;
+	CHECK(TransportConnect(&connection, address));
+	char host[256];
+	const char *port;
+	bool tcp = TransportSplitTcpAddress(listen_address, host, sizeof(host), &port);
+	CHECK(connection.kind == (tcp ? TransportKind::Tcp : TransportKind::Local));
+	if (tcp) {
+		// Port 0 was asked for, the one printed is the one bound
+		CHECK(TransportSplitTcpAddress(address, host, sizeof(host), &port) && strcmp(port, "0") != 0);
+	}
+	else {
+		// Only a single client is taken, the socket is gone once it is accepted
+		CHECK(strcmp(address, listen_address) == 0);
+	}
+
+	constexpr RpcMethod<int64_t, int64_t, RpcOptions<1>> UI_ATTACH { .id = 5, .name = "nvim_ui_attach" };
+	char attach[128];
+	RpcBufferWriter writer { .data = attach, .size = 0 };
+	RpcEncodeRequest(&writer, 7, UI_ATTACH, 80, 24, RpcOptions<1> { RpcOption { "ext_linegrid", true } });
+	CHECK(TransportWrite(&connection, attach, writer.size) == writer.size);
+
+	MPackStream *stream = new MPackStream;
+	MPackStreamInitialize(stream, TransportRead, &connection);
+	int responses = 0;
+	int flushes = 0;
+	MPackStreamMessage message;
+	while (MPackStreamNext(stream, &message)) {
+		mpack_node_t root = mpack_tree_root(message.tree);
+		int64_t type = mpack_node_int(mpack_node_array_at(root, 0));
+		// [1, msgid, error, result]
+		if (type == 1) {
+			responses += 1;
+			CHECK(mpack_node_u32(mpack_node_array_at(root, 1)) == 7);
+			CHECK(mpack_node_is_nil(mpack_node_array_at(root, 2)));
+		}
+		else if (type == RPC_NOTIFICATION) {
+			mpack_node_t events = mpack_node_array_at(root, 2);
+			for (size_t i = 0; i < mpack_node_array_length(events); ++i) {
+				mpack_node_t name = mpack_node_array_at(mpack_node_array_at(events, i), 0);
+				flushes += mpack_node_strlen(name) == 5 && !memcmp(mpack_node_str(name), "flush", 5);
+			}
+		}
+	}
+	CHECK(responses == 1);
+	// The initial redraw and one per frame
+	CHECK(flushes == FRAME_COUNT + 1);
+	MPackStreamDestroy(stream);
+	delete stream;
+
+	TransportShutdown(&connection);
+	TransportClose(&connection);
+	// Its stdout stays open until it has exited, otherwise it would be killed
+	char rest[64];
+	while (TransportRead(&process, rest, sizeof(rest)) > 0) {
+	}
+	TransportShutdown(&process);
+	CHECK(process.exit_code == 0);
+	TransportClose(&process);
+	if (!tcp) {
+		CHECK(access(listen_address, F_OK) != 0);
+	}
+}
+
+// transport_test <path of nvy_fake_nvim>
+int main(int argc, char **argv) {
+	if (argc > 1) {
+		TestRoundTrip(argv[1], "127.0.0.1:0");
+
+		char directory[] = "/tmp/nvy_transport_test.XXXXXX";
+		CHECK(mkdtemp(directory) != nullptr);
+		char path[256];
+		snprintf(path, sizeof(path), "%s/nvim.sock", directory);
+		TestRoundTrip(argv[1], path);
+		rmdir(directory);
+	}
+	return TestResult("transport_test");
+}
@@ -0,0 +1,889 @@
+// A stand-in for `nvim --embed` that generates synthetic redraw load. It
+// answers the requests Nvy sends (nvim_get_api_info, nvim_ui_attach, nvim_eval,
+// nvim_input, ...) just well enough to keep the client going, and once a UI has
+// attached sends frames of the chosen workload at a fixed rate:
+//   scroll      grid_scroll storms, only the exposed rows are redrawn
+//   pages       half page scrolls like repeated <C-d> and <C-u>, above a
+//               command line row that stays put
+//   lines       every row of the grid is redrawn through grid_line
+//   highlights  thousands of hl_attr_define per frame, all of them in use
+//   wide        rows of wide chars, emoji and clusters of several codepoints,
+//               each followed by its empty right half
+//   resize      the grid is resized, cleared and redrawn every frame
+//   cells       a few short runs of cells change in the middle of rows, like
+//               a statusline clock or diagnostic signs
+//   mixed       cycles through all of the above
+// Run Nvy with --nvim-command=nvy_fake_nvim ... to use it in place of nvim.
+// With --listen=<address> it instead waits for a single client on a TCP
+// host:port or a Unix domain socket path, like `nvim --listen`, and prints the
+// address it listens on to stdout, with the port actually bound for host:0.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "common/mpack_stream.h"
+#include "common/transport.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <csignal>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+enum class Workload {
+	Scroll,
+	Pages,
+	Lines,
+	Highlights,
+	Wide,
+	Resize,
+	Cells,
+	Mixed
+};
+constexpr const char *WORKLOAD_NAMES[] = {
+	"scroll",
+	"pages",
+	"lines",
+	"highlights",
+	"wide",
+	"resize",
+	"cells",
+	"mixed"
+};
+constexpr int MIXED_WORKLOAD_COUNT = static_cast<int>(Workload::Mixed);
+
+// The highlights the other workloads draw with
+constexpr int BASE_HIGHLIGHT_COUNT = 8;
+// Half page scrolls in one direction before the pages workload turns around
+constexpr uint64_t PAGE_SCROLL_RUN = 4;
+// Runs of cells changed per frame by the cells workload
+constexpr int CELL_RUN_COUNT = 6;
+constexpr int MAX_CELL_RUN_LENGTH = 8;
+constexpr const char *WIDE_CHARS[] = {
+	"世", "界", "漢", "字", "한", "글", "😀", "🚀", "🎉", "👍", "🦀", "🌍",
+	"👍🏽", "🇯🇵", "👨‍👩‍👧", "❤️"
+};
+
+struct FakeNvim {
+	Workload workload;
+	double frame_rate;
+	uint64_t frame_limit;
+	int highlight_count;
+
+	// Requests are answered on the reader thread while frames are sent from the main thread
+	std::mutex output_mutex;
+	uint64_t bytes_sent;
+
+	std::mutex state_mutex;
+	std::condition_variable state_changed;
+	// Set by nvim_ui_attach, frames only start once its response has been
+	// sent, as with nvim, or a fast generator could be done before it
+	bool attach_requested;
+	bool attached;
+	bool resized;
+	int rows;
+	int cols;
+	std::atomic<bool> quitting;
+
+	// Only touched by the generator
+	uint32_t random_state;
+	uint64_t frame;
+	// The resize workload shrinks the grid for a frame, the next one sizes it back
+	bool grid_shrunk;
+};
+
+struct OutMessage {
+	mpack_writer_t writer;
+	char *data;
+	size_t size;
+};
+
+struct Cell {
+	const char *text;
+	int hl_id;
+	int repeat;
+};
+
+#ifdef _WIN32
+// Set by --listen, otherwise stdin and stdout are used
+static SOCKET client_socket = INVALID_SOCKET;
+
+static size_t ReadInput(void *, char *buffer, size_t count) {
+	if (client_socket != INVALID_SOCKET) {
+		int bytes_read = recv(client_socket, buffer, static_cast<int>(std::min<size_t>(count, INT_MAX)), 0);
+		return bytes_read > 0 ? static_cast<size_t>(bytes_read) : 0;
+	}
+	DWORD bytes_read;
+	if (!ReadFile(GetStdHandle(STD_INPUT_HANDLE), buffer, static_cast<DWORD>(count), &bytes_read, nullptr)) {
+		return 0;
+	}
+	return bytes_read;
+}
+
+static bool WriteOutput(const char *data, size_t size) {
+	HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+	while (size > 0) {
+		DWORD bytes_written;
+		if (client_socket != INVALID_SOCKET) {
+			int bytes_sent = send(client_socket, data, static_cast<int>(std::min<size_t>(size, INT_MAX)), 0);
+			if (bytes_sent <= 0) {
+				return false;
+			}
+			bytes_written = static_cast<DWORD>(bytes_sent);
+		}
+		else if (!WriteFile(output, data, static_cast<DWORD>(size), &bytes_written, nullptr)) {
+			return false;
+		}
+		data += bytes_written;
+		size -= bytes_written;
+	}
+	return true;
+}
+
+// Only TCP, a named pipe server would need overlapped I/O for the reader and
+// generator threads to use it at once
+static bool ListenForClient(const char *address) {
+	char host[256];
+	const char *port;
+	if (!TransportSplitTcpAddress(address, host, sizeof(host), &port)) {
+		fprintf(stderr, "--listen only takes host:port addresses on Windows\n");
+		return false;
+	}
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		return false;
+	}
+
+	addrinfo hints {
+		.ai_flags = AI_PASSIVE,
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP
+	};
+	addrinfo *addresses;
+	if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+		return false;
+	}
+	SOCKET listener = INVALID_SOCKET;
+	for (addrinfo *candidate = addresses; candidate; candidate = candidate->ai_next) {
+		listener = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+		if (listener == INVALID_SOCKET) {
+			continue;
+		}
+		if (bind(listener, candidate->ai_addr, static_cast<int>(candidate->ai_addrlen)) == 0 &&
+			listen(listener, 1) == 0) {
+			break;
+		}
+		closesocket(listener);
+		listener = INVALID_SOCKET;
+	}
+	freeaddrinfo(addresses);
+	if (listener == INVALID_SOCKET) {
+		return false;
+	}
+
+	// The port actually bound, for --listen=host:0
+	sockaddr_storage bound;
+	int bound_length = sizeof(bound);
+	char bound_host[NI_MAXHOST];
+	char bound_port[NI_MAXSERV];
+	if (getsockname(listener, reinterpret_cast<sockaddr *>(&bound), &bound_length) != 0 ||
+		getnameinfo(reinterpret_cast<sockaddr *>(&bound), bound_length, bound_host, sizeof(bound_host),
+			bound_port, sizeof(bound_port), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+		closesocket(listener);
+		return false;
+	}
+	printf(bound.ss_family == AF_INET6 ? "[%s]:%s\n" : "%s:%s\n", bound_host, bound_port);
+	fflush(stdout);
+
+	client_socket = accept(listener, nullptr, nullptr);
+	closesocket(listener);
+	if (client_socket == INVALID_SOCKET) {
+		return false;
+	}
+	BOOL no_delay = true;
+	setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&no_delay), sizeof(no_delay));
+	return true;
+}
+#else
+// Set by --listen, otherwise stdin and stdout are used
+static int input_fd = STDIN_FILENO;
+static int output_fd = STDOUT_FILENO;
+
+static size_t ReadInput(void *, char *buffer, size_t count) {
+	ssize_t bytes_read = read(input_fd, buffer, count);
+	return bytes_read > 0 ? static_cast<size_t>(bytes_read) : 0;
+}
+
+static bool WriteOutput(const char *data, size_t size) {
+	while (size > 0) {
+		ssize_t bytes_written = write(output_fd, data, size);
+		if (bytes_written <= 0) {
+			return false;
+		}
+		data += bytes_written;
+		size -= bytes_written;
+	}
+	return true;
+}
+
+static int ListenTcp(const char *host, const char *port) {
+	addrinfo hints {
+		.ai_flags = AI_PASSIVE,
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP
+	};
+	addrinfo *addresses;
+	if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+		return -1;
+	}
+	int listener = -1;
+	for (addrinfo *candidate = addresses; candidate; candidate = candidate->ai_next) {
+		listener = socket(candidate->ai_family, candidate->ai_socktype | SOCK_CLOEXEC, candidate->ai_protocol);
+		if (listener < 0) {
+			continue;
+		}
+		int reuse_address = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse_address, sizeof(reuse_address));
+		if (bind(listener, candidate->ai_addr, candidate->ai_addrlen) == 0 && listen(listener, 1) == 0) {
+			break;
+		}
+		close(listener);
+		listener = -1;
+	}
+	freeaddrinfo(addresses);
+	if (listener < 0) {
+		return -1;
+	}
+
+	// The port actually bound, for --listen=host:0
+	sockaddr_storage bound;
+	socklen_t bound_length = sizeof(bound);
+	char bound_host[NI_MAXHOST];
+	char bound_port[NI_MAXSERV];
+	if (getsockname(listener, reinterpret_cast<sockaddr *>(&bound), &bound_length) != 0 ||
+		getnameinfo(reinterpret_cast<sockaddr *>(&bound), bound_length, bound_host, sizeof(bound_host),
+			bound_port, sizeof(bound_port), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+		close(listener);
+		return -1;
+	}
+	printf(bound.ss_family == AF_INET6 ? "[%s]:%s\n" : "%s:%s\n", bound_host, bound_port);
+	return listener;
+}
+
+static int ListenUnix(const char *path) {
+	sockaddr_un address { .sun_family = AF_UNIX };
+	size_t path_length = strlen(path);
+	if (path_length >= sizeof(address.sun_path)) {
+		return -1;
+	}
+	memcpy(address.sun_path, path, path_length + 1);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0) {
+		return -1;
+	}
+	if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 1) != 0) {
+		close(listener);
+		return -1;
+	}
+	printf("%s\n", path);
+	return listener;
+}
+
+static bool ListenForClient(const char *address) {
+	char host[256];
+	const char *port;
+	bool tcp = TransportSplitTcpAddress(address, host, sizeof(host), &port);
+	int listener = tcp ? ListenTcp(host, port) : ListenUnix(address);
+	if (listener < 0) {
+		return false;
+	}
+	fflush(stdout);
+
+	int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+	close(listener);
+	if (!tcp) {
+		unlink(address);
+	}
+	if (client < 0) {
+		return false;
+	}
+	if (tcp) {
+		int no_delay = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+	}
+	// A client that goes away shows up as a failing write instead
+	signal(SIGPIPE, SIG_IGN);
+	input_fd = client;
+	output_fd = client;
+	return true;
+}
+#endif
+
+static uint32_t Random(FakeNvim *fake) {
+	// xorshift32, the workloads only need to look busy
+	uint32_t x = fake->random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	fake->random_state = x;
+	return x;
+}
+
+static void BeginMessage(OutMessage *message) {
+	mpack_writer_init_growable(&message->writer, &message->data, &message->size);
+}
+
+static void SendMessage(FakeNvim *fake, OutMessage *message) {
+	if (mpack_writer_destroy(&message->writer) == mpack_ok) {
+		std::lock_guard<std::mutex> lock(fake->output_mutex);
+		if (!WriteOutput(message->data, message->size)) {
+			fake->quitting.store(true);
+		}
+		fake->bytes_sent += message->size;
+	}
+	free(message->data);
+}
+
+// [2, "redraw", [[event, args...]...]]
+static void BeginRedraw(mpack_writer_t *writer, uint32_t event_count) {
+	mpack_start_array(writer, 3);
+	mpack_write_int(writer, 2);
+	mpack_write_cstr(writer, "redraw");
+	mpack_start_array(writer, event_count);
+}
+
+static void BeginEvent(mpack_writer_t *writer, const char *name, uint32_t call_count) {
+	mpack_start_array(writer, call_count + 1);
+	mpack_write_cstr(writer, name);
+}
+
+static void WriteIntCall(mpack_writer_t *writer, std::initializer_list<int64_t> args) {
+	mpack_start_array(writer, static_cast<uint32_t>(args.size()));
+	for (int64_t arg : args) {
+		mpack_write_int(writer, arg);
+	}
+	mpack_finish_array(writer);
+}
+
+static void WriteFlush(mpack_writer_t *writer) {
+	BeginEvent(writer, "flush", 1);
+	mpack_start_array(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+}
+
+// Cells only carry their hl id when it differs from the cell to the left, like nvim
+static void WriteGridLine(mpack_writer_t *writer, int row, int col, const std::vector<Cell> &cells) {
+	mpack_start_array(writer, 5);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, row);
+	mpack_write_int(writer, col);
+	mpack_start_array(writer, static_cast<uint32_t>(cells.size()));
+	int previous_hl_id = -1;
+	for (const Cell &cell : cells) {
+		uint32_t length = cell.repeat > 1 ? 3 : (cell.hl_id != previous_hl_id ? 2 : 1);
+		mpack_start_array(writer, length);
+		mpack_write_cstr(writer, cell.text);
+		if (length > 1) {
+			mpack_write_int(writer, cell.hl_id);
+		}
+		if (length > 2) {
+			mpack_write_int(writer, cell.repeat);
+		}
+		mpack_finish_array(writer);
+		previous_hl_id = cell.hl_id;
+	}
+	mpack_finish_array(writer);
+	mpack_write_false(writer);
+	mpack_finish_array(writer);
+}
+
+constexpr const char *ASCII_CELLS[] = {
+	"a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m",
+	"n", "o", "p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z",
+	"(", ")", "{", "}", ";", "=", "_", "0", "1", "2"
+};
+
+// Text of random length in runs of highlights, the rest of the row is one repeated blank
+static void BuildTextRow(FakeNvim *fake, int cols, int hl_count, std::vector<Cell> *cells) {
+	cells->clear();
+	int text_length = static_cast<int>(Random(fake) % (cols + 1));
+	int hl_id = 1;
+	for (int col = 0; col < text_length; ++col) {
+		if (col % 6 == 0) {
+			hl_id = 1 + Random(fake) % hl_count;
+		}
+		const char *text = ASCII_CELLS[Random(fake) % (sizeof(ASCII_CELLS) / sizeof(ASCII_CELLS[0]))];
+		cells->push_back(Cell { .text = text, .hl_id = hl_id, .repeat = 1 });
+	}
+	if (text_length < cols) {
+		cells->push_back(Cell { .text = " ", .hl_id = 0, .repeat = cols - text_length });
+	}
+}
+
+static void BuildCellRun(FakeNvim *fake, int length, std::vector<Cell> *cells) {
+	cells->clear();
+	int hl_id = 1 + Random(fake) % BASE_HIGHLIGHT_COUNT;
+	for (int i = 0; i < length; ++i) {
+		const char *text = ASCII_CELLS[Random(fake) % (sizeof(ASCII_CELLS) / sizeof(ASCII_CELLS[0]))];
+		cells->push_back(Cell { .text = text, .hl_id = hl_id, .repeat = 1 });
+	}
+}
+
+static void BuildWideRow(FakeNvim *fake, int cols, std::vector<Cell> *cells) {
+	cells->clear();
+	int col = 0;
+	for (; col + 1 < cols; col += 2) {
+		const char *text = WIDE_CHARS[Random(fake) % (sizeof(WIDE_CHARS) / sizeof(WIDE_CHARS[0]))];
+		int hl_id = 1 + Random(fake) % BASE_HIGHLIGHT_COUNT;
+		cells->push_back(Cell { .text = text, .hl_id = hl_id, .repeat = 1 });
+		cells->push_back(Cell { .text = "", .hl_id = hl_id, .repeat = 1 });
+	}
+	if (col < cols) {
+		cells->push_back(Cell { .text = " ", .hl_id = 0, .repeat = 1 });
+	}
+}
+
+static void WriteHighlight(FakeNvim *fake, mpack_writer_t *writer, int id) {
+	mpack_start_array(writer, 4);
+	mpack_write_int(writer, id);
+	mpack_start_map(writer, 3);
+	mpack_write_cstr(writer, "foreground");
+	mpack_write_uint(writer, Random(fake) & 0xFFFFFF);
+	mpack_write_cstr(writer, "background");
+	mpack_write_uint(writer, Random(fake) & 0x3F3F3F);
+	mpack_write_cstr(writer, Random(fake) & 1 ? "bold" : "italic");
+	mpack_write_true(writer);
+	mpack_finish_map(writer);
+	mpack_start_map(writer, 0);
+	mpack_finish_map(writer);
+	mpack_start_array(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+}
+
+static void SendInitialRedraw(FakeNvim *fake, int rows, int cols) {
+	OutMessage message;
+	BeginMessage(&message);
+	mpack_writer_t *writer = &message.writer;
+	BeginRedraw(writer, 7);
+
+	BeginEvent(writer, "default_colors_set", 1);
+	WriteIntCall(writer, { 0xD4D4D4, 0x1E1E1E, 0xFF0000, 0, 0 });
+	mpack_finish_array(writer);
+
+	BeginEvent(writer, "hl_attr_define", BASE_HIGHLIGHT_COUNT);
+	for (int id = 1; id <= BASE_HIGHLIGHT_COUNT; ++id) {
+		WriteHighlight(fake, writer, id);
+	}
+	mpack_finish_array(writer);
+
+	BeginEvent(writer, "mode_info_set", 1);
+	mpack_start_array(writer, 2);
+	mpack_write_true(writer);
+	mpack_start_array(writer, 1);
+	mpack_start_map(writer, 2);
+	mpack_write_cstr(writer, "cursor_shape");
+	mpack_write_cstr(writer, "block");
+	mpack_write_cstr(writer, "attr_id");
+	mpack_write_int(writer, 0);
+	mpack_finish_map(writer);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	BeginEvent(writer, "grid_resize", 1);
+	WriteIntCall(writer, { 1, cols, rows });
+	mpack_finish_array(writer);
+
+	BeginEvent(writer, "grid_clear", 1);
+	WriteIntCall(writer, { 1 });
+	mpack_finish_array(writer);
+
+	BeginEvent(writer, "mode_change", 1);
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "normal");
+	mpack_write_int(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	WriteFlush(writer);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+	SendMessage(fake, &message);
+}
+
+static void SendFrame(FakeNvim *fake, Workload workload, int rows, int cols, bool resized) {
+	OutMessage message;
+	BeginMessage(&message);
+	mpack_writer_t *writer = &message.writer;
+	std::vector<Cell> cells;
+
+	if (fake->grid_shrunk) {
+		resized = true;
+		fake->grid_shrunk = false;
+	}
+	if (workload == Workload::Resize) {
+		// Shrink by up to 7 rows and cols, different every frame
+		int shrink = static_cast<int>(fake->frame % 8);
+		rows = std::max(1, rows - shrink);
+		cols = std::max(1, cols - shrink);
+		resized = true;
+		fake->grid_shrunk = true;
+	}
+
+	int hl_count = workload == Workload::Highlights ? fake->highlight_count : BASE_HIGHLIGHT_COUNT;
+	bool scrolls = workload == Workload::Scroll || workload == Workload::Pages;
+	bool redraw_all = resized || (!scrolls && workload != Workload::Cells);
+	uint32_t event_count = 3 + (resized ? 2 : 0) + (workload == Workload::Highlights ? 1 : 0) +
+		(scrolls ? 1 : 0);
+	BeginRedraw(writer, event_count);
+
+	if (resized) {
+		BeginEvent(writer, "grid_resize", 1);
+		WriteIntCall(writer, { 1, cols, rows });
+		mpack_finish_array(writer);
+		BeginEvent(writer, "grid_clear", 1);
+		WriteIntCall(writer, { 1 });
+		mpack_finish_array(writer);
+	}
+
+	if (workload == Workload::Highlights) {
+		BeginEvent(writer, "hl_attr_define", hl_count);
+		for (int id = 1; id <= hl_count; ++id) {
+			WriteHighlight(fake, writer, id);
+		}
+		mpack_finish_array(writer);
+	}
+
+	int first_row = 0;
+	int row_count = rows;
+	if (scrolls) {
+		int region_rows;
+		int scroll_rows;
+		if (workload == Workload::Pages) {
+			region_rows = std::max(1, rows - 1);
+			scroll_rows = std::max(1, region_rows / 2);
+			if ((fake->frame / PAGE_SCROLL_RUN) % 2) {
+				scroll_rows = -scroll_rows;
+			}
+		}
+		else {
+			// Scroll by 1 to 3 rows, mostly down like holding <C-e>
+			region_rows = rows;
+			scroll_rows = std::min(rows, 1 + static_cast<int>(Random(fake) % 3));
+			if (Random(fake) % 4 == 0) {
+				scroll_rows = -scroll_rows;
+			}
+		}
+		BeginEvent(writer, "grid_scroll", 1);
+		WriteIntCall(writer, { 1, 0, region_rows, 0, cols, scroll_rows, 0 });
+		mpack_finish_array(writer);
+		if (!redraw_all) {
+			row_count = scroll_rows > 0 ? scroll_rows : -scroll_rows;
+			first_row = scroll_rows > 0 ? region_rows - row_count : 0;
+		}
+	}
+
+	if (workload == Workload::Cells && !redraw_all) {
+		BeginEvent(writer, "grid_line", CELL_RUN_COUNT);
+		for (int i = 0; i < CELL_RUN_COUNT; ++i) {
+			int length = std::min(cols, 1 + static_cast<int>(Random(fake) % MAX_CELL_RUN_LENGTH));
+			int row = static_cast<int>(Random(fake) % rows);
+			int col = static_cast<int>(Random(fake) % (cols - length + 1));
+			BuildCellRun(fake, length, &cells);
+			WriteGridLine(writer, row, col, cells);
+		}
+		mpack_finish_array(writer);
+	}
+	else {
+		BeginEvent(writer, "grid_line", row_count);
+		for (int row = first_row; row < first_row + row_count; ++row) {
+			if (workload == Workload::Wide) {
+				BuildWideRow(fake, cols, &cells);
+			}
+			else {
+				BuildTextRow(fake, cols, hl_count, &cells);
+			}
+			WriteGridLine(writer, row, 0, cells);
+		}
+		mpack_finish_array(writer);
+	}
+
+	BeginEvent(writer, "grid_cursor_goto", 1);
+	WriteIntCall(writer, { 1, static_cast<int>(Random(fake) % rows), static_cast<int>(Random(fake) % cols) });
+	mpack_finish_array(writer);
+
+	WriteFlush(writer);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+	SendMessage(fake, &message);
+}
+
+static void Generate(FakeNvim *fake) {
+	{
+		std::unique_lock<std::mutex> lock(fake->state_mutex);
+		fake->state_changed.wait(lock, [fake] { return fake->attached || fake->quitting.load(); });
+	}
+
+	auto frame_interval = std::chrono::duration<double>(fake->frame_rate > 0.0 ? 1.0 / fake->frame_rate : 0.0);
+	auto next_frame = std::chrono::steady_clock::now();
+	bool initial = true;
+	while (!fake->quitting.load()) {
+		int rows, cols;
+		bool resized;
+		{
+			std::lock_guard<std::mutex> lock(fake->state_mutex);
+			rows = fake->rows;
+			cols = fake->cols;
+			resized = fake->resized;
+			fake->resized = false;
+		}
+		if (initial) {
+			SendInitialRedraw(fake, rows, cols);
+			initial = false;
+		}
+
+		Workload workload = fake->workload == Workload::Mixed ?
+			static_cast<Workload>(fake->frame % MIXED_WORKLOAD_COUNT) : fake->workload;
+		SendFrame(fake, workload, rows, cols, resized);
+		fake->frame += 1;
+		if (fake->frame_limit && fake->frame >= fake->frame_limit) {
+			break;
+		}
+
+		if (fake->frame_rate > 0.0) {
+			next_frame += std::chrono::duration_cast<std::chrono::steady_clock::duration>(frame_interval);
+			std::this_thread::sleep_until(next_frame);
+		}
+	}
+	fake->quitting.store(true);
+}
+
+static bool StringIs(mpack_node_t node, const char *str) {
+	return mpack_node_type(node) == mpack_type_str &&
+		mpack_node_strlen(node) == strlen(str) &&
+		memcmp(mpack_node_str(node), str, strlen(str)) == 0;
+}
+
+static void SetGridSize(FakeNvim *fake, mpack_node_t params, bool attach) {
+	{
+		std::lock_guard<std::mutex> lock(fake->state_mutex);
+		fake->cols = std::max(1, static_cast<int>(mpack_node_int(mpack_node_array_at(params, 0))));
+		fake->rows = std::max(1, static_cast<int>(mpack_node_int(mpack_node_array_at(params, 1))));
+		if (attach) {
+			fake->attach_requested = true;
+		}
+		else {
+			fake->resized = true;
+		}
+	}
+	fake->state_changed.notify_all();
+}
+
+// Carries out a call and writes its result, every method succeeds
+static void Call(FakeNvim *fake, mpack_node_t method, mpack_node_t params, mpack_writer_t *writer) {
+	if (StringIs(method, "nvim_get_api_info")) {
+		mpack_start_array(writer, 2);
+		mpack_write_int(writer, 1);
+		mpack_start_map(writer, 1);
+		mpack_write_cstr(writer, "version");
+		mpack_start_map(writer, 4);
+		mpack_write_cstr(writer, "major");
+		mpack_write_int(writer, 0);
+		mpack_write_cstr(writer, "minor");
+		mpack_write_int(writer, 10);
+		mpack_write_cstr(writer, "patch");
+		mpack_write_int(writer, 0);
+		mpack_write_cstr(writer, "api_level");
+		mpack_write_int(writer, 12);
+		mpack_finish_map(writer);
+		mpack_finish_map(writer);
+		mpack_finish_array(writer);
+	}
+	else if (StringIs(method, "nvim_ui_attach")) {
+		SetGridSize(fake, params, true);
+		mpack_write_nil(writer);
+	}
+	else if (StringIs(method, "nvim_ui_try_resize")) {
+		SetGridSize(fake, params, false);
+		mpack_write_nil(writer);
+	}
+	else if (StringIs(method, "nvim_eval")) {
+		// Only stdpath('config') and the input sync "0" are ever evaluated
+		mpack_node_t expression = mpack_node_array_at(params, 0);
+		if (mpack_node_strlen(expression) > 1) {
+			mpack_write_cstr(writer, "nvy_fake_nvim");
+		}
+		else {
+			mpack_write_int(writer, 0);
+		}
+	}
+	else if (StringIs(method, "nvim_input")) {
+		mpack_write_uint(writer, mpack_node_strlen(mpack_node_array_at(params, 0)));
+	}
+	else if (StringIs(method, "nvim_paste")) {
+		mpack_write_true(writer);
+	}
+	else if (StringIs(method, "nvim_command")) {
+		mpack_node_t command = mpack_node_array_at(params, 0);
+		if (mpack_node_strlen(command) > 0 && mpack_node_str(command)[0] == 'q') {
+			{
+				std::lock_guard<std::mutex> lock(fake->state_mutex);
+				fake->quitting.store(true);
+			}
+			fake->state_changed.notify_all();
+		}
+		mpack_write_nil(writer);
+	}
+	else if (StringIs(method, "nvim_call_atomic")) {
+		// [[results...], error]
+		mpack_node_t calls = mpack_node_array_at(params, 0);
+		size_t call_count = mpack_node_array_length(calls);
+		mpack_start_array(writer, 2);
+		mpack_start_array(writer, static_cast<uint32_t>(call_count));
+		for (size_t i = 0; i < call_count; ++i) {
+			mpack_node_t call = mpack_node_array_at(calls, i);
+			Call(fake, mpack_node_array_at(call, 0), mpack_node_array_at(call, 1), writer);
+		}
+		mpack_finish_array(writer);
+		mpack_write_nil(writer);
+		mpack_finish_array(writer);
+	}
+	else {
+		mpack_write_nil(writer);
+	}
+}
+
+static void HandleMessage(FakeNvim *fake, mpack_tree_t *tree) {
+	mpack_node_t root = mpack_tree_root(tree);
+	int64_t type = mpack_node_int(mpack_node_array_at(root, 0));
+	if (type == 0) {
+		// [0, msgid, method, params] is answered with [1, msgid, nil, result]
+		OutMessage message;
+		BeginMessage(&message);
+		mpack_start_array(&message.writer, 4);
+		mpack_write_int(&message.writer, 1);
+		mpack_write_u32(&message.writer, static_cast<uint32_t>(mpack_node_u32(mpack_node_array_at(root, 1))));
+		mpack_write_nil(&message.writer);
+		Call(fake, mpack_node_array_at(root, 2), mpack_node_array_at(root, 3), &message.writer);
+		mpack_finish_array(&message.writer);
+		SendMessage(fake, &message);
+	}
+	else if (type == 2) {
+		// Notifications are carried out with the result thrown away
+		OutMessage discard;
+		BeginMessage(&discard);
+		Call(fake, mpack_node_array_at(root, 1), mpack_node_array_at(root, 2), &discard.writer);
+		mpack_writer_destroy(&discard.writer);
+		free(discard.data);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(fake->state_mutex);
+		if (!fake->attach_requested || fake->attached) {
+			return;
+		}
+		fake->attached = true;
+	}
+	fake->state_changed.notify_all();
+}
+
+static void ReadRequests(FakeNvim *fake) {
+	MPackStream *stream = new MPackStream;
+	MPackStreamInitialize(stream, ReadInput, nullptr);
+	MPackStreamMessage message;
+	while (!fake->quitting.load() && MPackStreamNext(stream, &message)) {
+		HandleMessage(fake, message.tree);
+	}
+
+	// Input has ended or a quit was requested, the generator stops after its current frame
+	{
+		std::lock_guard<std::mutex> lock(fake->state_mutex);
+		fake->quitting.store(true);
+	}
+	fake->state_changed.notify_all();
+}
+
+static bool ParseWorkload(const char *name, Workload *workload) {
+	for (int i = 0; i < static_cast<int>(sizeof(WORKLOAD_NAMES) / sizeof(WORKLOAD_NAMES[0])); ++i) {
+		if (!strcmp(name, WORKLOAD_NAMES[i])) {
+			*workload = static_cast<Workload>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char **argv) {
+	FakeNvim *fake = new FakeNvim {};
+	fake->workload = Workload::Mixed;
+	fake->frame_rate = 60.0;
+	fake->highlight_count = 2000;
+	fake->random_state = 0x9E3779B9;
+
+	const char *listen_address = nullptr;
+	for (int i = 1; i < argc; ++i) {
+		if (!strncmp(argv[i], "--workload=", strlen("--workload="))) {
+			if (!ParseWorkload(argv[i] + strlen("--workload="), &fake->workload)) {
+				fprintf(stderr, "Unknown workload %s\n", argv[i] + strlen("--workload="));
+				return 2;
+			}
+		}
+		else if (!strncmp(argv[i], "--rate=", strlen("--rate="))) {
+			fake->frame_rate = atof(argv[i] + strlen("--rate="));
+		}
+		else if (!strncmp(argv[i], "--frames=", strlen("--frames="))) {
+			fake->frame_limit = strtoull(argv[i] + strlen("--frames="), nullptr, 10);
+		}
+		else if (!strncmp(argv[i], "--highlights=", strlen("--highlights="))) {
+			fake->highlight_count = std::clamp(atoi(argv[i] + strlen("--highlights=")), 1, 0xFFFE);
+		}
+		else if (!strncmp(argv[i], "--seed=", strlen("--seed="))) {
+			fake->random_state = static_cast<uint32_t>(strtoul(argv[i] + strlen("--seed="), nullptr, 10)) | 1;
+		}
+		else if (!strncmp(argv[i], "--listen=", strlen("--listen="))) {
+			listen_address = argv[i] + strlen("--listen=");
+		}
+		else if (strcmp(argv[i], "--embed") != 0) {
+			fprintf(stderr,
+				"Usage: nvy_fake_nvim [--embed] [--workload=scroll|pages|lines|highlights|wide|resize|cells|mixed]\n"
+				"                     [--rate=<frames per second, 0 for unlimited>] [--frames=<count>]\n"
+				"                     [--highlights=<count>] [--seed=<seed>] [--listen=<host:port or path>]\n");
+			return 2;
+		}
+	}
+	if (listen_address && !ListenForClient(listen_address)) {
+		fprintf(stderr, "Could not listen on %s\n", listen_address);
+		return 1;
+	}
+
+	// Requests are answered on their own thread, which is left blocked in its
+	// read once the generator is done, the process exits regardless
+	std::thread reader(ReadRequests, fake);
+	reader.detach();
+	Generate(fake);
+
+	fprintf(stderr, "nvy_fake_nvim: %llu frames, %llu bytes sent\n",
+		static_cast<unsigned long long>(fake->frame), static_cast<unsigned long long>(fake->bytes_sent));
+	return 0;
+}
@@ -0,0 +1,512 @@
+// Headless replay of a capture recorded with `Nvy --capture=<file>`. The
+// inbound traffic runs through the same stream parser and redraw decoder as
+// the reader thread, batches of redraw commands are cut at the same points,
+// and the time from the first event of a batch until it is complete is
+// reported. Each batch is then applied to a grid model the way the renderer
+// does, taking its dirty rows at every flush, which is timed separately. Runs anywhere the transport
+// does, so captures from Windows can be benchmarked on Linux.
+//
+// Scrolls are planned against a CPU framebuffer the way the renderer moves the
+// pixels of its canvas, cells are painted as blocks of a color made from their
+// contents. After every flush the framebuffer is checked against the grid, any
+// cell that differs means rows were left stale by a scroll.
+//
+// With --nvim-command the traffic comes live from a spawned nvim (or
+// nvy_fake_nvim) attached at the given geometry instead, for loads too long
+// to be worth capturing. --server does the same with an nvim already
+// listening on a TCP host:port or a local socket, to time the network path.
+// Either can be recorded with --capture=<file>, like Nvy's own --capture.
+//
+// A replay fails with exit code 1 if the capture's timestamps go back, it
+// ends in a truncated record or not all of its inbound bytes were parsed, and
+// so does any run that leaves stale cells on the framebuffer.
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "common/mpack_stream.h"
+#include "common/rpc_capture.h"
+#include "common/rpc_encoder.h"
+#include "common/transport.h"
+#include "nvim/redraw_commands.h"
+#include "nvim/redraw_decoder.h"
+#include "renderer/grid_model.h"
+#include "renderer/scroll_planner.h"
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+struct ReplayStats {
+	uint64_t inbound_records;
+	uint64_t inbound_bytes;
+	uint64_t outbound_records;
+	uint64_t outbound_bytes;
+	uint64_t capture_duration_us;
+	uint64_t capture_timestamp_regressions;
+	uint64_t capture_trailing_bytes;
+
+	uint64_t rpc_messages;
+	uint64_t redraw_batches;
+	uint64_t redraw_commands;
+	uint64_t unhandled_events;
+	uint64_t batch_total_us;
+	uint64_t batch_max_us;
+
+	uint64_t grid_lines;
+	uint64_t grid_cells;
+	uint64_t grid_scrolls;
+	uint64_t grid_scrolled_rows;
+	// Scrolls alone take well under a microsecond
+	uint64_t grid_scroll_ns;
+	uint64_t grid_resizes;
+	uint64_t grid_total_us;
+	uint64_t grid_max_us;
+	uint64_t row_text_units;
+	uint64_t row_text_ns;
+
+	uint64_t canvas_blits;
+	uint64_t canvas_blit_pixels;
+	uint64_t canvas_scroll_fallbacks;
+	uint64_t canvas_painted_pixels;
+	uint64_t canvas_us;
+	uint64_t canvas_checks;
+	uint64_t canvas_stale_cells;
+};
+
+struct ReplayCanvas {
+	float cell_width;
+	float cell_height;
+	int width;
+	int height;
+	uint32_t *pixels;
+};
+
+struct ReplayBatch {
+	RedrawCommandBuffer commands;
+	uint64_t start_us;
+	GridModel grid;
+	ReplayCanvas canvas;
+	// Scratch space for the text of the row being drawn, as in the renderer
+	char16_t *row_text;
+	uint32_t *row_text_offsets;
+	ReplayStats *stats;
+};
+
+static uint32_t CellColor(GridModel *grid, int row, int col) {
+	size_t offset = GridModelOffset(grid, row, col);
+	return (grid->text[offset] * 0x9E3779B1) ^ grid->attribs[offset];
+}
+
+static void ResizeCanvas(ReplayCanvas *canvas, GridModel *grid) {
+	// Grid resizes mark every row dirty, so what was drawn can be dropped
+	canvas->width = CanvasPixel(grid->cols * canvas->cell_width);
+	canvas->height = CanvasPixel(grid->rows * canvas->cell_height);
+	free(canvas->pixels);
+	canvas->pixels = static_cast<uint32_t *>(calloc(static_cast<size_t>(canvas->width) * canvas->height, sizeof(uint32_t)));
+}
+
+static void MoveCanvasPixels(ReplayCanvas *canvas, ScrollBlit *blit, ReplayStats *stats) {
+	int height = blit->bottom - blit->top;
+	int width = blit->right - blit->left;
+	for (int i = 0; i < height; ++i) {
+		// In the order that doesn't overwrite rows still to be moved
+		int y = blit->destination_top > blit->top ? height - 1 - i : i;
+		memmove(&canvas->pixels[static_cast<size_t>(blit->destination_top + y) * canvas->width + blit->left],
+			&canvas->pixels[static_cast<size_t>(blit->top + y) * canvas->width + blit->left],
+			width * sizeof(uint32_t));
+	}
+	stats->canvas_blits += 1;
+	stats->canvas_blit_pixels += static_cast<uint64_t>(width) * height;
+}
+
+// Paints the columns [start_col, end_col) of a row, or with check set counts
+// those that weren't painted the way they would be now
+static uint64_t PaintCells(ReplayCanvas *canvas, GridModel *grid, int row, int start_col, int end_col, bool check) {
+	uint64_t count = 0;
+	int top = CanvasPixel(row * canvas->cell_height);
+	int bottom = CanvasPixel((row + 1) * canvas->cell_height);
+	for (int col = start_col; col < end_col; ++col) {
+		uint32_t color = CellColor(grid, row, col);
+		int left = CanvasPixel(col * canvas->cell_width);
+		int right = CanvasPixel((col + 1) * canvas->cell_width);
+		bool stale = false;
+		for (int y = top; y < bottom; ++y) {
+			uint32_t *pixels = &canvas->pixels[static_cast<size_t>(y) * canvas->width];
+			for (int x = left; x < right; ++x) {
+				stale |= pixels[x] != color;
+				pixels[x] = check ? pixels[x] : color;
+			}
+		}
+		count += check ? stale : static_cast<uint64_t>(right - left) * (bottom - top);
+	}
+	return count;
+}
+
+static void ApplyBatch(ReplayBatch *batch) {
+	ReplayStats *stats = batch->stats;
+	uint64_t start_us = RpcCaptureNowMicroseconds();
+	for (RedrawCommand *command = RedrawCommandsBegin(&batch->commands); command;
+		command = RedrawCommandsNext(&batch->commands, command)) {
+		switch (command->type) {
+		case RedrawCommandType::GridResize: {
+			GridResizeCommand *grid_resize = RedrawCommandPayload<GridResizeCommand>(command);
+			if (GridModelResize(&batch->grid, grid_resize->rows, grid_resize->cols)) {
+				ResizeCanvas(&batch->canvas, &batch->grid);
+				free(batch->row_text);
+				free(batch->row_text_offsets);
+				batch->row_text = static_cast<char16_t *>(malloc(GRID_MAX_COLUMN_UNITS * static_cast<size_t>(grid_resize->cols) * sizeof(char16_t)));
+				batch->row_text_offsets = static_cast<uint32_t *>(malloc((static_cast<size_t>(grid_resize->cols) + 1) * sizeof(uint32_t)));
+			}
+			stats->grid_resizes += 1;
+		} break;
+		case RedrawCommandType::GridClear: {
+			GridModelClear(&batch->grid);
+		} break;
+		case RedrawCommandType::GridLine: {
+			GridLineCommand *grid_line = RedrawCommandPayload<GridLineCommand>(command);
+			GridModelApplyLine(&batch->grid, grid_line);
+			stats->grid_lines += 1;
+			stats->grid_cells += grid_line->cell_count;
+		} break;
+		case RedrawCommandType::GridScroll: {
+			GridScrollCommand *grid_scroll = RedrawCommandPayload<GridScrollCommand>(command);
+			ReplayCanvas *canvas = &batch->canvas;
+			ScrollBlit blit;
+			auto scroll_start = std::chrono::steady_clock::now();
+			bool planned = ScrollPlan(&batch->grid, grid_scroll, canvas->cell_width, canvas->cell_height,
+				canvas->width, canvas->height, &blit);
+			auto scroll_end = std::chrono::steady_clock::now();
+			stats->grid_scroll_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(scroll_end - scroll_start).count();
+
+			if (blit.top < blit.bottom) {
+				MoveCanvasPixels(canvas, &blit, stats);
+			}
+			stats->canvas_scroll_fallbacks += planned ? 0 : 1;
+			stats->canvas_us += std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - scroll_end).count();
+			stats->grid_scrolls += 1;
+			stats->grid_scrolled_rows += grid_scroll->bottom - grid_scroll->top;
+		} break;
+		case RedrawCommandType::Flush: {
+			uint64_t paint_start_us = RpcCaptureNowMicroseconds();
+			int start_col;
+			int end_col;
+			for (int row = GridModelTakeDirtyRow(&batch->grid, 0, &start_col, &end_col); row >= 0;
+				row = GridModelTakeDirtyRow(&batch->grid, row + 1, &start_col, &end_col)) {
+				// The renderer lays out and draws the row from its text here
+				GridModelWidenToBlanks(&batch->grid, row, &start_col, &end_col);
+				auto row_text_start = std::chrono::steady_clock::now();
+				stats->row_text_units += GridModelRowText(&batch->grid, row, start_col, end_col,
+					batch->row_text, batch->row_text_offsets);
+				stats->row_text_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - row_text_start).count();
+				stats->canvas_painted_pixels += PaintCells(&batch->canvas, &batch->grid, row, start_col, end_col, false);
+			}
+			stats->canvas_us += RpcCaptureNowMicroseconds() - paint_start_us;
+
+			// Not timed, neither is part of drawing a frame
+			uint64_t check_start_us = RpcCaptureNowMicroseconds();
+			for (int row = 0; row < batch->grid.rows; ++row) {
+				stats->canvas_stale_cells += PaintCells(&batch->canvas, &batch->grid, row, 0, batch->grid.cols, true);
+			}
+			stats->canvas_checks += 1;
+			start_us += RpcCaptureNowMicroseconds() - check_start_us;
+		} break;
+		default: {
+		} break;
+		}
+	}
+
+	uint64_t apply_us = RpcCaptureNowMicroseconds() - start_us;
+	stats->grid_total_us += apply_us;
+	if (apply_us > stats->grid_max_us) {
+		stats->grid_max_us = apply_us;
+	}
+}
+
+static void PublishBatch(ReplayBatch *batch) {
+	if (batch->commands.command_count == 0) {
+		return;
+	}
+
+	uint64_t batch_us = RpcCaptureNowMicroseconds() - batch->start_us;
+	batch->stats->redraw_batches += 1;
+	batch->stats->redraw_commands += batch->commands.command_count;
+	batch->stats->batch_total_us += batch_us;
+	if (batch_us > batch->stats->batch_max_us) {
+		batch->stats->batch_max_us = batch_us;
+	}
+	ApplyBatch(batch);
+	RedrawCommandBufferClear(&batch->commands);
+}
+
+static bool DecodeRedrawEvent(void *context, RedrawEvent *event) {
+	ReplayBatch *batch = static_cast<ReplayBatch *>(context);
+	if (batch->commands.command_count == 0) {
+		batch->start_us = RpcCaptureNowMicroseconds();
+	}
+
+	RedrawDecodeResult result = RedrawCommandsDecodeEvent(&batch->commands, event);
+	if (result == RedrawDecodeResult::Unhandled) {
+		batch->stats->unhandled_events += 1;
+	}
+	if (result == RedrawDecodeResult::Flush || batch->commands.size >= REDRAW_COMMAND_BATCH_SIZE) {
+		PublishBatch(batch);
+	}
+	return true;
+}
+
+static void CountRecords(const char *path, ReplayStats *stats) {
+	RpcCaptureFile capture_file;
+	if (!RpcCaptureMap(&capture_file, path)) {
+		return;
+	}
+
+	size_t offset = RPC_CAPTURE_FIRST_RECORD;
+	RpcCaptureRecord record;
+	const char *data;
+	while (RpcCaptureNextRecord(&capture_file, &offset, &record, &data)) {
+		if (record.direction == RpcCaptureDirection::Inbound) {
+			stats->inbound_records += 1;
+			stats->inbound_bytes += record.size;
+		}
+		else {
+			stats->outbound_records += 1;
+			stats->outbound_bytes += record.size;
+		}
+		if (record.timestamp_us < stats->capture_duration_us) {
+			stats->capture_timestamp_regressions += 1;
+		}
+		stats->capture_duration_us = record.timestamp_us;
+	}
+	stats->capture_trailing_bytes = capture_file.size - offset;
+	RpcCaptureUnmap(&capture_file);
+}
+
+// Where the traffic comes from, recorded as it is read and written with --capture
+struct ReplaySource {
+	Transport transport;
+	RpcCapture capture;
+	uint64_t bytes_read;
+};
+
+static size_t ReadSource(void *context, char *buffer, size_t count) {
+	ReplaySource *source = static_cast<ReplaySource *>(context);
+	size_t bytes_read = TransportRead(&source->transport, buffer, count);
+	if (bytes_read > 0 && source->capture.file) {
+		RpcCaptureWrite(&source->capture, RpcCaptureDirection::Inbound, buffer, bytes_read);
+	}
+	source->bytes_read += bytes_read;
+	return bytes_read;
+}
+
+constexpr RpcMethod<> GET_API_INFO { .id = 0, .name = "nvim_get_api_info" };
+constexpr RpcMethod<int64_t, int64_t, RpcOptions<1>> UI_ATTACH { .id = 1, .name = "nvim_ui_attach" };
+
+// Attaches the way Nvy does, the reply to the request is counted as an rpc message
+static void AttachUi(ReplaySource *source, int cols, int rows) {
+	RpcOptions<1> options { RpcOption { .name = "ext_linegrid", .value = true } };
+	RpcSizeCounter counter {};
+	RpcEncodeRequest(&counter, 0, GET_API_INFO);
+	RpcEncodeNotification(&counter, UI_ATTACH, cols, rows, options);
+
+	char *data = new char[counter.size];
+	RpcBufferWriter writer { .data = data, .size = 0 };
+	RpcEncodeRequest(&writer, 0, GET_API_INFO);
+	RpcEncodeNotification(&writer, UI_ATTACH, cols, rows, options);
+	size_t bytes_written = TransportWrite(&source->transport, data, writer.size);
+	if (bytes_written > 0 && source->capture.file) {
+		RpcCaptureWrite(&source->capture, RpcCaptureDirection::Outbound, data, bytes_written);
+	}
+	delete[] data;
+}
+
+int main(int argc, char **argv) {
+	bool original_pace = true;
+	const char *path = nullptr;
+	const char *nvim_command = nullptr;
+	const char *server_address = nullptr;
+	const char *capture_path = nullptr;
+	int cols = 100;
+	int rows = 30;
+	float cell_width = 1.0f;
+	float cell_height = 1.0f;
+	bool valid_arguments = true;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--fast")) {
+			original_pace = false;
+		}
+		else if (!strncmp(argv[i], "--nvim-command=", strlen("--nvim-command="))) {
+			nvim_command = argv[i] + strlen("--nvim-command=");
+		}
+		else if (!strncmp(argv[i], "--server=", strlen("--server="))) {
+			server_address = argv[i] + strlen("--server=");
+		}
+		else if (!strncmp(argv[i], "--capture=", strlen("--capture="))) {
+			capture_path = argv[i] + strlen("--capture=");
+		}
+		else if (!strncmp(argv[i], "--geometry=", strlen("--geometry="))) {
+			if (sscanf(argv[i] + strlen("--geometry="), "%dx%d", &cols, &rows) != 2 || cols <= 0 || rows <= 0) {
+				valid_arguments = false;
+			}
+		}
+		else if (!strncmp(argv[i], "--cell=", strlen("--cell="))) {
+			if (sscanf(argv[i] + strlen("--cell="), "%fx%f", &cell_width, &cell_height) != 2 ||
+				cell_width <= 0.0f || cell_height <= 0.0f) {
+				valid_arguments = false;
+			}
+		}
+		else {
+			path = argv[i];
+		}
+	}
+	const char *live_source = nvim_command ? nvim_command : server_address;
+	if (!valid_arguments || (nvim_command && server_address) || !path == !live_source || (path && capture_path)) {
+		fprintf(stderr, "Usage: nvy_replay [--fast] [--cell=<width>x<height>] <capture file>\n"
+			"       nvy_replay [--cell=<width>x<height>] --nvim-command=<command> [--geometry=<cols>x<rows>] [--capture=<file>]\n"
+			"       nvy_replay [--cell=<width>x<height>] --server=<host:port or path> [--geometry=<cols>x<rows>] [--capture=<file>]\n");
+		return 2;
+	}
+
+	ReplayStats stats {};
+	ReplaySource source {};
+	if (capture_path && !RpcCaptureOpen(&source.capture, capture_path)) {
+		fprintf(stderr, "Could not create capture file %s\n", capture_path);
+		return 1;
+	}
+	if (nvim_command) {
+		original_pace = false;
+#ifdef _WIN32
+		int length = MultiByteToWideChar(CP_UTF8, 0, nvim_command, -1, nullptr, 0);
+		wchar_t *command_line = new wchar_t[length];
+		MultiByteToWideChar(CP_UTF8, 0, nvim_command, -1, command_line, length);
+		bool spawned = TransportSpawn(&source.transport, command_line);
+		delete[] command_line;
+#else
+		bool spawned = TransportSpawn(&source.transport, nvim_command);
+#endif
+		if (!spawned) {
+			fprintf(stderr, "Could not start %s\n", nvim_command);
+			return 1;
+		}
+		AttachUi(&source, cols, rows);
+	}
+	else if (server_address) {
+		original_pace = false;
+		if (!TransportConnect(&source.transport, server_address)) {
+			fprintf(stderr, "Could not connect to %s\n", server_address);
+			return 1;
+		}
+		AttachUi(&source, cols, rows);
+	}
+	else {
+		CountRecords(path, &stats);
+		if (!TransportReplay(&source.transport, path, original_pace)) {
+			fprintf(stderr, "Could not open capture file %s\n", path);
+			return 1;
+		}
+	}
+
+	MPackStream *stream = new MPackStream;
+	MPackStreamInitialize(stream, ReadSource, &source);
+	ReplayBatch batch {
+		.canvas = ReplayCanvas {
+			.cell_width = cell_width,
+			.cell_height = cell_height
+		},
+		.stats = &stats
+	};
+
+	uint64_t start_us = RpcCaptureNowMicroseconds();
+	while (true) {
+		uint32_t event_count;
+		if (MPackStreamBeginNotification(stream, "redraw", &event_count)) {
+			bool success = RedrawDecoderRun(stream, event_count, DecodeRedrawEvent, &batch);
+			PublishBatch(&batch);
+			if (!success) {
+				break;
+			}
+			continue;
+		}
+
+		MPackFrame frame;
+		if (!MPackStreamNextFrame(stream, &frame)) {
+			break;
+		}
+		stats.rpc_messages += 1;
+	}
+	uint64_t replay_us = RpcCaptureNowMicroseconds() - start_us;
+	// Left in the stream's buffer if the data ended or turned malformed within a message
+	uint64_t unparsed_bytes = stream->write_offset - stream->read_offset;
+
+	MPackStreamDestroy(stream);
+	delete stream;
+	RedrawCommandBufferDestroy(&batch.commands);
+	TransportShutdown(&source.transport);
+	TransportClose(&source.transport);
+	RpcCaptureClose(&source.capture);
+
+	if (live_source) {
+		printf("live:     %.3f s from %s at %dx%d\n", replay_us / 1e6, live_source, cols, rows);
+		if (capture_path) {
+			printf("captured: %" PRIu64 " records (%" PRIu64 " bytes) to %s\n",
+				source.capture.records, source.capture.bytes, capture_path);
+		}
+	}
+	else {
+		printf("capture:  %" PRIu64 " inbound records (%" PRIu64 " bytes), %" PRIu64 " outbound records (%" PRIu64 " bytes) over %.3f s\n",
+			stats.inbound_records, stats.inbound_bytes, stats.outbound_records, stats.outbound_bytes,
+			stats.capture_duration_us / 1e6);
+		printf("replay:   %.3f s (%s), %.1f MB/s\n", replay_us / 1e6, original_pace ? "original pace" : "fast",
+			replay_us ? stats.inbound_bytes / static_cast<double>(replay_us) : 0.0);
+	}
+	printf("messages: %" PRIu64 " rpc, %" PRIu64 " redraw batches, %" PRIu64 " commands, %" PRIu64 " unhandled events\n",
+		stats.rpc_messages, stats.redraw_batches, stats.redraw_commands, stats.unhandled_events);
+	printf("batches:  %.1f us mean, %" PRIu64 " us max\n",
+		stats.redraw_batches ? stats.batch_total_us / static_cast<double>(stats.redraw_batches) : 0.0,
+		stats.batch_max_us);
+	printf("grid:     %" PRIu64 " lines (%" PRIu64 " cells), %" PRIu64 " scrolls, %" PRIu64 " resizes applied in %.3f ms, %" PRIu64 " us max per batch\n",
+		stats.grid_lines, stats.grid_cells, stats.grid_scrolls, stats.grid_resizes,
+		stats.grid_total_us / 1e3, stats.grid_max_us);
+	printf("scrolls:  %" PRIu64 " rows of scroll regions in %.3f ms, %.1f ns per scroll\n",
+		stats.grid_scrolled_rows, stats.grid_scroll_ns / 1e6,
+		stats.grid_scrolls ? stats.grid_scroll_ns / static_cast<double>(stats.grid_scrolls) : 0.0);
+	printf("rows:     %" PRIu64 " marked dirty by %" PRIu64 " events, %" PRIu64 " repainted with %" PRIu64 " changed cells (%.1f%% of their width)\n",
+		batch.grid.rows_marked, batch.grid.events_applied, batch.grid.rows_repainted, batch.grid.cells_repainted,
+		batch.grid.rows_repainted && batch.grid.cols ?
+			100.0 * batch.grid.cells_repainted / (static_cast<double>(batch.grid.rows_repainted) * batch.grid.cols) : 0.0);
+	printf("text:     %" PRIu64 " UTF-16 units built for repainted rows in %.3f ms, %u clusters held, %" PRIu64 " collections, %" PRIu64 " truncated\n",
+		stats.row_text_units, stats.row_text_ns / 1e6, batch.grid.clusters.count,
+		batch.grid.clusters.collections, batch.grid.clusters.truncated);
+	printf("canvas:   %" PRIu64 " scrolls moved %" PRIu64 " pixels, %" PRIu64 " redrawn instead, %" PRIu64 " pixels painted in %.3f ms, %" PRIu64 " stale cells over %" PRIu64 " frames\n",
+		stats.canvas_blits, stats.canvas_blit_pixels, stats.canvas_scroll_fallbacks, stats.canvas_painted_pixels,
+		stats.canvas_us / 1e3, stats.canvas_stale_cells, stats.canvas_checks);
+	GridModelDestroy(&batch.grid);
+	free(batch.canvas.pixels);
+	free(batch.row_text);
+	free(batch.row_text_offsets);
+
+	bool passed = true;
+	if (stats.canvas_stale_cells) {
+		fprintf(stderr, "%" PRIu64 " cells were left stale by scrolls\n", stats.canvas_stale_cells);
+		passed = false;
+	}
+	if (!live_source) {
+		if (stats.capture_timestamp_regressions) {
+			fprintf(stderr, "%" PRIu64 " records have an earlier timestamp than the one before\n",
+				stats.capture_timestamp_regressions);
+			passed = false;
+		}
+		if (stats.capture_trailing_bytes) {
+			fprintf(stderr, "the capture ends in a truncated record of %" PRIu64 " bytes\n", stats.capture_trailing_bytes);
+			passed = false;
+		}
+		if (source.bytes_read != stats.inbound_bytes || unparsed_bytes) {
+			fprintf(stderr, "only %" PRIu64 " of %" PRIu64 " inbound bytes were parsed\n",
+				source.bytes_read - unparsed_bytes, stats.inbound_bytes);
+			passed = false;
+		}
+	}
+	return passed ? 0 : 1;
+}